@@ -13,6 +13,9 @@ volatile assert_errors _assert_errors;
 
 int main(void)
 {
+    uint8_t *data;
+    size_t size;
+
     /*
      * System initializations.
      * - HAL initialization, this also initializes the configured 
@@ -23,12 +26,6 @@ int main(void)
     halInit();
     chSysInit();
 
-    /* Test the VBUS line... */
-    if (palReadPad(GPIOA, GPIOA_VBUS_FS) != 1)
-    {
-
-    }
-
     /*
      *
      * Initialize all drivers and modules.
@@ -46,7 +43,8 @@ int main(void)
     {
         if (isUSBActive())
         {
-            FlashStateMachine(USBReadByte(TIME_INFINITE));
+            size = USBReadBlock(&data, TIME_INFINITE);
+            FlashStateMachine(data, size);
         }
         else
         {
@@ -0,0 +1,6 @@
+# List of all the module's related files.
+CAN_SRCS = $(MODULE_DIR)/can/src/isotp.c \
+           $(MODULE_DIR)/can/src/mycan.c
+
+# Required include directories
+CAN_INC = $(MODULE_DIR)/can/inc
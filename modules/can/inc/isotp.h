@@ -0,0 +1,191 @@
+#ifndef __ISOTP_H
+#define __ISOTP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*===========================================================================*/
+/* Module global definitions.                                                */
+/*===========================================================================*/
+
+/** @brief  Maximum payload of a classic CAN frame. */
+#define ISOTP_CAN_FRAME_SIZE            8
+
+/** @brief  Maximum size of an ISO-TP message (12-bit length field). */
+#define ISOTP_MAX_MESSAGE_SIZE          4095
+
+/** @brief  Protocol Control Information types (upper nibble of byte 0). */
+#define ISOTP_PCI_SINGLE_FRAME          0x00
+#define ISOTP_PCI_FIRST_FRAME           0x10
+#define ISOTP_PCI_CONSECUTIVE_FRAME     0x20
+#define ISOTP_PCI_FLOW_CONTROL          0x30
+#define ISOTP_PCI_TYPE_MASK             0xf0
+
+/** @brief  Flow status values of a flow control frame. */
+#define ISOTP_FS_CONTINUE_TO_SEND       0x00
+#define ISOTP_FS_WAIT                   0x01
+#define ISOTP_FS_OVERFLOW               0x02
+
+/**
+ * @brief  Block size advertised in our flow control frames. 0 lets the
+ *         sender stream the whole message after the first frame, the
+ *         receiver is only copying bytes and the natural stop-and-wait of
+ *         the bootloader protocol paces the host between messages.
+ */
+#ifndef ISOTP_BLOCK_SIZE
+    #define ISOTP_BLOCK_SIZE            0
+#endif
+
+/** @brief  Minimum separation time (STmin) advertised in flow control. */
+#ifndef ISOTP_ST_MIN
+    #define ISOTP_ST_MIN                0
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Result of feeding a received CAN frame into the ISO-TP layer.
+ */
+typedef enum
+{
+    /**
+     * @brief   Frame consumed, the message is not yet complete.
+     */
+    ISOTP_RX_IN_PROGRESS,
+    /**
+     * @brief   A full message has been reassembled in the receive buffer.
+     */
+    ISOTP_RX_COMPLETE,
+    /**
+     * @brief   A flow control frame for the transmitter was received.
+     */
+    ISOTP_RX_FLOW_CONTROL,
+    /**
+     * @brief   Malformed or unexpected frame, the reception was aborted.
+     */
+    ISOTP_RX_ERROR
+} isotp_rx_status_t;
+
+/**
+ * @brief   State of the ISO-TP transmitter.
+ */
+typedef enum
+{
+    ISOTP_TX_IDLE,
+    ISOTP_TX_WAIT_FC,
+    ISOTP_TX_SENDING,
+    ISOTP_TX_ERROR
+} isotp_tx_state_t;
+
+/**
+ * @brief   Function pointer definition for the low level frame transmit.
+ */
+typedef bool (*isotp_send_t)(const uint8_t *data, uint8_t size);
+
+/**
+ * @brief   One ISO-TP link, i.e. the reassembly and segmentation state for
+ *          one pair of CAN identifiers.
+ */
+typedef struct
+{
+    /**
+     * @brief   Low level function to put a frame on the bus.
+     */
+    isotp_send_t send;
+    /**
+     * @brief   Pointer to the reassembly buffer.
+     */
+    uint8_t *rx_buffer;
+    /**
+     * @brief   Size of the reassembly buffer.
+     */
+    uint16_t rx_buffer_size;
+    /**
+     * @brief   Length of the message being received.
+     */
+    uint16_t rx_length;
+    /**
+     * @brief   Number of bytes received of the current message.
+     */
+    uint16_t rx_count;
+    /**
+     * @brief   Next expected sequence number.
+     */
+    uint8_t rx_sn;
+    /**
+     * @brief   Consecutive frames left until a flow control is due.
+     */
+    uint8_t rx_block_left;
+    /**
+     * @brief   True while a multi-frame reception is ongoing.
+     */
+    bool rx_active;
+    /**
+     * @brief   True if the current message arrived on the broadcast ID, in
+     *          this case no flow control is ever sent back.
+     */
+    bool rx_broadcast;
+    /**
+     * @brief   Pointer to the message being transmitted.
+     */
+    const uint8_t *tx_data;
+    /**
+     * @brief   Length of the message being transmitted.
+     */
+    uint16_t tx_length;
+    /**
+     * @brief   Number of bytes sent of the current message.
+     */
+    uint16_t tx_count;
+    /**
+     * @brief   Next sequence number to send.
+     */
+    uint8_t tx_sn;
+    /**
+     * @brief   Block size received in the last flow control.
+     */
+    uint8_t tx_block_size;
+    /**
+     * @brief   Consecutive frames left in the current block.
+     */
+    uint8_t tx_block_left;
+    /**
+     * @brief   STmin received in the last flow control (raw encoding).
+     */
+    uint8_t tx_st_min;
+    /**
+     * @brief   Transmitter state.
+     */
+    isotp_tx_state_t tx_state;
+} isotp_link_t;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module inline functions.                                                  */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+void ISOTP_Init(isotp_link_t *link,
+                isotp_send_t send,
+                uint8_t *rx_buffer,
+                uint16_t rx_buffer_size);
+isotp_rx_status_t ISOTP_ReceiveFrame(isotp_link_t *link,
+                                     const uint8_t *data,
+                                     uint8_t size,
+                                     bool broadcast);
+bool ISOTP_StartTransmit(isotp_link_t *link,
+                         const uint8_t *data,
+                         uint16_t size);
+bool ISOTP_ContinueTransmit(isotp_link_t *link);
+uint32_t ISOTP_STminToMicroseconds(uint8_t st_min);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef __MYCAN_H
+#define __MYCAN_H
+
+#include "isotp.h"
+#include "serial_transport.h"
+
+/* Defines */
+
+/**
+ * @brief   Identifier all nodes listen to, used to program many boards on the
+ *          same bus with one frame stream. Never answered with flow control.
+ */
+#define CAN_BOOT_BROADCAST_ID           0x700
+
+/** @brief  Base identifier for host to node messages (+ node ID). */
+#define CAN_BOOT_RX_BASE_ID             0x600
+
+/** @brief  Base identifier for node to host messages (+ node ID). */
+#define CAN_BOOT_TX_BASE_ID             0x680
+
+/** @brief  Mask for the node ID, gives 128 nodes per bus. */
+#define CAN_BOOT_NODE_ID_MASK           0x7f
+
+/**
+ * @brief   First byte of a node ID claim, sent from the response ID that is
+ *          claimed. Not a valid ISO-TP frame type, hosts ignore it.
+ *          A claim carries the CRC32 of the unique ID of the claimant, the
+ *          owner of the ID answers with the marker alone.
+ */
+#define CAN_BOOT_CLAIM_MARKER           0xf0
+
+/**
+ * @brief   Time to listen for an owner or a competing claim of a node ID.
+ *          A node in the middle of a sector erase answers late, buses with
+ *          nodes being programmed while others boot should set
+ *          CAN_BOOT_NODE_ID per board instead.
+ */
+#define CAN_BOOT_CLAIM_TIME             MS2ST(100)
+
+/** @brief  ISO-TP reassembly buffer size. */
+#define CAN_RECEIVE_BUFFER_SIZE         1024
+
+/** @brief  Time to wait for a flow control frame from the host (N_Bs). */
+#define CAN_ISOTP_TIMEOUT_BS            MS2ST(1000)
+
+/** @brief  Time to wait for a free transmit mailbox. */
+#define CAN_TRANSMIT_TIMEOUT            MS2ST(10)
+
+/* Typedefs */
+
+/* Global variables */
+extern const serial_transport_t can_transport;
+
+/* Macros */
+
+/* Inline functions */
+
+/* Global functions */
+void CANTransportStart(void);
+void CANTransportStop(void);
+bool isCANActive(void);
+uint8_t CANGetNodeID(void);
+size_t CANReceiveMessage(uint8_t **data, systime_t timeout);
+size_t CANSendData(uint8_t *data, size_t size, systime_t timeout);
+
+#endif
@@ -0,0 +1,355 @@
+/* *
+ *
+ * ISO-TP (ISO 15765-2) segmentation and reassembly.
+ * Hardware and OS independent, the CAN driver glue and the locking live in
+ * mycan.c. Tested on the host by tools/isotp_test.c.
+ *
+ * Frame formats (classic CAN, normal addressing):
+ *      Single frame:       0x0L | DATA (L = 1 - 7 bytes)
+ *      First frame:        0x1L LL | DATA (12-bit length, 6 data bytes)
+ *      Consecutive frame:  0x2N | DATA (N = sequence number, 7 data bytes)
+ *      Flow control:       0x3S | BS | STmin
+ *
+ * */
+
+#include "isotp.h"
+
+/*===========================================================================*/
+/* Module local definitions.                                                 */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module exported variables.                                                */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module local variables and types.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+/**
+ * @brief               Sends a flow control frame.
+ *
+ * @param[in] link      Pointer to the ISO-TP link.
+ * @param[in] status    Flow status to send.
+ */
+static void ISOTP_SendFlowControl(isotp_link_t *link, uint8_t status)
+{
+    uint8_t frame[3];
+
+    frame[0] = ISOTP_PCI_FLOW_CONTROL | status;
+    frame[1] = ISOTP_BLOCK_SIZE;
+    frame[2] = ISOTP_ST_MIN;
+
+    link->send(frame, sizeof(frame));
+}
+
+/**
+ * @brief               Handles a received flow control frame.
+ *
+ * @param[in] link      Pointer to the ISO-TP link.
+ * @param[in] data      Pointer to the frame data.
+ * @param[in] size      Size of the frame data.
+ * @return              ISOTP_RX_FLOW_CONTROL if it was expected, else
+ *                      ISOTP_RX_ERROR.
+ */
+static isotp_rx_status_t ISOTP_HandleFlowControl(isotp_link_t *link,
+                                                 const uint8_t *data,
+                                                 uint8_t size)
+{
+    if ((size < 3) || (link->tx_state != ISOTP_TX_WAIT_FC))
+        return ISOTP_RX_ERROR;
+
+    switch (data[0] & 0x0f)
+    {
+    case ISOTP_FS_CONTINUE_TO_SEND:
+        link->tx_block_size = data[1];
+        link->tx_block_left = data[1];
+        link->tx_st_min = data[2];
+        link->tx_state = ISOTP_TX_SENDING;
+        break;
+
+    case ISOTP_FS_WAIT:
+        /* Keep waiting for the next flow control */
+        break;
+
+    default: /* Overflow or invalid */
+        link->tx_state = ISOTP_TX_ERROR;
+        break;
+    }
+
+    return ISOTP_RX_FLOW_CONTROL;
+}
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief                       Initializes an ISO-TP link.
+ *
+ * @param[out] link             Pointer to the ISO-TP link.
+ * @param[in] send              Low level frame transmit function.
+ * @param[in] rx_buffer         Pointer to the reassembly buffer.
+ * @param[in] rx_buffer_size    Size of the reassembly buffer.
+ */
+void ISOTP_Init(isotp_link_t *link,
+                isotp_send_t send,
+                uint8_t *rx_buffer,
+                uint16_t rx_buffer_size)
+{
+    link->send = send;
+    link->rx_buffer = rx_buffer;
+    link->rx_buffer_size = rx_buffer_size;
+    link->rx_length = 0;
+    link->rx_count = 0;
+    link->rx_active = false;
+    link->rx_broadcast = false;
+    link->tx_data = NULL;
+    link->tx_length = 0;
+    link->tx_count = 0;
+    link->tx_state = ISOTP_TX_IDLE;
+}
+
+/**
+ * @brief               Feeds a received CAN frame into the link.
+ * @note                Frames from the broadcast ID never generate flow
+ *                      control, the host has to pace consecutive frames
+ *                      so that every node on the bus can keep up.
+ *
+ * @param[in] link      Pointer to the ISO-TP link.
+ * @param[in] data      Pointer to the frame data.
+ * @param[in] size      Size of the frame data (DLC).
+ * @param[in] broadcast True if the frame came from the broadcast ID.
+ * @return              The status of the reception.
+ */
+isotp_rx_status_t ISOTP_ReceiveFrame(isotp_link_t *link,
+                                     const uint8_t *data,
+                                     uint8_t size,
+                                     bool broadcast)
+{
+    uint16_t length, i, n;
+
+    if (size == 0)
+        return ISOTP_RX_ERROR;
+
+    switch (data[0] & ISOTP_PCI_TYPE_MASK)
+    {
+    case ISOTP_PCI_SINGLE_FRAME:
+        length = data[0] & 0x0f;
+
+        if ((length == 0) || (length > (size - 1)) ||
+            (length > link->rx_buffer_size))
+            return ISOTP_RX_ERROR;
+
+        for (i = 0; i < length; i++)
+            link->rx_buffer[i] = data[1 + i];
+
+        link->rx_active = false;
+        link->rx_length = length;
+        link->rx_count = length;
+        link->rx_broadcast = broadcast;
+
+        return ISOTP_RX_COMPLETE;
+
+    case ISOTP_PCI_FIRST_FRAME:
+        if (size < ISOTP_CAN_FRAME_SIZE)
+            return ISOTP_RX_ERROR;
+
+        length = ((uint16_t)(data[0] & 0x0f) << 8) | data[1];
+
+        /* First frames are only valid for messages that do not fit in a
+           single frame */
+        if (length < ISOTP_CAN_FRAME_SIZE)
+            return ISOTP_RX_ERROR;
+
+        if (length > link->rx_buffer_size)
+        {
+            link->rx_active = false;
+
+            if (broadcast == false)
+                ISOTP_SendFlowControl(link, ISOTP_FS_OVERFLOW);
+
+            return ISOTP_RX_ERROR;
+        }
+
+        for (i = 0; i < (ISOTP_CAN_FRAME_SIZE - 2); i++)
+            link->rx_buffer[i] = data[2 + i];
+
+        link->rx_active = true;
+        link->rx_broadcast = broadcast;
+        link->rx_length = length;
+        link->rx_count = ISOTP_CAN_FRAME_SIZE - 2;
+        link->rx_sn = 1;
+        link->rx_block_left = ISOTP_BLOCK_SIZE;
+
+        if (broadcast == false)
+            ISOTP_SendFlowControl(link, ISOTP_FS_CONTINUE_TO_SEND);
+
+        return ISOTP_RX_IN_PROGRESS;
+
+    case ISOTP_PCI_CONSECUTIVE_FRAME:
+        /* Consecutive frames must belong to the message being received and
+           arrive on the same addressing as its first frame */
+        if ((link->rx_active == false) || (link->rx_broadcast != broadcast))
+            return ISOTP_RX_ERROR;
+
+        if ((data[0] & 0x0f) != link->rx_sn)
+        {
+            link->rx_active = false;
+            return ISOTP_RX_ERROR;
+        }
+
+        link->rx_sn = (link->rx_sn + 1) & 0x0f;
+
+        n = link->rx_length - link->rx_count;
+        if (n > (uint16_t)(size - 1))
+            n = size - 1;
+
+        for (i = 0; i < n; i++)
+            link->rx_buffer[link->rx_count + i] = data[1 + i];
+
+        link->rx_count += n;
+
+        if (link->rx_count >= link->rx_length)
+        {
+            link->rx_active = false;
+            return ISOTP_RX_COMPLETE;
+        }
+
+        /* Request the next block if the block size is limited */
+        if ((ISOTP_BLOCK_SIZE != 0) && (--link->rx_block_left == 0))
+        {
+            link->rx_block_left = ISOTP_BLOCK_SIZE;
+
+            if (broadcast == false)
+                ISOTP_SendFlowControl(link, ISOTP_FS_CONTINUE_TO_SEND);
+        }
+
+        return ISOTP_RX_IN_PROGRESS;
+
+    case ISOTP_PCI_FLOW_CONTROL:
+        return ISOTP_HandleFlowControl(link, data, size);
+
+    default:
+        return ISOTP_RX_ERROR;
+    }
+}
+
+/**
+ * @brief               Starts the transmission of a message. Sends a single
+ *                      frame or the first frame of a segmented message.
+ *
+ * @param[in] link      Pointer to the ISO-TP link.
+ * @param[in] data      Pointer to the message, must stay valid until the
+ *                      transmission is finished.
+ * @param[in] size      Size of the message.
+ * @return              False if the message could not be started.
+ */
+bool ISOTP_StartTransmit(isotp_link_t *link,
+                         const uint8_t *data,
+                         uint16_t size)
+{
+    uint8_t frame[ISOTP_CAN_FRAME_SIZE];
+    uint16_t i;
+
+    if ((size == 0) || (size > ISOTP_MAX_MESSAGE_SIZE))
+        return false;
+
+    if (size < ISOTP_CAN_FRAME_SIZE)
+    {
+        frame[0] = ISOTP_PCI_SINGLE_FRAME | (uint8_t)size;
+
+        for (i = 0; i < size; i++)
+            frame[1 + i] = data[i];
+
+        link->tx_state = ISOTP_TX_IDLE;
+
+        return link->send(frame, size + 1);
+    }
+
+    frame[0] = ISOTP_PCI_FIRST_FRAME | (uint8_t)(size >> 8);
+    frame[1] = (uint8_t)size;
+
+    for (i = 0; i < (ISOTP_CAN_FRAME_SIZE - 2); i++)
+        frame[2 + i] = data[i];
+
+    link->tx_data = data;
+    link->tx_length = size;
+    link->tx_count = ISOTP_CAN_FRAME_SIZE - 2;
+    link->tx_sn = 1;
+    link->tx_state = ISOTP_TX_WAIT_FC;
+
+    if (link->send(frame, ISOTP_CAN_FRAME_SIZE) == false)
+    {
+        link->tx_state = ISOTP_TX_ERROR;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief               Sends the next consecutive frame of the message.
+ * @note                Shall only be called in the ISOTP_TX_SENDING state.
+ *                      The caller is responsible for honoring STmin between
+ *                      calls.
+ *
+ * @param[in] link      Pointer to the ISO-TP link.
+ * @return              False if the frame could not be sent.
+ */
+bool ISOTP_ContinueTransmit(isotp_link_t *link)
+{
+    uint8_t frame[ISOTP_CAN_FRAME_SIZE];
+    uint16_t i, n;
+
+    if (link->tx_state != ISOTP_TX_SENDING)
+        return false;
+
+    n = link->tx_length - link->tx_count;
+    if (n > (ISOTP_CAN_FRAME_SIZE - 1))
+        n = ISOTP_CAN_FRAME_SIZE - 1;
+
+    frame[0] = ISOTP_PCI_CONSECUTIVE_FRAME | link->tx_sn;
+
+    for (i = 0; i < n; i++)
+        frame[1 + i] = link->tx_data[link->tx_count + i];
+
+    if (link->send(frame, n + 1) == false)
+    {
+        link->tx_state = ISOTP_TX_ERROR;
+        return false;
+    }
+
+    link->tx_sn = (link->tx_sn + 1) & 0x0f;
+    link->tx_count += n;
+
+    if (link->tx_count >= link->tx_length)
+        link->tx_state = ISOTP_TX_IDLE;
+
+    else if ((link->tx_block_size != 0) && (--link->tx_block_left == 0))
+        link->tx_state = ISOTP_TX_WAIT_FC;
+
+    return true;
+}
+
+/**
+ * @brief               Converts the raw STmin encoding to microseconds.
+ *
+ * @param[in] st_min    Raw STmin value from a flow control frame.
+ * @return              The separation time in microseconds.
+ */
+uint32_t ISOTP_STminToMicroseconds(uint8_t st_min)
+{
+    if (st_min <= 0x7f)
+        return (uint32_t)st_min * 1000;
+
+    else if ((st_min >= 0xf1) && (st_min <= 0xf9))
+        return (uint32_t)(st_min - 0xf0) * 100;
+
+    else /* Reserved values shall be treated as 127 ms */
+        return 127000;
+}
@@ -0,0 +1,392 @@
+/* *
+ *
+ * CAN transport for the serial protocol (PORT_AUX4).
+ * The byte stream of the serial protocol is carried in ISO-TP messages,
+ * each node has a physical ID pair and all nodes share a broadcast ID.
+ *
+ * Without CAN_BOOT_NODE_ID the node ID is claimed at start: the node sends
+ * a claim from the response ID of the candidate and moves to the next ID
+ * if the owner answers or a claimant with a lower CRC32 of its unique ID
+ * competes for it. An owner answers every claim of its ID.
+ *
+ * */
+
+#include "ch.h"
+#include "hal.h"
+#include "crc.h"
+#include "version_information.h"
+#include "mycan.h"
+
+/* Global variable defines */
+
+/* Private variable defines */
+
+/**
+ * @brief   CAN configuration, 1 Mbit/s with APB1 at 42 MHz.
+ *          42 MHz / 3 = 14 MHz, 14 tq per bit, sample point at 85.7 %.
+ */
+static const CANConfig cancfg = {
+  CAN_MCR_ABOM | CAN_MCR_AWUM | CAN_MCR_TXFP,
+  CAN_BTR_SJW(0) | CAN_BTR_TS2(1) | CAN_BTR_TS1(10) | CAN_BTR_BRP(2)
+};
+
+/**
+ * @brief   ISO-TP link for the physical and broadcast IDs.
+ */
+static isotp_link_t can_link;
+
+/**
+ * @brief   Reassembly buffer of the ISO-TP link.
+ */
+CCM_MEMORY static uint8_t can_rx_buffer[CAN_RECEIVE_BUFFER_SIZE];
+
+/**
+ * @brief   Lock of the ISO-TP link, shared by the receive thread (flow
+ *          control) and the transmitting thread.
+ */
+static mutex_t can_link_lock;
+
+/**
+ * @brief   Signaled by the receive thread when a flow control frame
+ *          changed the transmitter state.
+ */
+static condition_variable_t can_fc_cond;
+
+/**
+ * @brief   The node ID used for the physical IDs.
+ */
+static uint8_t node_id;
+
+/**
+ * @brief   True when the CAN driver is started.
+ */
+static bool can_active = false;
+
+/* Private function defines */
+
+/* Private external functions */
+
+/**
+ * @brief           Puts one frame on the bus from this node's response ID.
+ *
+ * @param[in] data  Pointer to the frame data.
+ * @param[in] size  Size of the frame (DLC).
+ * @return          True if the frame was queued for transmission.
+ */
+static bool CANSendFrame(const uint8_t *data, uint8_t size)
+{
+  CANTxFrame txf;
+  uint8_t i;
+
+  txf.IDE = CAN_IDE_STD;
+  txf.RTR = CAN_RTR_DATA;
+  txf.SID = CAN_BOOT_TX_BASE_ID + node_id;
+  txf.DLC = size;
+
+  for (i = 0; i < size; i++)
+    txf.data8[i] = data[i];
+
+  return (canTransmit(&CAND1, CAN_ANY_MAILBOX, &txf, CAN_TRANSMIT_TIMEOUT)
+          == MSG_OK);
+}
+
+/**
+ * @brief           Sends a node ID claim, or the answer of the owner, from
+ *                  this node's response ID.
+ *
+ * @param[in] owner True to answer as the owner of the ID.
+ */
+static void CANSendClaim(bool owner)
+{
+  uint8_t frame[5];
+  uint32_t uid_crc;
+
+  frame[0] = CAN_BOOT_CLAIM_MARKER;
+
+  if (owner == true)
+  {
+    CANSendFrame(frame, 1);
+    return;
+  }
+
+  uid_crc = CRC32_chunk(ptrGetUniqueID(), UNIQUE_ID_SIZE, 0xffffffff);
+  frame[1] = (uint8_t)(uid_crc >> 24);
+  frame[2] = (uint8_t)(uid_crc >> 16);
+  frame[3] = (uint8_t)(uid_crc >> 8);
+  frame[4] = (uint8_t)uid_crc;
+
+  CANSendFrame(frame, sizeof(frame));
+}
+
+#ifndef CAN_BOOT_NODE_ID
+/**
+ * @brief   Claims node_id, the driver has to accept all response IDs.
+ *
+ * @return  True if the ID is free, false if it has an owner or a claimant
+ *          with a lower unique ID CRC.
+ */
+static bool CANClaimNodeID(void)
+{
+  CANRxFrame rxf;
+  systime_t start, elapsed;
+  uint32_t own, other;
+
+  own = CRC32_chunk(ptrGetUniqueID(), UNIQUE_ID_SIZE, 0xffffffff);
+
+  CANSendClaim(false);
+
+  start = chVTGetSystemTimeX();
+  while ((elapsed = chVTTimeElapsedSinceX(start)) < CAN_BOOT_CLAIM_TIME)
+  {
+    if (canReceive(&CAND1, CAN_ANY_MAILBOX, &rxf,
+                   CAN_BOOT_CLAIM_TIME - elapsed) != MSG_OK)
+      break;
+
+    if ((rxf.IDE != CAN_IDE_STD) || (rxf.RTR != CAN_RTR_DATA) ||
+        (rxf.SID != (CAN_BOOT_TX_BASE_ID + node_id)))
+      continue;
+
+    /* A competing claim, the lower CRC keeps the ID */
+    if ((rxf.DLC == 5) && (rxf.data8[0] == CAN_BOOT_CLAIM_MARKER))
+    {
+      other = ((uint32_t)rxf.data8[1] << 24) | ((uint32_t)rxf.data8[2] << 16) |
+              ((uint32_t)rxf.data8[3] << 8) | rxf.data8[4];
+
+      if (other > own)
+        continue;
+    }
+
+    /* The owner answered, or any other traffic from the ID */
+    return false;
+  }
+
+  return true;
+}
+#endif
+
+/**
+ * @brief   Picks the node ID, starting from an ID derived from the
+ *          hardware unique ID and moving on until one is free. With a full
+ *          bus the derived ID is kept.
+ */
+static void CANSelectNodeID(void)
+{
+#ifdef CAN_BOOT_NODE_ID
+  node_id = CAN_BOOT_NODE_ID & CAN_BOOT_NODE_ID_MASK;
+#else
+  /* Accept all response IDs while claiming */
+  const CANFilter claim_filters[1] = {
+    {0, 0, 1, 0, (uint32_t)CAN_BOOT_TX_BASE_ID << 21,
+                 (uint32_t)(0x7ff & ~CAN_BOOT_NODE_ID_MASK) << 21}
+  };
+  uint32_t i;
+
+  node_id = CRC8((uint8_t *)ptrGetUniqueID(), UNIQUE_ID_SIZE) &
+            CAN_BOOT_NODE_ID_MASK;
+
+  canSTM32SetFilters(14, 1, claim_filters);
+  canStart(&CAND1, &cancfg);
+
+  for (i = 0; i <= CAN_BOOT_NODE_ID_MASK; i++)
+  {
+    if (CANClaimNodeID() == true)
+      break;
+
+    node_id = (node_id + 1) & CAN_BOOT_NODE_ID_MASK;
+  }
+
+  canStop(&CAND1);
+#endif
+}
+
+/**
+ * @brief   Starts the CAN driver and the acceptance filters for the node.
+ */
+void CANTransportStart(void)
+{
+  chMtxObjectInit(&can_link_lock);
+  chCondObjectInit(&can_fc_cond);
+
+  ISOTP_Init(&can_link, CANSendFrame, can_rx_buffer, CAN_RECEIVE_BUFFER_SIZE);
+
+  /* CAN1 on PB8 (RX) and PB9 (TX) */
+  palSetPadMode(GPIOB, GPIOB_PIN8, PAL_MODE_ALTERNATE(9));
+  palSetPadMode(GPIOB, GPIOB_PIN9, PAL_MODE_ALTERNATE(9));
+
+  CANSelectNodeID();
+
+  /* Accept only the physical ID of this node and the broadcast ID, and
+     claims of this node's response ID */
+  const CANFilter filters[2] = {
+    {0, 1, 1, 0, (uint32_t)(CAN_BOOT_RX_BASE_ID + node_id) << 21,
+                 (uint32_t)CAN_BOOT_BROADCAST_ID << 21},
+    {1, 1, 1, 0, (uint32_t)(CAN_BOOT_TX_BASE_ID + node_id) << 21,
+                 (uint32_t)(CAN_BOOT_TX_BASE_ID + node_id) << 21}
+  };
+
+  canSTM32SetFilters(14, 2, filters);
+  canStart(&CAND1, &cancfg);
+
+  can_active = true;
+}
+
+/**
+ * @brief   Stops the CAN driver.
+ */
+void CANTransportStop(void)
+{
+  can_active = false;
+  canStop(&CAND1);
+
+  palSetPadMode(GPIOB, GPIOB_PIN8, PAL_MODE_INPUT);
+  palSetPadMode(GPIOB, GPIOB_PIN9, PAL_MODE_INPUT);
+}
+
+bool isCANActive(void)
+{
+  if ((can_active == true) && (CAND1.state == CAN_READY))
+    return true;
+  else
+    return false;
+}
+
+uint8_t CANGetNodeID(void)
+{
+  return node_id;
+}
+
+/**
+ * @brief               Waits for a complete ISO-TP message. Flow control
+ *                      frames for the transmitter are handled here as well.
+ *
+ * @param[out] data     Pointer to the reassembled message.
+ * @param[in] timeout   Timeout for each frame.
+ * @return              Size of the message, 0 on timeout.
+ */
+size_t CANReceiveMessage(uint8_t **data, systime_t timeout)
+{
+  CANRxFrame rxf;
+  isotp_rx_status_t status;
+
+  while (canReceive(&CAND1, CAN_ANY_MAILBOX, &rxf, timeout) == MSG_OK)
+  {
+    if ((rxf.IDE != CAN_IDE_STD) || (rxf.RTR != CAN_RTR_DATA))
+      continue;
+
+    /* Another node claiming our ID */
+    if (rxf.SID == (CAN_BOOT_TX_BASE_ID + node_id))
+    {
+      if ((rxf.DLC == 5) && (rxf.data8[0] == CAN_BOOT_CLAIM_MARKER))
+        CANSendClaim(true);
+
+      continue;
+    }
+
+    chMtxLock(&can_link_lock);
+
+    status = ISOTP_ReceiveFrame(&can_link, rxf.data8, rxf.DLC,
+                                (rxf.SID == CAN_BOOT_BROADCAST_ID));
+
+    if (status == ISOTP_RX_FLOW_CONTROL)
+      chCondSignal(&can_fc_cond);
+
+    chMtxUnlock(&can_link_lock);
+
+    /* The receive side of the link is only touched by this thread */
+    if (status == ISOTP_RX_COMPLETE)
+    {
+      *data = can_link.rx_buffer;
+      return can_link.rx_length;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @brief               Sends data as one or more ISO-TP messages.
+ *
+ * @param[in] data      Pointer to the data.
+ * @param[in] size      Size of the data.
+ * @param[in] timeout   Time to wait for each flow control frame.
+ * @return              Number of bytes sent.
+ */
+size_t CANSendData(uint8_t *data, size_t size, systime_t timeout)
+{
+  size_t sent = 0;
+  uint16_t chunk;
+  uint8_t st_min;
+
+  while (sent < size)
+  {
+    chunk = ((size - sent) > ISOTP_MAX_MESSAGE_SIZE) ?
+              ISOTP_MAX_MESSAGE_SIZE : (uint16_t)(size - sent);
+
+    chMtxLock(&can_link_lock);
+
+    if (ISOTP_StartTransmit(&can_link, &data[sent], chunk) == false)
+      can_link.tx_state = ISOTP_TX_ERROR;
+
+    while (can_link.tx_state != ISOTP_TX_IDLE)
+    {
+      if (can_link.tx_state == ISOTP_TX_WAIT_FC)
+      {
+        /* The mutex is not taken back on timeout */
+        if (chCondWaitTimeout(&can_fc_cond, timeout) == MSG_TIMEOUT)
+        {
+          chMtxLock(&can_link_lock);
+
+          if (can_link.tx_state == ISOTP_TX_WAIT_FC)
+            can_link.tx_state = ISOTP_TX_ERROR;
+        }
+      }
+      else if (can_link.tx_state == ISOTP_TX_SENDING)
+      {
+        ISOTP_ContinueTransmit(&can_link);
+
+        /* Let flow control through while waiting out STmin */
+        st_min = can_link.tx_st_min;
+        if ((can_link.tx_state == ISOTP_TX_SENDING) && (st_min != 0))
+        {
+          chMtxUnlock(&can_link_lock);
+          chThdSleepMicroseconds(ISOTP_STminToMicroseconds(st_min));
+          chMtxLock(&can_link_lock);
+        }
+      }
+
+      if (can_link.tx_state == ISOTP_TX_ERROR)
+      {
+        can_link.tx_state = ISOTP_TX_IDLE;
+        chMtxUnlock(&can_link_lock);
+        return sent;
+      }
+    }
+
+    chMtxUnlock(&can_link_lock);
+
+    sent += chunk;
+  }
+
+  return sent;
+}
+
+/**
+ * @brief               Transport send operation.
+ */
+static size_t CANTransportSend(uint8_t *data, size_t size)
+{
+  return CANSendData(data, size, CAN_ISOTP_TIMEOUT_BS);
+}
+
+/**
+ * @brief   CAN (ISO-TP) transport descriptor for the serial manager.
+ */
+const serial_transport_t can_transport = {
+  "CAN",
+  64,
+  NULL,
+  isCANActive,
+  CANTransportSend,
+  CANReceiveMessage,
+  NULL
+};
@@ -1,10 +1,24 @@
 # List of all the module's related files.
-COMMUNICATION_SRCS = $(MODULE_DIR)/communication/src/flash_statemachine.c
-                     #$(MODULE_DIR)/communication/src/circularbuffer.c \
-                     #$(MODULE_DIR)/communication/src/serialmanager.c \
-                     #$(MODULE_DIR)/communication/src/statemachine_generators.c \
-                     #$(MODULE_DIR)/communication/src/statemachine_parsers.c \
-                     #$(MODULE_DIR)/communication/src/statemachine.c
+COMMUNICATION_SRCS = $(MODULE_DIR)/communication/src/flash_statemachine.c \
+                     $(MODULE_DIR)/communication/src/hex_decoder.c \
+                     $(MODULE_DIR)/communication/src/circularbuffer.c \
+                     $(MODULE_DIR)/communication/src/cobs.c \
+                     $(MODULE_DIR)/communication/src/serialmanager.c \
+                     $(MODULE_DIR)/communication/src/statemachine_generators.c \
+                     $(MODULE_DIR)/communication/src/statemachine_parsers.c \
+                     $(MODULE_DIR)/communication/src/statemachine_commands.c \
+                     $(MODULE_DIR)/communication/src/statemachine_dispatcher.c \
+                     $(MODULE_DIR)/communication/src/serial_statistics.c \
+                     $(MODULE_DIR)/communication/src/response_cache.c \
+                     $(MODULE_DIR)/communication/src/firmware_readback.c \
+                     $(MODULE_DIR)/communication/src/statemachine.c
+
+# Files built for speed in release builds.
+COMMUNICATION_SPEED_SRCS = $(MODULE_DIR)/communication/src/flash_statemachine.c \
+                           $(MODULE_DIR)/communication/src/hex_decoder.c \
+                           $(MODULE_DIR)/communication/src/circularbuffer.c \
+                           $(MODULE_DIR)/communication/src/cobs.c \
+                           $(MODULE_DIR)/communication/src/statemachine.c
 
 # Required include directories
 COMMUNICATION_INC = $(MODULE_DIR)/communication/inc
@@ -34,6 +34,14 @@ typedef struct
 	 * @brief   Pointer to the data holding region.
 	 */
     uint8_t *buffer;        /* Pointer to memory area */
+	/**
+	 * @brief   Framing of the serial protocol frames written to the buffer.
+	 */
+    uint8_t framing;
+	/**
+	 * @brief   Offset from the head of the pending COBS code byte.
+	 */
+    int32_t cobs_code;
 } circular_buffer_t;
 
 /*===========================================================================*/
@@ -55,6 +63,7 @@ void CircularBuffer_InitMutex(circular_buffer_t *Cbuff);
 void CircularBuffer_Claim(circular_buffer_t *Cbuff);
 void CircularBuffer_Release(circular_buffer_t *Cbuff);
 uint32_t CircularBuffer_SpaceLeft(circular_buffer_t *Cbuff);
+uint32_t CircularBuffer_Size(circular_buffer_t *Cbuff);
 void CircularBuffer_WriteSingle(circular_buffer_t *Cbuff, uint8_t data);
 void CircularBuffer_WriteChunk(circular_buffer_t *Cbuff, 
 							   uint8_t *data, 
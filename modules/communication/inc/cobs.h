@@ -0,0 +1,48 @@
+#ifndef __COBS_H
+#define __COBS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*===========================================================================*/
+/* Module global definitions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Frame delimiter in COBS framing.
+ */
+#define COBS_DELIMITER                (0x00)
+
+/**
+ * @brief   Largest code byte, a block of 254 non-zero bytes without a
+ *          trailing zero.
+ */
+#define COBS_MAX_CODE                 (0xff)
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/**
+ * @brief   Worst case size of size bytes after COBS encoding, without the
+ *          delimiter.
+ */
+#define COBS_ENCODED_SIZE(size)       ((size) + ((size) / 254) + 1)
+
+/*===========================================================================*/
+/* Module inline functions.                                                  */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+size_t COBS_FindZero(const uint8_t *data, size_t size);
+size_t COBS_Decode(const uint8_t *src, size_t size, uint8_t *dst);
+
+#endif
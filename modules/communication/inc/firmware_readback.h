@@ -0,0 +1,51 @@
+#ifndef __FIRMWARE_READBACK_H
+#define __FIRMWARE_READBACK_H
+
+#include "statemachine.h"
+
+/*===========================================================================*/
+/* Module global definitions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Largest data part of a readback frame.
+ */
+#define READBACK_FRAME_DATA_SIZE      (255)
+
+/**
+ * @brief   Number of frames handed to the data pump at a time, and the
+ *          number of batches in flight. One batch is prepared while the
+ *          other is sent.
+ */
+#define READBACK_BATCH_FRAMES         (8)
+#define READBACK_NUM_BATCHES          (2)
+
+/**
+ * @brief   Time in milliseconds the readback waits for the flash pipeline
+ *          to finish before reading.
+ */
+#ifndef READBACK_FLASH_TIMEOUT_MS
+    #define READBACK_FLASH_TIMEOUT_MS (2000)
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module inline functions.                                                  */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+bool FirmwareReadback_Stream(External_Port port,
+                             uint32_t address,
+                             uint32_t size);
+
+#endif
@@ -7,6 +7,16 @@
 /*===========================================================================*/
 #define FLASH_CMD_BUFFER_SIZE       16
 
+/* Time in milliseconds a WRITE waits for more data before it is aborted */
+#ifndef FLASH_BINARY_TIMEOUT_MS
+#define FLASH_BINARY_TIMEOUT_MS     1000
+#endif
+
+/* Idle time in milliseconds that ends the draining of an aborted WRITE */
+#ifndef FLASH_BINARY_DRAIN_MS
+#define FLASH_BINARY_DRAIN_MS       100
+#endif
+
 /*===========================================================================*/
 /* Module data structures and types.                                         */
 /*===========================================================================*/
@@ -14,6 +24,7 @@ typedef enum
 {
     FLASH_GET_CMD,
     FLASH_GET_DATA,
+    FLASH_GET_BINARY,
     FLASH_EXIT
 } flash_state_t;
 
@@ -35,7 +46,7 @@ typedef struct
 /*===========================================================================*/
 /* External declarations.                                                    */
 /*===========================================================================*/
-void FlashStateMachine(uint8_t data);
+void FlashStateMachine(const uint8_t *data, size_t size);
 flash_state_t ParseCommand(uint8_t data);
 
 #endif
@@ -0,0 +1,125 @@
+#ifndef __HEX_DECODER_H
+#define __HEX_DECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*===========================================================================*/
+/* Module global definitions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Largest record in bytes: count, 4 address bytes, type, 255 data
+ *          bytes and the checksum.
+ */
+#define HEX_MAX_RECORD_SIZE           (262)
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Result of decoding a block of text.
+ */
+typedef enum
+{
+    /**
+     * @brief   All of the input was consumed, more records are expected.
+     */
+    HEX_CONTINUE = 0,
+    /**
+     * @brief   The end of file record was decoded.
+     */
+    HEX_END,
+    /**
+     * @brief   A line that is not a record was found, it is not consumed.
+     */
+    HEX_NOT_RECORD,
+    /**
+     * @brief   A record has a bad character or length.
+     */
+    HEX_ERROR_FORMAT,
+    /**
+     * @brief   A record has a bad checksum.
+     */
+    HEX_ERROR_CHECKSUM,
+    /**
+     * @brief   The data of a record was refused by the write callback.
+     */
+    HEX_ERROR_WRITE
+} hex_status_t;
+
+/**
+ * @brief   Incremental Intel HEX and Motorola S-record decoder. The format
+ *          is detected per line from the start character.
+ */
+typedef struct
+{
+    /**
+     * @brief   Called with the data of each record with a valid checksum,
+     *          returns false to refuse it.
+     */
+    bool (*write)(uint32_t address, const uint8_t *data, uint32_t size);
+    /**
+     * @brief   Parser state, see hex_decoder.c.
+     */
+    uint8_t state;
+    /**
+     * @brief   S-record type of the line, 0xff for Intel HEX.
+     */
+    uint8_t srec_type;
+    /**
+     * @brief   Byte being decoded from two hex digits.
+     */
+    uint8_t value;
+    /**
+     * @brief   Sum of the bytes of the line.
+     */
+    uint8_t checksum;
+    /**
+     * @brief   Number of hex digits decoded in the line.
+     */
+    uint16_t digits;
+    /**
+     * @brief   The decoded bytes of the line.
+     */
+    uint8_t record[HEX_MAX_RECORD_SIZE];
+    /**
+     * @brief   Intel HEX extended segment or linear base address.
+     */
+    uint32_t base;
+    /**
+     * @brief   Number of record lines started, the line number of the
+     *          current record.
+     */
+    uint32_t lines;
+    /**
+     * @brief   Number of data bytes written.
+     */
+    uint32_t bytes;
+} hex_decoder_t;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module inline functions.                                                  */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+void HexDecoder_Init(hex_decoder_t *dec,
+                     bool (*write)(uint32_t address,
+                                   const uint8_t *data,
+                                   uint32_t size));
+bool HexDecoder_IsRecordStart(uint8_t data);
+hex_status_t HexDecoder_Input(hex_decoder_t *dec,
+                              const uint8_t *data,
+                              size_t size,
+                              size_t *used);
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef __RESPONSE_CACHE_H
+#define __RESPONSE_CACHE_H
+
+#include "statemachine.h"
+
+/*===========================================================================*/
+/* Module global definitions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Number of framings a response is cached for, indexed by
+ *          Serial_Framing.
+ */
+#define RESPONSE_CACHE_FRAMINGS       (FRAMING_RAW + 1)
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   A response frame encoded in one framing.
+ */
+typedef struct
+{
+    /**
+     * @brief   Storage of the encoded frame, capacity + 1 bytes.
+     */
+    uint8_t *frame;
+    /**
+     * @brief   Length of the encoded frame.
+     */
+    uint16_t length;
+    /**
+     * @brief   True if the frame is encoded for revision.
+     */
+    bool valid;
+    /**
+     * @brief   True if the frame fit in the storage, else the response is
+     *          generated directly until the revision changes.
+     */
+    bool fits;
+    /**
+     * @brief   Revision of the content the frame was encoded from.
+     */
+    uint32_t revision;
+} cached_frame_t;
+
+/**
+ * @brief   A cached response, encoded on first use in each framing.
+ */
+typedef struct
+{
+    /**
+     * @brief   Largest encoded frame that is cached.
+     */
+    uint16_t capacity;
+    /**
+     * @brief   The encoded frames, indexed by Serial_Framing.
+     */
+    cached_frame_t frames[RESPONSE_CACHE_FRAMINGS];
+} response_cache_t;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/**
+ * @brief   Declares a response cache and its storage.
+ *
+ * @param[in] name      Name of the response_cache_t.
+ * @param[in] size      Largest encoded frame that is cached.
+ */
+#define RESPONSE_CACHE_DECL(name, size)                                     \
+    static uint8_t name##_storage[RESPONSE_CACHE_FRAMINGS][(size) + 1];     \
+    static response_cache_t name = {                                        \
+        (size),                                                             \
+        {                                                                   \
+            {name##_storage[FRAMING_SYNC], 0, false, false, 0},             \
+            {name##_storage[FRAMING_COBS], 0, false, false, 0},             \
+            {name##_storage[FRAMING_RAW], 0, false, false, 0}               \
+        }                                                                   \
+    }
+
+/*===========================================================================*/
+/* Module inline functions.                                                  */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+bool ResponseCache_Write(response_cache_t *cache,
+                         uint32_t revision,
+                         generator_t encoder,
+                         circular_buffer_t *Cbuff);
+
+#endif
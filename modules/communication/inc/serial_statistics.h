@@ -0,0 +1,126 @@
+#ifndef __SERIAL_STATISTICS_H
+#define __SERIAL_STATISTICS_H
+
+/*===========================================================================*/
+/* Module global definitions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Number of bins in the latency histograms.
+ */
+#define SERIAL_STATS_HISTOGRAM_BINS   (24)
+
+/**
+ * @brief   Log2 of the upper limit of the first histogram bin in cycles.
+ *          Bin n counts latencies in [2^(n + SHIFT), 2^(n + SHIFT + 1))
+ *          cycles, the first and last bins are open ended.
+ */
+#define SERIAL_STATS_HISTOGRAM_SHIFT  (8)
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Link statistics of one port, sent as is (little endian) by
+ *          Cmd_GetLinkStatistics. The layout has no padding.
+ * @note    The counters are updated without locking from several threads,
+ *          they are statistics and not exact.
+ */
+typedef struct
+{
+    /**
+     * @brief   Bytes received.
+     */
+    uint32_t rx_bytes;
+    /**
+     * @brief   Frames received without error.
+     */
+    uint32_t rx_frames;
+    /**
+     * @brief   Frames dropped for any reason.
+     */
+    uint32_t rx_errors;
+    /**
+     * @brief   Frames dropped for CRC8 or CRC16 errors.
+     */
+    uint32_t rx_crc_errors;
+    /**
+     * @brief   Frames dropped as too large.
+     */
+    uint32_t rx_overflows;
+    /**
+     * @brief   Frames dropped with an unknown command.
+     */
+    uint32_t rx_unknown_commands;
+    /**
+     * @brief   Frames dropped because the dispatch queue was full.
+     */
+    uint32_t rx_busy;
+    /**
+     * @brief   Bytes transmitted.
+     */
+    uint32_t tx_bytes;
+    /**
+     * @brief   Frames queued for transmission.
+     */
+    uint32_t tx_frames;
+    /**
+     * @brief   Frames that did not fit in a transmit lane.
+     */
+    uint32_t tx_overflows;
+    /**
+     * @brief   Bytes dropped because the transport failed.
+     */
+    uint32_t tx_dropped;
+    /**
+     * @brief   Largest fill of the control lane in bytes.
+     */
+    uint16_t tx_control_high_water;
+    /**
+     * @brief   Largest fill of the bulk lane in bytes.
+     */
+    uint16_t tx_bulk_high_water;
+    /**
+     * @brief   Largest number of frames waiting for the dispatch worker.
+     */
+    uint8_t dispatch_high_water;
+    /**
+     * @brief   SERIAL_STATS_HISTOGRAM_SHIFT, for the host.
+     */
+    uint8_t histogram_shift;
+    /**
+     * @brief   SERIAL_STATS_HISTOGRAM_BINS, for the host.
+     */
+    uint16_t histogram_bins;
+    /**
+     * @brief   End of frame to parser finished, in log2 cycle bins.
+     */
+    uint16_t processing_histogram[SERIAL_STATS_HISTOGRAM_BINS];
+    /**
+     * @brief   End of frame to ACK queued, in log2 cycle bins.
+     */
+    uint16_t ack_histogram[SERIAL_STATS_HISTOGRAM_BINS];
+    /**
+     * @brief   Frame queued to transmission started, in log2 cycle bins.
+     */
+    uint16_t tx_wait_histogram[SERIAL_STATS_HISTOGRAM_BINS];
+} serial_statistics_t;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module inline functions.                                                  */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+void SerialStatistics_Init(serial_statistics_t *stats);
+void SerialStatistics_AddSample(uint16_t *histogram, rtcnt_t cycles);
+void SerialStatistics_HighWater16(uint16_t *high_water, uint32_t value);
+
+#endif
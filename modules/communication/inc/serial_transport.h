@@ -0,0 +1,78 @@
+#ifndef __SERIAL_TRANSPORT_H
+#define __SERIAL_TRANSPORT_H
+
+/*===========================================================================*/
+/* Module global definitions.                                                */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   A contiguous piece of memory in a scatter-gather transmission.
+ */
+typedef struct
+{
+    /**
+     * @brief   Pointer to the first byte, RAM or memory mapped flash.
+     */
+    const uint8_t *data;
+    /**
+     * @brief   Number of bytes.
+     */
+    uint32_t size;
+} serial_segment_t;
+
+/**
+ * @brief   Transport descriptor, one per physical link carrying the serial
+ *          protocol. Registered with the serial manager for a port.
+ */
+typedef struct
+{
+    /**
+     * @brief   Name of the transport, used for the thread names.
+     */
+    const char *name;
+    /**
+     * @brief   Number of bytes the data pump tries to collect before it
+     *          calls send, normally the packet size of the link.
+     */
+    uint32_t packet_size;
+    /**
+     * @brief   Brings up the link, NULL if started by the system init.
+     */
+    void (*start)(void);
+    /**
+     * @brief   Returns true if the link is up and can transmit.
+     */
+    bool (*poll)(void);
+    /**
+     * @brief   Transmits a block of data, returns the number of bytes sent.
+     */
+    size_t (*send)(uint8_t *data, size_t size);
+    /**
+     * @brief   Waits for a block of received data, returns its size and a
+     *          pointer to it. 0 on timeout.
+     */
+    size_t (*receive)(uint8_t **data, systime_t timeout);
+    /**
+     * @brief   Transmits a list of segments in place, without copying them,
+     *          returns the number of bytes sent. NULL if not supported.
+     */
+    size_t (*send_segments)(const serial_segment_t *segments, size_t count);
+} serial_transport_t;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module inline functions.                                                  */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#endif
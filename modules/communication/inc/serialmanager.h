@@ -2,15 +2,58 @@
 #define __SERIALMANAGER_H
 
 #include "statemachine.h"
+#include "serial_transport.h"
 
 /*===========================================================================*/
 /* Module global definitions.                                                */
 /*===========================================================================*/
 
+/**
+ * @brief   Maximum time in microseconds a frame may wait for more frames
+ *          before the data pump flushes anyway. Rounded up to system ticks,
+ *          a full tick (1 ms) at the current CH_CFG_ST_FREQUENCY, so
+ *          ACK, NAK and the other urgent commands skip it.
+ */
+#ifndef SERIAL_TX_COALESCE_DEADLINE_US
+    #define SERIAL_TX_COALESCE_DEADLINE_US  500
+#endif
+
+/**
+ * @brief   Time in milliseconds the worker waits for room in a transmit
+ *          lane before a response is dropped.
+ */
+#ifndef SERIAL_GENERATE_TIMEOUT_MS
+    #define SERIAL_GENERATE_TIMEOUT_MS      100
+#endif
+
 /*===========================================================================*/
 /* Module data structures and types.                                         */
 /*===========================================================================*/
 
+/**
+ * @brief   A scatter-gather transmission handed to the data pump of a port.
+ *          The segments hold complete frames and are sent in place.
+ */
+typedef struct
+{
+    /**
+     * @brief   The segments, must stay valid until done.
+     */
+    const serial_segment_t *segments;
+    /**
+     * @brief   Number of segments.
+     */
+    size_t count;
+    /**
+     * @brief   Set by the data pump when the segments were sent or dropped.
+     */
+    volatile bool done;
+    /**
+     * @brief   HAL_SUCCESS if the segments were sent.
+     */
+    bool status;
+} serial_scatter_t;
+
 /*===========================================================================*/
 /* Module macros.                                                            */
 /*===========================================================================*/
@@ -23,9 +66,30 @@
 /* External declarations.                                                    */
 /*===========================================================================*/
 void vSerialManagerInit(void);
-void vTaskUSBSerialManager(void *);
-circular_buffer_t *SerialManager_GetCircularBufferFromPort(External_Port port);
-void SerialManager_StartTransmission(External_Port port);
+bool SerialManager_RegisterTransport(External_Port port,
+                                     const serial_transport_t *transport);
+circular_buffer_t *SerialManager_GetCircularBufferFromPort(External_Port port,
+                                                           TX_Lane lane);
+parser_holder_t *SerialManager_GetParserHolderFromPort(External_Port port);
+bool SerialManager_SetFraming(External_Port port, Serial_Framing framing);
+void SerialManager_StartTransmission(External_Port port, TX_Lane lane);
+void SerialManager_StartUrgentTransmission(External_Port port, TX_Lane lane);
+void SerialManager_CountTransmitOverflow(External_Port port);
+bool SerialManager_GetStatistics(External_Port port,
+                                 serial_statistics_t *stats);
+uint32_t SerialManager_GetTxSequence(External_Port port);
+bool SerialManager_WaitForTxSpace(External_Port port,
+                                  uint32_t sequence,
+                                  systime_t timeout);
+bool SerialManager_SupportsScatter(External_Port port);
+bool SerialManager_QueueScatter(External_Port port,
+                                serial_scatter_t *scatter,
+                                systime_t timeout);
+bool SerialManager_WaitScatter(External_Port port,
+                               serial_scatter_t *scatter,
+                               systime_t timeout);
+bool SerialManager_SetFlowControl(External_Port port, bool enable);
+bool SerialManager_FlowControlEnabled(External_Port port);
 bool SubscribeToCommandI(KFly_Command command,
                          External_Port port,
                          uint32_t delay_ms);
@@ -2,6 +2,7 @@
 #define __STATEMACHINE_H
 
 #include "circularbuffer.h"
+#include "serial_statistics.h"
 
 /*===========================================================================*/
 /* Module global definitions.                                                */
@@ -11,6 +12,12 @@
 #define ACK_BIT                       (0x80)
 #define SERIAL_RECIEVE_BUFFER_SIZE    (256)
 #define SERIAL_TRANSMIT_BUFFER_SIZE   (1024)
+#define SERIAL_CONTROL_BUFFER_SIZE    (128)
+#define SERIAL_NUM_PORTS              (6)
+#define SERIAL_COBS_BUFFER_SIZE       (SERIAL_RECIEVE_BUFFER_SIZE + 8)
+#define SERIAL_RESYNC_WINDOW          (32) /* Power of 2 */
+#define SERIAL_NAK_BURST              (4)
+#define SERIAL_NAK_INTERVAL_MS        (10)
 
 /*===========================================================================*/
 /* Module data structures and types.                                         */
@@ -40,9 +47,77 @@ typedef enum PACKED_VAR
     /**
      * @brief   AUX4 (CAN) identifier.
      */
-    PORT_AUX4 = 4
+    PORT_AUX4 = 4,
+    /**
+     * @brief   USB vendor bulk interface identifier.
+     */
+    PORT_USB_BULK = 5
 } External_Port;
 
+/**
+ * @brief   Transmit lane identifier, the control lane is always served
+ *          before the bulk lane.
+ */
+typedef enum PACKED_VAR
+{
+    /**
+     * @brief   Short latency critical frames (ACK, NextPackage, Ping).
+     */
+    LANE_CONTROL = 0,
+    /**
+     * @brief   Everything else (readback, debug, telemetry).
+     */
+    LANE_BULK = 1
+} TX_Lane;
+
+/**
+ * @brief   Framing of the serial protocol on a port.
+ */
+typedef enum PACKED_VAR
+{
+    /**
+     * @brief   SYNC delimited frames, SYNC in the data is doubled.
+     */
+    FRAMING_SYNC = 0,
+    /**
+     * @brief   COBS encoded frames delimited by zero.
+     */
+    FRAMING_COBS = 1,
+    /**
+     * @brief   SYNC delimited frames without escaping, the frame length
+     *          comes from the header. Only for links that deliver all bytes
+     *          in order (USB), data can be sent in place.
+     */
+    FRAMING_RAW = 2
+} Serial_Framing;
+
+/**
+ * @brief   Reason codes of a NAK.
+ */
+typedef enum PACKED_VAR
+{
+    /**
+     * @brief   Header CRC8 error, the command may be wrong.
+     */
+    NAK_CRC8 = 1,
+    /**
+     * @brief   Data CRC16 error.
+     */
+    NAK_CRC16 = 2,
+    /**
+     * @brief   Frame larger than the command or receiver accepts.
+     */
+    NAK_OVERFLOW = 3,
+    /**
+     * @brief   Command not in the command table.
+     */
+    NAK_UNKNOWN_COMMAND = 4,
+    /**
+     * @brief   No room to queue the frame for the parser.
+     */
+    NAK_BUSY = 5
+} NAK_Reason;
+
 /**
  * @brief   All the commands for the serial protocol.
  */
@@ -61,7 +136,8 @@ typedef enum PACKED_VAR
      */
     Cmd_Ping                        = 2,
     /**
-     * @brief   Send debug message command.
+     * @brief   Send debug message command. Text, or binary debug log
+     *          messages if the first byte is DEBUG_LOG_BINARY_MARKER.
      */
     Cmd_DebugMessage                = 3,
     /**
@@ -72,6 +148,26 @@ typedef enum PACKED_VAR
      * @brief   Manage Subscriptions command.
      */
     Cmd_ManageSubscriptions         = 5,
+    /**
+     * @brief   Set the framing of the port, takes a Serial_Framing byte.
+     * @note    The ACK is sent in the old framing.
+     */
+    Cmd_SetFraming                  = 6,
+    /**
+     * @brief   NAK command, sent when a frame is dropped.
+     *          Data: failed command (without ACK bit) | NAK_Reason.
+     */
+    Cmd_NAK                         = 7,
+    /**
+     * @brief   Get the link statistics of a port as a serial_statistics_t.
+     *          Data: optional port, the receiving port if omitted.
+     */
+    Cmd_GetLinkStatistics           = 8,
+    /**
+     * @brief   Get a page of thread and kernel statistics.
+     *          Data: optional index of the first thread, 0 if omitted.
+     */
+    Cmd_GetThreadStatistics         = 9,
 
     /*===============================================*/
     /* Bootloader specific commands.                 */
@@ -93,12 +189,16 @@ typedef enum PACKED_VAR
      */
     Cmd_WriteLastFirmwarePackage    = 12,
     /**
-     * @brief   Read firmware package.
+     * @brief   Read firmware package. The host sends the address and size
+     *          of the region (uint32_t each, little endian), the user flash
+     *          if omitted. The device answers with frames of this command
+     *          holding the data, ended by Cmd_ReadLastFirmwarePackage.
      * @note    Bootloader specific, shall always require ACK.
      */
     Cmd_ReadFirmwarePackage         = 13,
     /**
-     * @brief   Read the last firmware package.
+     * @brief   Read the last firmware package, the last frame of a
+     *          readback.
      * @note    Bootloader specific, shall always require ACK.
      */
     Cmd_ReadLastFirmwarePackage     = 14,
@@ -130,6 +230,24 @@ typedef enum PACKED_VAR
      */
     Cmd_SaveToFlash                 = 19,
 
+    /*===============================================*/
+    /* Diagnostic and link commands.                 */
+    /*===============================================*/
+
+    /**
+     * @brief   Stream the event trace ring.
+     *          Data: optional free running index of the first record
+     *          (uint32_t, little endian).
+     */
+    Cmd_DumpTrace                   = 20,
+    /**
+     * @brief   Enable (1) or disable (0) flow control on the port. When
+     *          enabled, the ACKs sent after a parser carry one data byte
+     *          with the number of frames the device can queue before it
+     *          NAKs busy.
+     */
+    Cmd_SetFlowControl              = 21,
+
     /*===============================================*/
     /* Controller specific commands.                 */
     /*===============================================*/
@@ -276,6 +394,10 @@ typedef struct _parser_holder
      * @brief   Which port the data came from.
      */
     External_Port Port;
+    /**
+     * @brief   The received command, without the ACK bit.
+     */
+    uint8_t command;
     /**
      * @brief   If an ACK was requested.
      */
@@ -300,12 +422,58 @@ typedef struct _parser_holder
      * @brief   The current CRC16 calculation.
      */
     uint16_t crc16;
+    /**
+     * @brief   The framing used on the port.
+     */
+    Serial_Framing framing;
+    /**
+     * @brief   Buffer collecting an encoded frame in COBS framing.
+     */
+    uint8_t *frame_buffer;
+    /**
+     * @brief   Number of bytes in the frame buffer, larger than
+     *          SERIAL_COBS_BUFFER_SIZE if the frame overflowed.
+     */
+    uint16_t frame_count;
+    /**
+     * @brief   The last received bytes, rescanned after a framing error.
+     */
+    uint8_t history[SERIAL_RESYNC_WINDOW];
+    /**
+     * @brief   Number of bytes received, the next index in the history.
+     */
+    uint32_t history_index;
+    /**
+     * @brief   History index of the first byte after the current SYNC.
+     */
+    uint32_t frame_start;
+    /**
+     * @brief   History index after the byte being processed.
+     */
+    uint32_t position;
+    /**
+     * @brief   Set by a framing error to request a rescan.
+     */
+    bool resync;
+    /**
+     * @brief   NAKs that can be sent before the rate limit applies.
+     */
+    uint8_t nak_tokens;
+    /**
+     * @brief   Time of the last NAK token refill.
+     */
+    systime_t nak_time;
+    /**
+     * @brief   Link statistics of the port, NULL if not kept.
+     */
+    serial_statistics_t *stats;
     /**
      * @brief   The number of receive errors.
      */
     uint32_t rx_error;
     /**
-     * @brief   The number of correctly received packets.
+     * @brief   The number of correctly received packets handed to the
+     *          worker, packets NAKed as busy count as errors.
      */
     uint32_t rx_success;
     /**
@@ -349,14 +517,7 @@ typedef bool (*generator_t)(circular_buffer_t *);
  */
 static inline bool isPort(External_Port port)
 {
-    if ((port == PORT_USB) ||
-        (port == PORT_AUX1) ||
-        (port == PORT_AUX2) ||
-        (port == PORT_AUX3) ||
-        (port == PORT_AUX4))
-        return true;
-    else
-        return false;
+    return ((uint32_t)port < SERIAL_NUM_PORTS);
 }
 
 /*===========================================================================*/
@@ -365,8 +526,15 @@ static inline bool isPort(External_Port port)
 
 void vInitStatemachineDataHolder(parser_holder_t *pHolder,
                                  External_Port port,
-                                 uint8_t *buffer);
+                                 uint8_t *buffer,
+                                 uint8_t *frame_buffer,
+                                 serial_statistics_t *stats);
 void vStatemachineDataEntry(uint8_t data, parser_holder_t *pHolder);
+void vStatemachineCOBSEntry(uint8_t *data,
+                            size_t size,
+                            parser_holder_t *pHolder);
+void vStatemachineSendNAK(parser_holder_t *pHolder, NAK_Reason reason);
+void vStatemachineFrameError(parser_holder_t *pHolder, NAK_Reason reason);
 void CircularBuffer_WriteSYNCNoIncrement(circular_buffer_t *Cbuff, 
 										 int32_t *count, 
 										 uint8_t *crc8, 
@@ -376,5 +544,12 @@ void CircularBuffer_WriteNoIncrement(circular_buffer_t *Cbuff,
                                      int32_t *count, 
                                      uint8_t *crc8, 
                                      uint16_t *crc16);
+void CircularBuffer_WriteChunkNoIncrement(circular_buffer_t *Cbuff,
+                                          const uint8_t *data,
+                                          uint32_t size,
+                                          int32_t *count,
+                                          uint16_t *crc16);
+void CircularBuffer_WriteEndNoIncrement(circular_buffer_t *Cbuff,
+                                        int32_t *count);
 
 #endif
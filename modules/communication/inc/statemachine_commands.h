@@ -0,0 +1,160 @@
+#ifndef __STATEMACHINE_COMMANDS_H
+#define __STATEMACHINE_COMMANDS_H
+
+#include "statemachine.h"
+
+/*===========================================================================*/
+/* Module global definitions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Number of entries in the command table, all commands without the
+ *          ACK bit.
+ */
+#define SERIAL_NUM_COMMANDS           (128)
+
+/**
+ * @brief   The command table, one line per command in KFly_Command.
+ * @details X(command, parser, generator, ACK policy, max payload, lane, urgent)
+ *          - parser:       Run on a received frame, NULL if none.
+ *          - generator:    Used by GenerateMessage(), NULL if none.
+ *          - ACK policy:   See ack_policy_t.
+ *          - max payload:  Largest data part accepted from the host.
+ *          - lane:         Transmit lane for the command.
+ *          - urgent:       Bypass the transmit coalescing of the data pump.
+ * @note    New commands only need a line here, the lookup is generated.
+ */
+#define SERIAL_COMMAND_TABLE(X)                                                                                                   \
+    X(Cmd_ACK,                       NULL,                     GenerateACK,            ACK_NEVER,      0,   LANE_CONTROL, true)   \
+    X(Cmd_Ping,                      ParsePing,                GeneratePing,           ACK_ON_REQUEST, 0,   LANE_CONTROL, true)   \
+    X(Cmd_DebugMessage,              NULL,                     NULL,                   ACK_ON_REQUEST, 255, LANE_BULK,    false)  \
+    X(Cmd_GetRunningMode,            ParseGetRunningMode,      GenerateGetRunningMode, ACK_ON_REQUEST, 0,   LANE_CONTROL, false)  \
+    X(Cmd_ManageSubscriptions,       NULL,                     NULL,                   ACK_ON_REQUEST, 7,   LANE_BULK,    false)  \
+    X(Cmd_SetFraming,                ParseSetFraming,          NULL,                   ACK_ON_REQUEST, 1,   LANE_CONTROL, false)  \
+    X(Cmd_NAK,                       NULL,                     NULL,                   ACK_NEVER,      2,   LANE_CONTROL, true)   \
+    X(Cmd_GetLinkStatistics,         ParseGetLinkStatistics,   NULL,                   ACK_ON_REQUEST, 1,   LANE_BULK,    false)  \
+    X(Cmd_GetThreadStatistics,       ParseGetThreadStatistics, NULL,                   ACK_ON_REQUEST, 1,   LANE_BULK,    false)  \
+    X(Cmd_PrepareWriteFirmware,      NULL,                     NULL,                   ACK_ALWAYS,     255, LANE_BULK,    false)  \
+    X(Cmd_WriteFirmwarePackage,      NULL,                     NULL,                   ACK_ALWAYS,     255, LANE_BULK,    false)  \
+    X(Cmd_WriteLastFirmwarePackage,  NULL,                     NULL,                   ACK_ALWAYS,     255, LANE_BULK,    false)  \
+    X(Cmd_ReadFirmwarePackage,       ParseReadFirmwarePackage, NULL,                   ACK_ALWAYS,     8,   LANE_BULK,    false)  \
+    X(Cmd_ReadLastFirmwarePackage,   NULL,                     NULL,                   ACK_ALWAYS,     255, LANE_BULK,    false)  \
+    X(Cmd_NextPackage,               NULL,                     NULL,                   ACK_ALWAYS,     0,   LANE_CONTROL, true)   \
+    X(Cmd_ExitBootloader,            NULL,                     NULL,                   ACK_ALWAYS,     0,   LANE_CONTROL, true)   \
+    X(Cmd_GetDeviceInfo,             ParseGetDeviceInfo,       GenerateGetDeviceInfo,  ACK_ON_REQUEST, 0,   LANE_BULK,    false)  \
+    X(Cmd_SetDeviceID,               ParseSetDeviceID,         NULL,                   ACK_ON_REQUEST, 100, LANE_BULK,    false)  \
+    X(Cmd_SaveToFlash,               NULL,                     NULL,                   ACK_ON_REQUEST, 0,   LANE_BULK,    false)  \
+    X(Cmd_DumpTrace,                 ParseDumpTrace,           NULL,                   ACK_ON_REQUEST, 4,   LANE_BULK,    false)  \
+    X(Cmd_SetFlowControl,            ParseSetFlowControl,      NULL,                   ACK_ON_REQUEST, 1,   LANE_CONTROL, false)  \
+    X(Cmd_GetArmSettings,            NULL,                     NULL,                   ACK_ON_REQUEST, 0,   LANE_BULK,    false)  \
+    X(Cmd_SetArmSettings,            NULL,                     NULL,                   ACK_ON_REQUEST, 255, LANE_BULK,    false)  \
+    X(Cmd_GetRateControllerData,     NULL,                     NULL,                   ACK_ON_REQUEST, 0,   LANE_BULK,    false)  \
+    X(Cmd_SetRateControllerData,     NULL,                     NULL,                   ACK_ON_REQUEST, 255, LANE_BULK,    false)  \
+    X(Cmd_GetAttitudeControllerData, NULL,                     NULL,                   ACK_ON_REQUEST, 0,   LANE_BULK,    false)  \
+    X(Cmd_SetAttitudeControllerData, NULL,                     NULL,                   ACK_ON_REQUEST, 255, LANE_BULK,    false)  \
+    X(Cmd_GetVelocityControllerData, NULL,                     NULL,                   ACK_ON_REQUEST, 0,   LANE_BULK,    false)  \
+    X(Cmd_SetVelocityControllerData, NULL,                     NULL,                   ACK_ON_REQUEST, 255, LANE_BULK,    false)  \
+    X(Cmd_GetPositionControllerData, NULL,                     NULL,                   ACK_ON_REQUEST, 0,   LANE_BULK,    false)  \
+    X(Cmd_SetPositionControllerData, NULL,                     NULL,                   ACK_ON_REQUEST, 255, LANE_BULK,    false)  \
+    X(Cmd_GetChannelMix,             NULL,                     NULL,                   ACK_ON_REQUEST, 0,   LANE_BULK,    false)  \
+    X(Cmd_SetChannelMix,             NULL,                     NULL,                   ACK_ON_REQUEST, 255, LANE_BULK,    false)  \
+    X(Cmd_GetRCCalibration,          NULL,                     NULL,                   ACK_ON_REQUEST, 0,   LANE_BULK,    false)  \
+    X(Cmd_SetRCCalibration,          NULL,                     NULL,                   ACK_ON_REQUEST, 255, LANE_BULK,    false)  \
+    X(Cmd_GetRCValues,               NULL,                     NULL,                   ACK_ON_REQUEST, 0,   LANE_BULK,    false)  \
+    X(Cmd_GetSensorData,             NULL,                     NULL,                   ACK_ON_REQUEST, 0,   LANE_BULK,    false)  \
+    X(Cmd_GetRawSensorData,          NULL,                     NULL,                   ACK_ON_REQUEST, 0,   LANE_BULK,    false)  \
+    X(Cmd_GetSensorCalibration,      NULL,                     NULL,                   ACK_ON_REQUEST, 0,   LANE_BULK,    false)  \
+    X(Cmd_SetSensorCalibration,      NULL,                     NULL,                   ACK_ON_REQUEST, 255, LANE_BULK,    false)  \
+    X(Cmd_GetEstimationRate,         NULL,                     NULL,                   ACK_ON_REQUEST, 0,   LANE_BULK,    false)  \
+    X(Cmd_GetEstimationAttitude,     NULL,                     NULL,                   ACK_ON_REQUEST, 0,   LANE_BULK,    false)  \
+    X(Cmd_GetEstimationVelocity,     NULL,                     NULL,                   ACK_ON_REQUEST, 0,   LANE_BULK,    false)  \
+    X(Cmd_GetEstimationPosition,     NULL,                     NULL,                   ACK_ON_REQUEST, 0,   LANE_BULK,    false)  \
+    X(Cmd_GetEstimationAllStates,    NULL,                     NULL,                   ACK_ON_REQUEST, 0,   LANE_BULK,    false)  \
+    X(Cmd_ResetEstimation,           NULL,                     NULL,                   ACK_ON_REQUEST, 0,   LANE_BULK,    false)  \
+    X(Cmd_ViconMeasurement,          NULL,                     NULL,                   ACK_ON_REQUEST, 255, LANE_BULK,    false)
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   How the ACK bit of a received command is handled.
+ */
+typedef enum PACKED_VAR
+{
+    /**
+     * @brief   ACK only if the host set the ACK bit.
+     */
+    ACK_ON_REQUEST = 0,
+    /**
+     * @brief   Always ACK, the command shall always require ACK.
+     */
+    ACK_ALWAYS = 1,
+    /**
+     * @brief   Never ACK, even if the ACK bit is set.
+     */
+    ACK_NEVER = 2
+} ack_policy_t;
+
+/**
+ * @brief   Descriptor of a command, generated from SERIAL_COMMAND_TABLE.
+ */
+typedef struct
+{
+    /**
+     * @brief   Parser for received frames, NULL if none.
+     */
+    parser_t parser;
+    /**
+     * @brief   Message generator, NULL if none.
+     */
+    generator_t generator;
+    /**
+     * @brief   Largest data part accepted from the host.
+     */
+    uint8_t max_payload;
+    /**
+     * @brief   ACK policy of the command.
+     */
+    ack_policy_t ack_policy;
+    /**
+     * @brief   Transmit lane of the command.
+     */
+    TX_Lane lane;
+    /**
+     * @brief   True if the message bypasses the transmit coalescing.
+     */
+    bool urgent;
+    /**
+     * @brief   True if the command is in the table, false for holes.
+     */
+    bool valid;
+} command_descriptor_t;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+extern const command_descriptor_t command_table[SERIAL_NUM_COMMANDS];
+
+/*===========================================================================*/
+/* Module inline functions.                                                  */
+/*===========================================================================*/
+
+/**
+ * @brief               Returns the descriptor of a command. The ACK bit is
+ *                      masked off so every input maps into the table.
+ *
+ * @param[in] command   Command to get the descriptor for.
+ * @return              Pointer to the command descriptor.
+ */
+static inline const command_descriptor_t *GetCommandDescriptor(uint8_t command)
+{
+    return &command_table[command & ~ACK_BIT];
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef __STATEMACHINE_DISPATCHER_H
+#define __STATEMACHINE_DISPATCHER_H
+
+#include "statemachine.h"
+
+/*===========================================================================*/
+/* Module global definitions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Number of received frames that can wait for the worker.
+ */
+#define SERIAL_DISPATCH_QUEUE_SIZE    (4)
+
+/**
+ * @brief   Stack size of the dispatch worker thread. The parsers are called
+ *          through pointers, the deepest chain is DispatchTask (208 bytes)
+ *          and ParseDumpTrace or ParseGetThreadStatistics (720 bytes with
+ *          the reply frame on the stack), 928 bytes on x86-64 at -O0
+ *          (-fcallgraph-info=su). The rest is margin for the interrupt
+ *          frames and the differences of the ARM build.
+ */
+#define SERIAL_DISPATCH_STACK_SIZE    (1536)
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   A completed frame waiting to be parsed by the worker.
+ */
+typedef struct
+{
+    /**
+     * @brief   The parser to run on the frame.
+     */
+    parser_t parser;
+    /**
+     * @brief   Which port the frame came from.
+     */
+    External_Port Port;
+    /**
+     * @brief   If an ACK was requested.
+     */
+    bool AckRequested;
+    /**
+     * @brief   The command of the frame, without ACK bit.
+     */
+    uint8_t command;
+    /**
+     * @brief   The length of the data.
+     */
+    uint8_t data_length;
+    /**
+     * @brief   Realtime counter when the frame was received.
+     */
+    rtcnt_t rx_cycles;
+    /**
+     * @brief   Link statistics of the port, may be NULL.
+     */
+    serial_statistics_t *stats;
+    /**
+     * @brief   The frame data.
+     */
+    uint8_t data[SERIAL_RECIEVE_BUFFER_SIZE];
+} frame_descriptor_t;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module inline functions.                                                  */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+void vStatemachineDispatcherInit(void);
+bool DispatchFrame(parser_holder_t *pHolder);
+uint8_t DispatchCredits(void);
+
+#endif
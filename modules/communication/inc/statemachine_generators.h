@@ -23,11 +23,23 @@
 /* External declarations.                                                    */
 /*===========================================================================*/
 
+bool GenerateACK(circular_buffer_t *Cbuff);
+bool GeneratePing(circular_buffer_t *Cbuff);
+bool GenerateGetRunningMode(circular_buffer_t *Cbuff);
+bool GenerateGetDeviceInfo(circular_buffer_t *Cbuff);
 bool GenerateMessage(KFly_Command command, External_Port port);
+bool GenerateMessageTimeout(KFly_Command command,
+                            External_Port port,
+                            systime_t timeout);
 bool GenerateCustomMessage(KFly_Command command,
                            uint8_t *data,
                            uint16_t size,
                            External_Port port);
+bool GenerateCustomMessageTimeout(KFly_Command command,
+                                  uint8_t *data,
+                                  uint16_t size,
+                                  External_Port port,
+                                  systime_t timeout);
 bool GenerateDebugMessage(uint8_t *data, 
                           uint32_t size, 
                           circular_buffer_t *Cbuff);
@@ -46,6 +46,15 @@ typedef struct PACKED_VAR
 /*===========================================================================*/
 /* External declarations.                                                    */
 /*===========================================================================*/
-parser_t GetParser(KFly_Command command);
+void ParsePing(parser_holder_t *pHolder);
+void ParseGetRunningMode(parser_holder_t *pHolder);
+void ParseGetDeviceInfo(parser_holder_t *pHolder);
+void ParseSetDeviceID(parser_holder_t *pHolder);
+void ParseSetFraming(parser_holder_t *pHolder);
+void ParseGetLinkStatistics(parser_holder_t *pHolder);
+void ParseGetThreadStatistics(parser_holder_t *pHolder);
+void ParseDumpTrace(parser_holder_t *pHolder);
+void ParseSetFlowControl(parser_holder_t *pHolder);
+void ParseReadFirmwarePackage(parser_holder_t *pHolder);
 
 #endif
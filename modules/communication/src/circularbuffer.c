@@ -4,6 +4,7 @@
  *
  * */
 
+#include <string.h>
 #include "ch.h"
 #include "hal.h"
 #include "crc.h"
@@ -44,6 +45,8 @@ void CircularBuffer_Init(circular_buffer_t *Cbuff,
     Cbuff->tail = 0;
     Cbuff->size = buffer_size;
     Cbuff->buffer = buffer;
+    Cbuff->framing = 0;
+    Cbuff->cobs_code = 0;
 }
 
 /**
@@ -86,6 +89,17 @@ uint32_t CircularBuffer_SpaceLeft(circular_buffer_t *Cbuff)
     return (Cbuff->tail + Cbuff->size - Cbuff->head - 1) % Cbuff->size;
 }
 
+/**
+ * @brief               Calculates the number of bytes waiting to be read
+ *                      from a circular buffer.
+ * 
+ * @param[in] Cbuff     Pointer to the circular buffer.
+ */
+uint32_t CircularBuffer_Size(circular_buffer_t *Cbuff)
+{
+    return (Cbuff->head + Cbuff->size - Cbuff->tail) % Cbuff->size;
+}
+
 /**
  * @brief               Writes a byte to a circular buffer.
  * 
@@ -110,30 +124,27 @@ void CircularBuffer_WriteChunk(circular_buffer_t *Cbuff,
                                uint8_t *data, 
                                const uint32_t count)
 {
-    uint32_t i, head, from_bot, to_top;
+    uint32_t head, from_bot, to_top;
 
     head = Cbuff->head;
     to_top = Cbuff->size - Cbuff->head;
 
 
-    if (to_top < count)
+    if (to_top <= count)
     {   /* If we need to wrap around during the write */
         from_bot = count - to_top;
 
         /* First we fill to the top */
-        for (i = 0; i < to_top; i++)
-            Cbuff->buffer[head + i] = data[i];
+        memcpy(&Cbuff->buffer[head], data, to_top);
 
         /* Then we fill the rest */
-        for (i = 0; i < from_bot; i++)
-            Cbuff->buffer[i] = data[to_top + i];
+        memcpy(Cbuff->buffer, &data[to_top], from_bot);
 
         Cbuff->head = from_bot; /* The end value of head was pre-calculated */
     }
     else
     {   /* No wrap around needed, chunk will fit in the space left to the top */
-        for (i = 0; i < count; i++)
-            Cbuff->buffer[head + i] = data[i];
+        memcpy(&Cbuff->buffer[head], data, count);
 
         Cbuff->head = (Cbuff->head + count); /* There will be no wrap around */
     }
@@ -0,0 +1,316 @@
+/* *
+ *
+ * Flash readback for the serial protocol.
+ * A region of the memory mapped flash is sent as a stream of
+ * Cmd_ReadFirmwarePackage frames ended by a Cmd_ReadLastFirmwarePackage
+ * frame. On ports in raw framing with a scatter-gather transport only the
+ * headers and CRCs are built in RAM, the data goes from the flash straight
+ * to the link. Other ports encode the data from the flash into the bulk
+ * lane.
+ *
+ * With an image key provisioned the flash holds decrypted firmware, so the
+ * user flash is not sent.
+ *
+ * */
+
+#include "ch.h"
+#include "hal.h"
+#include "crc.h"
+#include "flash_functionality.h"
+#include "flash_pipeline.h"
+#include "image_decrypt.h"
+#include "serialmanager.h"
+#include "statemachine_generators.h"
+#include "firmware_readback.h"
+
+/*===========================================================================*/
+/* Module local definitions.                                                 */
+/*===========================================================================*/
+
+/**
+ * @brief   Time the readback waits for the data pump.
+ */
+#define READBACK_TIMEOUT              MS2ST(SERIAL_GENERATE_TIMEOUT_MS)
+
+/**
+ * @brief   Size of a frame header (SYNC, command, size, CRC8) and of the
+ *          CRC16 trailer.
+ */
+#define READBACK_HEADER_SIZE          (4)
+#define READBACK_TRAILER_SIZE         (2)
+
+/*===========================================================================*/
+/* Module exported variables.                                                */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module local variables and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   A batch of readback frames, the data segments point into the
+ *          flash.
+ */
+typedef struct
+{
+    /**
+     * @brief   The transmission handed to the data pump.
+     */
+    serial_scatter_t scatter;
+    /**
+     * @brief   Header, data and trailer segment of each frame.
+     */
+    serial_segment_t segments[3 * READBACK_BATCH_FRAMES];
+    /**
+     * @brief   Frame headers.
+     */
+    uint8_t headers[READBACK_BATCH_FRAMES][READBACK_HEADER_SIZE];
+    /**
+     * @brief   Frame CRC16s.
+     */
+    uint8_t trailers[READBACK_BATCH_FRAMES][READBACK_TRAILER_SIZE];
+    /**
+     * @brief   True while the batch is owned by the data pump.
+     */
+    bool queued;
+} readback_batch_t;
+
+/**
+ * @brief   The batches, one is prepared while the other is sent.
+ */
+static readback_batch_t batches[READBACK_NUM_BATCHES];
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+/**
+ * @brief               Checks that a region is inside the flash and holds no
+ *                      decrypted firmware.
+ *
+ * @param[in] address   First address of the region.
+ * @param[in] size      Size of the region.
+ * @return              True if valid.
+ */
+static bool ReadbackRegionValid(uint32_t address, uint32_t size)
+{
+    if (((address + size) > FLASH_USER_BASE) &&
+        (ImageDecrypt_KeyPresent(IMAGE_CIPHER_AES128_CTR) == true))
+        return false;
+
+    return (address >= FLASH_BASE) &&
+           (address <= FLASH_END_ADDRESS) &&
+           (size <= (FLASH_END_ADDRESS - address));
+}
+
+/**
+ * @brief               Waits for a batch to be given back by the data pump.
+ *
+ * @param[in] port      Port the batch was queued on.
+ * @param[in] batch     The batch.
+ * @return              HAL_FAILED if the batch is still in use or was
+ *                      dropped, else HAL_SUCCESS.
+ */
+static bool ReadbackWaitBatch(External_Port port, readback_batch_t *batch)
+{
+    bool status;
+
+    if (batch->queued == false)
+        return HAL_SUCCESS;
+
+    status = SerialManager_WaitScatter(port, &batch->scatter, READBACK_TIMEOUT);
+
+    if (batch->scatter.done == true)
+        batch->queued = false;
+
+    return status;
+}
+
+/**
+ * @brief               Adds a frame to a batch, the data stays in place.
+ *
+ * @param[in] batch     The batch.
+ * @param[in] command   Command of the frame.
+ * @param[in] data      Pointer to the data.
+ * @param[in] size      Size of the data.
+ */
+static void ReadbackAddFrame(readback_batch_t *batch,
+                             KFly_Command command,
+                             const uint8_t *data,
+                             uint8_t size)
+{
+    uint32_t frame = batch->scatter.count / 3;
+    serial_segment_t *segments = &batch->segments[batch->scatter.count];
+    uint8_t *header = batch->headers[frame];
+    uint8_t *trailer = batch->trailers[frame];
+    uint16_t crc16;
+
+    header[0] = SYNC_BYTE;
+    header[1] = command;
+    header[2] = size;
+    header[3] = CRC8(header, 3);
+
+    segments[0].data = header;
+    segments[0].size = READBACK_HEADER_SIZE;
+
+    /* A frame without data has no CRC16, it still takes 3 segments */
+    segments[1].data = data;
+    segments[1].size = size;
+    segments[2].data = trailer;
+    segments[2].size = 0;
+
+    if (size > 0)
+    {
+        crc16 = CRC16(header, READBACK_HEADER_SIZE);
+        crc16 = CRC16_chunk(data, size, crc16);
+
+        trailer[0] = (uint8_t)(crc16 >> 8);
+        trailer[1] = (uint8_t)(crc16);
+        segments[2].size = READBACK_TRAILER_SIZE;
+    }
+
+    batch->scatter.count += 3;
+}
+
+/**
+ * @brief               Streams a region as frames sent in place, in batches
+ *                      handed to the data pump.
+ *
+ * @param[in] port      Port to send on.
+ * @param[in] address   First address of the region.
+ * @param[in] size      Size of the region.
+ * @return              HAL_FAILED if the stream was aborted, else
+ *                      HAL_SUCCESS.
+ */
+static bool ReadbackScatter(External_Port port, uint32_t address, uint32_t size)
+{
+    readback_batch_t *batch;
+    uint32_t i, n, next = 0;
+    bool last = false, status = HAL_SUCCESS;
+
+    /* A batch of an aborted readback may still be in use */
+    for (i = 0; i < READBACK_NUM_BATCHES; i++)
+    {
+        ReadbackWaitBatch(port, &batches[i]);
+
+        if (batches[i].queued == true)
+            return HAL_FAILED;
+    }
+
+    while ((last == false) && (status == HAL_SUCCESS))
+    {
+        batch = &batches[next];
+        next = (next + 1) % READBACK_NUM_BATCHES;
+
+        /* The batch sent READBACK_NUM_BATCHES batches ago */
+        if (ReadbackWaitBatch(port, batch) != HAL_SUCCESS)
+        {
+            status = HAL_FAILED;
+            break;
+        }
+
+        batch->scatter.segments = batch->segments;
+        batch->scatter.count = 0;
+
+        for (i = 0; (i < READBACK_BATCH_FRAMES) && (last == false); i++)
+        {
+            n = (size > READBACK_FRAME_DATA_SIZE) ? READBACK_FRAME_DATA_SIZE
+                                                  : size;
+            last = (n == size);
+
+            ReadbackAddFrame(batch,
+                             last ? Cmd_ReadLastFirmwarePackage
+                                  : Cmd_ReadFirmwarePackage,
+                             (const uint8_t *)address,
+                             n);
+
+            address += n;
+            size -= n;
+        }
+
+        status = SerialManager_QueueScatter(port,
+                                            &batch->scatter,
+                                            READBACK_TIMEOUT);
+        batch->queued = (status == HAL_SUCCESS);
+    }
+
+    /* The stream is done when all batches are sent */
+    for (i = 0; i < READBACK_NUM_BATCHES; i++)
+    {
+        if (ReadbackWaitBatch(port, &batches[i]) != HAL_SUCCESS)
+            status = HAL_FAILED;
+    }
+
+    return status;
+}
+
+/**
+ * @brief               Streams a region as frames encoded into the bulk
+ *                      lane of the port.
+ *
+ * @param[in] port      Port to send on.
+ * @param[in] address   First address of the region.
+ * @param[in] size      Size of the region.
+ * @return              HAL_FAILED if the stream was aborted, else
+ *                      HAL_SUCCESS.
+ */
+static bool ReadbackCopy(External_Port port, uint32_t address, uint32_t size)
+{
+    uint32_t n;
+    bool last = false;
+
+    while (last == false)
+    {
+        n = (size > READBACK_FRAME_DATA_SIZE) ? READBACK_FRAME_DATA_SIZE
+                                              : size;
+        last = (n == size);
+
+        if (GenerateCustomMessageTimeout(last ? Cmd_ReadLastFirmwarePackage
+                                              : Cmd_ReadFirmwarePackage,
+                                         (uint8_t *)address,
+                                         n,
+                                         port,
+                                         READBACK_TIMEOUT) != HAL_SUCCESS)
+            return HAL_FAILED;
+
+        address += n;
+        size -= n;
+    }
+
+    return HAL_SUCCESS;
+}
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief               Sends a region of the flash as a stream of
+ *                      Cmd_ReadFirmwarePackage frames with up to
+ *                      READBACK_FRAME_DATA_SIZE bytes each, the last frame
+ *                      is sent as Cmd_ReadLastFirmwarePackage. An empty
+ *                      region gives one empty last frame.
+ * @note                Waits for the flash pipeline so that the data just
+ *                      written is read back.
+ *
+ * @param[in] port      Port to send on.
+ * @param[in] address   First address of the region.
+ * @param[in] size      Size of the region.
+ * @return              HAL_FAILED if the region is outside the flash, holds
+ *                      decrypted firmware or the stream was aborted, else
+ *                      HAL_SUCCESS.
+ */
+bool FirmwareReadback_Stream(External_Port port,
+                             uint32_t address,
+                             uint32_t size)
+{
+    if (ReadbackRegionValid(address, size) == false)
+        return HAL_FAILED;
+
+    (void)FlashPipeline_Wait(MS2ST(READBACK_FLASH_TIMEOUT_MS));
+
+    if (SerialManager_SupportsScatter(port) == true)
+        return ReadbackScatter(port, address, size);
+    else
+        return ReadbackCopy(port, address, size);
+}
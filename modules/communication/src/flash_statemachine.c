@@ -1,12 +1,28 @@
+#include <string.h>
 #include "ch.h"
 #include "hal.h"
+#include "chprintf.h"
+#include "crc.h"
 #include "myusb.h"
+#include "flash_pipeline.h"
+#include "hex_decoder.h"
+#include "image_verify.h"
 #include "flash_statemachine.h"
-#include "chprintf.h"
+#include "debug_log.h"
 /*===========================================================================*/
 /* Module local definitions.                                                 */
 /*===========================================================================*/
 
+/**
+ * @brief   Size of the console replies with numbers.
+ */
+#define FLASH_REPLY_SIZE            64
+
+/**
+ * @brief   Size of the CRC32 trailer of a WRITE.
+ */
+#define FLASH_BINARY_TRAILER_SIZE   4
+
 /*===========================================================================*/
 /* Module exported variables.                                                */
 /*===========================================================================*/
@@ -17,6 +33,89 @@
 char command_buffer[FLASH_CMD_BUFFER_SIZE];
 uint32_t pos = 0;
 flash_state_t state = FLASH_GET_CMD;
+
+/**
+ * @brief   Decoder of the HEX or S-record file being received.
+ */
+static hex_decoder_t hex_decoder;
+
+/**
+ * @brief   Page collecting the records, a flash job aligned to its size.
+ *          NULL if no page is open.
+ */
+static flash_job_t *hex_page = NULL;
+
+/**
+ * @brief   Address of the open page and the range written in it.
+ */
+static uint32_t hex_page_base;
+static uint32_t hex_page_first;
+static uint32_t hex_page_end;
+
+/**
+ * @brief   First error of the file and its line, HEX_CONTINUE if none.
+ */
+static hex_status_t hex_error;
+static uint32_t hex_error_line;
+
+/**
+ * @brief   Set when DFU or the UF2 disk owned the flash as the file started,
+ *          the file is then only checked.
+ */
+static bool hex_busy;
+
+/**
+ * @brief   Set once a page of the file was queued for programming.
+ */
+static bool hex_submitted;
+
+/**
+ * @brief   Time the file started.
+ */
+static systime_t hex_start;
+
+/**
+ * @brief   Set when the end record ended on '\r', the '\n' of a CRLF
+ *          line end is then dropped instead of parsed as a command.
+ */
+static bool hex_crlf = false;
+
+/**
+ * @brief   Block of a WRITE being filled, NULL if none is open.
+ */
+static flash_job_t *bin_job = NULL;
+
+/**
+ * @brief   Address of the next byte of a WRITE, the number of bytes in the
+ *          open block and the number of bytes left.
+ */
+static uint32_t bin_address;
+static uint32_t bin_fill;
+static uint32_t bin_remaining;
+
+/**
+ * @brief   CRC32 of the received data and the received trailer.
+ */
+static uint32_t bin_crc;
+static uint8_t bin_trailer[FLASH_BINARY_TRAILER_SIZE];
+static uint32_t bin_trailer_pos;
+
+/**
+ * @brief   Set when the flash refused a block, the rest of the data is
+ *          received but not written.
+ */
+static bool bin_error;
+
+/**
+ * @brief   Set when a WRITE was refused, the data the host streams anyway
+ *          is discarded.
+ */
+static bool bin_drain = false;
+
+/**
+ * @brief   Receives the data after a flash error.
+ */
+static uint8_t bin_discard[USB_RECEIVE_BLOCK_SIZE];
 /*===========================================================================*/
 /* Module local functions.                                                   */
 /*===========================================================================*/
@@ -85,31 +184,594 @@ static int32_t getNum(char *str, uint32_t len)
     /* Convert characters to number */
     return simple_atoi(&str[start], len - start);
 }
-/*===========================================================================*/
-/* Module exported functions.                                                */
-/*===========================================================================*/
-void FlashStateMachine(uint8_t data)
+
+/**
+ * @brief   Checks the signed image in the user flash and replies with the
+ *          result and the cycles of the signature check.
+ */
+static void VerifyReply(void)
 {
-    if ((data < 32 && data != '\n') || data > 126)
-        return; /* Not ASCII data */
+    char reply[FLASH_REPLY_SIZE];
+    image_status_t status;
+    rtcnt_t cycles;
+    int n;
+
+    (void)FlashPipeline_Wait(TIME_INFINITE);
+    status = ImageVerify_Check(&cycles);
+
+    if (status == IMAGE_VALID)
+        n = chsnprintf(reply, sizeof(reply), "Image valid, %u cycles\n",
+                       cycles);
+    else if (status == IMAGE_BAD_SIGNATURE)
+        n = chsnprintf(reply, sizeof(reply), "Bad signature, %u cycles!\n",
+                       cycles);
+    else if (status == IMAGE_BAD_DIGEST)
+        n = chsnprintf(reply, sizeof(reply), "Bad image digest!\n");
+    else if (status == IMAGE_BAD_SIZE)
+        n = chsnprintf(reply, sizeof(reply), "Bad image size!\n");
+    else if (status == IMAGE_NO_KEY)
+        n = chsnprintf(reply, sizeof(reply), "No image key!\n");
+    else
+        n = chsnprintf(reply, sizeof(reply), "No image header!\n");
+
+    USBSendData((uint8_t *)reply, n, TIME_INFINITE);
+}
+
+/**
+ * @brief   Queues the open page for programming. The job starts at the
+ *          first word written in the page.
+ *
+ * @return  HAL_FAILED if the flash pipeline refused the job.
+ */
+static bool HexPageFlush(void)
+{
+    flash_job_t *job = hex_page;
+    uint32_t first;
+
+    if (job == NULL)
+        return HAL_SUCCESS;
+
+    hex_page = NULL;
+    first = hex_page_first & ~3;
+
+    if (first > 0)
+        memmove(job->data, (uint8_t *)job->data + first, hex_page_end - first);
+
+    job->address = hex_page_base + first;
+    job->size = hex_page_end - first;
+
+    if (FlashPipeline_Submit(job) != HAL_SUCCESS)
+        return HAL_FAILED;
+
+    hex_submitted = true;
+    return HAL_SUCCESS;
+}
+
+/**
+ * @brief   Erases the first sector of the user flash so a partly written
+ *          or corrupt image has no header and is not started. The writer
+ *          skips all jobs of a session after an error, so the erase runs
+ *          in a new session of the console.
+ */
+static void FlashInvalidate(void)
+{
+    flash_job_t *job;
+
+    (void)FlashPipeline_Wait(TIME_INFINITE);
+    FlashPipeline_End(FLASH_OWNER_CONSOLE);
+
+    if (FlashPipeline_Begin(FLASH_OWNER_CONSOLE,
+                            FLASH_USER_BASE,
+                            FLASH_END_ADDRESS) != HAL_SUCCESS)
+        return;
+
+    job = FlashPipeline_GetJob(TIME_INFINITE);
+    job->type = FLASH_JOB_ERASE;
+    job->address = FLASH_USER_BASE;
+    job->size = 1;
+
+    if (FlashPipeline_Submit(job) == HAL_SUCCESS)
+        (void)FlashPipeline_Wait(TIME_INFINITE);
+}
+
+/**
+ * @brief   Discards received data until the line is idle for
+ *          FLASH_BINARY_DRAIN_MS.
+ */
+static void FlashDrain(void)
+{
+    while (USBReadData(bin_discard, sizeof(bin_discard),
+                       MS2ST(FLASH_BINARY_DRAIN_MS)) > 0)
+        ;
+}
+
+/**
+ * @brief   Collects the data of a record in aligned pages, a page is queued
+ *          when a record falls in another page. Bytes not written in a
+ *          page are left erased. After an error the rest of the file is
+ *          only checked.
+ *
+ * @param[in] address   Address of the data.
+ * @param[in] data      Pointer to the data.
+ * @param[in] size      Size of the data.
+ * @return              False if the data is outside the user flash or the
+ *                      flash failed.
+ */
+static bool HexFlashWrite(uint32_t address, const uint8_t *data, uint32_t size)
+{
+    FLASH_Status status;
+    uint32_t base, offset, n;
+
+    if ((hex_error != HEX_CONTINUE) || (hex_busy == true))
+        return true;
 
-    if (state == FLASH_GET_CMD)
+    if ((address < FLASH_USER_BASE) || (address > FLASH_END_ADDRESS) ||
+        (size > (FLASH_END_ADDRESS - address)))
+        return false;
+
+    while (size > 0)
+    {
+        base = address & ~(FLASH_PIPELINE_BLOCK_SIZE - 1);
+        offset = address - base;
+        n = FLASH_PIPELINE_BLOCK_SIZE - offset;
+
+        if (n > size)
+            n = size;
+
+        if ((hex_page != NULL) && (hex_page_base != base) &&
+            (HexPageFlush() != HAL_SUCCESS))
+            return false;
+
+        if (hex_page == NULL)
+        {
+            osalSysLock();
+            status = FlashPipeline_GetStatusI();
+            osalSysUnlock();
+
+            if (status != FLASH_COMPLETE)
+                return false;
+
+            hex_page = FlashPipeline_GetJob(TIME_INFINITE);
+            hex_page->type = FLASH_JOB_PROGRAM;
+            memset(hex_page->data, 0xff, FLASH_PIPELINE_BLOCK_SIZE);
+
+            hex_page_base = base;
+            hex_page_first = offset;
+            hex_page_end = offset + n;
+        }
+
+        if (offset < hex_page_first)
+            hex_page_first = offset;
+
+        if ((offset + n) > hex_page_end)
+            hex_page_end = offset + n;
+
+        memcpy((uint8_t *)hex_page->data + offset, data, n);
+
+        address += n;
+        data += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+/**
+ * @brief   Starts receiving a HEX or S-record file, the user flash is
+ *          erased as the pages arrive.
+ */
+static void HexBegin(void)
+{
+    HexDecoder_Init(&hex_decoder, HexFlashWrite);
+
+    hex_error = HEX_CONTINUE;
+    hex_submitted = false;
+    hex_busy = (FlashPipeline_Begin(FLASH_OWNER_CONSOLE,
+                                    FLASH_USER_BASE,
+                                    FLASH_END_ADDRESS) != HAL_SUCCESS);
+    hex_start = chVTGetSystemTime();
+}
+
+/**
+ * @brief   Finishes a HEX or S-record file, waits for the flash and
+ *          replies with the result. The header is erased if pages of a
+ *          file that is not complete and valid were programmed.
+ *
+ * @param[in] status    How the file ended, HEX_END or HEX_NOT_RECORD.
+ */
+static void HexEnd(hex_status_t status)
+{
+    char reply[FLASH_REPLY_SIZE];
+    FLASH_Status flash;
+    bool written = false;
+    int n;
+
+    if ((hex_error != HEX_CONTINUE) && (hex_page != NULL))
+    {
+        /* A file with errors leaves the open page unwritten */
+        osalSysLock();
+        FlashPipeline_ReleaseI(hex_page);
+        osalSysUnlock();
+        hex_page = NULL;
+    }
+    else if ((HexPageFlush() != HAL_SUCCESS) && (hex_error == HEX_CONTINUE))
     {
-        state = ParseCommand(data);
+        hex_error = HEX_ERROR_WRITE;
+        hex_error_line = hex_decoder.lines;
     }
-    else if (state == FLASH_GET_DATA)
+
+    flash = FlashPipeline_Wait(TIME_INFINITE);
+
+    if ((hex_busy == false) && (hex_submitted == true) &&
+        ((hex_error != HEX_CONTINUE) || (flash != FLASH_COMPLETE) ||
+         (status != HEX_END)))
+        FlashInvalidate();
+
+    if (hex_busy == true)
+        n = chsnprintf(reply, sizeof(reply), "Flash busy!\n");
+    else if (hex_error == HEX_ERROR_CHECKSUM)
+        n = chsnprintf(reply, sizeof(reply), "Checksum error on line %u!\n",
+                       hex_error_line);
+    else if (hex_error == HEX_ERROR_FORMAT)
+        n = chsnprintf(reply, sizeof(reply), "Format error on line %u!\n",
+                       hex_error_line);
+    else if (hex_error == HEX_ERROR_WRITE)
+        n = chsnprintf(reply, sizeof(reply), "Write error on line %u!\n",
+                       hex_error_line);
+    else if (flash != FLASH_COMPLETE)
+        n = chsnprintf(reply, sizeof(reply), "Flash error %u!\n", flash);
+    else if (status != HEX_END)
+        n = chsnprintf(reply, sizeof(reply), "Missing end record!\n");
+    else
     {
+        n = chsnprintf(reply, sizeof(reply), "Written %u bytes in %u ms\n",
+                       hex_decoder.bytes,
+                       ST2MS(chVTTimeElapsedSinceX(hex_start)));
+        written = true;
+    }
+
+    USBSendData((uint8_t *)reply, n, TIME_INFINITE);
+
+    if (written == true)
+        VerifyReply();
+
+    FlashPipeline_End(FLASH_OWNER_CONSOLE);
+}
+
+/**
+ * @brief   Feeds received text to the HEX decoder. The file ends with its
+ *          end record, or at the first line that is not a record.
+ *
+ * @param[in] data      Pointer to the text.
+ * @param[in] size      Size of the text.
+ * @return              Number of bytes consumed.
+ */
+static size_t FlashGetData(const uint8_t *data, size_t size)
+{
+    hex_status_t status;
+    size_t used;
 
+    status = HexDecoder_Input(&hex_decoder, data, size, &used);
+
+    if ((status == HEX_END) || (status == HEX_NOT_RECORD))
+    {
+        hex_crlf = (status == HEX_END) && (data[used - 1] == '\r');
+        HexEnd(status);
+        state = FLASH_GET_CMD;
     }
-    else if (state == FLASH_EXIT)
+    else if ((status != HEX_CONTINUE) && (hex_error == HEX_CONTINUE))
     {
+        /* The rest of the file is checked but not written */
+        hex_error = status;
+        hex_error_line = hex_decoder.lines;
+    }
 
+    return used;
+}
+
+/**
+ * @brief   Starts the raw binary phase of a WRITE.
+ *
+ * @param[in] size      Number of data bytes, a CRC32 trailer follows.
+ * @return              The next state, FLASH_GET_CMD if the size does not
+ *                      fit in the user flash.
+ */
+static flash_state_t BinaryBegin(int32_t size)
+{
+    /* The host streams the data without waiting for the reply */
+    if ((size <= 0) || ((uint32_t)size > (FLASH_END_ADDRESS - FLASH_USER_BASE)))
+    {
+        USBSendData((uint8_t *)"Invalid size!\n", 14, TIME_INFINITE);
+        bin_drain = true;
+        return FLASH_GET_CMD;
+    }
+
+    if (FlashPipeline_Begin(FLASH_OWNER_CONSOLE,
+                            FLASH_USER_BASE,
+                            FLASH_END_ADDRESS) != HAL_SUCCESS)
+    {
+        USBSendData((uint8_t *)"Flash busy!\n", 12, TIME_INFINITE);
+        bin_drain = true;
+        return FLASH_GET_CMD;
+    }
+
+    bin_job = NULL;
+    bin_address = FLASH_USER_BASE;
+    bin_fill = 0;
+    bin_remaining = size;
+    bin_crc = 0;
+    bin_trailer_pos = 0;
+    bin_error = false;
+    hex_start = chVTGetSystemTime();
+
+    USBSendData((uint8_t *)"Write!\n", 7, TIME_INFINITE);
+
+    return FLASH_GET_BINARY;
+}
+
+/**
+ * @brief   Gets where the next bytes of a WRITE go. The data goes straight
+ *          into a flash block, the trailer into its own buffer.
+ *
+ * @param[out] size     Number of bytes wanted.
+ * @return              Pointer to the buffer.
+ */
+static uint8_t *BinaryBuffer(uint32_t *size)
+{
+    uint32_t n;
+
+    if (bin_remaining == 0)
+    {
+        *size = FLASH_BINARY_TRAILER_SIZE - bin_trailer_pos;
+        return &bin_trailer[bin_trailer_pos];
+    }
+
+    if (bin_error == true)
+    {
+        n = sizeof(bin_discard);
+        *size = (bin_remaining < n) ? bin_remaining : n;
+        return bin_discard;
+    }
+
+    if (bin_job == NULL)
+    {
+        bin_job = FlashPipeline_GetJob(TIME_INFINITE);
+        bin_job->type = FLASH_JOB_PROGRAM;
+        bin_fill = 0;
+    }
+
+    n = FLASH_PIPELINE_BLOCK_SIZE - bin_fill;
+    *size = (bin_remaining < n) ? bin_remaining : n;
+
+    return (uint8_t *)bin_job->data + bin_fill;
+}
+
+/**
+ * @brief   Finishes a WRITE, waits for the flash and checks the CRC32. The
+ *          header is erased after a flash error or if the CRC32 does not
+ *          match.
+ */
+static void BinaryEnd(void)
+{
+    char reply[FLASH_REPLY_SIZE];
+    FLASH_Status flash;
+    uint32_t crc;
+    bool written = false;
+    int n;
+
+    flash = FlashPipeline_Wait(TIME_INFINITE);
+    crc = (uint32_t)bin_trailer[0]         | ((uint32_t)bin_trailer[1] << 8) |
+          ((uint32_t)bin_trailer[2] << 16) | ((uint32_t)bin_trailer[3] << 24);
+
+    if ((bin_error == true) || (flash != FLASH_COMPLETE))
+    {
+        FlashInvalidate();
+        n = chsnprintf(reply, sizeof(reply), "Flash error %u at 0x%08x!\n",
+                       flash, bin_address);
+    }
+    else if (crc != bin_crc)
+    {
+        FlashInvalidate();
+        n = chsnprintf(reply, sizeof(reply), "CRC error, got 0x%08x!\n",
+                       bin_crc);
+    }
+    else
+    {
+        n = chsnprintf(reply, sizeof(reply), "Written %u bytes in %u ms\n",
+                       bin_address - FLASH_USER_BASE,
+                       ST2MS(chVTTimeElapsedSinceX(hex_start)));
+        written = true;
+    }
+
+    USBSendData((uint8_t *)reply, n, TIME_INFINITE);
+    state = FLASH_GET_CMD;
+
+    if (written == true)
+        VerifyReply();
+
+    FlashPipeline_End(FLASH_OWNER_CONSOLE);
+}
+
+/**
+ * @brief   Accounts for bytes placed in the buffer from BinaryBuffer(). A
+ *          block is queued when full, the WRITE ends with the trailer.
+ *
+ * @param[in] data      Pointer to the bytes.
+ * @param[in] size      Number of bytes.
+ */
+static void BinaryCommit(const uint8_t *data, uint32_t size)
+{
+    if (bin_remaining == 0)
+    {
+        bin_trailer_pos += size;
+
+        if (bin_trailer_pos == FLASH_BINARY_TRAILER_SIZE)
+            BinaryEnd();
+
+        return;
+    }
+
+    bin_crc = CRC32_chunk(data, size, bin_crc);
+    bin_remaining -= size;
+
+    if (bin_error == true)
+        return;
+
+    bin_fill += size;
+
+    if ((bin_fill == FLASH_PIPELINE_BLOCK_SIZE) || (bin_remaining == 0))
+    {
+        bin_job->address = bin_address;
+        bin_job->size = bin_fill;
+
+        if (FlashPipeline_Submit(bin_job) != HAL_SUCCESS)
+            bin_error = true;
+        else
+            bin_address += bin_fill;
+
+        bin_job = NULL;
+    }
+}
+
+/**
+ * @brief   Copies received data into a WRITE.
+ *
+ * @param[in] data      Pointer to the data.
+ * @param[in] size      Size of the data.
+ * @return              Number of bytes consumed.
+ */
+static size_t FlashGetBinary(const uint8_t *data, size_t size)
+{
+    uint32_t n, used = 0;
+    uint8_t *buffer;
+
+    while ((used < size) && (state == FLASH_GET_BINARY))
+    {
+        buffer = BinaryBuffer(&n);
+
+        if (n > (size - used))
+            n = size - used;
+
+        memcpy(buffer, &data[used], n);
+        BinaryCommit(buffer, n);
+        used += n;
+    }
+
+    return used;
+}
+
+/**
+ * @brief   Reads the rest of a WRITE from the USB straight into the flash
+ *          blocks. Aborts if no data arrives for FLASH_BINARY_TIMEOUT_MS,
+ *          the partly written image is invalidated and late data of the
+ *          WRITE is discarded until the line is idle, so it is not parsed
+ *          as commands.
+ */
+static void FlashReadBinary(void)
+{
+    uint32_t n;
+    uint8_t *buffer;
+
+    while (state == FLASH_GET_BINARY)
+    {
+        buffer = BinaryBuffer(&n);
+        n = USBReadData(buffer, n, MS2ST(FLASH_BINARY_TIMEOUT_MS));
+
+        if (n == 0)
+        {
+            if (bin_job != NULL)
+            {
+                osalSysLock();
+                FlashPipeline_ReleaseI(bin_job);
+                osalSysUnlock();
+                bin_job = NULL;
+            }
+
+            FlashInvalidate();
+            FlashPipeline_End(FLASH_OWNER_CONSOLE);
+            USBSendData((uint8_t *)"Write timeout!\n", 15, TIME_INFINITE);
+            state = FLASH_GET_CMD;
+            FlashDrain();
+        }
+        else
+        {
+            BinaryCommit(buffer, n);
+        }
+    }
+}
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Runs received data through the console. A line starting with
+ *          ':' or 'S' starts an Intel HEX or S-record file which is
+ *          written to the user flash. "WRITE <n>" is followed by n bytes
+ *          of raw binary data for the user flash and their CRC32, little
+ *          endian, which are read without filtering.
+ *
+ * @param[in] data      Pointer to the received data.
+ * @param[in] size      Size of the received data.
+ */
+void FlashStateMachine(const uint8_t *data, size_t size)
+{
+    size_t used;
+
+    while (size > 0)
+    {
+        used = 1;
+
+        if (state == FLASH_GET_DATA)
+        {
+            used = FlashGetData(data, size);
+        }
+        else if (state == FLASH_GET_BINARY)
+        {
+            used = FlashGetBinary(data, size);
+        }
+        else if (state == FLASH_GET_CMD)
+        {
+            if (hex_crlf == true)
+            {
+                /* Rest of the end record line */
+                hex_crlf = false;
+                used = (data[0] == '\n') ? 1 : 0;
+            }
+            else if ((pos == 0) && (HexDecoder_IsRecordStart(data[0]) == true))
+            {
+                HexBegin();
+                state = FLASH_GET_DATA;
+                used = 0;
+            }
+            else if ((data[0] >= 32 || data[0] == '\n') && data[0] <= 126)
+            {
+                state = ParseCommand(data[0]);
+
+                /* The rest is data of a refused WRITE */
+                if (bin_drain == true)
+                    used = size;
+            }
+        }
+
+        data += used;
+        size -= used;
+    }
+
+    /* The rest of a WRITE is read in bulk */
+    if (state == FLASH_GET_BINARY)
+        FlashReadBinary();
+
+    if (bin_drain == true)
+    {
+        bin_drain = false;
+        FlashDrain();
     }
 }
 
 flash_state_t ParseCommand(uint8_t data)
 {
-    int32_t size;
+    flash_state_t next = FLASH_GET_CMD;
 
     if (pos < FLASH_CMD_BUFFER_SIZE && data != '\n')
     {
@@ -127,8 +789,11 @@ flash_state_t ParseCommand(uint8_t data)
         }
         else if (strcmp_ms("WRITE", command_buffer, 5))
         {
-            size = getNum(&command_buffer[5], pos - 5);
-            chprintf(USBStream(), "WRITE: %i\n", size);
+            next = BinaryBegin(getNum(&command_buffer[5], pos - 5));
+        }
+        else if (strcmp_ms("VERIFY", command_buffer, 6))
+        {
+            VerifyReply();
         }
         else if (strcmp_ms("ERASE", command_buffer, 5))
         {
@@ -156,7 +821,7 @@ flash_state_t ParseCommand(uint8_t data)
         USBSendData((uint8_t *)"Unknown error!\n", 15, TIME_INFINITE);
     }
 
-    return FLASH_GET_CMD;
+    return next;
 
 }
 
@@ -0,0 +1,359 @@
+/* *
+ *
+ * Incremental Intel HEX and Motorola S-record decoder.
+ * Text is fed in blocks of any size, the hex digits are decoded and the
+ * line checksum summed in the same pass. The data of a record is passed on
+ * when its line ends with a valid checksum.
+ *
+ * Intel HEX:   :CCAAAATT<data>SS      SS = two's complement of the sum
+ * S-record:    StCC<address><data>SS  SS = one's complement of the sum,
+ *                                     CC counts address, data and SS
+ *
+ * Has no dependencies on the OS so that it can be tested on a host.
+ *
+ * */
+
+#include "hex_decoder.h"
+
+/*===========================================================================*/
+/* Module local definitions.                                                 */
+/*===========================================================================*/
+
+/**
+ * @brief   Parser states.
+ */
+#define HEX_STATE_LINE                (0)
+#define HEX_STATE_SREC_TYPE           (1)
+#define HEX_STATE_DIGITS              (2)
+#define HEX_STATE_SKIP                (3)
+
+/**
+ * @brief   S-record type of Intel HEX lines.
+ */
+#define HEX_INTEL                     (0xff)
+
+/**
+ * @brief   Intel HEX record types.
+ */
+#define INTEL_DATA                    (0x00)
+#define INTEL_END_OF_FILE             (0x01)
+#define INTEL_EXTENDED_SEGMENT        (0x02)
+#define INTEL_START_SEGMENT           (0x03)
+#define INTEL_EXTENDED_LINEAR         (0x04)
+#define INTEL_START_LINEAR            (0x05)
+
+/*===========================================================================*/
+/* Module exported variables.                                                */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module local variables and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Size of the address of each S-record type, 0 for invalid types.
+ */
+static const uint8_t srec_address_size[10] = {2, 2, 3, 4, 0, 2, 3, 4, 3, 2};
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+/**
+ * @brief               Converts a hex digit.
+ *
+ * @param[in] c         The character.
+ * @return              The value, larger than 15 if not a hex digit.
+ */
+static inline uint8_t HexDigit(uint8_t c)
+{
+    if ((c >= '0') && (c <= '9'))
+        return c - '0';
+
+    c |= 0x20;
+
+    if ((c >= 'a') && (c <= 'f'))
+        return c - 'a' + 10;
+
+    return 0xff;
+}
+
+/**
+ * @brief               Passes the data of a record to the write callback.
+ *
+ * @param[in] dec       Pointer to the decoder.
+ * @param[in] address   Address of the data.
+ * @param[in] data      Pointer to the data.
+ * @param[in] size      Size of the data.
+ * @return              HEX_ERROR_WRITE if refused, else HEX_CONTINUE.
+ */
+static hex_status_t HexWrite(hex_decoder_t *dec,
+                             uint32_t address,
+                             const uint8_t *data,
+                             uint32_t size)
+{
+    if (size == 0)
+        return HEX_CONTINUE;
+
+    if (dec->write(address, data, size) == false)
+        return HEX_ERROR_WRITE;
+
+    dec->bytes += size;
+
+    return HEX_CONTINUE;
+}
+
+/**
+ * @brief               Handles a complete Intel HEX line.
+ *
+ * @param[in] dec       Pointer to the decoder.
+ * @param[in] length    Number of bytes in the line.
+ * @return              The status of the line.
+ */
+static hex_status_t HexIntelLine(hex_decoder_t *dec, uint32_t length)
+{
+    const uint8_t *r = dec->record;
+    uint32_t count = r[0];
+
+    if ((length < 5) || (length != count + 5))
+        return HEX_ERROR_FORMAT;
+
+    /* The checksum makes the sum zero */
+    if (dec->checksum != 0)
+        return HEX_ERROR_CHECKSUM;
+
+    switch (r[3])
+    {
+        case INTEL_DATA:
+            return HexWrite(dec,
+                            dec->base + (((uint32_t)r[1] << 8) | r[2]),
+                            &r[4],
+                            count);
+
+        case INTEL_END_OF_FILE:
+            return HEX_END;
+
+        case INTEL_EXTENDED_SEGMENT:
+        case INTEL_EXTENDED_LINEAR:
+            if (count != 2)
+                return HEX_ERROR_FORMAT;
+
+            dec->base = ((uint32_t)r[4] << 8) | r[5];
+            dec->base <<= (r[3] == INTEL_EXTENDED_LINEAR) ? 16 : 4;
+            return HEX_CONTINUE;
+
+        case INTEL_START_SEGMENT:
+        case INTEL_START_LINEAR:
+            return HEX_CONTINUE;
+
+        default:
+            return HEX_ERROR_FORMAT;
+    }
+}
+
+/**
+ * @brief               Handles a complete S-record line.
+ *
+ * @param[in] dec       Pointer to the decoder.
+ * @param[in] length    Number of bytes in the line.
+ * @return              The status of the line.
+ */
+static hex_status_t HexSrecLine(hex_decoder_t *dec, uint32_t length)
+{
+    const uint8_t *r = dec->record;
+    uint32_t i, address = 0, count = r[0];
+    uint32_t address_size = srec_address_size[dec->srec_type];
+
+    if ((address_size == 0) ||
+        (length != count + 1) ||
+        (count < address_size + 1))
+        return HEX_ERROR_FORMAT;
+
+    /* The checksum makes the sum 0xff */
+    if (dec->checksum != 0xff)
+        return HEX_ERROR_CHECKSUM;
+
+    for (i = 1; i <= address_size; i++)
+        address = (address << 8) | r[i];
+
+    switch (dec->srec_type)
+    {
+        case 1:
+        case 2:
+        case 3:
+            return HexWrite(dec,
+                            address,
+                            &r[1 + address_size],
+                            count - address_size - 1);
+
+        case 7:
+        case 8:
+        case 9:
+            return HEX_END;
+
+        default:
+            /* Header and record counts */
+            return HEX_CONTINUE;
+    }
+}
+
+/**
+ * @brief               Handles a complete line.
+ *
+ * @param[in] dec       Pointer to the decoder.
+ * @return              The status of the line.
+ */
+static hex_status_t HexLine(hex_decoder_t *dec)
+{
+    if ((dec->digits == 0) || ((dec->digits & 1) != 0))
+        return HEX_ERROR_FORMAT;
+
+    if (dec->srec_type == HEX_INTEL)
+        return HexIntelLine(dec, dec->digits / 2);
+    else
+        return HexSrecLine(dec, dec->digits / 2);
+}
+
+/**
+ * @brief               Starts a new line.
+ *
+ * @param[in] dec       Pointer to the decoder.
+ * @param[in] type      S-record type, HEX_INTEL for Intel HEX.
+ */
+static void HexStartLine(hex_decoder_t *dec, uint8_t type)
+{
+    dec->srec_type = type;
+    dec->digits = 0;
+    dec->checksum = 0;
+    dec->state = HEX_STATE_DIGITS;
+}
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief               Initializes a decoder.
+ *
+ * @param[out] dec      Pointer to the decoder.
+ * @param[in] write     Called with the data of each valid record.
+ */
+void HexDecoder_Init(hex_decoder_t *dec,
+                     bool (*write)(uint32_t address,
+                                   const uint8_t *data,
+                                   uint32_t size))
+{
+    dec->write = write;
+    dec->state = HEX_STATE_LINE;
+    dec->base = 0;
+    dec->lines = 0;
+    dec->bytes = 0;
+}
+
+/**
+ * @brief               Checks if a character starts a record.
+ *
+ * @param[in] data      The character.
+ * @return              True for ':' and 'S'.
+ */
+bool HexDecoder_IsRecordStart(uint8_t data)
+{
+    return (data == ':') || (data == 'S');
+}
+
+/**
+ * @brief               Decodes a block of text. Stops after the end of file
+ *                      record, at a line that is not a record, or after an
+ *                      error. After a format error in a line the rest of
+ *                      the line is skipped by the next call.
+ *
+ * @param[in] dec       Pointer to the decoder.
+ * @param[in] data      Pointer to the text.
+ * @param[in] size      Size of the text.
+ * @param[out] used     Number of characters consumed.
+ * @return              The status, see hex_status_t.
+ */
+hex_status_t HexDecoder_Input(hex_decoder_t *dec,
+                              const uint8_t *data,
+                              size_t size,
+                              size_t *used)
+{
+    hex_status_t status = HEX_CONTINUE;
+    size_t i;
+    uint8_t c, nibble;
+
+    for (i = 0; (i < size) && (status == HEX_CONTINUE); i++)
+    {
+        c = data[i];
+
+        switch (dec->state)
+        {
+            case HEX_STATE_LINE:
+                if (HexDecoder_IsRecordStart(c) == true)
+                    dec->lines++;
+
+                if (c == ':')
+                    HexStartLine(dec, HEX_INTEL);
+                else if (c == 'S')
+                    dec->state = HEX_STATE_SREC_TYPE;
+                else if ((c != '\r') && (c != '\n') && (c != ' '))
+                {
+                    *used = i;
+                    return HEX_NOT_RECORD;
+                }
+                break;
+
+            case HEX_STATE_SREC_TYPE:
+                if ((c >= '0') && (c <= '9'))
+                    HexStartLine(dec, c - '0');
+                else
+                {
+                    dec->state = HEX_STATE_SKIP;
+                    status = HEX_ERROR_FORMAT;
+                }
+                break;
+
+            case HEX_STATE_DIGITS:
+                nibble = HexDigit(c);
+
+                if (nibble < 16)
+                {
+                    if (dec->digits >= (2 * HEX_MAX_RECORD_SIZE))
+                    {
+                        dec->state = HEX_STATE_SKIP;
+                        status = HEX_ERROR_FORMAT;
+                        break;
+                    }
+
+                    dec->value = (dec->value << 4) | nibble;
+                    dec->digits++;
+
+                    if ((dec->digits & 1) == 0)
+                    {
+                        dec->record[dec->digits / 2 - 1] = dec->value;
+                        dec->checksum += dec->value;
+                    }
+                }
+                else if ((c == '\r') || (c == '\n'))
+                {
+                    dec->state = HEX_STATE_LINE;
+                    status = HexLine(dec);
+                }
+                else
+                {
+                    dec->state = HEX_STATE_SKIP;
+                    status = HEX_ERROR_FORMAT;
+                }
+                break;
+
+            default:
+                if ((c == '\r') || (c == '\n'))
+                    dec->state = HEX_STATE_LINE;
+                break;
+        }
+    }
+
+    *used = i;
+
+    return status;
+}
@@ -0,0 +1,114 @@
+/* *
+ *
+ * Cache of fully encoded response frames.
+ * Responses with constant content are encoded once per framing, sending
+ * one is then a copy of the frame into the transmit lane. Content that can
+ * change is tagged with a revision and encoded again when it changes.
+ *
+ * */
+
+#include "ch.h"
+#include "hal.h"
+#include "response_cache.h"
+
+/*===========================================================================*/
+/* Module local definitions.                                                 */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module exported variables.                                                */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module local variables and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Serializes the encoding and copying of cached frames, the
+ *          generators run on every port's threads.
+ */
+static BSEMAPHORE_DECL(cache_lock, false);
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+/**
+ * @brief               Encodes a response into the storage of a cached
+ *                      frame, using a circular buffer over the storage.
+ *
+ * @param[in] cache     Pointer to the response cache.
+ * @param[in] framing   Framing to encode in.
+ * @param[in] revision  Revision of the content.
+ * @param[in] encoder   Generator encoding the response.
+ */
+static void EncodeFrame(response_cache_t *cache,
+                        Serial_Framing framing,
+                        uint32_t revision,
+                        generator_t encoder)
+{
+    cached_frame_t *cached = &cache->frames[framing];
+    circular_buffer_t scratch;
+
+    /* One byte more than the capacity so the frame never wraps */
+    CircularBuffer_Init(&scratch, cached->frame, cache->capacity + 1);
+    scratch.framing = framing;
+
+    cached->fits = (encoder(&scratch) == HAL_SUCCESS);
+    cached->length = (uint16_t)CircularBuffer_Size(&scratch);
+    cached->revision = revision;
+    cached->valid = true;
+}
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief               Writes a cached response to a circular buffer in
+ *                      the framing of the buffer. The response is encoded
+ *                      first if it is not cached for the revision. If the
+ *                      encoded frame is larger than the cache the encoder
+ *                      writes the response directly.
+ * @note                Read the revision before the content it covers, so
+ *                      a change while encoding is caught on the next call.
+ *
+ * @param[in] cache     Pointer to the response cache.
+ * @param[in] revision  Revision of the content of the response.
+ * @param[in] encoder   Generator encoding the response.
+ * @param[out] Cbuff    Pointer to the circular buffer to put the data in.
+ * @return              HAL_FAILED if the message didn't fit or HAL_SUCCESS
+ *                      if it did fit.
+ */
+bool ResponseCache_Write(response_cache_t *cache,
+                         uint32_t revision,
+                         generator_t encoder,
+                         circular_buffer_t *Cbuff)
+{
+    cached_frame_t *cached;
+    bool status;
+
+    if (Cbuff->framing >= RESPONSE_CACHE_FRAMINGS)
+        return encoder(Cbuff);
+
+    cached = &cache->frames[Cbuff->framing];
+
+    chBSemWait(&cache_lock);
+
+    if ((cached->valid == false) || (cached->revision != revision))
+        EncodeFrame(cache, (Serial_Framing)Cbuff->framing, revision, encoder);
+
+    if (cached->fits == false)
+        status = encoder(Cbuff);
+    else if (CircularBuffer_SpaceLeft(Cbuff) < cached->length)
+        status = HAL_FAILED;
+    else
+    {
+        CircularBuffer_WriteChunk(Cbuff, cached->frame, cached->length);
+        status = HAL_SUCCESS;
+    }
+
+    chBSemSignal(&cache_lock);
+
+    return status;
+}
@@ -0,0 +1,86 @@
+/* *
+ *
+ * Link statistics of the serial ports.
+ * Latencies are measured with the realtime counter (DWT cycle counter) and
+ * kept as log2 histograms.
+ *
+ * */
+
+#include "ch.h"
+#include "hal.h"
+#include "serial_statistics.h"
+
+/*===========================================================================*/
+/* Module local definitions.                                                 */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module exported variables.                                                */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module local variables and types.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief               Clears a statistics block.
+ *
+ * @param[out] stats    Pointer to the statistics block.
+ */
+void SerialStatistics_Init(serial_statistics_t *stats)
+{
+    uint32_t i;
+    uint8_t *p = (uint8_t *)stats;
+
+    for (i = 0; i < sizeof(serial_statistics_t); i++)
+        p[i] = 0;
+
+    stats->histogram_shift = SERIAL_STATS_HISTOGRAM_SHIFT;
+    stats->histogram_bins = SERIAL_STATS_HISTOGRAM_BINS;
+}
+
+/**
+ * @brief               Adds a latency to a log2 histogram, the bins
+ *                      saturate instead of wrapping.
+ *
+ * @param[in] histogram Pointer to the histogram bins.
+ * @param[in] cycles    Latency in realtime counter cycles.
+ */
+void SerialStatistics_AddSample(uint16_t *histogram, rtcnt_t cycles)
+{
+    uint32_t bin;
+
+    if (cycles < (1UL << (SERIAL_STATS_HISTOGRAM_SHIFT + 1)))
+        bin = 0;
+    else
+        bin = (31 - __builtin_clz(cycles)) - SERIAL_STATS_HISTOGRAM_SHIFT;
+
+    if (bin >= SERIAL_STATS_HISTOGRAM_BINS)
+        bin = SERIAL_STATS_HISTOGRAM_BINS - 1;
+
+    if (histogram[bin] < 0xffff)
+        histogram[bin]++;
+}
+
+/**
+ * @brief                   Updates a 16-bit high-water mark.
+ *
+ * @param[in] high_water    Pointer to the high-water mark.
+ * @param[in] value         Current value.
+ */
+void SerialStatistics_HighWater16(uint16_t *high_water, uint32_t value)
+{
+    if (value > 0xffff)
+        value = 0xffff;
+
+    if (value > *high_water)
+        *high_water = (uint16_t)value;
+}
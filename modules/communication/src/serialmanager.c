@@ -8,18 +8,34 @@
 #include "ch.h"
 #include "hal.h"
 #include "myusb.h"
+#include "usb_bulk.h"
+#include "mycan.h"
 #include "statemachine.h"
 #include "statemachine_generators.h"
+#include "statemachine_dispatcher.h"
 #include "crc.h"
 #include "serialmanager.h"
+#include "trace.h"
 
 /*===========================================================================*/
 /* Module local definitions.                                                 */
 /*===========================================================================*/
 
 #define START_TRANSMISSION_EVENT            EVENT_MASK(0)
+#define URGENT_TRANSMISSION_EVENT           EVENT_MASK(1)
+#define ANY_TRANSMISSION_EVENT              (START_TRANSMISSION_EVENT | \
+                                             URGENT_TRANSMISSION_EVENT)
 
-static bool USBTransmitCircularBuffer(circular_buffer_t *Cbuff);
+/**
+ * @brief   Number of frame boundaries remembered per bulk lane.
+ */
+#define SERIAL_BULK_FRAME_MARKS             16
+
+/**
+ * @brief   Stack sizes of the per port threads.
+ */
+#define SERIAL_MANAGER_STACK_SIZE           256
+#define SERIAL_DATA_PUMP_STACK_SIZE         256
 
 /*===========================================================================*/
 /* Module exported variables.                                                */
@@ -30,185 +46,531 @@ static bool USBTransmitCircularBuffer(circular_buffer_t *Cbuff);
 /*===========================================================================*/
 
 /**
- * @brief   Holder of the necessary information for the data pump threads.
+ * @brief   The transmit lanes of a port. The control lane is always served
+ *          before the bulk lane, at frame boundaries.
  */
 typedef struct
 {
     /**
-     * @brief   Pointer to the USB data pump thread.
+     * @brief   Control lane (ACK, NextPackage, Ping, ...).
+     */
+    circular_buffer_t control;
+    /**
+     * @brief   Bulk lane (readback, debug, telemetry, ...).
+     */
+    circular_buffer_t bulk;
+    /**
+     * @brief   Head positions of the bulk lane recorded when frames were
+     *          queued, every head position is a frame boundary.
+     */
+    uint32_t bulk_marks[SERIAL_BULK_FRAME_MARKS];
+    /**
+     * @brief   Position of the next mark to write.
+     */
+    uint32_t mark_head;
+    /**
+     * @brief   Number of marks stored.
      */
-    thread_t *ptrUSBDataPump;
+    uint32_t mark_count;
     /**
-     * @brief   USB data pump circular transmit buffer.
+     * @brief   Realtime counter when the oldest waiting frame was queued.
      */
-    circular_buffer_t USBTransmitBuffer;
+    rtcnt_t queued_time;
     /**
-     * @brief   Pointer to the AUX1 data pump thread.
+     * @brief   True if frames are waiting for the data pump.
      */
-    thread_t *ptrAUX1DataPump;
+    bool queued;
+} Serial_TX_Lanes;
+
+/**
+ * @brief   Holder of the necessary information for one registered port.
+ */
+typedef struct
+{
     /**
-     * @brief   AUX1 data pump circular transmit buffer.
+     * @brief   Transport carrying the port, NULL if not registered.
      */
-    circular_buffer_t AUX1TransmitBuffer;
+    const serial_transport_t *transport;
     /**
-     * @brief   Pointer to the AUX2 data pump thread.
+     * @brief   Pointer to the data pump thread.
      */
-    thread_t *ptrAUX2DataPump;
+    thread_t *data_pump;
     /**
-     * @brief   AUX2 data pump circular transmit buffer.
+     * @brief   Data pump transmit lanes.
      */
-    circular_buffer_t AUX2TransmitBuffer;
+    Serial_TX_Lanes lanes;
     /**
-     * @brief   Pointer to the AUX3 data pump thread.
+     * @brief   Receive state machine of the port.
      */
-    thread_t *ptrAUX3DataPump;
+    parser_holder_t parser;
     /**
-     * @brief   AUX3 data pump circular transmit buffer.
+     * @brief   Link statistics of the port.
      */
-    circular_buffer_t AUX3TransmitBuffer;
+    serial_statistics_t stats;
     /**
-     * @brief   Pointer to the AUX4 data pump thread.
+     * @brief   Threads waiting for room in the transmit lanes.
      */
-    thread_t *ptrAUX4DataPump;
+    threads_queue_t tx_waiters;
     /**
-     * @brief   AUX4 data pump circular transmit buffer.
+     * @brief   Incremented every time the data pump frees space in a lane.
      */
-    circular_buffer_t AUX4TransmitBuffer;
-} Serial_Datapump_Holder;
-
-/* Instance of the data pump holder structure */
-Serial_Datapump_Holder data_pumps = {
-    .ptrUSBDataPump = NULL,
-    .ptrAUX1DataPump = NULL,
-    .ptrAUX2DataPump = NULL,
-    .ptrAUX3DataPump = NULL,
-    .ptrAUX4DataPump = NULL
-};
+    uint32_t tx_sequence;
+    /**
+     * @brief   Scatter-gather transmission waiting for the data pump, NULL
+     *          if none.
+     */
+    serial_scatter_t *scatter;
+    /**
+     * @brief   True if the host asked for dispatch credits in the ACKs.
+     */
+    bool flow_control;
+    /**
+     * @brief   Buffer for parsing received commands.
+     */
+    uint8_t rx_buffer[SERIAL_RECIEVE_BUFFER_SIZE];
+    /**
+     * @brief   Buffer for encoded frames in COBS framing.
+     */
+    uint8_t frame_buffer[SERIAL_COBS_BUFFER_SIZE];
+    /**
+     * @brief   Memory of the control lane.
+     */
+    uint8_t control_buffer[SERIAL_CONTROL_BUFFER_SIZE];
+    /**
+     * @brief   Memory of the bulk lane.
+     */
+    uint8_t bulk_buffer[SERIAL_TRANSMIT_BUFFER_SIZE];
+} Serial_Port_Holder;
+
+/**
+ * @brief   The transport registry, indexed directly by External_Port.
+ */
+CCM_MEMORY static Serial_Port_Holder serial_ports[SERIAL_NUM_PORTS];
 
 /*===================================================*/
 /* Working area for the data pump                    */
 /* and data decode threads.                          */
 /*===================================================*/
 
-THD_WORKING_AREA(waUSBSerialManagerTask, 128);
-THD_WORKING_AREA(waUSBDataPumpTask, 128);
+static THD_WORKING_AREA(waSerialManagerTask0, SERIAL_MANAGER_STACK_SIZE);
+static THD_WORKING_AREA(waSerialManagerTask1, SERIAL_MANAGER_STACK_SIZE);
+static THD_WORKING_AREA(waSerialManagerTask2, SERIAL_MANAGER_STACK_SIZE);
+static THD_WORKING_AREA(waSerialManagerTask3, SERIAL_MANAGER_STACK_SIZE);
+static THD_WORKING_AREA(waSerialManagerTask4, SERIAL_MANAGER_STACK_SIZE);
+static THD_WORKING_AREA(waSerialManagerTask5, SERIAL_MANAGER_STACK_SIZE);
+static THD_WORKING_AREA(waDataPumpTask0, SERIAL_DATA_PUMP_STACK_SIZE);
+static THD_WORKING_AREA(waDataPumpTask1, SERIAL_DATA_PUMP_STACK_SIZE);
+static THD_WORKING_AREA(waDataPumpTask2, SERIAL_DATA_PUMP_STACK_SIZE);
+static THD_WORKING_AREA(waDataPumpTask3, SERIAL_DATA_PUMP_STACK_SIZE);
+static THD_WORKING_AREA(waDataPumpTask4, SERIAL_DATA_PUMP_STACK_SIZE);
+static THD_WORKING_AREA(waDataPumpTask5, SERIAL_DATA_PUMP_STACK_SIZE);
+
+/**
+ * @brief   Working areas of the receive threads, indexed by External_Port.
+ */
+static void * const waSerialManagerTasks[SERIAL_NUM_PORTS] = {
+    waSerialManagerTask0,
+    waSerialManagerTask1,
+    waSerialManagerTask2,
+    waSerialManagerTask3,
+    waSerialManagerTask4,
+    waSerialManagerTask5
+};
+
+/**
+ * @brief   Working areas of the data pump threads, indexed by External_Port.
+ */
+static void * const waDataPumpTasks[SERIAL_NUM_PORTS] = {
+    waDataPumpTask0,
+    waDataPumpTask1,
+    waDataPumpTask2,
+    waDataPumpTask3,
+    waDataPumpTask4,
+    waDataPumpTask5
+};
 
 /*===========================================================================*/
 /* Module local functions.                                                   */
 /*===========================================================================*/
 
-/*===================================================*/
-/* USB Communication threads.                        */
-/*===================================================*/
+/**
+ * @brief                   Initializes the transmit lanes of a port.
+ *
+ * @param[out] lanes        Pointer to the transmit lanes.
+ * @param[in] control_buf   Memory for the control lane.
+ * @param[in] bulk_buf      Memory for the bulk lane.
+ */
+static void TxLanesInit(Serial_TX_Lanes *lanes,
+                        uint8_t *control_buf,
+                        uint8_t *bulk_buf)
+{
+    CircularBuffer_Init(&lanes->control,
+                        control_buf,
+                        SERIAL_CONTROL_BUFFER_SIZE);
+    CircularBuffer_InitMutex(&lanes->control);
+
+    CircularBuffer_Init(&lanes->bulk,
+                        bulk_buf,
+                        SERIAL_TRANSMIT_BUFFER_SIZE);
+    CircularBuffer_InitMutex(&lanes->bulk);
+
+    lanes->mark_head = 0;
+    lanes->mark_count = 0;
+    lanes->queued = false;
+}
 
 /**
- * @brief           The USB Serial Manager task will handle incoming
- *                  data and direct it for decode and processing.
- *             
- * @param[in] arg   Input argument (unused).
+ * @brief               Records the current head of the bulk lane as a frame
+ *                      boundary. If all marks are used the newest one is
+ *                      moved forward, which only makes the batch larger.
+ *
+ * @param[in] lanes     Pointer to the transmit lanes.
  */
-__attribute__((noreturn))
-static THD_FUNCTION(USBSerialManagerTask, arg)
+static void TxLanesMarkBulkFrame(Serial_TX_Lanes *lanes)
 {
-    (void)arg;
+    osalSysLock();
 
-    /* Name for debug */
-    chRegSetThreadName("USB Serial Manager");
+    if (lanes->mark_count < SERIAL_BULK_FRAME_MARKS)
+    {
+        lanes->bulk_marks[lanes->mark_head] = lanes->bulk.head;
+        lanes->mark_head = (lanes->mark_head + 1) % SERIAL_BULK_FRAME_MARKS;
+        lanes->mark_count++;
+    }
+    else
+        lanes->bulk_marks[(lanes->mark_head + SERIAL_BULK_FRAME_MARKS - 1) %
+                          SERIAL_BULK_FRAME_MARKS] = lanes->bulk.head;
+
+    osalSysUnlock();
+}
+
+/**
+ * @brief               Accounts for a frame queued in a lane and marks
+ *                      the frame boundary for the bulk lane.
+ *
+ * @param[in] holder    Port the frame was queued on.
+ * @param[in] lane      Lane the frame was queued in.
+ */
+static void TxLanesFrameQueued(Serial_Port_Holder *holder, TX_Lane lane)
+{
+    Serial_TX_Lanes *lanes = &holder->lanes;
 
-    /* Data structure for communication */
-    static parser_holder_t data_holder;
+    if (lane == LANE_BULK)
+        TxLanesMarkBulkFrame(lanes);
 
-    /* Buffer for parsing serial USB commands */
-    CCM_MEMORY static uint8_t USB_in_buffer[SERIAL_RECIEVE_BUFFER_SIZE]; 
+    holder->stats.tx_frames++;
+    SerialStatistics_HighWater16(&holder->stats.tx_control_high_water,
+                                 CircularBuffer_Size(&lanes->control));
+    SerialStatistics_HighWater16(&holder->stats.tx_bulk_high_water,
+                                 CircularBuffer_Size(&lanes->bulk));
 
-    /* Initialize data structure */
-    vInitStatemachineDataHolder(&data_holder, PORT_USB, USB_in_buffer);
+    /* The transmit wait is measured from the oldest waiting frame */
+    osalSysLock();
 
-    while(1)
-        vStatemachineDataEntry(USBReadByte(TIME_INFINITE),
-                               &data_holder);
+    if (lanes->queued == false)
+    {
+        lanes->queued_time = chSysGetRealtimeCounterX();
+        lanes->queued = true;
+    }
+
+    osalSysUnlock();
 }
 
 /**
- * @brief           Transmits the content of the USB circular buffer over USB.
- *  
- * @param[in] arg   Input argument (unused).
+ * @brief               Gets the next batch to transmit. All of the control
+ *                      lane is returned first, else the bulk lane up to the
+ *                      oldest frame mark.
+ *
+ * @param[in] lanes     Pointer to the transmit lanes.
+ * @param[out] Cbuff    Pointer to the lane to transmit from.
+ * @return              Number of bytes to transmit, 0 if both lanes are
+ *                      empty.
  */
-__attribute__((noreturn))
-static THD_FUNCTION(USBDataPumpTask, arg)
+static uint32_t TxLanesNext(Serial_TX_Lanes *lanes, circular_buffer_t **Cbuff)
 {
-    (void)arg;
+    uint32_t count, mark;
 
-    /* Name for debug */
-    chRegSetThreadName("USB Data Pump");
+    /* The control lane only holds complete frames */
+    count = CircularBuffer_Size(&lanes->control);
 
-    /* Buffer for transmitting serial USB commands */
-    CCM_MEMORY static uint8_t USB_out_buffer[SERIAL_TRANSMIT_BUFFER_SIZE]; 
+    if (count > 0)
+    {
+        *Cbuff = &lanes->control;
+        return count;
+    }
 
-    /* Initialize the USB transmit circular buffer */
-    CircularBuffer_Init(&data_pumps.USBTransmitBuffer,
-                        USB_out_buffer,
-                        SERIAL_TRANSMIT_BUFFER_SIZE);
-    CircularBuffer_InitMutex(&data_pumps.USBTransmitBuffer);
+    *Cbuff = &lanes->bulk;
 
-    /* Put the USB data pump thread into the list of available data pumps */
-    data_pumps.ptrUSBDataPump = chThdGetSelfX();
+    do
+    {
+        osalSysLock();
 
-    while(1)
+        if (lanes->mark_count > 0)
+        {
+            mark = lanes->bulk_marks[(lanes->mark_head +
+                                      SERIAL_BULK_FRAME_MARKS -
+                                      lanes->mark_count) %
+                                     SERIAL_BULK_FRAME_MARKS];
+            lanes->mark_count--;
+        }
+        else
+            mark = lanes->bulk.head;
+
+        osalSysUnlock();
+
+        count = (mark + lanes->bulk.size - lanes->bulk.tail) %
+                lanes->bulk.size;
+
+    } while ((count == 0) && (lanes->mark_count > 0));
+
+    return count;
+}
+
+/**
+ * @brief               Number of bytes waiting in all lanes of a port.
+ *
+ * @param[in] lanes     Pointer to the transmit lanes.
+ * @return              The number of bytes.
+ */
+static uint32_t TxLanesPending(Serial_TX_Lanes *lanes)
+{
+    return CircularBuffer_Size(&lanes->control) +
+           CircularBuffer_Size(&lanes->bulk);
+}
+
+/**
+ * @brief               Waits until the transmit lanes hold a full packet,
+ *                      an urgent frame is queued or the coalescing deadline
+ *                      expires, whichever comes first.
+ *
+ * @param[in] lanes     Transmit lanes being coalesced.
+ * @param[in] events    Events that woke up the data pump.
+ */
+static void WaitForCoalescing(Serial_TX_Lanes *lanes,
+                              uint32_t packet_size,
+                              eventmask_t events)
+{
+    systime_t start, now, window;
+
+    if (events & URGENT_TRANSMISSION_EVENT)
+        return;
+
+    start = chVTGetSystemTimeX();
+    window = US2ST(SERIAL_TX_COALESCE_DEADLINE_US);
+
+    while (TxLanesPending(lanes) < packet_size)
     {
-        /* Wait for a start transmission event */
-        chEvtWaitAny(START_TRANSMISSION_EVENT);
+        now = chVTGetSystemTimeX();
+
+        /* Deadline expired, flush what we have */
+        if ((systime_t)(now - start) >= window)
+            return;
+
+        events = chEvtWaitAnyTimeout(ANY_TRANSMISSION_EVENT,
+                                     window - (systime_t)(now - start));
 
-        /* We will only get here is a request to send data has been received */
-        USBTransmitCircularBuffer(&data_pumps.USBTransmitBuffer);
+        if ((events == 0) || (events & URGENT_TRANSMISSION_EVENT))
+            return;
     }
 }
 
 /**
- * @brief               Transmits a circular buffer over the USB interface.
- *             
+ * @brief               Transmits a part of a circular buffer over the
+ *                      transport of a port.
+ * @note                The data is dropped if the transport fails, so that
+ *                      the lane does not lock up.
+ *
+ * @param[in] holder    Port to transmit on.
  * @param[in] Cbuff     Circular buffer to transmit.
+ * @param[in] count     Number of bytes to transmit.
  * @return              Returns HAL_FAILED if it did not succeed to transmit
  *                      the buffer, else HAL_SUCCESS is returned.
  */
-static bool USBTransmitCircularBuffer(circular_buffer_t *Cbuff)
+static bool TransmitCircularBuffer(Serial_Port_Holder *holder,
+                                   circular_buffer_t *Cbuff,
+                                   uint32_t count)
 {
     uint8_t *read_pointer;
     uint32_t read_size;
 
-    if ((isUSBActive() == true) && (Cbuff != NULL))
+    if (holder->transport->poll() == false)
+        return HAL_FAILED;
+
+    /* Read out the number of bytes to send and the pointer to the
+       first byte */
+    read_pointer = CircularBuffer_GetReadPointer(Cbuff, &read_size);
+
+    while ((read_size > 0) && (count > 0))
     {
-        /* Read out the number of bytes to send and the pointer to the
-           first byte */
+        if (read_size > count)
+            read_size = count;
+
+        /* Send the contiguous part of the circular buffer */
+        if (holder->transport->send(read_pointer, read_size) != read_size)
+        {
+            CircularBuffer_IncrementTail(Cbuff, count);
+            holder->stats.tx_dropped += count;
+            return HAL_FAILED;
+        }
+
+        /* Increment the circular buffer tail */
+        CircularBuffer_IncrementTail(Cbuff, read_size);
+        holder->stats.tx_bytes += read_size;
+        count -= read_size;
+
+        /* Get the read size again in case we reached the end of the
+           buffer (to make sure the entire batch is sent) */
         read_pointer = CircularBuffer_GetReadPointer(Cbuff, &read_size);
+    }
+
+    /* Transfer finished successfully */
+    return HAL_SUCCESS;
+}
 
-        /* Claim the USB bus during the entire transfer */
-        USBClaim();
-        while (read_size > 0)
+/**
+ * @brief               Transmits the waiting scatter-gather transmission of
+ *                      a port, if any. The slot is freed before the
+ *                      transmission so the next one can be prepared while
+ *                      this one is sent.
+ * @note                The segments are dropped if the transport fails.
+ *
+ * @param[in] holder    Port to transmit on.
+ */
+static void TransmitScatter(Serial_Port_Holder *holder)
+{
+    serial_scatter_t *scatter;
+    size_t i, size = 0, sent = 0;
+
+    osalSysLock();
+    scatter = holder->scatter;
+    holder->scatter = NULL;
+    osalThreadDequeueAllI(&holder->tx_waiters, MSG_OK);
+    osalOsRescheduleS();
+    osalSysUnlock();
+
+    if (scatter == NULL)
+        return;
+
+    for (i = 0; i < scatter->count; i++)
+        size += scatter->segments[i].size;
+
+    if (holder->transport->poll() == true)
+        sent = holder->transport->send_segments(scatter->segments,
+                                                scatter->count);
+
+    if (sent == size)
+        holder->stats.tx_bytes += size;
+    else
+        holder->stats.tx_dropped += size;
+
+    osalSysLock();
+    scatter->status = (sent == size) ? HAL_SUCCESS : HAL_FAILED;
+    scatter->done = true;
+    holder->tx_sequence++;
+    osalThreadDequeueAllI(&holder->tx_waiters, MSG_OK);
+    osalOsRescheduleS();
+    osalSysUnlock();
+}
+
+/*===================================================*/
+/* Communication threads.                            */
+/*===================================================*/
+
+/**
+ * @brief           The Serial Manager task will handle incoming data
+ *                  and direct it for decode and processing.
+ *             
+ * @param[in] arg   Pointer to the Serial_Port_Holder of the port.
+ */
+__attribute__((noreturn))
+static THD_FUNCTION(SerialManagerTask, arg)
+{
+    Serial_Port_Holder *holder = (Serial_Port_Holder *)arg;
+    uint8_t *data;
+    size_t i, size;
+
+    /* Name for debug */
+    chRegSetThreadName(holder->transport->name);
+
+    while(1)
+    {
+        size = holder->transport->receive(&data, TIME_INFINITE);
+        holder->stats.rx_bytes += size;
+
+        if (holder->parser.framing == FRAMING_COBS)
+            vStatemachineCOBSEntry(data, size, &holder->parser);
+        else
         {
-            /* Send the data from the circular buffer */
-            USBSendData(read_pointer, read_size, TIME_INFINITE);
+            for (i = 0; i < size; i++)
+                vStatemachineDataEntry(data[i], &holder->parser);
+        }
+    }
+}
 
-            /* Increment the circular buffer tail */
-            CircularBuffer_IncrementTail(Cbuff, read_size);
+/**
+ * @brief           Transmits the content of the transmit lanes over the
+ *                  port's transport.
+ *  
+ * @param[in] arg   Pointer to the Serial_Port_Holder of the port.
+ */
+__attribute__((noreturn))
+static THD_FUNCTION(DataPumpTask, arg)
+{
+    Serial_Port_Holder *holder = (Serial_Port_Holder *)arg;
+    eventmask_t events;
+    circular_buffer_t *Cbuff;
+    uint32_t count;
+    rtcnt_t queued_time;
+    bool queued, status;
 
-            /* Get the read size again in case new data is available or if
-               we reached the end of the buffer (to make sure the entire
-               buffer is sent) */
-            read_pointer = CircularBuffer_GetReadPointer(Cbuff, &read_size);
+    /* Name for debug */
+    chRegSetThreadName(holder->transport->name);
+
+    /* Put the data pump thread into the list of available data pumps */
+    holder->data_pump = chThdGetSelfX();
 
-            /* If the USB has been removed during the transfer: abort */
-            if (isUSBActive() == false)
-                return HAL_FAILED;
+    while(1)
+    {
+        /* Wait for a start transmission event */
+        events = chEvtWaitAny(ANY_TRANSMISSION_EVENT);
+
+        /* Give more frames a chance to fill the packet */
+        WaitForCoalescing(&holder->lanes,
+                          holder->transport->packet_size,
+                          events);
+
+        osalSysLock();
+        queued = holder->lanes.queued;
+        queued_time = holder->lanes.queued_time;
+        holder->lanes.queued = false;
+        osalSysUnlock();
+
+        if (queued == true)
+            SerialStatistics_AddSample(holder->stats.tx_wait_histogram,
+                                       chSysGetRealtimeCounterX() -
+                                       queued_time);
+
+        /* We will only get here is a request to send data has been received,
+           the control lane is checked again after every bulk batch */
+        while ((count = TxLanesNext(&holder->lanes, &Cbuff)) > 0)
+        {
+            TRACE_EVENT(TRACE_TX_FLUSH_START, holder->parser.Port, count);
+            status = TransmitCircularBuffer(holder, Cbuff, count);
+            TRACE_EVENT(TRACE_TX_FLUSH_END, holder->parser.Port, status);
+
+            /* The lane has room again, even if the data was dropped */
+            osalSysLock();
+            holder->tx_sequence++;
+            osalThreadDequeueAllI(&holder->tx_waiters, MSG_OK);
+            osalOsRescheduleS();
+            osalSysUnlock();
+
+            if (status != HAL_SUCCESS)
+                break;
         }
-        /* Release the USB bus */
-        USBRelease();
 
-        /* Transfer finished successfully */
-        return HAL_SUCCESS;
+        /* Scatter-gather transmissions go after the frames queued before */
+        TransmitScatter(holder);
     }
-    else /* Some error occurred */
-        return HAL_FAILED;
 }
 
 /*===========================================================================*/
@@ -216,77 +578,428 @@ static bool USBTransmitCircularBuffer(circular_buffer_t *Cbuff)
 /*===========================================================================*/
 
 /**
- * @brief   Initializes communication.
+ * @brief   Initializes communication and registers the available transports.
  */
 void vSerialManagerInit(void)
 {
-    /* Initialize the USB mutex */
-    USBMutexInit();
+    uint32_t i;
+
+    /* CCM is not cleared at startup, empty the registry */
+    for (i = 0; i < SERIAL_NUM_PORTS; i++)
+    {
+        serial_ports[i].transport = NULL;
+        serial_ports[i].data_pump = NULL;
+    }
+
+    /* The worker must be up before any frame can be received */
+    vStatemachineDispatcherInit();
+
+    /* The CDC (PORT_USB) stays with the ASCII console in main.c, the framed
+       protocol runs on the links nothing else reads */
+    SerialManager_RegisterTransport(PORT_AUX4, &can_transport);
+
+#if !USB_UF2_MSC
+    /* EP3 is the mass storage interface otherwise */
+    SerialManager_RegisterTransport(PORT_USB_BULK, &usb_bulk_transport);
+#endif
+}
+
+/**
+ * @brief               Registers a transport for a port and starts its
+ *                      receive and data pump threads.
+ *
+ * @param[in] port      Port to register the transport for.
+ * @param[in] transport Transport descriptor.
+ * @return              HAL_FAILED if the port is invalid or already taken,
+ *                      else HAL_SUCCESS.
+ */
+bool SerialManager_RegisterTransport(External_Port port,
+                                     const serial_transport_t *transport)
+{
+    Serial_Port_Holder *holder;
+
+    if ((isPort(port) == false) || (transport == NULL))
+        return HAL_FAILED;
+
+    holder = &serial_ports[port];
+
+    if (holder->transport != NULL)
+        return HAL_FAILED;
+
+    holder->data_pump = NULL;
+    holder->tx_sequence = 0;
+    holder->scatter = NULL;
+    holder->flow_control = false;
+    osalThreadQueueObjectInit(&holder->tx_waiters);
+
+    /* Initialize the transmit lanes and the receive state machine */
+    TxLanesInit(&holder->lanes, holder->control_buffer, holder->bulk_buffer);
+    SerialStatistics_Init(&holder->stats);
+    vInitStatemachineDataHolder(&holder->parser,
+                                port,
+                                holder->rx_buffer,
+                                holder->frame_buffer,
+                                &holder->stats);
 
+    holder->transport = transport;
 
-    /* Start the USB communication tasks */
+    if (transport->start != NULL)
+        transport->start();
 
-    chThdCreateStatic(waUSBSerialManagerTask,
-                      sizeof(waUSBSerialManagerTask),
+    chThdCreateStatic(waSerialManagerTasks[port],
+                      THD_WORKING_AREA_SIZE(SERIAL_MANAGER_STACK_SIZE),
                       NORMALPRIO,
-                      USBSerialManagerTask,
-                      NULL);
+                      SerialManagerTask,
+                      holder);
 
-    chThdCreateStatic(waUSBDataPumpTask,
-                      sizeof(waUSBDataPumpTask),
+    chThdCreateStatic(waDataPumpTasks[port],
+                      THD_WORKING_AREA_SIZE(SERIAL_DATA_PUMP_STACK_SIZE),
                       NORMALPRIO,
-                      USBDataPumpTask,
-                      NULL);
+                      DataPumpTask,
+                      holder);
+
+    return HAL_SUCCESS;
 }
 
 /**
  * @brief               Return the circular buffer of corresponding 
- *                      communication port.
+ *                      communication port and transmit lane.
  *             
  * @param[in] port      Port parameter.
+ * @param[in] lane      Transmit lane parameter.
  * @return              Returns the pointer to the corresponding port's 
- *                      circular buffer.
+ *                      circular buffer, NULL if no transport is registered.
  */
-circular_buffer_t *SerialManager_GetCircularBufferFromPort(External_Port port)
+circular_buffer_t *SerialManager_GetCircularBufferFromPort(External_Port port,
+                                                           TX_Lane lane)
 {
-    if (port == PORT_USB)
-        return &data_pumps.USBTransmitBuffer;
+    if ((isPort(port) == false) || (serial_ports[port].transport == NULL))
+        return NULL;
 
-    else if (port == PORT_AUX1)
-        return &data_pumps.AUX1TransmitBuffer;
+    else if (lane == LANE_CONTROL)
+        return &serial_ports[port].lanes.control;
 
-    else if (port == PORT_AUX2)
-        return &data_pumps.AUX2TransmitBuffer;
+    else
+        return &serial_ports[port].lanes.bulk;
+}
+
+/**
+ * @brief               Return the receive state machine of a port.
+ *
+ * @param[in] port      Port parameter.
+ * @return              Returns the pointer to the port's parser holder,
+ *                      NULL if no transport is registered.
+ */
+parser_holder_t *SerialManager_GetParserHolderFromPort(External_Port port)
+{
+    if ((isPort(port) == false) || (serial_ports[port].transport == NULL))
+        return NULL;
+    else
+        return &serial_ports[port].parser;
+}
+
+/**
+ * @brief               Switches the framing of a port. Frames already queued
+ *                      are sent in the old framing.
+ * @note                The host shall wait for the ACK of Cmd_SetFraming
+ *                      before it sends frames in the new framing.
+ *
+ * @param[in] port      Port parameter.
+ * @param[in] framing   The new framing.
+ * @return              HAL_FAILED if no transport is registered for the port,
+ *                      else HAL_SUCCESS.
+ */
+bool SerialManager_SetFraming(External_Port port, Serial_Framing framing)
+{
+    Serial_Port_Holder *holder;
 
-    else if (port == PORT_AUX3)
-        return &data_pumps.AUX3TransmitBuffer;
+    if ((isPort(port) == false) || (serial_ports[port].transport == NULL))
+        return HAL_FAILED;
 
-    else if (port == PORT_AUX4)
-        return &data_pumps.AUX4TransmitBuffer;
+    holder = &serial_ports[port];
 
-    else
-        return NULL;
+    CircularBuffer_Claim(&holder->lanes.control);
+    holder->lanes.control.framing = framing;
+    CircularBuffer_Release(&holder->lanes.control);
+
+    CircularBuffer_Claim(&holder->lanes.bulk);
+    holder->lanes.bulk.framing = framing;
+    CircularBuffer_Release(&holder->lanes.bulk);
+
+    holder->parser.frame_count = 0;
+    holder->parser.framing = framing;
+
+    return HAL_SUCCESS;
 }
 
 /**
  * @brief               Signal the data pump thread to start transmission.
+ *                      The data pump may hold the data for up to
+ *                      SERIAL_TX_COALESCE_DEADLINE_US to fill a packet.
  *             
  * @param[in] port      Port parameter.
+ * @param[in] lane      Lane the frame was queued in.
+ */
+void SerialManager_StartTransmission(External_Port port, TX_Lane lane)
+{
+    if ((isPort(port) == false) || (serial_ports[port].data_pump == NULL))
+        return;
+
+    TxLanesFrameQueued(&serial_ports[port], lane);
+
+    chEvtSignal(serial_ports[port].data_pump, START_TRANSMISSION_EVENT);
+}
+
+/**
+ * @brief               Signal the data pump thread to start transmission
+ *                      immediately, bypassing the coalescing deadline.
+ *
+ * @param[in] port      Port parameter.
+ * @param[in] lane      Lane the frame was queued in.
+ */
+void SerialManager_StartUrgentTransmission(External_Port port, TX_Lane lane)
+{
+    if ((isPort(port) == false) || (serial_ports[port].data_pump == NULL))
+        return;
+
+    TxLanesFrameQueued(&serial_ports[port], lane);
+
+    chEvtSignal(serial_ports[port].data_pump, URGENT_TRANSMISSION_EVENT);
+}
+
+/**
+ * @brief               Counts a frame that did not fit in a transmit lane.
+ *
+ * @param[in] port      Port parameter.
+ */
+void SerialManager_CountTransmitOverflow(External_Port port)
+{
+    if ((isPort(port) == false) || (serial_ports[port].transport == NULL))
+        return;
+
+    serial_ports[port].stats.tx_overflows++;
+}
+
+/**
+ * @brief               Takes a snapshot of the link statistics of a port.
+ *
+ * @param[in] port      Port parameter.
+ * @param[out] stats    Pointer to where the snapshot is stored.
+ * @return              HAL_FAILED if no transport is registered for the port,
+ *                      else HAL_SUCCESS.
  */
-void SerialManager_StartTransmission(External_Port port)
+bool SerialManager_GetStatistics(External_Port port,
+                                 serial_statistics_t *stats)
 {
-    if ((port == PORT_USB) && (data_pumps.ptrUSBDataPump != NULL))
-        chEvtSignal(data_pumps.ptrUSBDataPump, START_TRANSMISSION_EVENT);
+    Serial_Port_Holder *holder;
+
+    if ((isPort(port) == false) || (serial_ports[port].transport == NULL))
+        return HAL_FAILED;
+
+    holder = &serial_ports[port];
 
-    else if ((port == PORT_AUX1) && (data_pumps.ptrAUX1DataPump != NULL))
-        chEvtSignal(data_pumps.ptrAUX1DataPump, START_TRANSMISSION_EVENT);
+    osalSysLock();
+    *stats = holder->stats;
+    stats->rx_frames = holder->parser.rx_success;
+    stats->rx_errors = holder->parser.rx_error;
+    osalSysUnlock();
 
-    else if ((port == PORT_AUX2) && (data_pumps.ptrAUX2DataPump != NULL))
-        chEvtSignal(data_pumps.ptrAUX2DataPump, START_TRANSMISSION_EVENT);
+    return HAL_SUCCESS;
+}
+
+/**
+ * @brief               Returns the transmit sequence of a port, it changes
+ *                      every time the data pump frees space in a lane.
+ * @note                Read it before trying to queue a frame and give it
+ *                      to SerialManager_WaitForTxSpace() if the frame did
+ *                      not fit.
+ *
+ * @param[in] port      Port parameter.
+ * @return              The transmit sequence.
+ */
+uint32_t SerialManager_GetTxSequence(External_Port port)
+{
+    if ((isPort(port) == false) || (serial_ports[port].transport == NULL))
+        return 0;
 
-    else if ((port == PORT_AUX3) && (data_pumps.ptrAUX3DataPump != NULL))
-        chEvtSignal(data_pumps.ptrAUX3DataPump, START_TRANSMISSION_EVENT);
+    return serial_ports[port].tx_sequence;
+}
+
+/**
+ * @brief               Waits for the data pump of a port to free space in
+ *                      the transmit lanes.
+ *
+ * @param[in] port      Port parameter.
+ * @param[in] sequence  Transmit sequence read before the failed attempt.
+ * @param[in] timeout   Longest time to wait.
+ * @return              HAL_FAILED on timeout or if no transport is
+ *                      registered for the port, else HAL_SUCCESS.
+ */
+bool SerialManager_WaitForTxSpace(External_Port port,
+                                  uint32_t sequence,
+                                  systime_t timeout)
+{
+    Serial_Port_Holder *holder;
+    msg_t msg = MSG_OK;
+
+    if ((isPort(port) == false) || (serial_ports[port].transport == NULL))
+        return HAL_FAILED;
+
+    holder = &serial_ports[port];
+
+    osalSysLock();
+
+    /* Space was freed after the attempt, no need to wait */
+    if (holder->tx_sequence == sequence)
+        msg = osalThreadEnqueueTimeoutS(&holder->tx_waiters, timeout);
+
+    osalSysUnlock();
+
+    if (msg == MSG_OK)
+        return HAL_SUCCESS;
+    else
+        return HAL_FAILED;
+}
+
+/**
+ * @brief               Checks if frames can be sent in place on a port. The
+ *                      transport must support scatter-gather and the port
+ *                      must use raw framing, which never changes the data.
+ *
+ * @param[in] port      Port parameter.
+ * @return              True if supported.
+ */
+bool SerialManager_SupportsScatter(External_Port port)
+{
+    if ((isPort(port) == false) || (serial_ports[port].transport == NULL))
+        return false;
+
+    return (serial_ports[port].transport->send_segments != NULL) &&
+           (serial_ports[port].lanes.bulk.framing == FRAMING_RAW);
+}
+
+/**
+ * @brief               Hands a scatter-gather transmission to the data pump
+ *                      of a port. Waits while the previous one has not been
+ *                      taken by the data pump.
+ *
+ * @param[in] port      Port parameter.
+ * @param[in] scatter   The transmission, the segments must hold complete
+ *                      frames in raw framing.
+ * @param[in] timeout   Longest time to wait for the data pump.
+ * @return              HAL_FAILED on timeout or if the port does not
+ *                      support scatter-gather, else HAL_SUCCESS.
+ */
+bool SerialManager_QueueScatter(External_Port port,
+                                serial_scatter_t *scatter,
+                                systime_t timeout)
+{
+    Serial_Port_Holder *holder;
+    msg_t msg = MSG_OK;
+
+    if ((SerialManager_SupportsScatter(port) == false) ||
+        (serial_ports[port].data_pump == NULL))
+        return HAL_FAILED;
+
+    holder = &serial_ports[port];
+
+    scatter->done = false;
+    scatter->status = HAL_FAILED;
+
+    osalSysLock();
+
+    while ((holder->scatter != NULL) && (msg == MSG_OK))
+        msg = osalThreadEnqueueTimeoutS(&holder->tx_waiters, timeout);
+
+    if (msg == MSG_OK)
+        holder->scatter = scatter;
+
+    osalSysUnlock();
+
+    if (msg != MSG_OK)
+        return HAL_FAILED;
+
+    holder->stats.tx_frames++;
+    chEvtSignal(holder->data_pump, URGENT_TRANSMISSION_EVENT);
+
+    return HAL_SUCCESS;
+}
+
+/**
+ * @brief               Waits for the data pump to send a scatter-gather
+ *                      transmission, after this its memory can be reused.
+ *                      On timeout a transmission not yet taken by the data
+ *                      pump is withdrawn.
+ * @note                Check done before reusing the memory after a
+ *                      timeout, the transmission may still be in progress.
+ *
+ * @param[in] port      Port parameter.
+ * @param[in] scatter   The transmission.
+ * @param[in] timeout   Longest time to wait for each data pump pass.
+ * @return              HAL_FAILED on timeout or if the segments were
+ *                      dropped, else HAL_SUCCESS.
+ */
+bool SerialManager_WaitScatter(External_Port port,
+                               serial_scatter_t *scatter,
+                               systime_t timeout)
+{
+    Serial_Port_Holder *holder;
+    msg_t msg = MSG_OK;
+
+    if ((isPort(port) == false) || (serial_ports[port].transport == NULL))
+        return HAL_FAILED;
+
+    holder = &serial_ports[port];
+
+    osalSysLock();
+
+    while ((scatter->done == false) && (msg == MSG_OK))
+        msg = osalThreadEnqueueTimeoutS(&holder->tx_waiters, timeout);
+
+    if (holder->scatter == scatter)
+    {
+        holder->scatter = NULL;
+        scatter->done = true;
+    }
+
+    osalSysUnlock();
+
+    if (scatter->done == true)
+        return scatter->status;
+    else
+        return HAL_FAILED;
+}
+
+/**
+ * @brief               Enables or disables the dispatch credits in the ACKs
+ *                      sent on a port.
+ *
+ * @param[in] port      Port parameter.
+ * @param[in] enable    True to enable.
+ * @return              HAL_FAILED if no transport is registered for the port,
+ *                      else HAL_SUCCESS.
+ */
+bool SerialManager_SetFlowControl(External_Port port, bool enable)
+{
+    if ((isPort(port) == false) || (serial_ports[port].transport == NULL))
+        return HAL_FAILED;
+
+    serial_ports[port].flow_control = enable;
+
+    return HAL_SUCCESS;
+}
+
+/**
+ * @brief               Checks if the host asked for dispatch credits in the
+ *                      ACKs sent on a port.
+ *
+ * @param[in] port      Port parameter.
+ * @return              True if enabled.
+ */
+bool SerialManager_FlowControlEnabled(External_Port port)
+{
+    if ((isPort(port) == false) || (serial_ports[port].transport == NULL))
+        return false;
 
-    else if ((port == PORT_AUX4) && (data_pumps.ptrAUX4DataPump != NULL))
-        chEvtSignal(data_pumps.ptrAUX4DataPump, START_TRANSMISSION_EVENT);
+    return serial_ports[port].flow_control;
 }
@@ -47,13 +47,35 @@
  *
  * This gives 126 commands for the user.
  *
+ *
+ * COBS framing
+ * ------------
+ * A port can be switched to COBS framing with Cmd_SetFraming. The frame is
+ * the same as above without the SYNC byte, COBS encoded and ended with a
+ * zero byte. The CRCs are calculated as if the SYNC was there. This caps
+ * the overhead to 1 byte per 254 instead of doubling every SYNC valued byte.
+ *
+ *      COBS(HEADER | CRC8 | DATA | CRC16) | 0x00
+ *
+ *
+ * Raw framing
+ * -----------
+ * On links that never lose or reorder bytes (USB) a port can be switched to
+ * raw framing. The frame is the same as in SYNC framing but SYNC valued
+ * bytes are not doubled, the receiver knows the end of the frame from the
+ * header. The data of a frame is never changed by the framing so it can be
+ * transmitted straight from where it is stored.
+ *
  */
 
 #include "ch.h"
 #include "hal.h"
 #include "crc.h"
-#include "statemachine_parsers.h"
+#include "cobs.h"
+#include "statemachine_commands.h"
 #include "statemachine_generators.h"
+#include "statemachine_dispatcher.h"
+#include "trace.h"
 #include "statemachine.h"
 
 
@@ -69,6 +91,7 @@ static void vRxCRC8(uint8_t data, parser_holder_t *pHolder);
 static void vRxData(uint8_t data, parser_holder_t *pHolder);
 static void vRxCRC16_1(uint8_t data, parser_holder_t *pHolder);
 static void vRxCRC16_2(uint8_t data, parser_holder_t *pHolder);
+static void vFramingError(parser_holder_t *pHolder, NAK_Reason reason);
 
 /*===========================================================================*/
 /* Module exported variables.                                                */
@@ -82,6 +105,48 @@ static void vRxCRC16_2(uint8_t data, parser_holder_t *pHolder);
 /* Module local functions.                                                   */
 /*===========================================================================*/
 
+/**
+ * @brief              Drops the current frame after a framing error and
+ *                     requests a rescan of its bytes for the next SYNC.
+ *
+ * @param[in] pHolder  Pointer to parser_holder_t structure.
+ * @param[in] reason   Reason sent to the host in the NAK.
+ */
+static void vFramingError(parser_holder_t *pHolder, NAK_Reason reason)
+{
+    pHolder->next_state = vWaitingForSYNC;
+    pHolder->resync = true;
+
+    /* False SYNCs found while rescanning are not receive errors */
+    if (pHolder->position == pHolder->history_index)
+        vStatemachineFrameError(pHolder, reason);
+}
+
+/**
+ * @brief              Runs one byte through the SYNC framing state machine.
+ *
+ * @param[in] data     Input data to be parsed.
+ * @param[in] pHolder  Pointer to parser_holder_t structure.
+ */
+static void vStatemachineStep(uint8_t data, parser_holder_t *pHolder)
+{
+    /* In raw framing a SYNC valued byte inside a frame is plain data */
+    if ((data == SYNC_BYTE) && (pHolder->framing == FRAMING_SYNC))
+    {
+        if ((pHolder->next_state != vWaitingForSYNC) && \
+            (pHolder->next_state != vWaitingForSYNCorCMD) && \
+            (pHolder->next_state != vRxCmd))
+        {
+            pHolder->current_state = pHolder->next_state;
+            pHolder->next_state = vWaitingForSYNCorCMD;
+        }
+        else
+            pHolder->next_state(data, pHolder);
+    }
+    else
+        pHolder->next_state(data, pHolder);
+}
+
 /**
  * @brief              Waiting for SYNC function. Will run this until a
  *                     valid SYNC has occurred.
@@ -94,6 +159,7 @@ static void vWaitingForSYNC(uint8_t data, parser_holder_t *pHolder)
     if (data == SYNC_BYTE)
     {
         pHolder->next_state = vRxCmd;
+        pHolder->frame_start = pHolder->position;
 
         pHolder->buffer_count = 0;
         pHolder->crc8 = CRC8_step(SYNC_BYTE, 0x00);
@@ -115,6 +181,7 @@ static void vWaitingForSYNCorCMD(uint8_t data, parser_holder_t *pHolder)
         pHolder->current_state(data, pHolder);
     else /* If not SYNC, reset transfer and check if byte is command */
     {
+        pHolder->frame_start = pHolder->position - 1;
         pHolder->buffer_count = 0;
         pHolder->crc8 = CRC8_step(SYNC_BYTE, 0x00);
         pHolder->crc16 = CRC16_step(SYNC_BYTE, 0xffff);
@@ -131,8 +198,10 @@ static void vWaitingForSYNCorCMD(uint8_t data, parser_holder_t *pHolder)
  */
 static void vRxCmd(uint8_t data, parser_holder_t *pHolder)
 {
-    /* 0 is not an allowed command (Cmd_None) */
-    if ((data & ~ACK_BIT) > Cmd_None)
+    const command_descriptor_t *desc = GetCommandDescriptor(data);
+
+    /* Only commands in the command table are allowed (not Cmd_None) */
+    if (desc->valid == true)
     {
         pHolder->next_state = vRxSize;
 
@@ -140,19 +209,26 @@ static void vRxCmd(uint8_t data, parser_holder_t *pHolder)
         pHolder->crc8 = CRC8_step(data, pHolder->crc8);
         pHolder->crc16 = CRC16_step(data, pHolder->crc16);
 
-        /* Get the correct parser from the parser lookup table */
-        pHolder->parser = GetParser(data & ~ACK_BIT);
+        /* Get the correct parser from the command table */
+        pHolder->command = data & ~ACK_BIT;
+        pHolder->parser = desc->parser;
+
+        /* Frames found while rescanning started earlier */
+        if (pHolder->position == pHolder->history_index)
+            TRACE_EVENT(TRACE_RX_FRAME_START, pHolder->Port, pHolder->command);
 
-        /* If ACK is requested */
-        if (data & ACK_BIT)
+        /* If ACK is requested, subject to the ACK policy of the command */
+        if (desc->ack_policy == ACK_ALWAYS)
+            pHolder->AckRequested = true;
+        else if ((desc->ack_policy == ACK_ON_REQUEST) && (data & ACK_BIT))
             pHolder->AckRequested = true;
         else
             pHolder->AckRequested = false;
     }
     else
     {
-        pHolder->next_state = vWaitingForSYNC;
-        pHolder->rx_error++;
+        pHolder->command = data & ~ACK_BIT;
+        vFramingError(pHolder, NAK_UNKNOWN_COMMAND);
     }
 }
 
@@ -182,20 +258,19 @@ static void vRxCRC8(uint8_t data, parser_holder_t *pHolder)
 {
     if (pHolder->crc8 == data)
     {
-        /* CRC OK! */
-        if (pHolder->data_length == 0)
+        /* CRC OK! Discard messages larger than the command accepts */
+        if (pHolder->data_length >
+                        GetCommandDescriptor(pHolder->command)->max_payload)
+            vFramingError(pHolder, NAK_OVERFLOW);
+
+        else if (pHolder->data_length == 0)
         {   /* If no data, parse now! */
             pHolder->next_state = vWaitingForSYNC;
 
-            /* Receive success! Increment statistics counter */
-            pHolder->rx_success++;
-
-            if (pHolder->parser != NULL)
-                pHolder->parser(pHolder);
-
-            /* If an ACK was requested, send it after the parser finished */
-            if (pHolder->AckRequested == true)
-                GenerateMessage(Cmd_ACK, pHolder->Port);
+            /* Hand the frame to the worker, a frame NAKed as busy is
+               counted as an error instead of a success */
+            if (DispatchFrame(pHolder) == HAL_SUCCESS)
+                pHolder->rx_success++;
         }
         else
         {
@@ -206,8 +281,7 @@ static void vRxCRC8(uint8_t data, parser_holder_t *pHolder)
     }
     else /* CRC error! */
     {
-        pHolder->next_state = vWaitingForSYNC;
-        pHolder->rx_error++;
+        vFramingError(pHolder, NAK_CRC8);
     }
 }
 
@@ -244,13 +318,12 @@ static void vRxCRC16_1(uint8_t data, parser_holder_t *pHolder)
     }
     else
     {
-        pHolder->next_state = vWaitingForSYNC;
-        pHolder->rx_error++;
+        vFramingError(pHolder, NAK_CRC16);
     }
 }
 
 /**
- * @brief              Checks the second CRC16 byte. If OK: run parser.
+ * @brief              Checks the second CRC16 byte. If OK: dispatch the frame.
  * 
  * @param[in] data     Input data to be parsed.
  * @param[in] pHolder  Pointer to parser_holder_t structure.
@@ -262,24 +335,145 @@ static void vRxCRC16_2(uint8_t data, parser_holder_t *pHolder)
 
     if (data == (uint8_t)(pHolder->crc16))
     {
-        /* Receive success! Increment statistics counter */
-        pHolder->rx_success++;
+        /* Hand the frame to the worker, the parser and ACK run there.
+           Receive success only if it was queued */
+        if (DispatchFrame(pHolder) == HAL_SUCCESS)
+            pHolder->rx_success++;
+    }
+    else /* CRC error! Discard data. */
+    {
+        vFramingError(pHolder, NAK_CRC16);
+    }
+}
+
+/**
+ * @brief              Checks a complete COBS frame and dispatches it.
+ *
+ * @param[in] pHolder  Pointer to parser_holder_t structure.
+ */
+static void vCOBSFrameComplete(parser_holder_t *pHolder)
+{
+    const command_descriptor_t *desc;
+    uint8_t *frame = pHolder->frame_buffer;
+    uint8_t *buffer;
+    uint16_t crc16;
+    size_t size;
 
-        /* If there is a parser for the message, execute it */
-        if (pHolder->parser != NULL)
-            pHolder->parser(pHolder);
+    /* Empty frames are allowed as padding between frames */
+    if (pHolder->frame_count == 0)
+        return;
 
-        /* If an ACK was requested, send it after the parser finished */
-        if (pHolder->AckRequested == true)
-            GenerateMessage(Cmd_ACK, pHolder->Port);
+    /* Nothing is known about the frame until the header is checked */
+    pHolder->command = Cmd_None;
+    pHolder->AckRequested = false;
+
+    if (pHolder->frame_count > SERIAL_COBS_BUFFER_SIZE)
+    {
+        vStatemachineFrameError(pHolder, NAK_OVERFLOW);
+        return;
     }
-    else /* CRC error! Discard data. */
+
+    size = COBS_Decode(frame, pHolder->frame_count, frame);
+
+    /* At least the header and CRC8, the CRCs include the SYNC as in SYNC
+       framing */
+    if ((size < 3) ||
+        (frame[2] != CRC8_step(frame[1],
+                     CRC8_step(frame[0], CRC8_step(SYNC_BYTE, 0x00)))))
+    {
+        vStatemachineFrameError(pHolder, NAK_CRC8);
+        return;
+    }
+
+    desc = GetCommandDescriptor(frame[0]);
+    pHolder->command = frame[0] & ~ACK_BIT;
+
+    if (desc->valid == false)
+    {
+        vStatemachineFrameError(pHolder, NAK_UNKNOWN_COMMAND);
+        return;
+    }
+
+    if (desc->ack_policy == ACK_ALWAYS)
+        pHolder->AckRequested = true;
+    else if ((desc->ack_policy == ACK_ON_REQUEST) && (frame[0] & ACK_BIT))
+        pHolder->AckRequested = true;
+    else
+        pHolder->AckRequested = false;
+
+    if (frame[1] > desc->max_payload)
     {
-        pHolder->next_state = vWaitingForSYNC;
-        pHolder->rx_error++;
+        vStatemachineFrameError(pHolder, NAK_OVERFLOW);
+        return;
     }
+
+    if (size != ((frame[1] == 0) ? 3u : (size_t)frame[1] + 5))
+    {
+        vStatemachineFrameError(pHolder, NAK_CRC16);
+        return;
+    }
+
+    if (frame[1] > 0)
+    {
+        crc16 = CRC16_step(SYNC_BYTE, 0xffff);
+
+        for (size = 0; size < ((size_t)frame[1] + 3); size++)
+            crc16 = CRC16_step(frame[size], crc16);
+
+        if ((frame[size] != (uint8_t)(crc16 >> 8)) ||
+            (frame[size + 1] != (uint8_t)(crc16)))
+        {
+            vStatemachineFrameError(pHolder, NAK_CRC16);
+            return;
+        }
+    }
+
+    pHolder->parser = desc->parser;
+    pHolder->data_length = frame[1];
+
+    /* The data is already in place after the header, dispatch from there */
+    buffer = pHolder->buffer;
+    pHolder->buffer = &frame[3];
+
+    if (DispatchFrame(pHolder) == HAL_SUCCESS)
+        pHolder->rx_success++;
+
+    pHolder->buffer = buffer;
 }
 
+/**
+ * @brief               Writes a byte in COBS framing.
+ *
+ * @param[in/out] Cbuff Pointer to the circular buffer.
+ * @param[in] data      Byte being written.
+ * @param[in/out] count Pointer to tracking variable for the size of the
+ *                      data being written to the circular buffer.
+ */
+static void CircularBuffer_WriteCOBSNoIncrement(circular_buffer_t *Cbuff,
+                                                uint8_t data,
+                                                int32_t *count)
+{
+    /* The byte and a new code byte */
+    if ((CircularBuffer_SpaceLeft(Cbuff) - *count) >= 2)
+    {
+        if (data != 0)
+        {
+            Cbuff->buffer[(Cbuff->head + *count) % Cbuff->size] = data;
+            *count += 1;
+        }
+
+        /* A zero or a full block closes the block at the code byte */
+        if ((data == 0) || ((*count - Cbuff->cobs_code) == COBS_MAX_CODE))
+        {
+            Cbuff->buffer[(Cbuff->head + Cbuff->cobs_code) % Cbuff->size] =
+                                          (uint8_t)(*count - Cbuff->cobs_code);
+            Cbuff->cobs_code = *count;
+            *count += 1;
+        }
+    }
+    else
+        *count = -1;
+}
 
 /*===========================================================================*/
 /* Module exported functions.                                                */
@@ -288,45 +482,196 @@ static void vRxCRC16_2(uint8_t data, parser_holder_t *pHolder)
 /**
  * @brief                   Initializes the data holder structure.
  * 
- * @param[in/out] pHolder   Pointer to parser_holder_t structure.
- * @param[in]     port      Port used for data transfers.
- * @param[in]     buffer    Buffer used for intermediate data.
+ * @param[in/out] pHolder       Pointer to parser_holder_t structure.
+ * @param[in]     port          Port used for data transfers.
+ * @param[in]     buffer        Buffer used for intermediate data.
+ * @param[in]     frame_buffer  Buffer of SERIAL_COBS_BUFFER_SIZE bytes for
+ *                              frames in COBS framing.
+ * @param[in]     stats         Link statistics of the port, may be NULL.
  */
 void vInitStatemachineDataHolder(parser_holder_t *pHolder,
                                  External_Port port,
-                                 uint8_t *buffer)
+                                 uint8_t *buffer,
+                                 uint8_t *frame_buffer,
+                                 serial_statistics_t *stats)
 {
     pHolder->Port = port;
     pHolder->buffer = buffer;
+    pHolder->framing = FRAMING_SYNC;
+    pHolder->frame_buffer = frame_buffer;
+    pHolder->frame_count = 0;
+    pHolder->history_index = 0;
+    pHolder->frame_start = 0;
+    pHolder->position = 0;
+    pHolder->resync = false;
+    pHolder->nak_tokens = SERIAL_NAK_BURST;
+    pHolder->nak_time = chVTGetSystemTimeX();
     pHolder->current_state = NULL;
     pHolder->next_state = vWaitingForSYNC;
     pHolder->parser = NULL;
+    pHolder->stats = stats;
     pHolder->rx_error = 0;
     pHolder->rx_success = 0;
 }
 
 /**
  * @brief              The entry point of serial data to the state machine.
+ *                     Framing errors are recovered by rescanning the
+ *                     history window.
  * 
  * @param[in] data     Input data to be parsed.
  * @param[in] pHolder  Pointer to parser_holder_t structure.
  */
 void vStatemachineDataEntry(uint8_t data, parser_holder_t *pHolder)
 {
-    if (data == SYNC_BYTE)
+    uint32_t start;
+
+    /* Keep the byte in the history window */
+    pHolder->history[pHolder->history_index % SERIAL_RESYNC_WINDOW] = data;
+    pHolder->history_index++;
+    pHolder->position = pHolder->history_index;
+
+    vStatemachineStep(data, pHolder);
+
+    /* After a framing error rescan the bytes after the failed SYNC that are
+       still in the window, a real SYNC may be hidden in them. Every rescan
+       starts after the SYNC of the previous one so this always ends. */
+    while (pHolder->resync == true)
     {
-        if ((pHolder->next_state != vWaitingForSYNC) && \
-            (pHolder->next_state != vWaitingForSYNCorCMD) && \
-            (pHolder->next_state != vRxCmd))
+        pHolder->resync = false;
+
+        start = pHolder->frame_start;
+
+        if ((uint32_t)(pHolder->history_index - start) > SERIAL_RESYNC_WINDOW)
+            start = pHolder->history_index - SERIAL_RESYNC_WINDOW;
+
+        while ((start != pHolder->history_index) && (pHolder->resync == false))
         {
-            pHolder->current_state = pHolder->next_state;
-            pHolder->next_state = vWaitingForSYNCorCMD;
+            pHolder->position = start + 1;
+            vStatemachineStep(pHolder->history[start % SERIAL_RESYNC_WINDOW],
+                              pHolder);
+            start++;
+        }
+    }
+}
+
+/**
+ * @brief              The entry point of serial data in COBS framing. Runs
+ *                     up to each delimiter are collected word-wide and the
+ *                     frame is checked when the delimiter arrives.
+ *
+ * @param[in] data     Input data to be parsed.
+ * @param[in] size     Size of the input data.
+ * @param[in] pHolder  Pointer to parser_holder_t structure.
+ */
+void vStatemachineCOBSEntry(uint8_t *data,
+                            size_t size,
+                            parser_holder_t *pHolder)
+{
+    size_t i, n;
+
+    while (size > 0)
+    {
+        n = COBS_FindZero(data, size);
+
+        if ((pHolder->frame_count == 0) && (n > 0))
+            TRACE_EVENT(TRACE_RX_FRAME_START, pHolder->Port, 0);
+
+        /* Collect the run, a frame too large is marked and dropped at the
+           delimiter */
+        if ((pHolder->frame_count + n) <= SERIAL_COBS_BUFFER_SIZE)
+        {
+            for (i = 0; i < n; i++)
+                pHolder->frame_buffer[pHolder->frame_count + i] = data[i];
+
+            pHolder->frame_count += n;
         }
         else
-            pHolder->next_state(data, pHolder);
+            pHolder->frame_count = SERIAL_COBS_BUFFER_SIZE + 1;
+
+        if (n < size)
+        {
+            vCOBSFrameComplete(pHolder);
+            pHolder->frame_count = 0;
+            n++;
+        }
+
+        data += n;
+        size -= n;
     }
-    else
-        pHolder->next_state(data, pHolder);
+}
+
+/**
+ * @brief              Sends a NAK for the frame in the holder, rate limited
+ *                     to SERIAL_NAK_BURST NAKs and then one every
+ *                     SERIAL_NAK_INTERVAL_MS.
+ * @note               Errors with a trusted header are only NAKed if the
+ *                     frame requested an ACK, the host does not retry
+ *                     other frames.
+ *
+ * @param[in] pHolder  Pointer to parser_holder_t structure.
+ * @param[in] reason   Reason of the NAK.
+ */
+void vStatemachineSendNAK(parser_holder_t *pHolder, NAK_Reason reason)
+{
+    uint8_t data[2];
+    systime_t now, refill;
+
+    if ((reason != NAK_CRC8) && (reason != NAK_UNKNOWN_COMMAND) &&
+        (pHolder->AckRequested == false))
+        return;
+
+    /* Refill the NAK tokens */
+    now = chVTGetSystemTimeX();
+    refill = (systime_t)(now - pHolder->nak_time) /
+                                            MS2ST(SERIAL_NAK_INTERVAL_MS);
+
+    if (refill > 0)
+    {
+        pHolder->nak_time += refill * MS2ST(SERIAL_NAK_INTERVAL_MS);
+
+        if (refill >= (systime_t)(SERIAL_NAK_BURST - pHolder->nak_tokens))
+            pHolder->nak_tokens = SERIAL_NAK_BURST;
+        else
+            pHolder->nak_tokens += refill;
+    }
+
+    if (pHolder->nak_tokens == 0)
+        return;
+
+    pHolder->nak_tokens--;
+
+    data[0] = pHolder->command;
+    data[1] = reason;
+
+    GenerateCustomMessage(Cmd_NAK, data, sizeof(data), pHolder->Port);
+}
+
+/**
+ * @brief              Counts a dropped frame by reason and NAKs it.
+ *
+ * @param[in] pHolder  Pointer to parser_holder_t structure.
+ * @param[in] reason   Reason of the drop, sent to the host in the NAK.
+ */
+void vStatemachineFrameError(parser_holder_t *pHolder, NAK_Reason reason)
+{
+    serial_statistics_t *stats = pHolder->stats;
+
+    pHolder->rx_error++;
+
+    if (stats != NULL)
+    {
+        if ((reason == NAK_CRC8) || (reason == NAK_CRC16))
+            stats->rx_crc_errors++;
+        else if (reason == NAK_OVERFLOW)
+            stats->rx_overflows++;
+        else if (reason == NAK_UNKNOWN_COMMAND)
+            stats->rx_unknown_commands++;
+        else if (reason == NAK_BUSY)
+            stats->rx_busy++;
+    }
+
+    vStatemachineSendNAK(pHolder, reason);
 }
 
 /*===============================================================*/
@@ -335,7 +680,8 @@ void vStatemachineDataEntry(uint8_t data, parser_holder_t *pHolder)
 
 /**
  * @brief               Writes a byte to the circular buffer, if its vaule is
- *                      SYNC: write it twice.
+ *                      SYNC: write it twice. In COBS framing the byte is
+ *                      COBS encoded instead, in raw framing written as is.
  *  
  * @param[in/out] Cbuff Pointer to the circular buffer.
  * @param[in/out] data  Byte being written.
@@ -351,7 +697,18 @@ void CircularBuffer_WriteNoIncrement(circular_buffer_t *Cbuff,
                                      uint16_t *crc16)
 {
     /* Check if we have an error from previous write */
-    if (*count >= 0)
+    if ((*count >= 0) && (Cbuff->framing == FRAMING_COBS))
+    {
+        /* Only add CRCs of they are needed */
+        if (crc8 != NULL)
+            *crc8 = CRC8_step(data, *crc8);
+
+        if (crc16 != NULL)
+            *crc16 = CRC16_step(data, *crc16);
+
+        CircularBuffer_WriteCOBSNoIncrement(Cbuff, data, count);
+    }
+    else if (*count >= 0)
     {
         /* Check if we have 2 bytes free, in case of data = SYNC */
         if ((CircularBuffer_SpaceLeft(Cbuff) - *count) >= 2)
@@ -366,7 +723,7 @@ void CircularBuffer_WriteNoIncrement(circular_buffer_t *Cbuff,
             if (crc16 != NULL)
                 *crc16 = CRC16_step(data, *crc16);  
 
-            if (data == SYNC_BYTE)
+            if ((data == SYNC_BYTE) && (Cbuff->framing == FRAMING_SYNC))
             {
                 Cbuff->buffer[(Cbuff->head + *count) % Cbuff->size] = SYNC_BYTE;
                 *count += 1;
@@ -378,8 +735,8 @@ void CircularBuffer_WriteNoIncrement(circular_buffer_t *Cbuff,
 }
 
 /**
- * @brief               Writes a SYNC byte to the circular buffer.
- *                      
+ * @brief               Writes a SYNC byte to the circular buffer, or starts
+ *                      a frame in COBS framing.
  * @param[in/out] Cbuff Pointer to the circular buffer.
  * @param[in/out] count Pointer to tracking variable for the size of the
  *                      data being written to the circular buffer.
@@ -394,7 +751,12 @@ void CircularBuffer_WriteSYNCNoIncrement(circular_buffer_t *Cbuff,
     /* Check if we have 4 byte free for SYNC + Header */
     if (CircularBuffer_SpaceLeft(Cbuff) >= 4)
     {
-        Cbuff->buffer[(Cbuff->head + *count) % Cbuff->size] = SYNC_BYTE;
+        /* In COBS framing the place of the SYNC holds the first code byte */
+        if (Cbuff->framing == FRAMING_COBS)
+            Cbuff->cobs_code = *count;
+        else
+            Cbuff->buffer[(Cbuff->head + *count) % Cbuff->size] = SYNC_BYTE;
+
         *count += 1;
 
         /* When writing the SYNC CRC8 must be calculated */
@@ -406,3 +768,94 @@ void CircularBuffer_WriteSYNCNoIncrement(circular_buffer_t *Cbuff,
     else
         *count = -1;
 }
+
+/**
+ * @brief               Writes a block of data to the circular buffer. In COBS
+ *                      framing the runs between zeros are found word-wide
+ *                      and copied as a block.
+ *
+ * @param[in/out] Cbuff Pointer to the circular buffer.
+ * @param[in] data      Pointer to the data.
+ * @param[in] size      Size of the data.
+ * @param[in/out] count Pointer to tracking variable for the size of the
+ *                      data being written to the circular buffer.
+ * @param[in] crc16     Pointer to the CRC16 data holder.
+ */
+void CircularBuffer_WriteChunkNoIncrement(circular_buffer_t *Cbuff,
+                                          const uint8_t *data,
+                                          uint32_t size,
+                                          int32_t *count,
+                                          uint16_t *crc16)
+{
+    uint32_t i, n, left;
+
+    if (Cbuff->framing != FRAMING_COBS)
+    {
+        for (i = 0; i < size; i++)
+            CircularBuffer_WriteNoIncrement(Cbuff, data[i], count, NULL, crc16);
+
+        return;
+    }
+
+    while ((size > 0) && (*count >= 0))
+    {
+        /* Non-zero run, limited by the room left in the current block */
+        n = COBS_FindZero(data, size);
+        left = COBS_MAX_CODE - 1 - (uint32_t)(*count - Cbuff->cobs_code);
+
+        if (n > left)
+            n = left;
+
+        if ((CircularBuffer_SpaceLeft(Cbuff) - *count) < (n + 2))
+        {
+            *count = -1;
+            return;
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            Cbuff->buffer[(Cbuff->head + *count + i) % Cbuff->size] = data[i];
+
+            if (crc16 != NULL)
+                *crc16 = CRC16_step(data[i], *crc16);
+        }
+
+        *count += n;
+        data += n;
+        size -= n;
+
+        /* The block is full or a zero follows, let the byte writer close
+           the block */
+        if (size > 0)
+        {
+            CircularBuffer_WriteNoIncrement(Cbuff, data[0], count, NULL, crc16);
+            data++;
+            size--;
+        }
+    }
+}
+
+/**
+ * @brief               Ends a frame. In COBS framing the last code byte is
+ *                      written and the delimiter added, else nothing is done.
+ *
+ * @param[in/out] Cbuff Pointer to the circular buffer.
+ * @param[in/out] count Pointer to tracking variable for the size of the
+ *                      data being written to the circular buffer.
+ */
+void CircularBuffer_WriteEndNoIncrement(circular_buffer_t *Cbuff,
+                                        int32_t *count)
+{
+    if ((*count < 0) || (Cbuff->framing != FRAMING_COBS))
+        return;
+
+    if ((CircularBuffer_SpaceLeft(Cbuff) - *count) >= 1)
+    {
+        Cbuff->buffer[(Cbuff->head + Cbuff->cobs_code) % Cbuff->size] =
+                                          (uint8_t)(*count - Cbuff->cobs_code);
+        Cbuff->buffer[(Cbuff->head + *count) % Cbuff->size] = COBS_DELIMITER;
+        *count += 1;
+    }
+    else
+        *count = -1;
+}
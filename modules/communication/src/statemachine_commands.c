@@ -0,0 +1,46 @@
+/* *
+ *
+ * The command descriptor table, generated from SERIAL_COMMAND_TABLE in
+ * statemachine_commands.h. Commands not in the table are invalid.
+ *
+ * */
+
+#include "ch.h"
+#include "hal.h"
+#include "statemachine_parsers.h"
+#include "statemachine_generators.h"
+#include "statemachine_commands.h"
+
+/*===========================================================================*/
+/* Module local definitions.                                                 */
+/*===========================================================================*/
+
+/**
+ * @brief   Expands a command table line to a designated initializer.
+ */
+#define COMMAND_DESCRIPTOR(command, parser, generator, ack, max_payload,    \
+                           lane, urgent)                                    \
+    [command] = {parser, generator, max_payload, ack, lane, urgent, true},
+
+/*===========================================================================*/
+/* Module exported variables.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Descriptors for all commands, indexed by the command.
+ */
+const command_descriptor_t command_table[SERIAL_NUM_COMMANDS] = {
+    SERIAL_COMMAND_TABLE(COMMAND_DESCRIPTOR)
+};
+
+/*===========================================================================*/
+/* Module local variables and types.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
@@ -0,0 +1,246 @@
+/**
+ *
+ * Parse and dispatch worker for the serial protocol.
+ * Completed frames are copied into descriptors from a memory pool and
+ * posted to a mailbox, a worker thread runs the parser and the ACK so that
+ * slow handlers (flash erase/program) do not block the receivers.
+ *
+ */
+
+#include "ch.h"
+#include "hal.h"
+#include "statemachine_generators.h"
+#include "statemachine_dispatcher.h"
+#include "serialmanager.h"
+#include "trace.h"
+
+/*===========================================================================*/
+/* Module local definitions.                                                 */
+/*===========================================================================*/
+
+/**
+ * @brief   Time the worker waits for room in a transmit lane for an ACK.
+ */
+#define DISPATCH_ACK_TIMEOUT          MS2ST(SERIAL_GENERATE_TIMEOUT_MS)
+
+/*===========================================================================*/
+/* Module exported variables.                                                */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module local variables and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Frame descriptor storage for the pool.
+ */
+CCM_MEMORY static frame_descriptor_t frame_descriptors[SERIAL_DISPATCH_QUEUE_SIZE];
+
+/**
+ * @brief   Pool of free frame descriptors.
+ */
+static memory_pool_t frame_pool;
+
+/**
+ * @brief   Number of free descriptors in the pool, the dispatch credits.
+ */
+static uint8_t dispatch_free;
+
+/**
+ * @brief   Mailbox buffer, holds pointers to the queued descriptors.
+ */
+static msg_t dispatch_mailbox_buffer[SERIAL_DISPATCH_QUEUE_SIZE];
+
+/**
+ * @brief   Mailbox of frames waiting to be parsed.
+ */
+static mailbox_t dispatch_mailbox;
+
+/**
+ * @brief   Working area for the dispatch worker.
+ */
+static THD_WORKING_AREA(waDispatchTask, SERIAL_DISPATCH_STACK_SIZE);
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+/**
+ * @brief               Dispatch worker, runs the parser and sends the ACK for
+ *                      each queued frame in order of reception.
+ *
+ * @param[in] arg       Unused.
+ */
+static THD_FUNCTION(DispatchTask, arg)
+{
+    (void)arg;
+    msg_t msg;
+    frame_descriptor_t *desc;
+    parser_holder_t holder;
+    uint8_t credits;
+    bool status;
+
+    chRegSetThreadName("Serial Dispatch");
+
+    while (1)
+    {
+        if (chMBFetch(&dispatch_mailbox, &msg, TIME_INFINITE) != MSG_OK)
+            continue;
+
+        desc = (frame_descriptor_t *)msg;
+
+        /* The parsers only use the port, ACK flag and data of the holder */
+        holder.Port = desc->Port;
+        holder.command = desc->command;
+        holder.AckRequested = desc->AckRequested;
+        holder.data_length = desc->data_length;
+        holder.buffer = desc->data;
+        holder.buffer_count = desc->data_length;
+        holder.parser = desc->parser;
+        holder.stats = desc->stats;
+
+        TRACE_EVENT(TRACE_DISPATCH_START, desc->Port, desc->command);
+
+        /* If there is a parser for the message, execute it */
+        if (holder.parser != NULL)
+            holder.parser(&holder);
+
+        if (desc->stats != NULL)
+            SerialStatistics_AddSample(desc->stats->processing_histogram,
+                                       chSysGetRealtimeCounterX() -
+                                       desc->rx_cycles);
+
+        /* If an ACK was requested, send it after the parser finished, the
+           turnaround is measured until the ACK is queued */
+        if (holder.AckRequested == true)
+        {
+            if (SerialManager_FlowControlEnabled(holder.Port) == true)
+            {
+                /* This descriptor is free as soon as the ACK is queued */
+                credits = DispatchCredits() + 1;
+                status = GenerateCustomMessageTimeout(Cmd_ACK,
+                                                      &credits,
+                                                      1,
+                                                      holder.Port,
+                                                      DISPATCH_ACK_TIMEOUT);
+            }
+            else
+                status = GenerateMessageTimeout(Cmd_ACK,
+                                                holder.Port,
+                                                DISPATCH_ACK_TIMEOUT);
+
+            if ((status == HAL_SUCCESS) && (desc->stats != NULL))
+                SerialStatistics_AddSample(desc->stats->ack_histogram,
+                                           chSysGetRealtimeCounterX() -
+                                           desc->rx_cycles);
+        }
+
+        TRACE_EVENT(TRACE_DISPATCH_END, desc->Port, desc->command);
+
+        osalSysLock();
+        chPoolFreeI(&frame_pool, desc);
+        dispatch_free++;
+        osalSysUnlock();
+    }
+}
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Initializes the frame pool, the mailbox and starts the worker.
+ * @note    The worker runs below the receivers so reception continues while
+ *          a long command executes.
+ */
+void vStatemachineDispatcherInit(void)
+{
+    chPoolObjectInit(&frame_pool, sizeof(frame_descriptor_t), NULL);
+    chPoolLoadArray(&frame_pool, frame_descriptors, SERIAL_DISPATCH_QUEUE_SIZE);
+    dispatch_free = SERIAL_DISPATCH_QUEUE_SIZE;
+
+    chMBObjectInit(&dispatch_mailbox,
+                   dispatch_mailbox_buffer,
+                   SERIAL_DISPATCH_QUEUE_SIZE);
+
+    chThdCreateStatic(waDispatchTask,
+                      sizeof(waDispatchTask),
+                      NORMALPRIO - 1,
+                      DispatchTask,
+                      NULL);
+}
+
+/**
+ * @brief               Queues a received frame for the worker.
+ * @note                If all descriptors are in use the frame is dropped,
+ *                      counted as a receive error and NAKed as busy.
+ *                      The reception time is kept for the latency
+ *                      histograms of the port.
+ *
+ * @param[in] pHolder   Pointer to the parser_holder_t of the received frame.
+ * @return              HAL_FAILED if the frame was dropped, else HAL_SUCCESS.
+ */
+bool DispatchFrame(parser_holder_t *pHolder)
+{
+    frame_descriptor_t *desc;
+    uint16_t i;
+    cnt_t used;
+
+    TRACE_EVENT(TRACE_RX_FRAME_END, pHolder->Port, pHolder->command);
+
+    /* Nothing to do for the worker */
+    if ((pHolder->parser == NULL) && (pHolder->AckRequested == false))
+        return HAL_SUCCESS;
+
+    osalSysLock();
+    desc = (frame_descriptor_t *)chPoolAllocI(&frame_pool);
+
+    if (desc != NULL)
+        dispatch_free--;
+
+    osalSysUnlock();
+
+    if (desc == NULL)
+    {
+        vStatemachineFrameError(pHolder, NAK_BUSY);
+        return HAL_FAILED;
+    }
+
+    desc->rx_cycles = chSysGetRealtimeCounterX();
+    desc->stats = pHolder->stats;
+    desc->parser = pHolder->parser;
+    desc->Port = pHolder->Port;
+    desc->AckRequested = pHolder->AckRequested;
+    desc->command = pHolder->command;
+    desc->data_length = pHolder->data_length;
+
+    for (i = 0; i < pHolder->data_length; i++)
+        desc->data[i] = pHolder->buffer[i];
+
+    /* The pool and mailbox have the same depth, posting cannot block */
+    chMBPost(&dispatch_mailbox, (msg_t)desc, TIME_IMMEDIATE);
+
+    if (pHolder->stats != NULL)
+    {
+        osalSysLock();
+        used = chMBGetUsedCountI(&dispatch_mailbox);
+        osalSysUnlock();
+
+        if (used > pHolder->stats->dispatch_high_water)
+            pHolder->stats->dispatch_high_water = (uint8_t)used;
+    }
+
+    return HAL_SUCCESS;
+}
+
+/**
+ * @brief               Returns the number of frames that can be queued for
+ *                      the worker before frames are NAKed as busy.
+ * @note                The credits are shared by all ports.
+ *
+ * @return              The number of free frame descriptors.
+ */
+uint8_t DispatchCredits(void)
+{
+    return dispatch_free;
+}
@@ -11,18 +11,27 @@
 #include "serialmanager.h"
 #include "crc.h"
 #include "statemachine_parsers.h"
+#include "statemachine_commands.h"
 #include "statemachine_generators.h"
+#include "response_cache.h"
 
 /*===========================================================================*/
 /* Module local definitions.                                                 */
 /*===========================================================================*/
 
-static bool GenerateACK(circular_buffer_t *Cbuff);
-static bool GeneratePing(circular_buffer_t *Cbuff);
-static bool GenerateGetRunningMode(circular_buffer_t *Cbuff);
-static bool GenerateGetDeviceInfo(circular_buffer_t *Cbuff);
 static uint32_t myStrlen(const uint8_t *str, const uint32_t max_length);
 
+/**
+ * @brief   Largest cached frame with a few bytes of data.
+ */
+#define SMALL_FRAME_CACHE_SIZE        (16)
+
+/**
+ * @brief   Largest cached GetDeviceInfo frame, a longer frame (many SYNC
+ *          bytes to double) is generated directly.
+ */
+#define DEVICE_INFO_CACHE_SIZE        (300)
+
 /*===========================================================================*/
 /* Module exported variables.                                                */
 /*===========================================================================*/
@@ -31,30 +40,18 @@ static uint32_t myStrlen(const uint8_t *str, const uint32_t max_length);
 /* Module local variables and types.                                         */
 /*===========================================================================*/
 
+/**
+ * @brief   Encoded frames of the responses with constant content.
+ */
+RESPONSE_CACHE_DECL(ack_cache, SMALL_FRAME_CACHE_SIZE);
+RESPONSE_CACHE_DECL(ping_cache, SMALL_FRAME_CACHE_SIZE);
+RESPONSE_CACHE_DECL(running_mode_cache, SMALL_FRAME_CACHE_SIZE);
 
 /**
- * The message generation lookup table
+ * @brief   Encoded frames of GetDeviceInfo, tagged with the user ID
+ *          revision.
  */
-static const generator_t generator_lookup[18] = {
-    NULL,                             /* 0:   Cmd_None                        */
-    GenerateACK,                      /* 1:   Cmd_ACK                         */
-    GeneratePing,                     /* 2:   Cmd_Ping                        */
-    NULL,                             /* 3:   Cmd_DebugMessage                */
-    GenerateGetRunningMode,           /* 4:   Cmd_GetRunningMode              */
-    NULL,                             /* 5:                                   */
-    NULL,                             /* 6:                                   */
-    NULL,                             /* 7:                                   */
-    NULL,                             /* 8:                                   */
-    NULL,                             /* 9:                                   */
-    NULL,                             /* 10:  Cmd_PrepareWriteFirmware        */
-    NULL,                             /* 11:  Cmd_WriteFirmwarePackage        */
-    NULL,                             /* 12:  Cmd_WriteLastFirmwarePackage    */
-    NULL,                             /* 13:  Cmd_ReadFirmwarePackage         */
-    NULL,                             /* 14:  Cmd_ReadLastFirmwarePackage     */
-    NULL,                             /* 15:  Cmd_NextPackage                 */
-    NULL,                             /* 16:  Cmd_ExitBootloader              */
-    GenerateGetDeviceInfo             /* 17:  Cmd_GetDeviceInfo               */
-};
+RESPONSE_CACHE_DECL(device_info_cache, DEVICE_INFO_CACHE_SIZE);
 
 /*===========================================================================*/
 /* Module local functions.                                                   */
@@ -81,6 +78,7 @@ static bool GenerateHeaderOnlyCommand(KFly_Command command,
     CircularBuffer_WriteNoIncrement(Cbuff, command, &count, &crc8, NULL); 
     CircularBuffer_WriteNoIncrement(Cbuff, 0,       &count, &crc8, NULL); 
     CircularBuffer_WriteNoIncrement(Cbuff, crc8,    &count, NULL,  NULL);
+    CircularBuffer_WriteEndNoIncrement(Cbuff, &count);
 
     /* Check if the message fit inside the buffer */
     return CircularBuffer_Increment(Cbuff, count); 
@@ -102,7 +100,6 @@ static bool GenerateGenericCommand(KFly_Command command,
                                    circular_buffer_t *Cbuff)
 {
     int32_t count = 0;
-    uint32_t i;
     uint8_t crc8;
     uint16_t crc16;
 
@@ -121,12 +118,12 @@ static bool GenerateGenericCommand(KFly_Command command,
     CircularBuffer_WriteNoIncrement(Cbuff, crc8,       &count, NULL,  &crc16);
 
     /* Add the data to the message */
-    for (i = 0; i < data_count; i++)
-        CircularBuffer_WriteNoIncrement(Cbuff, data[i], &count, NULL, &crc16); 
+    CircularBuffer_WriteChunkNoIncrement(Cbuff, data, data_count, &count, &crc16);
 
     /* Add the CRC16 */
     CircularBuffer_WriteNoIncrement(Cbuff, (uint8_t)(crc16 >> 8), &count, NULL, NULL);
     CircularBuffer_WriteNoIncrement(Cbuff, (uint8_t)(crc16),      &count, NULL, NULL);
+    CircularBuffer_WriteEndNoIncrement(Cbuff, &count);
 
     /* Check if the message fit inside the buffer */
     return CircularBuffer_Increment(Cbuff, count);
@@ -134,52 +131,163 @@ static bool GenerateGenericCommand(KFly_Command command,
 
 
 /**
- * @brief               Generates an ACK.
+ * @brief               Queues a frame in the lane of the command and starts
+ *                      the transmission. While the lane is full it waits
+ *                      for the data pump to free space, up to timeout.
+ *                      Frames that are not queued are counted.
+ *
+ * @param[in] command   The command of the frame.
+ * @param[in] data      Pointer to the data, if custom.
+ * @param[in] size      Size of the data, if custom.
+ * @param[in] custom    True to send data, false to use the generator of
+ *                      the command.
+ * @param[in] port      Which port to send the frame.
+ * @param[in] timeout   Longest time to wait for room in the lane.
+ * @return              HAL_FAILED if the frame was not queued, else
+ *                      HAL_SUCCESS.
+ */
+static bool QueueFrame(KFly_Command command,
+                       uint8_t *data,
+                       uint16_t size,
+                       bool custom,
+                       External_Port port,
+                       systime_t timeout)
+{
+    bool status;
+    const command_descriptor_t *desc;
+    circular_buffer_t *Cbuff;
+    systime_t start, elapsed, wait;
+    uint32_t sequence;
+
+    desc = GetCommandDescriptor(command);
+    Cbuff = SerialManager_GetCircularBufferFromPort(port, desc->lane);
+
+    /* Check so the circular buffer address is valid and that the command
+       exists and has a generator if needed */
+    if ((Cbuff == NULL) || (desc->valid == false) ||
+        ((custom == false) && (desc->generator == NULL)))
+        return HAL_FAILED;
+
+    start = chVTGetSystemTimeX();
+
+    while (1)
+    {
+        /* Taken before the attempt so no transmission is missed */
+        sequence = SerialManager_GetTxSequence(port);
+
+        /* Claim the circular buffer for writing */
+        CircularBuffer_Claim(Cbuff);
+        {
+            if (custom == true)
+                status = GenerateGenericCommand(command, data, size, Cbuff);
+            else
+                status = desc->generator(Cbuff);
+        }
+        /* Release the circular buffer */
+        CircularBuffer_Release(Cbuff);
+
+        /* If it was successful then start the transmission */
+        if (status == HAL_SUCCESS)
+        {
+            if (desc->urgent == true)
+                SerialManager_StartUrgentTransmission(port, desc->lane);
+            else
+                SerialManager_StartTransmission(port, desc->lane);
+
+            return HAL_SUCCESS;
+        }
+
+        /* A frame that does not fit in an empty lane never will */
+        if ((timeout == TIME_IMMEDIATE) || (CircularBuffer_Size(Cbuff) == 0))
+            break;
+
+        if (timeout == TIME_INFINITE)
+            wait = TIME_INFINITE;
+        else
+        {
+            elapsed = chVTGetSystemTimeX() - start;
+
+            if (elapsed >= timeout)
+                break;
+
+            wait = timeout - elapsed;
+        }
+
+        if (SerialManager_WaitForTxSpace(port, sequence, wait) != HAL_SUCCESS)
+            break;
+    }
+
+    SerialManager_CountTransmitOverflow(port);
+
+    return HAL_FAILED;
+}
+
+/**
+ * @brief                   Calculates the length of a string but with
+ *                          maximum length termination.
+ * 
+ * @param[in] str           Pointer to the string.
+ * @param[in] max_length    Maximum length/timeout.
+ * @return                  Returns the length of the string.
+ */
+uint32_t myStrlen(const uint8_t *str, const uint32_t max_length)
+{
+    const uint8_t *s;
+    s = str;
+
+    while ((*s != '\0') && ((uint32_t)(s - str) < max_length))
+        s++;
+
+    return (s - str);
+}
+
+/**
+ * @brief               Encodes an ACK.
  * 
  * @param[out] Cbuff    Pointer to the circular buffer to put the data in.
  * @return              HAL_FAILED if the message didn't fit or HAL_SUCCESS
  *                      if it did fit.
  */
-static bool GenerateACK(circular_buffer_t *Cbuff)
+static bool EncodeACK(circular_buffer_t *Cbuff)
 {
     return GenerateHeaderOnlyCommand(Cmd_ACK, Cbuff);   /* Return status */
 }
 
 /**
- * @brief               Generates a Ping.
+ * @brief               Encodes a Ping.
  * 
  * @param[out] Cbuff    Pointer to the circular buffer to put the data in.
  * @return              HAL_FAILED if the message didn't fit or HAL_SUCCESS
  *                      if it did fit.
  */
-static bool GeneratePing(circular_buffer_t *Cbuff)
+static bool EncodePing(circular_buffer_t *Cbuff)
 {
     return GenerateHeaderOnlyCommand(Cmd_Ping, Cbuff);  /* Return status */
 }
 
 /**
- * @brief               Generates the message for the current running mode.
+ * @brief               Encodes the message for the current running mode.
  * 
  * @param[out] Cbuff    Pointer to the circular buffer to put the data in.
  * @return              HAL_FAILED if the message didn't fit or HAL_SUCCESS
  *                      if it did fit.
  */
-static bool GenerateGetRunningMode(circular_buffer_t *Cbuff)
+static bool EncodeGetRunningMode(circular_buffer_t *Cbuff)
 {
     return GenerateGenericCommand(Cmd_GetRunningMode, (uint8_t *)"B", 1, Cbuff);
 }
 
 /**
- * @brief               Generates the message for the the ID of the system.
+ * @brief               Encodes the message for the the ID of the system.
  * 
  * @param[out] Cbuff    Pointer to the circular buffer to put the data in.
  * @return              HAL_FAILED if the message didn't fit or HAL_SUCCESS
  *                      if it did fit.
  */
-static bool GenerateGetDeviceInfo(circular_buffer_t *Cbuff)
+static bool EncodeGetDeviceInfo(circular_buffer_t *Cbuff)
 {
     uint8_t *device_id, *text_fw, *text_bl, *text_usr;
-    uint32_t length_fw, length_bl, length_usr, data_count, i = 0;
+    uint32_t length_fw, length_bl, length_usr, data_count;
     uint8_t crc8;
     uint16_t crc16;
     int32_t count = 0;
@@ -216,30 +324,26 @@ static bool GenerateGetDeviceInfo(circular_buffer_t *Cbuff)
                                                                        &crc16);
 
     /* Get the Device ID */
-    for (i = 0; i < UNIQUE_ID_SIZE; i++) 
-        CircularBuffer_WriteNoIncrement(Cbuff, device_id[i], &count, NULL, 
-                                                                       &crc16);
+    CircularBuffer_WriteChunkNoIncrement(Cbuff, device_id, UNIQUE_ID_SIZE,
+                                                              &count, &crc16);
 
     /* Get the Bootloader Version string */
-    for (i = 0; i < length_bl; i++) 
-        CircularBuffer_WriteNoIncrement(Cbuff, text_bl[i], &count, NULL, 
-                                                                       &crc16);
+    CircularBuffer_WriteChunkNoIncrement(Cbuff, text_bl, length_bl,
+                                                              &count, &crc16);
 
     CircularBuffer_WriteNoIncrement(Cbuff, 0x00, &count, NULL, 
                                                                        &crc16);
 
     /* Get the Firmware Version string */
-    for (i = 0; i < length_fw; i++) 
-        CircularBuffer_WriteNoIncrement(Cbuff, text_fw[i], &count, NULL, 
-                                                                       &crc16);
+    CircularBuffer_WriteChunkNoIncrement(Cbuff, text_fw, length_fw,
+                                                              &count, &crc16);
 
     CircularBuffer_WriteNoIncrement(Cbuff, 0x00, &count, NULL, 
                                                                        &crc16);
 
     /* Get the User string */
-    for (i = 0; i < length_usr; i++) 
-        CircularBuffer_WriteNoIncrement(Cbuff, text_usr[i], &count, NULL, 
-                                                                       &crc16);
+    CircularBuffer_WriteChunkNoIncrement(Cbuff, text_usr, length_usr,
+                                                              &count, &crc16);
 
     CircularBuffer_WriteNoIncrement(Cbuff, 0x00, &count, NULL, 
                                                                        &crc16);
@@ -249,37 +353,77 @@ static bool GenerateGetDeviceInfo(circular_buffer_t *Cbuff)
                                                                           NULL);
     CircularBuffer_WriteNoIncrement(Cbuff, (uint8_t)(crc16),      &count, NULL, 
                                                                           NULL);
+    CircularBuffer_WriteEndNoIncrement(Cbuff, &count);
 
     /* Check if the message fit inside the buffer */
     return CircularBuffer_Increment(Cbuff, count);
 }
 
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
 /**
- * @brief                   Calculates the length of a string but with
- *                          maximum length termination.
+ * @brief               Generates an ACK from the response cache.
  * 
- * @param[in] str           Pointer to the string.
- * @param[in] max_length    Maximum length/timeout.
- * @return                  Returns the length of the string.
+ * @param[out] Cbuff    Pointer to the circular buffer to put the data in.
+ * @return              HAL_FAILED if the message didn't fit or HAL_SUCCESS
+ *                      if it did fit.
  */
-uint32_t myStrlen(const uint8_t *str, const uint32_t max_length)
+bool GenerateACK(circular_buffer_t *Cbuff)
 {
-    const uint8_t *s;
-    s = str;
+    return ResponseCache_Write(&ack_cache, 0, EncodeACK, Cbuff);
+}
 
-    while ((*s != '\0') && ((uint32_t)(s - str) < max_length))
-        s++;
+/**
+ * @brief               Generates a Ping from the response cache.
+ * 
+ * @param[out] Cbuff    Pointer to the circular buffer to put the data in.
+ * @return              HAL_FAILED if the message didn't fit or HAL_SUCCESS
+ *                      if it did fit.
+ */
+bool GeneratePing(circular_buffer_t *Cbuff)
+{
+    return ResponseCache_Write(&ping_cache, 0, EncodePing, Cbuff);
+}
 
-    return (s - str);
+/**
+ * @brief               Generates the message for the current running mode
+ *                      from the response cache.
+ * 
+ * @param[out] Cbuff    Pointer to the circular buffer to put the data in.
+ * @return              HAL_FAILED if the message didn't fit or HAL_SUCCESS
+ *                      if it did fit.
+ */
+bool GenerateGetRunningMode(circular_buffer_t *Cbuff)
+{
+    return ResponseCache_Write(&running_mode_cache,
+                               0,
+                               EncodeGetRunningMode,
+                               Cbuff);
 }
 
-/*===========================================================================*/
-/* Module exported functions.                                                */
-/*===========================================================================*/
+/**
+ * @brief               Generates the message for the the ID of the system
+ *                      from the response cache, it is encoded again when
+ *                      the user ID string has changed.
+ * 
+ * @param[out] Cbuff    Pointer to the circular buffer to put the data in.
+ * @return              HAL_FAILED if the message didn't fit or HAL_SUCCESS
+ *                      if it did fit.
+ */
+bool GenerateGetDeviceInfo(circular_buffer_t *Cbuff)
+{
+    return ResponseCache_Write(&device_info_cache,
+                               ulGetUserIDRevision(),
+                               EncodeGetDeviceInfo,
+                               Cbuff);
+}
 
  /**
   * @brief              Generate a message for the ports based on the
-  *                     generators in the lookup table.
+  *                     generators in the command table, fails at once if
+  *                     the message does not fit.
   * 
   * @param[in] command  The command to generate a message for.
   * @param[in] port     Which port to send the data.
@@ -288,40 +432,30 @@ uint32_t myStrlen(const uint8_t *str, const uint32_t max_length)
   */
 bool GenerateMessage(KFly_Command command, External_Port port)
 {
-    bool status;
-    circular_buffer_t *Cbuff = NULL;
-
-    Cbuff = SerialManager_GetCircularBufferFromPort(port);
-
-    /* Check so the circular buffer address is valid and that
-       we are inside the lookup table */
-    if (Cbuff == NULL || command > 17)
-        return HAL_FAILED;
-
-    /* Check so there is an available Generator function for this command */
-    if (generator_lookup[command] != NULL)
-    {
-        /* Claim the circular buffer for writing */
-        CircularBuffer_Claim(Cbuff);
-        {
-            status = generator_lookup[command](Cbuff);
-        }
-        /* Release the circular buffer */
-        CircularBuffer_Release(Cbuff);
-
-        /* If it was successful then start the transmission */
-        if (status == HAL_SUCCESS)
-            SerialManager_StartTransmission(port);
-    }
-    else
-        status = HAL_FAILED;
-    
-    return status;
+    return GenerateMessageTimeout(command, port, TIME_IMMEDIATE);
 }
 
  /**
   * @brief              Generate a message for the ports based on the
-  *                     generators in the lookup table.
+  *                     generators in the command table, waits for the data
+  *                     pump to make room in the lane if needed.
+  * 
+  * @param[in] command  The command to generate a message for.
+  * @param[in] port     Which port to send the data.
+  * @param[in] timeout  Longest time to wait for room in the lane.
+  * @return             HAL_FAILED if the message didn't fit in time or
+  *                     HAL_SUCCESS if it did fit.
+  */
+bool GenerateMessageTimeout(KFly_Command command,
+                            External_Port port,
+                            systime_t timeout)
+{
+    return QueueFrame(command, NULL, 0, false, port, timeout);
+}
+
+ /**
+  * @brief              Generate a message with custom data for the ports,
+  *                     fails at once if the message does not fit.
   * 
   * @param[in] command  The command to generate a custom message for.
   * @param[in] data     Pointer to the data to be sent.
@@ -335,32 +469,33 @@ bool GenerateCustomMessage(KFly_Command command,
                            uint16_t size,
                            External_Port port)
 {
-    bool status;
-    circular_buffer_t *Cbuff = NULL;
-
-    Cbuff = SerialManager_GetCircularBufferFromPort(port);
-
-    /* Check so the circular buffer address is valid and that
-           we are inside the lookup table */
-    if (Cbuff == NULL || command > 17)
-        return HAL_FAILED;
-
-    /* Claim the circular buffer for writing */
-    CircularBuffer_Claim(Cbuff);
-    {
-        status = GenerateGenericCommand(command,
+    return GenerateCustomMessageTimeout(command,
                                         data,
                                         size,
-                                        Cbuff);
-    }
-    /* Release the circular buffer */
-    CircularBuffer_Release(Cbuff);
-
-    /* If it was successful then start the transmission */
-    if (status == HAL_SUCCESS)
-        SerialManager_StartTransmission(port);
-    
-    return status;
+                                        port,
+                                        TIME_IMMEDIATE);
+}
+
+ /**
+  * @brief              Generate a message with custom data for the ports,
+  *                     waits for the data pump to make room in the lane if
+  *                     needed.
+  * 
+  * @param[in] command  The command to generate a custom message for.
+  * @param[in] data     Pointer to the data to be sent.
+  * @param[in] size     Size of the data to be sent.
+  * @param[in] port     Which port to send the data.
+  * @param[in] timeout  Longest time to wait for room in the lane.
+  * @return             HAL_FAILED if the message didn't fit in time or
+  *                     HAL_SUCCESS if it did fit.
+  */
+bool GenerateCustomMessageTimeout(KFly_Command command,
+                                  uint8_t *data,
+                                  uint16_t size,
+                                  External_Port port,
+                                  systime_t timeout)
+{
+    return QueueFrame(command, data, size, true, port, timeout);
 }
 
 
@@ -2,7 +2,7 @@
  *
  * All the parsers for the different packages.
  * To expand the functionality of the serial communication is just to add
- * functions here and add them to the parser_lookup table.
+ * functions here and add them to SERIAL_COMMAND_TABLE.
  *
  * */
 
@@ -13,16 +13,25 @@
 #include "statemachine_generators.h"
 #include "serialmanager.h"
 #include "crc.h"
+#include "thread_statistics.h"
+#include "trace.h"
+#include "flash_functionality.h"
+#include "firmware_readback.h"
 #include "statemachine_parsers.h"
 
 /*===========================================================================*/
 /* Module local definitions.                                                 */
 /*===========================================================================*/
 
-static void ParsePing(parser_holder_t *pHolder);
-static void ParseGetRunningMode(parser_holder_t *pHolder);
-static void ParseGetDeviceInfo(parser_holder_t *pHolder);
+/**
+ * @brief   Number of trace records in one dump frame.
+ */
+#define TRACE_DUMP_RECORDS            30
 
+/**
+ * @brief   Time the parsers wait for room in a transmit lane.
+ */
+#define PARSER_GENERATE_TIMEOUT       MS2ST(SERIAL_GENERATE_TIMEOUT_MS)
 
 /*===========================================================================*/
 /* Module exported variables.                                                */
@@ -33,28 +42,23 @@ static void ParseGetDeviceInfo(parser_holder_t *pHolder);
 /*===========================================================================*/
 
 /**
- * @brief Lookup table for all the serial parsers.
+ * @brief   A frame of the trace dump, an empty frame ends the dump.
  */
-static const parser_t parser_lookup[18] = {
-    NULL,                             /* 0:   Cmd_None                        */
-    NULL,                             /* 1:   Cmd_ACK                         */
-    ParsePing,                        /* 2:   Cmd_Ping                        */
-    NULL,                             /* 3:   Cmd_DebugMessage                */
-    ParseGetRunningMode,              /* 4:   Cmd_GetRunningMode              */
-    NULL,                             /* 5:                                   */
-    NULL,                             /* 6:                                   */
-    NULL,                             /* 7:                                   */
-    NULL,                             /* 8:                                   */
-    NULL,                             /* 9:                                   */
-    NULL,                             /* 10:  Cmd_PrepareWriteFirmware        */
-    NULL,                             /* 11:  Cmd_WriteFirmwarePackage        */
-    NULL,                             /* 12:  Cmd_WriteLastFirmwarePackage    */
-    NULL,                             /* 13:  Cmd_ReadFirmwarePackage         */
-    NULL,                             /* 14:  Cmd_ReadLastFirmwarePackage     */
-    NULL,                             /* 15:  Cmd_NextPackage                 */
-    NULL,                             /* 16:  Cmd_ExitBootloader              */
-    ParseGetDeviceInfo                /* 17:  Cmd_GetBootloaderVersion        */
-};
+typedef struct
+{
+    /**
+     * @brief   Free running index of the first record.
+     */
+    uint32_t index;
+    /**
+     * @brief   Frequency of the record timestamps in Hz.
+     */
+    uint32_t clock;
+    /**
+     * @brief   The records.
+     */
+    trace_record_t records[TRACE_DUMP_RECORDS];
+} trace_dump_frame_t;
 
 /*===========================================================================*/
 /* Module local functions.                                                   */
@@ -85,15 +89,19 @@ static void GenericSaveData(uint8_t *save_location,
     osalSysUnlock();
 }
 
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
 /**
  * @brief               Parses a Ping command.
  * 
  * @param[in] pHolder   Message holder containing information
  *                      about the transmission. 
  */
-static void ParsePing(parser_holder_t *pHolder)
+void ParsePing(parser_holder_t *pHolder)
 {
-    GenerateMessage(Cmd_Ping, pHolder->Port);
+    GenerateMessageTimeout(Cmd_Ping, pHolder->Port, PARSER_GENERATE_TIMEOUT);
 }
 
 /**
@@ -102,9 +110,9 @@ static void ParsePing(parser_holder_t *pHolder)
  * @param[in] pHolder   Message holder containing information
  *                      about the transmission.
  */
-static void ParseGetRunningMode(parser_holder_t *pHolder)
+void ParseGetRunningMode(parser_holder_t *pHolder)
 {
-    GenerateMessage(Cmd_GetRunningMode, pHolder->Port);
+    GenerateMessageTimeout(Cmd_GetRunningMode, pHolder->Port, PARSER_GENERATE_TIMEOUT);
 }
 
 
@@ -114,25 +122,191 @@ static void ParseGetRunningMode(parser_holder_t *pHolder)
  * @param[in] pHolder   Message holder containing information
  *                      about the transmission.
  */
-static void ParseGetDeviceInfo(parser_holder_t *pHolder)
+void ParseGetDeviceInfo(parser_holder_t *pHolder)
 {
-    GenerateMessage(Cmd_GetDeviceInfo, pHolder->Port);
+    GenerateMessageTimeout(Cmd_GetDeviceInfo, pHolder->Port, PARSER_GENERATE_TIMEOUT);
 }
 
-/*===========================================================================*/
-/* Module exported functions.                                                */
-/*===========================================================================*/
+/**
+ * @brief               Parses a SetDeviceID command, the data is the new
+ *                      user ID string.
+ * 
+ * @param[in] pHolder   Message holder containing information
+ *                      about the transmission.
+ */
+void ParseSetDeviceID(parser_holder_t *pHolder)
+{
+    vSetUserIDString(pHolder->buffer, pHolder->data_length);
+}
+
+/**
+ * @brief               Parses a SetFraming command. The ACK is generated
+ *                      here so that it goes out in the old framing.
+ * 
+ * @param[in] pHolder   Message holder containing information
+ *                      about the transmission.
+ */
+void ParseSetFraming(parser_holder_t *pHolder)
+{
+    if ((pHolder->data_length != 1) || (pHolder->buffer[0] > FRAMING_RAW))
+        return;
+
+    if (pHolder->AckRequested == true)
+    {
+        GenerateMessageTimeout(Cmd_ACK,
+                               pHolder->Port,
+                               PARSER_GENERATE_TIMEOUT);
+        pHolder->AckRequested = false;
+    }
+
+    SerialManager_SetFraming(pHolder->Port, (Serial_Framing)pHolder->buffer[0]);
+}
+
+/**
+ * @brief               Parses a GetLinkStatistics command, the statistics
+ *                      of the requested port are sent back on the
+ *                      receiving port.
+ * 
+ * @param[in] pHolder   Message holder containing information
+ *                      about the transmission.
+ */
+void ParseGetLinkStatistics(parser_holder_t *pHolder)
+{
+    serial_statistics_t stats;
+    External_Port port = pHolder->Port;
+
+    if (pHolder->data_length > 1)
+        return;
+    else if (pHolder->data_length == 1)
+        port = (External_Port)pHolder->buffer[0];
+
+    if (SerialManager_GetStatistics(port, &stats) != HAL_SUCCESS)
+        return;
+
+    GenerateCustomMessageTimeout(Cmd_GetLinkStatistics,
+                                 (uint8_t *)&stats,
+                                 sizeof(serial_statistics_t),
+                                 pHolder->Port,
+                                 PARSER_GENERATE_TIMEOUT);
+}
 
 /**
- * @brief               Return the parser associated to the command.
+ * @brief               Parses a GetThreadStatistics command, one page of
+ *                      thread statistics is sent back.
  * 
- * @param[in] command   Command to get the parser for.
- * @return              Pointer to the associated parser.
+ * @param[in] pHolder   Message holder containing information
+ *                      about the transmission.
+ */
+void ParseGetThreadStatistics(parser_holder_t *pHolder)
+{
+    thread_statistics_page_t page;
+    uint8_t first = 0;
+    size_t size;
+
+    if (pHolder->data_length > 1)
+        return;
+    else if (pHolder->data_length == 1)
+        first = pHolder->buffer[0];
+
+    size = xSystemGetThreadStatistics(first, &page);
+
+    GenerateCustomMessageTimeout(Cmd_GetThreadStatistics,
+                                 (uint8_t *)&page,
+                                 size,
+                                 pHolder->Port,
+                                 PARSER_GENERATE_TIMEOUT);
+}
+
+/**
+ * @brief               Parses a DumpTrace command, the trace ring is sent
+ *                      as a stream of Cmd_DumpTrace frames ended by a frame
+ *                      without records. Tracing is paused during the dump.
+ * 
+ * @param[in] pHolder   Message holder containing information
+ *                      about the transmission.
+ */
+void ParseDumpTrace(parser_holder_t *pHolder)
+{
+    trace_dump_frame_t frame;
+    uint32_t index = 0, count;
+
+    if (pHolder->data_length == 4)
+        index = ((uint32_t)pHolder->buffer[0])       |
+                ((uint32_t)pHolder->buffer[1] << 8)  |
+                ((uint32_t)pHolder->buffer[2] << 16) |
+                ((uint32_t)pHolder->buffer[3] << 24);
+    else if (pHolder->data_length != 0)
+        return;
+
+    Trace_Freeze(true);
+
+    frame.clock = STM32_HCLK;
+
+    do
+    {
+        count = Trace_Read(&index, frame.records, TRACE_DUMP_RECORDS);
+        frame.index = index;
+
+        /* Waits for the data pump to make room in the bulk lane */
+        if (GenerateCustomMessageTimeout(Cmd_DumpTrace,
+                                         (uint8_t *)&frame,
+                                         8 + count * sizeof(trace_record_t),
+                                         pHolder->Port,
+                                         PARSER_GENERATE_TIMEOUT)
+                != HAL_SUCCESS)
+            break;
+
+        index += count;
+
+    } while (count > 0);
+
+    Trace_Freeze(false);
+}
+
+/**
+ * @brief               Parses a ReadFirmwarePackage command. The data is the
+ *                      address and size of the region to read (uint32_t
+ *                      each, little endian), the whole user flash is read
+ *                      if omitted. The frames are sent before the ACK.
+ * 
+ * @param[in] pHolder   Message holder containing information
+ *                      about the transmission.
+ */
+void ParseReadFirmwarePackage(parser_holder_t *pHolder)
+{
+    uint32_t address = FLASH_USER_BASE;
+    uint32_t size = FLASH_END_ADDRESS - FLASH_USER_BASE;
+    uint8_t *data = pHolder->buffer;
+
+    if (pHolder->data_length == 8)
+    {
+        address = ((uint32_t)data[0])       |
+                  ((uint32_t)data[1] << 8)  |
+                  ((uint32_t)data[2] << 16) |
+                  ((uint32_t)data[3] << 24);
+        size    = ((uint32_t)data[4])       |
+                  ((uint32_t)data[5] << 8)  |
+                  ((uint32_t)data[6] << 16) |
+                  ((uint32_t)data[7] << 24);
+    }
+    else if (pHolder->data_length != 0)
+        return;
+
+    FirmwareReadback_Stream(pHolder->Port, address, size);
+}
+
+/**
+ * @brief               Parses a SetFlowControl command. When enabled, the
+ *                      ACKs sent by the worker on the port carry the number
+ *                      of frames the device can take before it NAKs busy.
+ * 
+ * @param[in] pHolder   Message holder containing information
+ *                      about the transmission.
  */
-parser_t GetParser(KFly_Command command)
+void ParseSetFlowControl(parser_holder_t *pHolder)
 {
-    if (command > 17)
-        return NULL;
-    else
-        return parser_lookup[command];
+    if ((pHolder->data_length != 1) || (pHolder->buffer[0] > 1))
+        return;
+
+    SerialManager_SetFlowControl(pHolder->Port, (pHolder->buffer[0] == 1));
 }
@@ -1,5 +1,8 @@
 # List of all the module's related files.
 CRC_SRCS = $(MODULE_DIR)/crc/src/crc.c 
 
+# Files built for speed in release builds.
+CRC_SPEED_SRCS = $(CRC_SRCS)
+
 # Required include directories
 CRC_INC = $(MODULE_DIR)/crc/inc
@@ -25,5 +25,7 @@ uint8_t CRC8(uint8_t *data, uint32_t data_len);
 uint8_t CRC8_step(uint8_t data, uint8_t crc);
 uint16_t CRC16(uint8_t *data, uint32_t data_len);
 uint16_t CRC16_step(uint8_t data, uint16_t crc);
+uint16_t CRC16_chunk(const uint8_t *data, uint32_t data_len, uint16_t crc);
+uint32_t CRC32_chunk(const uint8_t *data, uint32_t data_len, uint32_t crc);
 
 #endif
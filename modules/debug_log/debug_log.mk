@@ -0,0 +1,5 @@
+# List of all the module's related files.
+DEBUGLOG_SRCS = $(MODULE_DIR)/debug_log/src/debug_log.c
+
+# Required include directories
+DEBUGLOG_INC = $(MODULE_DIR)/debug_log/inc
@@ -0,0 +1,93 @@
+#ifndef __DEBUG_LOG_H
+#define __DEBUG_LOG_H
+
+#include "statemachine.h"
+
+/*===========================================================================*/
+/* Module global definitions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Size of the log ring in 32-bit words.
+ */
+#ifndef DEBUG_LOG_RING_SIZE
+    #define DEBUG_LOG_RING_SIZE         256
+#endif
+
+/**
+ * @brief   Port the log is sent on. The CDC belongs to the ASCII console,
+ *          so the log goes to the USB bulk interface. Builds with
+ *          USB_UF2_MSC have no bulk port, the Makefile sends it to CAN.
+ */
+#ifndef DEBUG_LOG_PORT
+    #define DEBUG_LOG_PORT              PORT_USB_BULK
+#endif
+
+/**
+ * @brief   Time between flushes of the log ring.
+ */
+#ifndef DEBUG_LOG_FLUSH_INTERVAL_MS
+    #define DEBUG_LOG_FLUSH_INTERVAL_MS 20
+#endif
+
+/**
+ * @brief   Maximum number of arguments of a log message.
+ */
+#define DEBUG_LOG_MAX_ARGS              4
+
+/**
+ * @brief   First byte of a Cmd_DebugMessage holding binary log messages,
+ *          text messages never start with it.
+ */
+#define DEBUG_LOG_BINARY_MARKER         0x00
+
+/**
+ * @brief   Format ID of the message counting dropped messages.
+ */
+#define DEBUG_LOG_DROPPED_ID            0
+
+#if (DEBUG_LOG_RING_SIZE & (DEBUG_LOG_RING_SIZE - 1)) != 0
+#error "DEBUG_LOG_RING_SIZE must be a power of 2"
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/**
+ * @brief   Counts the arguments of a log message, 0 to 4.
+ */
+#define DEBUG_LOG_NARGS(...)                                                \
+    DEBUG_LOG_NARGS_(0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define DEBUG_LOG_NARGS_(_0, _1, _2, _3, _4, n, ...) n
+
+/**
+ * @brief   Logs a message with up to 4 integer or pointer arguments.
+ * @details The format string is placed in the .log_strings section, which
+ *          is not loaded, and only its address is logged. The message is
+ *          formatted on the host with the string table from the ELF file.
+ */
+#define DEBUG_LOG(fmt, ...)                                                 \
+    do {                                                                    \
+        static const char debug_log_fmt[]                                   \
+            __attribute__((section(".log_strings"), used)) = fmt;           \
+        DebugLog_Write((uint32_t)(uintptr_t)debug_log_fmt,                  \
+                       DEBUG_LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__);        \
+    } while (0)
+
+/*===========================================================================*/
+/* Module inline functions.                                                  */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+void DebugLog_Init(void);
+void DebugLog_Write(uint32_t id, uint32_t nargs, ...);
+
+#endif
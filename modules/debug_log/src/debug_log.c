@@ -0,0 +1,254 @@
+/* *
+ *
+ * Deferred binary debug log.
+ * A message is stored as the ID of its format string plus the raw
+ * arguments, a low priority thread ships the messages in Cmd_DebugMessage
+ * frames and the host does the formatting.
+ *
+ * Message in the ring and on the wire (little endian):
+ *   ID (uint32) | Time in ticks (uint32) | Number of arguments (uint32 in
+ *   the ring, uint8 on the wire) | Arguments (uint32 each)
+ *
+ * */
+
+#include <stdarg.h>
+#include "ch.h"
+#include "hal.h"
+#include "statemachine_generators.h"
+#include "debug_log.h"
+
+/*===========================================================================*/
+/* Module local definitions.                                                 */
+/*===========================================================================*/
+
+/**
+ * @brief   Number of ring words of a message besides the arguments.
+ */
+#define DEBUG_LOG_HEADER_WORDS          3
+
+/**
+ * @brief   Largest size of a message on the wire.
+ */
+#define DEBUG_LOG_MAX_MESSAGE_SIZE      (9 + 4 * DEBUG_LOG_MAX_ARGS)
+
+/**
+ * @brief   Size of the data part of a log frame.
+ */
+#define DEBUG_LOG_FRAME_SIZE            255
+
+/**
+ * @brief   Stack size of the log thread.
+ */
+#define DEBUG_LOG_STACK_SIZE            256
+
+/*===========================================================================*/
+/* Module exported variables.                                                */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module local variables and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   The log ring.
+ */
+CCM_MEMORY static uint32_t log_ring[DEBUG_LOG_RING_SIZE];
+
+/**
+ * @brief   Free running index of the next word to write.
+ */
+static uint32_t log_head;
+
+/**
+ * @brief   Free running index of the next word to send.
+ */
+static uint32_t log_tail;
+
+/**
+ * @brief   Messages dropped since the last flush.
+ */
+static uint32_t log_dropped;
+
+/**
+ * @brief   Frame being built by the log thread.
+ */
+static uint8_t log_frame[DEBUG_LOG_FRAME_SIZE];
+
+/**
+ * @brief   Working area for the log thread.
+ */
+static THD_WORKING_AREA(waDebugLogTask, DEBUG_LOG_STACK_SIZE);
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+/**
+ * @brief               Appends a 32-bit value to a frame, little endian.
+ *
+ * @param[out] frame    Pointer to where the value is written.
+ * @param[in] value     The value.
+ * @return              Number of bytes written.
+ */
+static uint32_t LogPutWord(uint8_t *frame, uint32_t value)
+{
+    frame[0] = (uint8_t)(value);
+    frame[1] = (uint8_t)(value >> 8);
+    frame[2] = (uint8_t)(value >> 16);
+    frame[3] = (uint8_t)(value >> 24);
+
+    return 4;
+}
+
+/**
+ * @brief               Builds a frame of log messages from the ring.
+ *
+ * @param[out] tail     The ring position after the messages in the frame.
+ * @param[out] dropped  The number of dropped messages reported.
+ * @return              Size of the frame, 1 if there are no messages.
+ */
+static uint32_t LogBuildFrame(uint32_t *tail, uint32_t *dropped)
+{
+    uint32_t head, nargs, i, size = 0;
+
+    osalSysLock();
+    head = log_head;
+    *dropped = log_dropped;
+    osalSysUnlock();
+
+    *tail = log_tail;
+    log_frame[size++] = DEBUG_LOG_BINARY_MARKER;
+
+    /* Report lost messages first, as a message with one argument */
+    if (*dropped > 0)
+    {
+        size += LogPutWord(&log_frame[size], DEBUG_LOG_DROPPED_ID);
+        size += LogPutWord(&log_frame[size], chVTGetSystemTimeX());
+        log_frame[size++] = 1;
+        size += LogPutWord(&log_frame[size], *dropped);
+    }
+
+    while ((head != *tail) &&
+           ((size + DEBUG_LOG_MAX_MESSAGE_SIZE) <= DEBUG_LOG_FRAME_SIZE))
+    {
+        nargs = log_ring[(*tail + 2) & (DEBUG_LOG_RING_SIZE - 1)];
+
+        size += LogPutWord(&log_frame[size],
+                           log_ring[*tail & (DEBUG_LOG_RING_SIZE - 1)]);
+        size += LogPutWord(&log_frame[size],
+                           log_ring[(*tail + 1) & (DEBUG_LOG_RING_SIZE - 1)]);
+        log_frame[size++] = (uint8_t)nargs;
+
+        for (i = 0; i < nargs; i++)
+            size += LogPutWord(&log_frame[size],
+                               log_ring[(*tail + DEBUG_LOG_HEADER_WORDS + i) &
+                                        (DEBUG_LOG_RING_SIZE - 1)]);
+
+        *tail += DEBUG_LOG_HEADER_WORDS + nargs;
+    }
+
+    return size;
+}
+
+/**
+ * @brief               Ships the log ring, the messages stay in the ring
+ *                      until the frame is queued.
+ *
+ * @param[in] arg       Unused.
+ */
+__attribute__((noreturn))
+static THD_FUNCTION(DebugLogTask, arg)
+{
+    (void)arg;
+    uint32_t size, tail, dropped;
+
+    chRegSetThreadName("Debug Log");
+
+    while (1)
+    {
+        chThdSleepMilliseconds(DEBUG_LOG_FLUSH_INTERVAL_MS);
+
+        do
+        {
+            size = LogBuildFrame(&tail, &dropped);
+
+            if (size <= 1)
+                break;
+
+            /* Retry on the next flush if the port is busy or down */
+            if (GenerateCustomMessage(Cmd_DebugMessage,
+                                      log_frame,
+                                      size,
+                                      DEBUG_LOG_PORT) != HAL_SUCCESS)
+                break;
+
+            osalSysLock();
+            log_tail = tail;
+            log_dropped -= dropped;
+            osalSysUnlock();
+
+        } while (1);
+    }
+}
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Empties the log ring and starts the log thread.
+ */
+void DebugLog_Init(void)
+{
+    log_head = 0;
+    log_tail = 0;
+    log_dropped = 0;
+
+    chThdCreateStatic(waDebugLogTask,
+                      sizeof(waDebugLogTask),
+                      NORMALPRIO - 2,
+                      DebugLogTask,
+                      NULL);
+}
+
+/**
+ * @brief               Stores a log message, use DEBUG_LOG() instead.
+ * @note                Can be called from any context. If the ring is full
+ *                      the message is dropped and counted.
+ *
+ * @param[in] id        Address of the format string in .log_strings.
+ * @param[in] nargs     Number of arguments, at most DEBUG_LOG_MAX_ARGS.
+ * @param[in] ...       The arguments, 32-bit integers or pointers.
+ */
+void DebugLog_Write(uint32_t id, uint32_t nargs, ...)
+{
+    uint32_t args[DEBUG_LOG_MAX_ARGS];
+    uint32_t i;
+    syssts_t sts;
+    va_list ap;
+
+    if (nargs > DEBUG_LOG_MAX_ARGS)
+        nargs = DEBUG_LOG_MAX_ARGS;
+
+    va_start(ap, nargs);
+    for (i = 0; i < nargs; i++)
+        args[i] = va_arg(ap, uint32_t);
+    va_end(ap);
+
+    sts = chSysGetStatusAndLockX();
+
+    if ((DEBUG_LOG_RING_SIZE - (log_head - log_tail)) <
+        (DEBUG_LOG_HEADER_WORDS + nargs))
+        log_dropped++;
+    else
+    {
+        log_ring[log_head++ & (DEBUG_LOG_RING_SIZE - 1)] = id;
+        log_ring[log_head++ & (DEBUG_LOG_RING_SIZE - 1)] = chVTGetSystemTimeX();
+        log_ring[log_head++ & (DEBUG_LOG_RING_SIZE - 1)] = nargs;
+
+        for (i = 0; i < nargs; i++)
+            log_ring[log_head++ & (DEBUG_LOG_RING_SIZE - 1)] = args[i];
+    }
+
+    chSysRestoreStatusX(sts);
+}
@@ -1,6 +1,7 @@
 # List of all the module's related files.
 FLASHPROG_SRCS = $(MODULE_DIR)/flash_programming/src/stm32f4xx_flash.c \
-                 $(MODULE_DIR)/flash_programming/src/flash_functionality.c
+                 $(MODULE_DIR)/flash_programming/src/flash_functionality.c \
+                 $(MODULE_DIR)/flash_programming/src/flash_pipeline.c
 
 # Required include directories
 FLASHPROG_INC = $(MODULE_DIR)/flash_programming/inc
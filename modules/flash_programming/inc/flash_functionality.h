@@ -7,6 +7,22 @@
 /* Module global definitions.                                                */
 /*===========================================================================*/
 
+/**
+ * @brief   Number of flash sectors of the STM32F405.
+ */
+#define FLASH_NUM_SECTORS           12
+
+/**
+ * @brief   End of the flash.
+ */
+#define FLASH_END_ADDRESS           (FLASH_BASE + 0x100000)
+
+/**
+ * @brief   Start of the user application, the bootloader owns the sectors
+ *          below it (sectors 0 to 5).
+ */
+#define FLASH_USER_BASE             (FLASH_BASE + 0x20000)
+
 /*===========================================================================*/
 /* Module data structures and types.                                         */
 /*===========================================================================*/
@@ -24,6 +40,8 @@
 /*===========================================================================*/
 
 uint32_t FlashGetSector(uint32_t base_sector, uint32_t size);
+uint32_t FlashGetSectorIndex(uint32_t address);
+uint32_t FlashGetSectorSize(uint32_t index);
 FLASH_Status FlashEraseFromSector(uint32_t base_sector, uint32_t size);
 
 #endif
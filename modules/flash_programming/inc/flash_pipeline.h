@@ -0,0 +1,153 @@
+#ifndef __FLASH_PIPELINE_H
+#define __FLASH_PIPELINE_H
+
+#include "flash_functionality.h"
+#include "image_verify.h"
+
+/*===========================================================================*/
+/* Module global definitions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Number of job buffers, one is programmed while the next is
+ *          filled.
+ */
+#define FLASH_PIPELINE_BUFFERS          2
+
+/**
+ * @brief   Size of the data of a program job in bytes.
+ */
+#define FLASH_PIPELINE_BLOCK_SIZE       2048
+
+/**
+ * @brief   Stack size of the flash writer thread, it also runs the image
+ *          decryption and the SHA-512 of the image check. The deepest call
+ *          chain of the thread, through SHA512_Blocks, takes 464 bytes on
+ *          x86-64 at -O0 (-fcallgraph-info=su), the rest is margin for
+ *          the interrupt frames and the differences of the ARM build.
+ */
+#define FLASH_PIPELINE_STACK_SIZE       1024
+
+/**
+ * @brief   Stack size of the image check thread, it runs the Ed25519
+ *          signature check. The deepest call chain of the thread takes
+ *          2336 bytes on x86-64 at -O0 (-fcallgraph-info=su).
+ */
+#define FLASH_CHECK_STACK_SIZE          3072
+
+/**
+ * @brief   Typical sector erase times at 2.7V to 3.6V, in ms.
+ */
+#define FLASH_ERASE_16K_MS              250
+#define FLASH_ERASE_64K_MS              550
+#define FLASH_ERASE_128K_MS             1000
+
+/**
+ * @brief   Typical word program time at 2.7V to 3.6V, in us.
+ */
+#define FLASH_PROGRAM_WORD_US           16
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Flash job types.
+ */
+typedef enum
+{
+    /**
+     * @brief   Erase all sectors overlapping the range.
+     */
+    FLASH_JOB_ERASE = 0,
+    /**
+     * @brief   Program the data, sectors not erased since
+     *          FlashPipeline_Begin are erased first.
+     */
+    FLASH_JOB_PROGRAM
+} flash_job_type_t;
+
+/**
+ * @brief   Users of the flash pipeline. One of them owns the session from
+ *          FlashPipeline_Begin to FlashPipeline_End, the others are
+ *          refused meanwhile.
+ */
+typedef enum
+{
+    FLASH_OWNER_NONE = 0,
+    /**
+     * @brief   HEX, S-record and WRITE uploads of the ASCII console.
+     */
+    FLASH_OWNER_CONSOLE,
+    /**
+     * @brief   DfuSe downloads.
+     */
+    FLASH_OWNER_DFU,
+    /**
+     * @brief   UF2 files copied to the mass storage disk.
+     */
+    FLASH_OWNER_MSC
+} flash_owner_t;
+
+/**
+ * @brief   A flash job.
+ */
+typedef struct
+{
+    /**
+     * @brief   What to do.
+     */
+    flash_job_type_t type;
+    /**
+     * @brief   Start address of the range, word aligned for programming.
+     */
+    uint32_t address;
+    /**
+     * @brief   Size of the range in bytes.
+     */
+    uint32_t size;
+    /**
+     * @brief   Sectors to erase before the job, set on submit.
+     */
+    uint16_t erase_mask;
+    /**
+     * @brief   Estimated time of the job in ms, set on submit.
+     */
+    uint32_t estimate_ms;
+    /**
+     * @brief   The data to program.
+     */
+    uint32_t data[FLASH_PIPELINE_BLOCK_SIZE / 4];
+} flash_job_t;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module inline functions.                                                  */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+void FlashPipeline_Init(void);
+bool FlashPipeline_BeginI(flash_owner_t owner, uint32_t base, uint32_t end);
+bool FlashPipeline_Begin(flash_owner_t owner, uint32_t base, uint32_t end);
+void FlashPipeline_EndI(flash_owner_t owner);
+void FlashPipeline_End(flash_owner_t owner);
+bool FlashPipeline_CheckI(flash_owner_t owner);
+bool FlashPipeline_CheckDoneI(image_status_t *status);
+flash_job_t *FlashPipeline_GetJobI(void);
+flash_job_t *FlashPipeline_GetJob(systime_t timeout);
+void FlashPipeline_ReleaseI(flash_job_t *job);
+bool FlashPipeline_SubmitI(flash_job_t *job);
+bool FlashPipeline_Submit(flash_job_t *job);
+FLASH_Status FlashPipeline_Wait(systime_t timeout);
+FLASH_Status FlashPipeline_GetStatusI(void);
+bool FlashPipeline_IsIdleI(void);
+uint32_t FlashPipeline_PendingTimeMsI(void);
+uint32_t FlashPipeline_NextFreeTimeMsI(void);
+
+#endif
@@ -7,6 +7,7 @@
 #include "ch.h"
 #include "hal.h"
 #include "flash_functionality.h"
+#include "trace.h"
 
 /*===========================================================================*/
 /* Module local definitions.                                                 */
@@ -20,6 +21,14 @@
 /* Module local variables and types.                                         */
 /*===========================================================================*/
 
+/**
+ * @brief   Sector sizes for STM32F405.
+ */
+static ROMCONST uint32_t sector_sizes[FLASH_NUM_SECTORS] = {
+    16*1024, 16*1024, 16*1024, 16*1024, 64*1024, 128*1024, 128*1024,
+    128*1024, 128*1024, 128*1024, 128*1024, 128*1024
+};
+
 /*===========================================================================*/
 /* Module local functions.                                                   */
 /*===========================================================================*/
@@ -41,16 +50,10 @@ uint32_t FlashGetSector(uint32_t base_sector, uint32_t size)
     /* Check the parameters */
     osalDbgCheck(IS_FLASH_SECTOR(base_sector));
 
-    /* Sector sizes for STM32F405 */
-    static ROMCONST uint32_t sector_sizes[] = {16*1024, 16*1024, 16*1024,
-                                               16*1024, 64*1024, 128*1024,
-                                               128*1024, 128*1024, 128*1024,
-                                               128*1024, 128*1024};
-
     uint32_t i = base_sector / FLASH_Sector_1, sum = 0;
 
     /* Sum sectors until requested size has been achieved. */
-    for (; i < sizeof(sector_sizes)/sizeof(sector_sizes[0]); i++)
+    for (; i < FLASH_NUM_SECTORS; i++)
     {
         sum += sector_sizes[i];
         if (sum >= size)
@@ -60,6 +63,42 @@ uint32_t FlashGetSector(uint32_t base_sector, uint32_t size)
     return (uint32_t)-1;
 }
 
+/**
+ * @brief                   Gets the index of the sector holding an address.
+ *
+ * @param[in] address       Address in the flash.
+ * @return                  The sector index. Returns -1 if the address is
+ *                          outside the flash.
+ */
+uint32_t FlashGetSectorIndex(uint32_t address)
+{
+    uint32_t i, base = FLASH_BASE;
+
+    for (i = 0; i < FLASH_NUM_SECTORS; i++)
+    {
+        if ((address >= base) && (address < (base + sector_sizes[i])))
+            return i;
+
+        base += sector_sizes[i];
+    }
+
+    return (uint32_t)-1;
+}
+
+/**
+ * @brief                   Gets the size of a sector.
+ *
+ * @param[in] index         Sector index.
+ * @return                  The size in bytes, 0 if the index is invalid.
+ */
+uint32_t FlashGetSectorSize(uint32_t index)
+{
+    if (index >= FLASH_NUM_SECTORS)
+        return 0;
+
+    return sector_sizes[index];
+}
+
 /**
  * @brief                   Erases as many sectors as needed, starting from
  *                          base_sector, to fit size bytes there.
@@ -87,7 +126,9 @@ FLASH_Status FlashEraseFromSector(uint32_t base_sector, uint32_t size)
     for (i = base_sector; i <= end_sector; i += FLASH_Sector_1)
     {
         /* Erasing at 2.7V to 3.6V */
+        TRACE_EVENT(TRACE_FLASH_ERASE_START, 0, i / FLASH_Sector_1);
         status = FLASH_EraseSector(i, VoltageRange_3);
+        TRACE_EVENT(TRACE_FLASH_ERASE_END, 0, status);
 
         /* Check for errors. */
         if (status != FLASH_COMPLETE)
@@ -0,0 +1,746 @@
+/* *
+ *
+ * Asynchronous flash writer.
+ * Jobs are filled by the receiving side and executed by a writer thread,
+ * so the next block can be received while the previous one is programmed.
+ * Sectors are erased lazily the first time a job touches them, and data is
+ * programmed as a burst of words with the programming mode set up once.
+ * Jobs of encrypted images are decrypted before programming, programmed
+ * data is passed on to the streaming hash of the image check.
+ *
+ * The console, DFU and the UF2 disk all write through the pipeline. A
+ * session belongs to the user that began it until it ends it, the others
+ * are refused in the meantime and jobs are only accepted in a session.
+ * DFU and the UF2 disk end their sessions with a check of the image, run
+ * by a thread of its own as the signature check takes too long for the
+ * USB handlers.
+ *
+ * Note: The flash stalls all reads while it erases or programs, code
+ *       executing from flash waits for the operation to finish. The hosts
+ *       are told how long to stay away with the time estimates.
+ *
+ * */
+
+#include <string.h>
+#include "ch.h"
+#include "hal.h"
+#include "flash_pipeline.h"
+#include "image_verify.h"
+#include "image_decrypt.h"
+#include "trace.h"
+#include "debug_log.h"
+
+/*===========================================================================*/
+/* Module local definitions.                                                 */
+/*===========================================================================*/
+
+/**
+ * @brief   Flash error flags, cleared before each job.
+ */
+#define FLASH_ERROR_FLAGS       (FLASH_FLAG_EOP | FLASH_FLAG_OPERR |        \
+                                 FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR |    \
+                                 FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR)
+
+/*===========================================================================*/
+/* Module exported variables.                                                */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module local variables and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   The job buffers.
+ */
+static flash_job_t flash_jobs[FLASH_PIPELINE_BUFFERS];
+
+/**
+ * @brief   Mailbox buffers of the free and the pending jobs.
+ */
+static msg_t free_jobs_buffer[FLASH_PIPELINE_BUFFERS];
+static msg_t pending_jobs_buffer[FLASH_PIPELINE_BUFFERS];
+
+/**
+ * @brief   Jobs that can be filled.
+ */
+static mailbox_t free_jobs;
+
+/**
+ * @brief   Jobs waiting for the writer, in order of submission.
+ */
+static mailbox_t pending_jobs;
+
+/**
+ * @brief   Threads waiting for the writer to finish all jobs.
+ */
+static threads_queue_t idle_waiters;
+
+/**
+ * @brief   Number of submitted jobs not finished.
+ */
+static uint32_t jobs_busy;
+
+/**
+ * @brief   User owning the session, FLASH_OWNER_NONE between sessions.
+ */
+static flash_owner_t session_owner;
+
+/**
+ * @brief   Range jobs may write in, set by FlashPipeline_Begin. Empty
+ *          between sessions.
+ */
+static uint32_t region_base;
+static uint32_t region_end;
+
+/**
+ * @brief   Sectors erased, or scheduled to be erased, since
+ *          FlashPipeline_Begin.
+ */
+static uint16_t erase_scheduled;
+
+/**
+ * @brief   First error since FlashPipeline_Begin, jobs are skipped after an
+ *          error.
+ */
+static FLASH_Status pipeline_status;
+
+/**
+ * @brief   Sum of the estimates of the pending jobs.
+ */
+static uint32_t queued_ms;
+
+/**
+ * @brief   Estimate of the job being executed, 0 if the writer is idle.
+ */
+static uint32_t current_ms;
+
+/**
+ * @brief   System time the current job started.
+ */
+static systime_t current_start;
+
+/**
+ * @brief   Owner of the session whose image is being checked,
+ *          FLASH_OWNER_NONE if no check is running.
+ */
+static flash_owner_t check_owner;
+
+/**
+ * @brief   Result of the last image check.
+ */
+static image_status_t check_result;
+
+/**
+ * @brief   Signaled to start the image check.
+ */
+static BSEMAPHORE_DECL(check_request, true);
+
+/**
+ * @brief   Working area for the writer thread.
+ */
+static THD_WORKING_AREA(waFlashPipelineTask, FLASH_PIPELINE_STACK_SIZE);
+
+/**
+ * @brief   Working area for the image check thread.
+ */
+static THD_WORKING_AREA(waFlashCheckTask, FLASH_CHECK_STACK_SIZE);
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+/**
+ * @brief               Typical erase time of a sector.
+ *
+ * @param[in] index     Sector index.
+ * @return              The time in ms.
+ */
+static uint32_t FlashEraseTimeMs(uint32_t index)
+{
+    uint32_t size = FlashGetSectorSize(index);
+
+    if (size <= 16*1024)
+        return FLASH_ERASE_16K_MS;
+    else if (size <= 64*1024)
+        return FLASH_ERASE_64K_MS;
+    else
+        return FLASH_ERASE_128K_MS;
+}
+
+/**
+ * @brief               Programs words with the programming mode set up once
+ *                      for the whole burst.
+ * @note                The flash must be unlocked.
+ *
+ * @param[in] address   Word aligned address to program.
+ * @param[in] data      Pointer to the words.
+ * @param[in] words     Number of words.
+ * @return              The flash status.
+ */
+static FLASH_Status FlashProgramBurst(uint32_t address,
+                                      const uint32_t *data,
+                                      uint32_t words)
+{
+    FLASH_Status status = FLASH_WaitForLastOperation();
+    uint32_t i;
+
+    if (status != FLASH_COMPLETE)
+        return status;
+
+    FLASH->CR &= CR_PSIZE_MASK;
+    FLASH->CR |= FLASH_PSIZE_WORD;
+    FLASH->CR |= FLASH_CR_PG;
+
+    for (i = 0; i < words; i++)
+    {
+        *(__IO uint32_t *)address = data[i];
+        address += 4;
+
+        while ((FLASH->SR & FLASH_FLAG_BSY) != 0)
+            ;
+    }
+
+    /* The error flags are sticky, one check covers the whole burst */
+    status = FLASH_WaitForLastOperation();
+    FLASH->CR &= (~FLASH_CR_PG);
+
+    return status;
+}
+
+/**
+ * @brief               Executes a job.
+ *
+ * @param[in] job       Pointer to the job.
+ * @return              The flash status.
+ */
+static FLASH_Status FlashRunJob(flash_job_t *job)
+{
+    FLASH_Status status = FLASH_COMPLETE;
+    uint32_t i;
+
+    FLASH_Unlock();
+    FLASH_ClearFlag(FLASH_ERROR_FLAGS);
+
+    for (i = 0; (i < FLASH_NUM_SECTORS) && (status == FLASH_COMPLETE); i++)
+    {
+        if ((job->erase_mask & (1 << i)) == 0)
+            continue;
+
+        /* Erasing at 2.7V to 3.6V */
+        TRACE_EVENT(TRACE_FLASH_ERASE_START, 0, i);
+        status = FLASH_EraseSector(i * FLASH_Sector_1, VoltageRange_3);
+        TRACE_EVENT(TRACE_FLASH_ERASE_END, 0, status);
+    }
+
+    if ((status == FLASH_COMPLETE) && (job->type == FLASH_JOB_PROGRAM))
+    {
+        TRACE_EVENT(TRACE_FLASH_PROGRAM_START, 0, (job->size + 3) / 4);
+        status = FlashProgramBurst(job->address,
+                                   job->data,
+                                   (job->size + 3) / 4);
+        TRACE_EVENT(TRACE_FLASH_PROGRAM_END, 0, status);
+    }
+
+    FLASH_Lock();
+
+    return status;
+}
+
+/**
+ * @brief               Remaining time of the job being executed.
+ * @note                Must be called from a locked context.
+ *
+ * @return              The time in ms, at least 1 while a job runs.
+ */
+static uint32_t FlashCurrentTimeMsI(void)
+{
+    uint32_t elapsed;
+
+    if (current_ms == 0)
+        return 0;
+
+    elapsed = ST2MS(chVTTimeElapsedSinceX(current_start));
+
+    /* Running late, it's close to done */
+    if (elapsed >= current_ms)
+        return 1;
+
+    return current_ms - elapsed;
+}
+
+/**
+ * @brief               Flash writer, executes the jobs in order of
+ *                      submission.
+ *
+ * @param[in] arg       Unused.
+ */
+static THD_FUNCTION(FlashPipelineTask, arg)
+{
+    (void)arg;
+    msg_t msg;
+    flash_job_t *job;
+    FLASH_Status status;
+
+    chRegSetThreadName("Flash Writer");
+
+    while (1)
+    {
+        if (chMBFetch(&pending_jobs, &msg, TIME_INFINITE) != MSG_OK)
+            continue;
+
+        job = (flash_job_t *)msg;
+
+        osalSysLock();
+        queued_ms -= job->estimate_ms;
+        current_ms = (job->estimate_ms > 0) ? job->estimate_ms : 1;
+        current_start = chVTGetSystemTimeX();
+        osalSysUnlock();
+
+        /* After an error the rest of the session is skipped. A job the
+           decryption refuses fails the session unprogrammed. */
+        if (pipeline_status != FLASH_COMPLETE)
+        {
+            status = pipeline_status;
+        }
+        else if ((job->type == FLASH_JOB_PROGRAM) &&
+                 (ImageDecrypt_Job(job->address,
+                                   (uint8_t *)job->data,
+                                   job->size) != HAL_SUCCESS))
+        {
+            status = FLASH_ERROR_PROGRAM;
+        }
+        else
+        {
+            status = FlashRunJob(job);
+        }
+
+        if ((status == FLASH_COMPLETE) && (job->type == FLASH_JOB_PROGRAM))
+            ImageVerify_Update(job->address,
+                               (const uint8_t *)job->data,
+                               job->size);
+
+        osalSysLock();
+
+        if (pipeline_status == FLASH_COMPLETE)
+            pipeline_status = status;
+
+        current_ms = 0;
+        jobs_busy--;
+        chMBPostI(&free_jobs, (msg_t)job);
+
+        if (jobs_busy == 0)
+            osalThreadDequeueAllI(&idle_waiters, MSG_OK);
+
+        osalOsRescheduleS();
+        osalSysUnlock();
+    }
+}
+
+/**
+ * @brief               Image check, waits for the writer to finish the
+ *                      session, checks the image and ends the session.
+ *
+ * @param[in] arg       Unused.
+ */
+static THD_FUNCTION(FlashCheckTask, arg)
+{
+    (void)arg;
+    FLASH_Status flash;
+    image_status_t result;
+    rtcnt_t cycles;
+
+    chRegSetThreadName("Image Check");
+
+    while (1)
+    {
+        chBSemWait(&check_request);
+
+        flash = FlashPipeline_Wait(TIME_INFINITE);
+        result = ImageVerify_Check(&cycles);
+
+        DEBUG_LOG("Image: check %u (flash %u), %u cycles",
+                  result, flash, cycles);
+
+        osalSysLock();
+        check_result = result;
+        FlashPipeline_EndI(check_owner);
+        check_owner = FLASH_OWNER_NONE;
+        osalSysUnlock();
+    }
+}
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Initializes the job mailboxes and starts the writer.
+ * @note    The writer runs below the communication threads, it spends most
+ *          of its time waiting for the flash.
+ */
+void FlashPipeline_Init(void)
+{
+    uint32_t i;
+
+    chMBObjectInit(&free_jobs, free_jobs_buffer, FLASH_PIPELINE_BUFFERS);
+    chMBObjectInit(&pending_jobs, pending_jobs_buffer, FLASH_PIPELINE_BUFFERS);
+    osalThreadQueueObjectInit(&idle_waiters);
+
+    for (i = 0; i < FLASH_PIPELINE_BUFFERS; i++)
+        chMBPost(&free_jobs, (msg_t)&flash_jobs[i], TIME_IMMEDIATE);
+
+    jobs_busy = 0;
+    queued_ms = 0;
+    current_ms = 0;
+    session_owner = FLASH_OWNER_NONE;
+    check_owner = FLASH_OWNER_NONE;
+    check_result = IMAGE_NO_HEADER;
+    region_base = 0;
+    region_end = 0;
+    pipeline_status = FLASH_COMPLETE;
+
+    osalSysLock();
+    ImageDecrypt_ResetI();
+    ImageVerify_ResetI();
+    osalSysUnlock();
+
+    chThdCreateStatic(waFlashPipelineTask,
+                      sizeof(waFlashPipelineTask),
+                      NORMALPRIO - 2,
+                      FlashPipelineTask,
+                      NULL);
+
+    chThdCreateStatic(waFlashCheckTask,
+                      sizeof(waFlashCheckTask),
+                      NORMALPRIO - 3,
+                      FlashCheckTask,
+                      NULL);
+}
+
+/**
+ * @brief               Starts a programming session. Clears the errors and
+ *                      the record of erased sectors.
+ * @note                Must be called from a locked context.
+ *
+ * @param[in] owner     User starting the session, the owner of the session
+ *                      may start it again.
+ * @param[in] base      First address jobs may write.
+ * @param[in] end       Address after the last address jobs may write.
+ * @return              HAL_FAILED if another user owns the session, its jobs
+ *                      are still being written or its image is being
+ *                      checked, else HAL_SUCCESS.
+ */
+bool FlashPipeline_BeginI(flash_owner_t owner, uint32_t base, uint32_t end)
+{
+    if (check_owner != FLASH_OWNER_NONE)
+        return HAL_FAILED;
+
+    if ((owner != session_owner) &&
+        ((session_owner != FLASH_OWNER_NONE) || (jobs_busy > 0)))
+        return HAL_FAILED;
+
+    session_owner = owner;
+    region_base = base;
+    region_end = end;
+    erase_scheduled = 0;
+    pipeline_status = FLASH_COMPLETE;
+    ImageDecrypt_ResetI();
+    ImageVerify_ResetI();
+
+    return HAL_SUCCESS;
+}
+
+/**
+ * @brief               Starts a programming session. Clears the errors and
+ *                      the record of erased sectors.
+ *
+ * @param[in] owner     User starting the session.
+ * @param[in] base      First address jobs may write.
+ * @param[in] end       Address after the last address jobs may write.
+ * @return              HAL_FAILED if another user owns the session, else
+ *                      HAL_SUCCESS.
+ */
+bool FlashPipeline_Begin(flash_owner_t owner, uint32_t base, uint32_t end)
+{
+    bool status;
+
+    osalSysLock();
+    status = FlashPipeline_BeginI(owner, base, end);
+    osalSysUnlock();
+
+    return status;
+}
+
+/**
+ * @brief               Ends the session of the owner, nothing happens if
+ *                      it does not own the session. Submitted jobs are
+ *                      still written, the next session can start when they
+ *                      are done.
+ * @note                Must be called from a locked context.
+ *
+ * @param[in] owner     User ending its session.
+ */
+void FlashPipeline_EndI(flash_owner_t owner)
+{
+    if (owner != session_owner)
+        return;
+
+    session_owner = FLASH_OWNER_NONE;
+    region_base = 0;
+    region_end = 0;
+}
+
+/**
+ * @brief               Ends the session of the owner.
+ *
+ * @param[in] owner     User ending its session.
+ */
+void FlashPipeline_End(flash_owner_t owner)
+{
+    osalSysLock();
+    FlashPipeline_EndI(owner);
+    osalSysUnlock();
+}
+
+/**
+ * @brief               Ends the session of the owner with a check of the
+ *                      image. The check thread waits for the submitted
+ *                      jobs, checks the image, writes the result to the
+ *                      debug log and ends the session. No session can
+ *                      begin until then.
+ * @note                Must be called from a locked context.
+ *
+ * @param[in] owner     User ending its session.
+ * @return              HAL_FAILED if it does not own the session or a check
+ *                      is running, else HAL_SUCCESS.
+ */
+bool FlashPipeline_CheckI(flash_owner_t owner)
+{
+    if ((owner == FLASH_OWNER_NONE) || (owner != session_owner) ||
+        (check_owner != FLASH_OWNER_NONE))
+        return HAL_FAILED;
+
+    check_owner = owner;
+    chBSemSignalI(&check_request);
+
+    return HAL_SUCCESS;
+}
+
+/**
+ * @brief               Gets the result of the last image check.
+ * @note                Must be called from a locked context.
+ *
+ * @param[out] status   The result, set once the check is done.
+ * @return              False while the check is running.
+ */
+bool FlashPipeline_CheckDoneI(image_status_t *status)
+{
+    if (check_owner != FLASH_OWNER_NONE)
+        return false;
+
+    *status = check_result;
+
+    return true;
+}
+
+/**
+ * @brief               Takes a free job without waiting.
+ * @note                Must be called from a locked context.
+ *
+ * @return              Pointer to the job, NULL if all jobs are busy.
+ */
+flash_job_t *FlashPipeline_GetJobI(void)
+{
+    msg_t msg;
+
+    if (chMBFetchI(&free_jobs, &msg) != MSG_OK)
+        return NULL;
+
+    return (flash_job_t *)msg;
+}
+
+/**
+ * @brief               Takes a free job.
+ *
+ * @param[in] timeout   Time to wait for the writer to free a job.
+ * @return              Pointer to the job, NULL on timeout.
+ */
+flash_job_t *FlashPipeline_GetJob(systime_t timeout)
+{
+    msg_t msg;
+
+    if (chMBFetch(&free_jobs, &msg, timeout) != MSG_OK)
+        return NULL;
+
+    return (flash_job_t *)msg;
+}
+
+/**
+ * @brief               Gives back a job that was not submitted.
+ * @note                Must be called from a locked context.
+ *
+ * @param[in] job       Pointer to the job.
+ */
+void FlashPipeline_ReleaseI(flash_job_t *job)
+{
+    chMBPostI(&free_jobs, (msg_t)job);
+}
+
+/**
+ * @brief               Queues a filled job for the writer. The erase of the
+ *                      sectors the job needs and the time is estimated here.
+ *                      A job outside the session range, or outside a
+ *                      session, is given back.
+ * @note                Must be called from a locked context.
+ *
+ * @param[in] job       Pointer to the job.
+ * @return              HAL_FAILED if the range is invalid or HAL_SUCCESS if
+ *                      the job was queued.
+ */
+bool FlashPipeline_SubmitI(flash_job_t *job)
+{
+    uint32_t i, first, last, mask = 0;
+
+    first = FlashGetSectorIndex(job->address);
+    last = FlashGetSectorIndex(job->address + job->size - 1);
+
+    if ((job->size == 0) ||
+        (job->address < region_base) ||
+        (job->address + job->size > region_end) ||
+        (first == (uint32_t)-1) || (last == (uint32_t)-1) ||
+        ((job->type == FLASH_JOB_PROGRAM) &&
+         (((job->address & 3) != 0) ||
+          (job->size > FLASH_PIPELINE_BLOCK_SIZE))))
+    {
+        FlashPipeline_ReleaseI(job);
+        return HAL_FAILED;
+    }
+
+    for (i = first; i <= last; i++)
+        mask |= (1 << i);
+
+    /* Explicit erases are always done, programming only erases once */
+    if (job->type == FLASH_JOB_ERASE)
+        job->erase_mask = mask;
+    else
+        job->erase_mask = mask & ~erase_scheduled;
+
+    erase_scheduled |= mask;
+
+    job->estimate_ms = 0;
+
+    for (i = first; i <= last; i++)
+        if ((job->erase_mask & (1 << i)) != 0)
+            job->estimate_ms += FlashEraseTimeMs(i);
+
+    if (job->type == FLASH_JOB_PROGRAM)
+    {
+        /* Pad the last word with the erased value */
+        for (i = job->size; (i & 3) != 0; i++)
+            ((uint8_t *)job->data)[i] = 0xff;
+
+        job->estimate_ms += ((job->size + 3) / 4 * FLASH_PROGRAM_WORD_US +
+                             999) / 1000;
+    }
+
+    queued_ms += job->estimate_ms;
+    jobs_busy++;
+
+    /* Never full, there are as many slots as jobs */
+    chMBPostI(&pending_jobs, (msg_t)job);
+
+    return HAL_SUCCESS;
+}
+
+/**
+ * @brief               Queues a filled job for the writer.
+ *
+ * @param[in] job       Pointer to the job.
+ * @return              HAL_FAILED if the range is invalid or HAL_SUCCESS if
+ *                      the job was queued.
+ */
+bool FlashPipeline_Submit(flash_job_t *job)
+{
+    bool status;
+
+    osalSysLock();
+    status = FlashPipeline_SubmitI(job);
+    osalOsRescheduleS();
+    osalSysUnlock();
+
+    return status;
+}
+
+/**
+ * @brief               Waits for the writer to finish all submitted jobs.
+ *
+ * @param[in] timeout   Time to wait.
+ * @return              FLASH_BUSY on timeout, else the first error of the
+ *                      session or FLASH_COMPLETE.
+ */
+FLASH_Status FlashPipeline_Wait(systime_t timeout)
+{
+    FLASH_Status status;
+
+    osalSysLock();
+
+    if (jobs_busy > 0)
+        osalThreadEnqueueTimeoutS(&idle_waiters, timeout);
+
+    if (jobs_busy > 0)
+        status = FLASH_BUSY;
+    else
+        status = pipeline_status;
+
+    osalSysUnlock();
+
+    return status;
+}
+
+/**
+ * @brief               Gets the first error of the session.
+ * @note                Must be called from a locked context.
+ *
+ * @return              The flash status.
+ */
+FLASH_Status FlashPipeline_GetStatusI(void)
+{
+    return pipeline_status;
+}
+
+/**
+ * @brief               Checks if all submitted jobs are finished.
+ * @note                Must be called from a locked context.
+ *
+ * @return              True if the writer is idle.
+ */
+bool FlashPipeline_IsIdleI(void)
+{
+    return (jobs_busy == 0);
+}
+
+/**
+ * @brief               Estimates the time until all submitted jobs are
+ *                      finished.
+ * @note                Must be called from a locked context.
+ *
+ * @return              The time in ms.
+ */
+uint32_t FlashPipeline_PendingTimeMsI(void)
+{
+    return FlashCurrentTimeMsI() + queued_ms;
+}
+
+/**
+ * @brief               Estimates the time until a job is free.
+ * @note                Must be called from a locked context.
+ *
+ * @return              The time in ms, 0 if a job is free.
+ */
+uint32_t FlashPipeline_NextFreeTimeMsI(void)
+{
+    if (chMBGetUsedCountI(&free_jobs) > 0)
+        return 0;
+
+    return FlashCurrentTimeMsI();
+}
@@ -0,0 +1,14 @@
+# List of all the module's related files.
+IMAGEVERIFY_SRCS = $(MODULE_DIR)/image_verify/src/sha512.c \
+                   $(MODULE_DIR)/image_verify/src/ed25519.c \
+                   $(MODULE_DIR)/image_verify/src/aes.c \
+                   $(MODULE_DIR)/image_verify/src/image_verify.c \
+                   $(MODULE_DIR)/image_verify/src/image_decrypt.c
+
+# Files built for speed in release builds.
+IMAGEVERIFY_SPEED_SRCS = $(MODULE_DIR)/image_verify/src/sha512.c \
+                         $(MODULE_DIR)/image_verify/src/ed25519.c \
+                         $(MODULE_DIR)/image_verify/src/aes.c
+
+# Required include directories
+IMAGEVERIFY_INC = $(MODULE_DIR)/image_verify/inc
@@ -0,0 +1,64 @@
+#ifndef __AES_H
+#define __AES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*===========================================================================*/
+/* Module global definitions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Size of a block.
+ */
+#define AES_BLOCK_SIZE                (16)
+
+/**
+ * @brief   Largest number of rounds, AES-256.
+ */
+#define AES_MAX_ROUNDS                (14)
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Expanded encryption key.
+ */
+typedef struct
+{
+    /**
+     * @brief   Round keys, little endian columns.
+     */
+    uint32_t rk[4 * (AES_MAX_ROUNDS + 1)];
+    /**
+     * @brief   Number of rounds, 10 or 14.
+     */
+    uint32_t rounds;
+} aes_context_t;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module inline functions.                                                  */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+void AES_Init(void);
+bool AES_SetKey(aes_context_t *ctx, const uint8_t *key, size_t size);
+void AES_Encrypt(const aes_context_t *ctx,
+                 const uint8_t in[AES_BLOCK_SIZE],
+                 uint8_t out[AES_BLOCK_SIZE]);
+void AES_CTR_Xor(const aes_context_t *ctx,
+                 const uint8_t counter[AES_BLOCK_SIZE],
+                 uint32_t offset,
+                 uint8_t *data,
+                 size_t size);
+
+#endif
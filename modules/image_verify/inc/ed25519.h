@@ -0,0 +1,39 @@
+#ifndef __ED25519_H
+#define __ED25519_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*===========================================================================*/
+/* Module global definitions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Size of a public key and of a signature.
+ */
+#define ED25519_PUBLIC_KEY_SIZE       (32)
+#define ED25519_SIGNATURE_SIZE        (64)
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module inline functions.                                                  */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+bool Ed25519_Verify(const uint8_t signature[ED25519_SIGNATURE_SIZE],
+                    const uint8_t public_key[ED25519_PUBLIC_KEY_SIZE],
+                    const uint8_t *message,
+                    size_t size);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef __IMAGE_DECRYPT_H
+#define __IMAGE_DECRYPT_H
+
+#include "image_verify.h"
+
+/*===========================================================================*/
+/* Module global definitions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   One time programmable area of the STM32F405, 16 blocks of 32
+ *          bytes.
+ */
+#define IMAGE_OTP_BASE                0x1fff7800
+#define IMAGE_OTP_BLOCK_SIZE          32
+
+/**
+ * @brief   OTP block holding the image key, AES-128 uses its first 16
+ *          bytes. An erased block (all 0xff) means no key.
+ * @note    Lock the block after programming it, and set read protection
+ *          level 2 in the option bytes so that the debug port can not read
+ *          it.
+ */
+#ifndef IMAGE_KEY_OTP_BLOCK
+    #define IMAGE_KEY_OTP_BLOCK       15
+#endif
+
+/**
+ * @brief   Address of the image key.
+ */
+#define IMAGE_KEY_ADDRESS             (IMAGE_OTP_BASE +                       \
+                                       IMAGE_KEY_OTP_BLOCK *                  \
+                                       IMAGE_OTP_BLOCK_SIZE)
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module inline functions.                                                  */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+bool ImageDecrypt_KeyPresent(uint32_t cipher);
+void ImageDecrypt_ResetI(void);
+bool ImageDecrypt_Job(uint32_t address, uint8_t *data, uint32_t size);
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef __IMAGE_VERIFY_H
+#define __IMAGE_VERIFY_H
+
+#include "flash_functionality.h"
+#include "sha512.h"
+#include "ed25519.h"
+#include "aes.h"
+
+/*===========================================================================*/
+/* Module global definitions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Start of a signed image, its header is first.
+ */
+#define IMAGE_BASE                    FLASH_USER_BASE
+
+/**
+ * @brief   Space of the header, the application is linked to start after
+ *          it. Keeps the vector table aligned for VTOR.
+ */
+#define IMAGE_HEADER_SIZE             512
+
+/**
+ * @brief   Header magic, "KFLY" in memory.
+ */
+#define IMAGE_HEADER_MAGIC            0x594c464b
+
+/**
+ * @brief   Number of header bytes covered by the signature.
+ */
+#define IMAGE_HEADER_SIGNED_SIZE      (16 + SHA512_DIGEST_SIZE)
+
+/**
+ * @brief   Ciphers of the image after the header, other values are read as
+ *          unencrypted.
+ */
+#define IMAGE_CIPHER_NONE             0
+#define IMAGE_CIPHER_AES128_CTR       1
+#define IMAGE_CIPHER_AES256_CTR       2
+
+/**
+ * @brief   Ed25519 public key images are checked against, as a C
+ *          initializer from tools/image_sign.py.
+ * @note    The default is the test key of RFC 8032 whose secret key is
+ *          public, release builds must define their own.
+ */
+#if !defined(IMAGE_PUBLIC_KEY) && defined(BUILD_RELEASE)
+    #error "IMAGE_PUBLIC_KEY must be defined in release builds"
+#endif
+
+#ifndef IMAGE_PUBLIC_KEY
+    #define IMAGE_PUBLIC_KEY                                                  \
+        {0xd7, 0x5a, 0x98, 0x01, 0x82, 0xb1, 0x0a, 0xb7,                      \
+         0xd5, 0x4b, 0xfe, 0xd3, 0xc9, 0x64, 0x07, 0x3a,                      \
+         0x0e, 0xe1, 0x72, 0xf3, 0xda, 0xa6, 0x23, 0x25,                      \
+         0xaf, 0x02, 0x1a, 0x68, 0xf7, 0x07, 0x51, 0x1a}
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Header of a signed image, padded with 0xff to
+ *          IMAGE_HEADER_SIZE. The header itself is never encrypted.
+ */
+typedef struct
+{
+    /**
+     * @brief   IMAGE_HEADER_MAGIC.
+     */
+    uint32_t magic;
+    /**
+     * @brief   IMAGE_HEADER_SIZE.
+     */
+    uint32_t header_size;
+    /**
+     * @brief   Size of the image after the header.
+     */
+    uint32_t image_size;
+    /**
+     * @brief   Version of the image, not used by the bootloader.
+     */
+    uint32_t version;
+    /**
+     * @brief   SHA-512 of the image after the header.
+     */
+    uint8_t digest[SHA512_DIGEST_SIZE];
+    /**
+     * @brief   Ed25519 signature of the IMAGE_HEADER_SIGNED_SIZE bytes
+     *          before it.
+     */
+    uint8_t signature[ED25519_SIGNATURE_SIZE];
+    /**
+     * @brief   Cipher of the image, IMAGE_CIPHER_x. Not signed, a changed
+     *          value gives a wrong digest.
+     */
+    uint32_t cipher;
+    /**
+     * @brief   CTR counter block of the first byte after the header.
+     */
+    uint8_t counter[AES_BLOCK_SIZE];
+} image_header_t;
+
+/**
+ * @brief   Result of an image check.
+ */
+typedef enum
+{
+    IMAGE_VALID = 0,
+    IMAGE_NO_HEADER,
+    IMAGE_BAD_SIZE,
+    IMAGE_BAD_DIGEST,
+    IMAGE_BAD_SIGNATURE,
+    IMAGE_NO_KEY
+} image_status_t;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module inline functions.                                                  */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+image_status_t ImageVerify_CheckHeader(const image_header_t *header);
+void ImageVerify_ResetI(void);
+void ImageVerify_Update(uint32_t address, const uint8_t *data, uint32_t size);
+image_status_t ImageVerify_Check(rtcnt_t *cycles);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef __SHA512_H
+#define __SHA512_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*===========================================================================*/
+/* Module global definitions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Size of a SHA-512 digest and of a message block.
+ */
+#define SHA512_DIGEST_SIZE            (64)
+#define SHA512_BLOCK_SIZE             (128)
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   State of an incremental SHA-512.
+ */
+typedef struct
+{
+    /**
+     * @brief   Hash state.
+     */
+    uint64_t state[8];
+    /**
+     * @brief   Number of bytes hashed.
+     */
+    uint64_t count;
+    /**
+     * @brief   Bytes waiting for a full block.
+     */
+    uint8_t buffer[SHA512_BLOCK_SIZE];
+} sha512_context_t;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module inline functions.                                                  */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+void SHA512_Init(sha512_context_t *ctx);
+void SHA512_Update(sha512_context_t *ctx, const uint8_t *data, size_t size);
+void SHA512_Final(sha512_context_t *ctx, uint8_t digest[SHA512_DIGEST_SIZE]);
+
+#endif
@@ -0,0 +1,279 @@
+/* *
+ *
+ * AES-128 and AES-256 encryption (FIPS 197) and CTR mode (SP 800-38A).
+ * Only the forward cipher is needed for CTR. Rounds use one 1 KB T-table
+ * with the other three columns as rotations, which are free in the operands
+ * of the Cortex-M4. The tables are generated into RAM by AES_Init: no flash
+ * wait states on the lookups, and the M4 has no data cache whose timing
+ * could leak the key.
+ *
+ * Has no dependencies on the OS so that it can be tested on a host.
+ *
+ * */
+
+#include <string.h>
+#include "aes.h"
+
+/*===========================================================================*/
+/* Module local definitions.                                                 */
+/*===========================================================================*/
+
+#define ROTL32(x, n)    (((x) << (n)) | ((x) >> (32 - (n))))
+
+/*===========================================================================*/
+/* Module exported variables.                                                */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module local variables and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   S-box and T-table, T[x] = (2S, S, S, 3S) from the low byte.
+ */
+static uint8_t aes_sbox[256];
+static uint32_t aes_t[256];
+static bool aes_tables = false;
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+/**
+ * @brief               Multiplies by x in GF(2^8).
+ */
+static inline uint8_t GfDouble(uint8_t a)
+{
+    return (uint8_t)((a << 1) ^ (((a & 0x80) != 0) ? 0x1b : 0x00));
+}
+
+static inline uint32_t Load32LE(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void Store32LE(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+/**
+ * @brief               Applies the S-box to each byte of a word.
+ */
+static inline uint32_t SubWord(uint32_t w)
+{
+    return (uint32_t)aes_sbox[w & 0xff] |
+           ((uint32_t)aes_sbox[(w >> 8) & 0xff] << 8) |
+           ((uint32_t)aes_sbox[(w >> 16) & 0xff] << 16) |
+           ((uint32_t)aes_sbox[w >> 24] << 24);
+}
+
+/**
+ * @brief               Adds a block count to a big endian counter block.
+ */
+static void CounterAdd(uint8_t block[AES_BLOCK_SIZE],
+                       const uint8_t counter[AES_BLOCK_SIZE],
+                       uint32_t count)
+{
+    uint32_t sum;
+    int32_t i;
+
+    for (i = AES_BLOCK_SIZE - 1; i >= 0; i--)
+    {
+        sum = (uint32_t)counter[i] + (count & 0xff);
+        block[i] = (uint8_t)sum;
+        count = (count >> 8) + (sum >> 8);
+    }
+}
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief               Generates the S-box and the T-table. Done once, also
+ *                      by the first AES_SetKey.
+ */
+void AES_Init(void)
+{
+    uint8_t p = 1, q = 1, s, s2;
+    uint32_t i;
+
+    if (aes_tables == true)
+        return;
+
+    /* p runs through the powers of 3 and q through those of 1/3, so q is
+       the inverse of p */
+    do
+    {
+        p = p ^ GfDouble(p);
+
+        q ^= q << 1;
+        q ^= q << 2;
+        q ^= q << 4;
+        q ^= ((q & 0x80) != 0) ? 0x09 : 0x00;
+
+        s = q ^ (uint8_t)((q << 1) | (q >> 7)) ^ (uint8_t)((q << 2) | (q >> 6))
+              ^ (uint8_t)((q << 3) | (q >> 5)) ^ (uint8_t)((q << 4) | (q >> 4));
+        aes_sbox[p] = s ^ 0x63;
+    } while (p != 1);
+
+    aes_sbox[0] = 0x63;
+
+    for (i = 0; i < 256; i++)
+    {
+        s = aes_sbox[i];
+        s2 = GfDouble(s);
+        aes_t[i] = (uint32_t)s2 | ((uint32_t)s << 8) | ((uint32_t)s << 16) |
+                   ((uint32_t)(s2 ^ s) << 24);
+    }
+
+    aes_tables = true;
+}
+
+/**
+ * @brief               Expands a key.
+ *
+ * @param[out] ctx      The expanded key.
+ * @param[in] key       Pointer to the key.
+ * @param[in] size      16 for AES-128 or 32 for AES-256.
+ * @return              False for other key sizes.
+ */
+bool AES_SetKey(aes_context_t *ctx, const uint8_t *key, size_t size)
+{
+    uint32_t i, nk, words, temp, rcon = 1;
+
+    if ((size != 16) && (size != 32))
+        return false;
+
+    AES_Init();
+
+    nk = size / 4;
+    ctx->rounds = nk + 6;
+    words = 4 * (ctx->rounds + 1);
+
+    for (i = 0; i < nk; i++)
+        ctx->rk[i] = Load32LE(&key[4 * i]);
+
+    for (i = nk; i < words; i++)
+    {
+        temp = ctx->rk[i - 1];
+
+        if ((i % nk) == 0)
+        {
+            temp = SubWord(ROTL32(temp, 24)) ^ rcon;
+            rcon = GfDouble((uint8_t)rcon);
+        }
+        else if ((nk == 8) && ((i % nk) == 4))
+        {
+            temp = SubWord(temp);
+        }
+
+        ctx->rk[i] = ctx->rk[i - nk] ^ temp;
+    }
+
+    return true;
+}
+
+/**
+ * @brief               Encrypts a block.
+ *
+ * @param[in] ctx       The expanded key.
+ * @param[in] in        The plaintext block.
+ * @param[out] out      The ciphertext block, may alias in.
+ */
+void AES_Encrypt(const aes_context_t *ctx,
+                 const uint8_t in[AES_BLOCK_SIZE],
+                 uint8_t out[AES_BLOCK_SIZE])
+{
+    const uint32_t *rk = ctx->rk;
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3, r;
+
+    s0 = Load32LE(&in[0]) ^ rk[0];
+    s1 = Load32LE(&in[4]) ^ rk[1];
+    s2 = Load32LE(&in[8]) ^ rk[2];
+    s3 = Load32LE(&in[12]) ^ rk[3];
+
+    /* Row r of column c comes from column c + r */
+#define AES_ROUND_COLUMN(a, b, c, d, k)                                     \
+    (aes_t[(a) & 0xff] ^                                                    \
+     ROTL32(aes_t[((b) >> 8) & 0xff], 8) ^                                  \
+     ROTL32(aes_t[((c) >> 16) & 0xff], 16) ^                                \
+     ROTL32(aes_t[(d) >> 24], 24) ^ (k))
+
+    for (r = 1; r < ctx->rounds; r++)
+    {
+        rk += 4;
+        t0 = AES_ROUND_COLUMN(s0, s1, s2, s3, rk[0]);
+        t1 = AES_ROUND_COLUMN(s1, s2, s3, s0, rk[1]);
+        t2 = AES_ROUND_COLUMN(s2, s3, s0, s1, rk[2]);
+        t3 = AES_ROUND_COLUMN(s3, s0, s1, s2, rk[3]);
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+#undef AES_ROUND_COLUMN
+
+    /* The last round has no MixColumns */
+#define AES_LAST_COLUMN(a, b, c, d, k)                                      \
+    (((uint32_t)aes_sbox[(a) & 0xff] |                                      \
+      ((uint32_t)aes_sbox[((b) >> 8) & 0xff] << 8) |                        \
+      ((uint32_t)aes_sbox[((c) >> 16) & 0xff] << 16) |                      \
+      ((uint32_t)aes_sbox[(d) >> 24] << 24)) ^ (k))
+
+    rk += 4;
+    Store32LE(&out[0], AES_LAST_COLUMN(s0, s1, s2, s3, rk[0]));
+    Store32LE(&out[4], AES_LAST_COLUMN(s1, s2, s3, s0, rk[1]));
+    Store32LE(&out[8], AES_LAST_COLUMN(s2, s3, s0, s1, rk[2]));
+    Store32LE(&out[12], AES_LAST_COLUMN(s3, s0, s1, s2, rk[3]));
+
+#undef AES_LAST_COLUMN
+}
+
+/**
+ * @brief               Encrypts or decrypts in CTR mode from any offset of
+ *                      the stream. Block n of the stream is xored with the
+ *                      encryption of counter + n, the counter is big endian
+ *                      over all 16 bytes.
+ *
+ * @param[in] ctx       The expanded key.
+ * @param[in] counter   Counter block of the start of the stream.
+ * @param[in] offset    Offset of the data in the stream.
+ * @param[in] data      Pointer to the data, transformed in place.
+ * @param[in] size      Size of the data.
+ */
+void AES_CTR_Xor(const aes_context_t *ctx,
+                 const uint8_t counter[AES_BLOCK_SIZE],
+                 uint32_t offset,
+                 uint8_t *data,
+                 size_t size)
+{
+    uint8_t block[AES_BLOCK_SIZE];
+    uint32_t index = offset / AES_BLOCK_SIZE;
+    uint32_t skip = offset % AES_BLOCK_SIZE;
+    uint32_t i, n;
+
+    while (size > 0)
+    {
+        CounterAdd(block, counter, index++);
+        AES_Encrypt(ctx, block, block);
+
+        n = AES_BLOCK_SIZE - skip;
+
+        if (n > size)
+            n = size;
+
+        for (i = 0; i < n; i++)
+            data[i] ^= block[skip + i];
+
+        data += n;
+        size -= n;
+        skip = 0;
+    }
+}
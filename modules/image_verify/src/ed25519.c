@@ -0,0 +1,672 @@
+/* *
+ *
+ * Ed25519 signature verification (RFC 8032).
+ * Only public data is handled so the code is variable time. Field elements
+ * have 10 signed limbs of alternating 26 and 25 bits, the products are
+ * 32x32->64 bit multiply-accumulates which the Cortex-M4 does in one
+ * instruction. Points are in extended coordinates, [S]B - [h]A is computed
+ * with one shared chain of doublings (Straus-Shamir).
+ *
+ * Has no dependencies on the OS so that it can be tested on a host.
+ *
+ * */
+
+#include <string.h>
+#include "sha512.h"
+#include "ed25519.h"
+
+/*===========================================================================*/
+/* Module local definitions.                                                 */
+/*===========================================================================*/
+
+/**
+ * @brief   Field element mod 2^255 - 19, limb i has 26 bits if i is even
+ *          and 25 bits if odd.
+ */
+typedef int32_t fe_t[10];
+
+/**
+ * @brief   Point in extended coordinates, x = X/Z, y = Y/Z, xy = T/Z.
+ */
+typedef struct
+{
+    fe_t X;
+    fe_t Y;
+    fe_t Z;
+    fe_t T;
+} ge_t;
+
+/**
+ * @brief   Point prepared for additions.
+ */
+typedef struct
+{
+    fe_t YplusX;
+    fe_t YminusX;
+    fe_t Z2;
+    fe_t T2d;
+} ge_cached_t;
+
+/*===========================================================================*/
+/* Module exported variables.                                                */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module local variables and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Curve constant d = -121665/121666, 2*d and sqrt(-1).
+ */
+static const fe_t fe_d = {56195235, 13857412, 51736253, 6949390, 114729, 24766616, 60832955, 30306712, 48412415, 21499315};
+static const fe_t fe_d2 = {45281625, 27714825, 36363642, 13898781, 229458, 15978800, 54557047, 27058993, 29715967, 9444199};
+static const fe_t fe_sqrtm1 = {34513072, 25610706, 9377949, 3500415, 12389472, 33281959, 41962654, 31548777, 326685, 11406482};
+
+/**
+ * @brief   The base point.
+ */
+static const ge_t ge_base = {
+    {52811034, 25909283, 16144682, 17082669, 27570973, 30858332, 40966398, 8378388, 20764389, 8758491},
+    {40265304, 26843545, 13421772, 20132659, 26843545, 6710886, 53687091, 13421772, 40265318, 26843545},
+    {1, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {28827043, 27438313, 39759291, 244362, 8635006, 11264893, 19351346, 13413597, 16611511, 27139452}
+};
+
+/**
+ * @brief   Order of the base point, L = 2^252 + 27742317777372353535851937790883648493.
+ */
+static const uint8_t order[32] = {
+    0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58,
+    0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10
+};
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+/**
+ * @brief               Bits of limb i.
+ */
+static inline uint32_t FeLimbBits(uint32_t i)
+{
+    return ((i & 1) != 0) ? 25 : 26;
+}
+
+/**
+ * @brief               Carries wide limbs into a field element with limbs
+ *                      of about 2^25 magnitude.
+ *
+ * @param[out] h        The field element.
+ * @param[in] t         The wide limbs, destroyed.
+ */
+static void FeCarry(fe_t h, int64_t t[10])
+{
+    int64_t carry;
+    uint32_t i, bits;
+
+    for (i = 0; i < 10; i++)
+    {
+        bits = FeLimbBits(i);
+        carry = (t[i] + ((int64_t)1 << (bits - 1))) >> bits;
+        t[i] -= carry * ((int64_t)1 << bits);
+
+        if (i < 9)
+            t[i + 1] += carry;
+        else
+            t[0] += carry * 19;
+    }
+
+    carry = (t[0] + ((int64_t)1 << 25)) >> 26;
+    t[0] -= carry * ((int64_t)1 << 26);
+    t[1] += carry;
+
+    for (i = 0; i < 10; i++)
+        h[i] = (int32_t)t[i];
+}
+
+static inline void FeCopy(fe_t h, const fe_t f)
+{
+    memcpy(h, f, sizeof(fe_t));
+}
+
+static inline void FeSet(fe_t h, int32_t v)
+{
+    memset(h, 0, sizeof(fe_t));
+    h[0] = v;
+}
+
+static void FeAdd(fe_t h, const fe_t f, const fe_t g)
+{
+    int64_t t[10];
+    uint32_t i;
+
+    for (i = 0; i < 10; i++)
+        t[i] = (int64_t)f[i] + g[i];
+
+    FeCarry(h, t);
+}
+
+static void FeSub(fe_t h, const fe_t f, const fe_t g)
+{
+    int64_t t[10];
+    uint32_t i;
+
+    for (i = 0; i < 10; i++)
+        t[i] = (int64_t)f[i] - g[i];
+
+    FeCarry(h, t);
+}
+
+static void FeNeg(fe_t h, const fe_t f)
+{
+    uint32_t i;
+
+    for (i = 0; i < 10; i++)
+        h[i] = -f[i];
+}
+
+/**
+ * @brief               Multiplies field elements. A product of limbs that
+ *                      wraps past 2^255 is multiplied by 19, one of two odd
+ *                      limbs by 2 as their positions sum half a bit short.
+ *
+ * @param[out] h        f * g, may alias f or g.
+ * @param[in] f         First factor.
+ * @param[in] g         Second factor.
+ */
+static void FeMul(fe_t h, const fe_t f, const fe_t g)
+{
+    int64_t t[10] = {0};
+    int32_t g19[10], f2;
+    uint32_t i, j;
+
+    for (j = 0; j < 10; j++)
+        g19[j] = 19 * g[j];
+
+    for (i = 0; i < 10; i++)
+    {
+        f2 = ((i & 1) != 0) ? 2 * f[i] : f[i];
+
+        for (j = 0; j < 10 - i; j++)
+            t[i + j] += (int64_t)(((j & 1) != 0) ? f2 : f[i]) * g[j];
+
+        for (j = 10 - i; j < 10; j++)
+            t[i + j - 10] += (int64_t)(((j & 1) != 0) ? f2 : f[i]) * g19[j];
+    }
+
+    FeCarry(h, t);
+}
+
+static inline void FeSq(fe_t h, const fe_t f)
+{
+    FeMul(h, f, f);
+}
+
+/**
+ * @brief               Squares n times.
+ */
+static void FeSqN(fe_t h, const fe_t f, uint32_t n)
+{
+    FeSq(h, f);
+
+    while (--n > 0)
+        FeSq(h, h);
+}
+
+/**
+ * @brief               Computes z^(2^250 - 1) and z^11, the common part of
+ *                      the inversion and the square root.
+ *
+ * @param[out] z250     z^(2^250 - 1).
+ * @param[out] z11      z^11.
+ * @param[in] z         The field element.
+ */
+static void FePow250(fe_t z250, fe_t z11, const fe_t z)
+{
+    fe_t z2, t, z5, z10, z20, z50, z100;
+
+    FeSq(z2, z);
+    FeSqN(t, z2, 2);
+    FeMul(t, t, z);                     /* z^9 */
+    FeMul(z11, t, z2);                  /* z^11 */
+    FeSq(z5, z11);
+    FeMul(z5, z5, t);                   /* z^(2^5 - 1) */
+    FeSqN(t, z5, 5);
+    FeMul(z10, t, z5);                  /* z^(2^10 - 1) */
+    FeSqN(t, z10, 10);
+    FeMul(z20, t, z10);                 /* z^(2^20 - 1) */
+    FeSqN(t, z20, 20);
+    FeMul(t, t, z20);                   /* z^(2^40 - 1) */
+    FeSqN(t, t, 10);
+    FeMul(z50, t, z10);                 /* z^(2^50 - 1) */
+    FeSqN(t, z50, 50);
+    FeMul(z100, t, z50);                /* z^(2^100 - 1) */
+    FeSqN(t, z100, 100);
+    FeMul(t, t, z100);                  /* z^(2^200 - 1) */
+    FeSqN(t, t, 50);
+    FeMul(z250, t, z50);                /* z^(2^250 - 1) */
+}
+
+/**
+ * @brief               Inverts, z^(p - 2) = z^(2^255 - 21). h may alias z.
+ */
+static void FeInvert(fe_t h, const fe_t z)
+{
+    fe_t z250, z11;
+
+    FePow250(z250, z11, z);
+    FeSqN(h, z250, 5);
+    FeMul(h, h, z11);
+}
+
+/**
+ * @brief               Computes z^((p - 5) / 8) = z^(2^252 - 3). h may
+ *                      alias z.
+ */
+static void FePow22523(fe_t h, const fe_t z)
+{
+    fe_t z250, z11;
+
+    FePow250(z250, z11, z);
+    FeSqN(z250, z250, 2);
+    FeMul(h, z250, z);
+}
+
+/**
+ * @brief               Loads 255 bits, the top bit is ignored.
+ */
+static void FeFromBytes(fe_t h, const uint8_t s[32])
+{
+    uint32_t i, pos = 0, bits, byte, k;
+    uint64_t v;
+
+    for (i = 0; i < 10; i++)
+    {
+        bits = FeLimbBits(i);
+        byte = pos / 8;
+        v = 0;
+
+        for (k = 0; (k < 5) && ((byte + k) < 32); k++)
+            v |= (uint64_t)s[byte + k] << (8 * k);
+
+        h[i] = (int32_t)((v >> (pos % 8)) & (((uint64_t)1 << bits) - 1));
+        pos += bits;
+    }
+}
+
+/**
+ * @brief               Stores the canonical value, below 2^255 - 19.
+ */
+static void FeToBytes(uint8_t s[32], const fe_t f)
+{
+    int64_t t[10];
+    int64_t carry;
+    uint64_t acc = 0;
+    uint32_t i, k, bits, acc_bits = 0, out = 0;
+
+    /* Make all limbs positive, the value is then below 2^255 + 2^26 */
+    for (i = 0; i < 10; i++)
+        t[i] = f[i];
+
+    for (k = 0; k < 2; k++)
+    {
+        for (i = 0; i < 10; i++)
+        {
+            bits = FeLimbBits(i);
+            carry = t[i] >> bits;
+            t[i] -= carry * ((int64_t)1 << bits);
+
+            if (i < 9)
+                t[i + 1] += carry;
+            else
+                t[0] += carry * 19;
+        }
+    }
+
+    /* If t + 19 reaches 2^255 then t >= p, keep t + 19 - 2^255 */
+    carry = 19;
+
+    for (i = 0; i < 10; i++)
+    {
+        bits = FeLimbBits(i);
+        carry += t[i];
+        carry >>= bits;
+    }
+
+    t[0] += 19 * carry;
+
+    for (i = 0; i < 10; i++)
+    {
+        bits = FeLimbBits(i);
+        carry = t[i] >> bits;
+        t[i] -= carry * ((int64_t)1 << bits);
+
+        if (i < 9)
+            t[i + 1] += carry;
+    }
+
+    for (i = 0; i < 10; i++)
+    {
+        acc |= (uint64_t)t[i] << acc_bits;
+        acc_bits += FeLimbBits(i);
+
+        while ((acc_bits >= 8) || ((i == 9) && (acc_bits > 0)))
+        {
+            s[out++] = (uint8_t)acc;
+            acc >>= 8;
+            acc_bits = (acc_bits >= 8) ? (acc_bits - 8) : 0;
+        }
+    }
+}
+
+static bool FeIsZero(const fe_t f)
+{
+    uint8_t s[32];
+    uint8_t x = 0;
+    uint32_t i;
+
+    FeToBytes(s, f);
+
+    for (i = 0; i < 32; i++)
+        x |= s[i];
+
+    return x == 0;
+}
+
+static bool FeIsNegative(const fe_t f)
+{
+    uint8_t s[32];
+
+    FeToBytes(s, f);
+
+    return (s[0] & 1) != 0;
+}
+
+/**
+ * @brief               Decodes a point and negates it.
+ *
+ * @param[out] h        The negated point.
+ * @param[in] s         The encoded point.
+ * @return              False if s is not a point.
+ */
+static bool GeFromBytesNegate(ge_t *h, const uint8_t s[32])
+{
+    fe_t u, v, v3, vxx, check;
+
+    FeFromBytes(h->Y, s);
+    FeSet(h->Z, 1);
+
+    /* u = y^2 - 1, v = d*y^2 + 1 */
+    FeSq(u, h->Y);
+    FeMul(v, u, fe_d);
+    FeSub(u, u, h->Z);
+    FeAdd(v, v, h->Z);
+
+    /* x = u*v^3 * (u*v^7)^((p - 5) / 8) */
+    FeSq(v3, v);
+    FeMul(v3, v3, v);
+    FeSq(h->X, v3);
+    FeMul(h->X, h->X, v);
+    FeMul(h->X, h->X, u);
+    FePow22523(h->X, h->X);
+    FeMul(h->X, h->X, v3);
+    FeMul(h->X, h->X, u);
+
+    /* v*x^2 is u, or -u if x needs a factor sqrt(-1) */
+    FeSq(vxx, h->X);
+    FeMul(vxx, vxx, v);
+    FeSub(check, vxx, u);
+
+    if (FeIsZero(check) == false)
+    {
+        FeAdd(check, vxx, u);
+
+        if (FeIsZero(check) == false)
+            return false;
+
+        FeMul(h->X, h->X, fe_sqrtm1);
+    }
+
+    if ((FeIsZero(h->X) == true) && ((s[31] >> 7) != 0))
+        return false;
+
+    /* Negated: x gets the opposite of the sign bit */
+    if (FeIsNegative(h->X) == ((s[31] >> 7) != 0))
+        FeNeg(h->X, h->X);
+
+    FeMul(h->T, h->X, h->Y);
+
+    return true;
+}
+
+static void GeToBytes(uint8_t s[32], const ge_t *p)
+{
+    fe_t zinv, x, y;
+
+    FeInvert(zinv, p->Z);
+    FeMul(x, p->X, zinv);
+    FeMul(y, p->Y, zinv);
+    FeToBytes(s, y);
+
+    if (FeIsNegative(x) == true)
+        s[31] |= 0x80;
+}
+
+static void GeToCached(ge_cached_t *c, const ge_t *p)
+{
+    FeAdd(c->YplusX, p->Y, p->X);
+    FeSub(c->YminusX, p->Y, p->X);
+    FeAdd(c->Z2, p->Z, p->Z);
+    FeMul(c->T2d, p->T, fe_d2);
+}
+
+/**
+ * @brief               Adds a prepared point, r may alias p.
+ */
+static void GeAdd(ge_t *r, const ge_t *p, const ge_cached_t *q)
+{
+    fe_t a, b, c, d, e, f, g, h;
+
+    FeSub(a, p->Y, p->X);
+    FeMul(a, a, q->YminusX);
+    FeAdd(b, p->Y, p->X);
+    FeMul(b, b, q->YplusX);
+    FeMul(c, p->T, q->T2d);
+    FeMul(d, p->Z, q->Z2);
+
+    FeSub(e, b, a);
+    FeSub(f, d, c);
+    FeAdd(g, d, c);
+    FeAdd(h, b, a);
+
+    FeMul(r->X, e, f);
+    FeMul(r->Y, g, h);
+    FeMul(r->Z, f, g);
+    FeMul(r->T, e, h);
+}
+
+/**
+ * @brief               Doubles a point, r may alias p.
+ */
+static void GeDouble(ge_t *r, const ge_t *p)
+{
+    fe_t a, b, c, e, f, g, h;
+
+    FeSq(a, p->X);
+    FeSq(b, p->Y);
+    FeSq(c, p->Z);
+    FeAdd(c, c, c);
+
+    /* a = -1: G = B - A, H = -A - B, E = (X + Y)^2 + H */
+    FeAdd(e, p->X, p->Y);
+    FeSq(e, e);
+    FeSub(g, b, a);
+    FeAdd(h, a, b);
+    FeSub(e, e, h);
+    FeNeg(h, h);
+    FeSub(f, g, c);
+
+    FeMul(r->X, e, f);
+    FeMul(r->Y, g, h);
+    FeMul(r->Z, f, g);
+    FeMul(r->T, e, h);
+}
+
+/**
+ * @brief               Computes [a]A + [b]B sharing the doublings.
+ *
+ * @param[out] r        The result.
+ * @param[in] a         Scalar for A, little endian.
+ * @param[in] A         The point A.
+ * @param[in] b         Scalar for the base point, little endian.
+ */
+static void GeDoubleScalarMultBase(ge_t *r,
+                                   const uint8_t a[32],
+                                   const ge_t *A,
+                                   const uint8_t b[32])
+{
+    ge_cached_t table[3];
+    ge_t sum;
+    uint32_t i, bits;
+    bool started = false;
+
+    /* A, B and A + B */
+    GeToCached(&table[0], A);
+    GeToCached(&table[1], &ge_base);
+    GeAdd(&sum, A, &table[1]);
+    GeToCached(&table[2], &sum);
+
+    memset(r, 0, sizeof(ge_t));
+    FeSet(r->Y, 1);
+    FeSet(r->Z, 1);
+
+    for (i = 256; i-- > 0;)
+    {
+        bits = ((a[i / 8] >> (i % 8)) & 1) | (((b[i / 8] >> (i % 8)) & 1) << 1);
+
+        if (started == true)
+            GeDouble(r, r);
+
+        if (bits != 0)
+        {
+            GeAdd(r, r, &table[bits - 1]);
+            started = true;
+        }
+    }
+}
+
+/**
+ * @brief               Reduces a 512 bit little endian number mod L.
+ *
+ * @param[out] r        The result, 32 bytes.
+ * @param[in] s         The number, 64 bytes.
+ */
+static void ScalarReduce(uint8_t r[32], const uint8_t s[64])
+{
+    int64_t x[64], carry;
+    int32_t i, j;
+
+    for (i = 0; i < 64; i++)
+        x[i] = s[i];
+
+    /* Fold the top bytes down with 2^256 = -16 * (L - 2^252) mod L */
+    for (i = 63; i >= 32; i--)
+    {
+        carry = 0;
+
+        for (j = i - 32; j < i - 12; j++)
+        {
+            x[j] += carry - 16 * x[i] * order[j - (i - 32)];
+            carry = (x[j] + 128) >> 8;
+            x[j] -= carry * 256;
+        }
+
+        x[j] += carry;
+        x[i] = 0;
+    }
+
+    carry = 0;
+
+    for (j = 0; j < 32; j++)
+    {
+        x[j] += carry - (x[31] >> 4) * order[j];
+        carry = x[j] >> 8;
+        x[j] &= 255;
+    }
+
+    for (j = 0; j < 32; j++)
+        x[j] -= carry * order[j];
+
+    for (i = 0; i < 32; i++)
+    {
+        if (i < 31)
+            x[i + 1] += x[i] >> 8;
+
+        r[i] = (uint8_t)(x[i] & 255);
+    }
+}
+
+/**
+ * @brief               Checks that a scalar is below L.
+ */
+static bool ScalarIsCanonical(const uint8_t s[32])
+{
+    int32_t i;
+
+    for (i = 31; i >= 0; i--)
+    {
+        if (s[i] < order[i])
+            return true;
+
+        if (s[i] > order[i])
+            return false;
+    }
+
+    return false;
+}
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief               Verifies an Ed25519 signature, [S]B = R + [h]A with
+ *                      h = SHA-512(R | A | message) mod L.
+ *
+ * @param[in] signature The signature, R and S.
+ * @param[in] public_key The public key A.
+ * @param[in] message   Pointer to the message.
+ * @param[in] size      Size of the message.
+ * @return              True if the signature is valid.
+ */
+bool Ed25519_Verify(const uint8_t signature[ED25519_SIGNATURE_SIZE],
+                    const uint8_t public_key[ED25519_PUBLIC_KEY_SIZE],
+                    const uint8_t *message,
+                    size_t size)
+{
+    sha512_context_t sha;
+    uint8_t digest[SHA512_DIGEST_SIZE];
+    uint8_t h[32], check[32];
+    ge_t minus_A, R;
+
+    if (ScalarIsCanonical(&signature[32]) == false)
+        return false;
+
+    if (GeFromBytesNegate(&minus_A, public_key) == false)
+        return false;
+
+    SHA512_Init(&sha);
+    SHA512_Update(&sha, signature, 32);
+    SHA512_Update(&sha, public_key, ED25519_PUBLIC_KEY_SIZE);
+    SHA512_Update(&sha, message, size);
+    SHA512_Final(&sha, digest);
+    ScalarReduce(h, digest);
+
+    /* R = [S]B - [h]A */
+    GeDoubleScalarMultBase(&R, h, &minus_A, &signature[32]);
+    GeToBytes(check, &R);
+
+    return memcmp(check, signature, 32) == 0;
+}
@@ -0,0 +1,189 @@
+/* *
+ *
+ * Decryption of encrypted images.
+ * The flash writer passes each job through here before programming it, so
+ * the console, DFU and UF2 downloads all get the decryption. The header is
+ * plain text and gives the cipher and the CTR counter, the key is in an
+ * OTP block.
+ *
+ * The header is collected from the jobs of the session. Until it is
+ * complete it is not known if the body is encrypted, so with a key
+ * provisioned body jobs ahead of the header are refused and the session
+ * fails, rather than programming ciphertext. Once the header is in, CTR
+ * decrypts from any offset and the body jobs may come in any order.
+ * Without a key the image is programmed as received and fails the check.
+ *
+ * */
+
+#include <string.h>
+#include "ch.h"
+#include "hal.h"
+#include "image_decrypt.h"
+
+/*===========================================================================*/
+/* Module local definitions.                                                 */
+/*===========================================================================*/
+
+/**
+ * @brief   Start of the image after the header.
+ */
+#define IMAGE_BODY_BASE               (IMAGE_BASE + IMAGE_HEADER_SIZE)
+
+/*===========================================================================*/
+/* Module exported variables.                                                */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module local variables and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   The header as collected from the jobs, and the number of bytes
+ *          collected.
+ */
+static image_header_t decrypt_header;
+static uint32_t decrypt_header_size;
+
+/**
+ * @brief   Set when the image of the session is decrypted, up to
+ *          decrypt_end.
+ */
+static bool decrypt_active;
+static uint32_t decrypt_end;
+
+/**
+ * @brief   The expanded key.
+ */
+static aes_context_t decrypt_aes;
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+/**
+ * @brief               Size of the key of a cipher.
+ *
+ * @param[in] cipher    IMAGE_CIPHER_x.
+ * @return              Size in bytes, 0 if not encrypted.
+ */
+static uint32_t ImageKeySize(uint32_t cipher)
+{
+    if (cipher == IMAGE_CIPHER_AES128_CTR)
+        return 16;
+    else if (cipher == IMAGE_CIPHER_AES256_CTR)
+        return 32;
+    else
+        return 0;
+}
+
+/**
+ * @brief               Starts decrypting if the collected header is valid
+ *                      and asks for a cipher with a key present.
+ */
+static void ImageDecryptStart(void)
+{
+    uint32_t size = ImageKeySize(decrypt_header.cipher);
+
+    if ((ImageVerify_CheckHeader(&decrypt_header) != IMAGE_VALID) ||
+        (size == 0) ||
+        (ImageDecrypt_KeyPresent(decrypt_header.cipher) == false))
+        return;
+
+    AES_SetKey(&decrypt_aes, (const uint8_t *)IMAGE_KEY_ADDRESS, size);
+
+    decrypt_end = IMAGE_BODY_BASE + decrypt_header.image_size;
+    decrypt_active = true;
+}
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief               Checks if the key of a cipher is programmed.
+ *
+ * @param[in] cipher    IMAGE_CIPHER_x.
+ * @return              True if the key is present or not needed.
+ */
+bool ImageDecrypt_KeyPresent(uint32_t cipher)
+{
+    const uint8_t *key = (const uint8_t *)IMAGE_KEY_ADDRESS;
+    uint32_t i, size = ImageKeySize(cipher);
+
+    for (i = 0; i < size; i++)
+    {
+        if (key[i] != 0xff)
+            return true;
+    }
+
+    return (size == 0);
+}
+
+/**
+ * @brief   Forgets the header of the previous session.
+ * @note    Must be called from a locked context.
+ */
+void ImageDecrypt_ResetI(void)
+{
+    decrypt_header_size = 0;
+    decrypt_active = false;
+}
+
+/**
+ * @brief               Decrypts the part of a job inside an encrypted
+ *                      image.
+ * @note                Called by the flash writer before the job is
+ *                      programmed.
+ *
+ * @param[in] address   Address of the job.
+ * @param[in] data      Pointer to the data of the job, decrypted in place.
+ * @param[in] size      Size of the job.
+ * @return              HAL_FAILED if the job holds body bytes, a key is
+ *                      provisioned and the header has not been seen yet,
+ *                      the job must not be programmed. Else HAL_SUCCESS.
+ */
+bool ImageDecrypt_Job(uint32_t address, uint8_t *data, uint32_t size)
+{
+    uint32_t first, last, header_end;
+
+    header_end = IMAGE_BASE + decrypt_header_size;
+
+    /* Collect the header while the jobs extend it */
+    if ((decrypt_header_size < sizeof(image_header_t)) &&
+        (address <= header_end) && ((address + size) > header_end))
+    {
+        last = address + size - IMAGE_BASE;
+
+        if (last > sizeof(image_header_t))
+            last = sizeof(image_header_t);
+
+        memcpy((uint8_t *)&decrypt_header + decrypt_header_size,
+               &data[header_end - address],
+               last - decrypt_header_size);
+        decrypt_header_size = last;
+
+        if (decrypt_header_size == sizeof(image_header_t))
+            ImageDecryptStart();
+    }
+
+    /* Body bytes ahead of the header may be ciphertext */
+    if ((decrypt_header_size < sizeof(image_header_t)) &&
+        ((address + size) > IMAGE_BODY_BASE) &&
+        (ImageDecrypt_KeyPresent(IMAGE_CIPHER_AES128_CTR) == true))
+        return HAL_FAILED;
+
+    if (decrypt_active == false)
+        return HAL_SUCCESS;
+
+    first = (address > IMAGE_BODY_BASE) ? address : IMAGE_BODY_BASE;
+    last = ((address + size) < decrypt_end) ? (address + size) : decrypt_end;
+
+    if (first < last)
+        AES_CTR_Xor(&decrypt_aes,
+                    decrypt_header.counter,
+                    first - IMAGE_BODY_BASE,
+                    &data[first - address],
+                    last - first);
+
+    return HAL_SUCCESS;
+}
@@ -0,0 +1,234 @@
+/* *
+ *
+ * Signed image verification.
+ * The image is hashed as the flash writer programs it: each programmed job
+ * is added to a SHA-512 while the data is still in RAM, so the digest is
+ * ready when the last job lands. The check at the end compares the digest
+ * with the header and verifies the Ed25519 signature of the header, the
+ * only slow step left.
+ *
+ * Jobs that do not follow the previous one (out of order records, pages
+ * written twice) stop the streaming hash, the check then hashes the image
+ * from the flash instead.
+ *
+ * */
+
+#include <string.h>
+#include "ch.h"
+#include "hal.h"
+#include "image_verify.h"
+#include "image_decrypt.h"
+
+/*===========================================================================*/
+/* Module local definitions.                                                 */
+/*===========================================================================*/
+
+/**
+ * @brief   Start of the image after the header.
+ */
+#define IMAGE_BODY_BASE               (IMAGE_BASE + IMAGE_HEADER_SIZE)
+
+/*===========================================================================*/
+/* Module exported variables.                                                */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module local variables and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   The public key images are checked against.
+ */
+static const uint8_t image_public_key[ED25519_PUBLIC_KEY_SIZE] =
+    IMAGE_PUBLIC_KEY;
+
+/**
+ * @brief   Hash of the image as it is programmed.
+ */
+static sha512_context_t stream_sha;
+
+/**
+ * @brief   Address the next job must start at, and the end of the image
+ *          once the header is programmed.
+ */
+static uint32_t stream_next;
+static uint32_t stream_end;
+
+/**
+ * @brief   Set when the header is programmed, cleared if a job broke the
+ *          order.
+ */
+static bool stream_header;
+static bool stream_valid;
+
+/**
+ * @brief   Hash finished by the check, the streaming hash is kept.
+ */
+static sha512_context_t check_sha;
+
+/**
+ * @brief   Taken by a running check, the console and the check thread of
+ *          the flash pipeline both check images.
+ */
+static BSEMAPHORE_DECL(check_lock, false);
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+/**
+ * @brief               Checks the image in the user flash: the header, the
+ *                      digest of the image and the signature of the header.
+ *
+ * @param[out] cycles   Realtime counter cycles of the signature check, 0 if
+ *                      it was not reached.
+ * @return              The result of the check.
+ */
+static image_status_t ImageVerifyCheck(rtcnt_t *cycles)
+{
+    const image_header_t *header = (const image_header_t *)IMAGE_BASE;
+    uint8_t digest[SHA512_DIGEST_SIZE];
+    image_status_t status;
+    rtcnt_t start;
+    bool valid;
+
+    *cycles = 0;
+    status = ImageVerify_CheckHeader(header);
+
+    if (status != IMAGE_VALID)
+        return status;
+
+    /* Without the key the image was programmed encrypted */
+    if (ImageDecrypt_KeyPresent(header->cipher) == false)
+        return IMAGE_NO_KEY;
+
+    /* Use the streaming hash if it covered all of the image */
+    if ((stream_valid == true) && (stream_header == true) &&
+        (stream_next >= stream_end) &&
+        (stream_end == (IMAGE_BODY_BASE + header->image_size)))
+    {
+        check_sha = stream_sha;
+    }
+    else
+    {
+        SHA512_Init(&check_sha);
+        SHA512_Update(&check_sha,
+                      (const uint8_t *)IMAGE_BODY_BASE,
+                      header->image_size);
+    }
+
+    SHA512_Final(&check_sha, digest);
+
+    if (memcmp(digest, header->digest, SHA512_DIGEST_SIZE) != 0)
+        return IMAGE_BAD_DIGEST;
+
+    start = chSysGetRealtimeCounterX();
+    valid = Ed25519_Verify(header->signature,
+                           image_public_key,
+                           (const uint8_t *)header,
+                           IMAGE_HEADER_SIGNED_SIZE);
+    *cycles = chSysGetRealtimeCounterX() - start;
+
+    return (valid == true) ? IMAGE_VALID : IMAGE_BAD_SIGNATURE;
+}
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief               Checks the fields of a header.
+ *
+ * @param[in] header    Pointer to the header.
+ * @return              IMAGE_VALID if the header describes an image in the
+ *                      user flash.
+ */
+image_status_t ImageVerify_CheckHeader(const image_header_t *header)
+{
+    if ((header->magic != IMAGE_HEADER_MAGIC) ||
+        (header->header_size != IMAGE_HEADER_SIZE))
+        return IMAGE_NO_HEADER;
+
+    if ((header->image_size == 0) ||
+        (header->image_size > (FLASH_END_ADDRESS - IMAGE_BODY_BASE)))
+        return IMAGE_BAD_SIZE;
+
+    return IMAGE_VALID;
+}
+
+/**
+ * @brief   Starts the streaming hash of a new programming session.
+ * @note    Must be called from a locked context.
+ */
+void ImageVerify_ResetI(void)
+{
+    SHA512_Init(&stream_sha);
+    stream_next = IMAGE_BASE;
+    stream_end = IMAGE_BASE;
+    stream_header = false;
+    stream_valid = true;
+}
+
+/**
+ * @brief               Adds a programmed job to the streaming hash.
+ * @note                Called by the flash writer after the job was
+ *                      programmed without errors.
+ *
+ * @param[in] address   Address of the job.
+ * @param[in] data      Pointer to the data of the job.
+ * @param[in] size      Size of the job.
+ */
+void ImageVerify_Update(uint32_t address, const uint8_t *data, uint32_t size)
+{
+    const image_header_t *header = (const image_header_t *)IMAGE_BASE;
+    uint32_t first, last;
+
+    if ((stream_valid == false) || (address != stream_next))
+    {
+        stream_valid = false;
+        return;
+    }
+
+    stream_next += size;
+
+    /* The header is in the flash once its last byte is programmed */
+    if ((stream_header == false) &&
+        (stream_next >= (IMAGE_BASE + sizeof(image_header_t))))
+    {
+        stream_header = true;
+
+        if (ImageVerify_CheckHeader(header) != IMAGE_VALID)
+        {
+            stream_valid = false;
+            return;
+        }
+
+        stream_end = IMAGE_BODY_BASE + header->image_size;
+    }
+
+    first = (address > IMAGE_BODY_BASE) ? address : IMAGE_BODY_BASE;
+    last = (stream_next < stream_end) ? stream_next : stream_end;
+
+    if (first < last)
+        SHA512_Update(&stream_sha, &data[first - address], last - first);
+}
+
+/**
+ * @brief               Checks the image in the user flash: the header, the
+ *                      digest of the image and the signature of the header.
+ * @note                The flash writer must be idle.
+ *
+ * @param[out] cycles   Realtime counter cycles of the signature check, 0 if
+ *                      it was not reached.
+ * @return              The result of the check.
+ */
+image_status_t ImageVerify_Check(rtcnt_t *cycles)
+{
+    image_status_t status;
+
+    chBSemWait(&check_lock);
+    status = ImageVerifyCheck(cycles);
+    chBSemSignal(&check_lock);
+
+    return status;
+}
@@ -2,24 +2,41 @@
 MODULE_DIR = ./modules
 
 # Imported source files and paths from modules
+include $(MODULE_DIR)/can/can.mk
 include $(MODULE_DIR)/communication/communication.mk
 include $(MODULE_DIR)/crc/crc.mk
+include $(MODULE_DIR)/debug_log/debug_log.mk
 include $(MODULE_DIR)/flash_programming/flash_programming.mk
+include $(MODULE_DIR)/image_verify/image_verify.mk
+include $(MODULE_DIR)/trace/trace.mk
 include $(MODULE_DIR)/usb/usb.mk
 include $(MODULE_DIR)/version_information/version_information.mk
 
 # List of all the module related files.
-MODULES_SRC = $(COMMUNICATION_SRCS) \
+MODULES_SRC = $(CAN_SRCS) \
+              $(COMMUNICATION_SRCS) \
               $(CONTROL_SRCS) \
               $(CRC_SRCS) \
+              $(DEBUGLOG_SRCS) \
               $(FLASHPROG_SRCS) \
+              $(IMAGEVERIFY_SRCS) \
+              $(TRACE_SRCS) \
               $(USB_SRCS) \
               $(VERSIONINFO_SRCS)
 
+# Modules built for speed in release builds
+MODULES_SPEED_SRC = $(COMMUNICATION_SPEED_SRCS) \
+                    $(CRC_SPEED_SRCS) \
+                    $(IMAGEVERIFY_SPEED_SRCS)
+
 # Required include directories
-MODULES_INC = $(COMMUNICATION_INC) \
+MODULES_INC = $(CAN_INC) \
+              $(COMMUNICATION_INC) \
               $(CONTROL_INC) \
               $(CRC_INC) \
+              $(DEBUGLOG_INC) \
               $(FLASHPROG_INC) \
+              $(IMAGEVERIFY_INC) \
+              $(TRACE_INC) \
               $(USB_INC) \
               $(VERSIONINFO_INC)
\ No newline at end of file
@@ -0,0 +1,132 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+/*===========================================================================*/
+/* Module global definitions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Enables the event trace, the hooks compile to nothing if FALSE.
+ */
+#ifndef TRACE_ENABLE
+    #define TRACE_ENABLE                TRUE
+#endif
+
+/**
+ * @brief   Number of records in the trace ring, must be a power of 2.
+ */
+#ifndef TRACE_RING_SIZE
+    #define TRACE_RING_SIZE             512
+#endif
+
+#if (TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) != 0
+#error "TRACE_RING_SIZE must be a power of 2"
+#endif
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Trace events, the meaning of tag and argument is given per event.
+ * @note    The host decoder has the same list, only append to it.
+ */
+typedef enum PACKED_VAR
+{
+    /**
+     * @brief   First byte of a frame seen. Tag: port.
+     */
+    TRACE_RX_FRAME_START      = 1,
+    /**
+     * @brief   Frame checked and handed to the worker.
+     *          Tag: port, argument: command.
+     */
+    TRACE_RX_FRAME_END        = 2,
+    /**
+     * @brief   Worker starts the parser. Tag: port, argument: command.
+     */
+    TRACE_DISPATCH_START      = 3,
+    /**
+     * @brief   Worker finished the parser and ACK.
+     *          Tag: port, argument: command.
+     */
+    TRACE_DISPATCH_END        = 4,
+    /**
+     * @brief   Sector erase starts. Argument: sector number.
+     */
+    TRACE_FLASH_ERASE_START   = 5,
+    /**
+     * @brief   Sector erase finished. Argument: FLASH_Status.
+     */
+    TRACE_FLASH_ERASE_END     = 6,
+    /**
+     * @brief   Flash program starts. Argument: size in words.
+     */
+    TRACE_FLASH_PROGRAM_START = 7,
+    /**
+     * @brief   Flash program finished. Argument: FLASH_Status.
+     */
+    TRACE_FLASH_PROGRAM_END   = 8,
+    /**
+     * @brief   Data pump starts a transmission.
+     *          Tag: port, argument: bytes.
+     */
+    TRACE_TX_FLUSH_START      = 9,
+    /**
+     * @brief   Data pump finished a transmission.
+     *          Tag: port, argument: HAL_SUCCESS or HAL_FAILED.
+     */
+    TRACE_TX_FLUSH_END        = 10
+} trace_event_t;
+
+/**
+ * @brief   One trace record, 8 bytes.
+ */
+typedef struct
+{
+    /**
+     * @brief   Realtime counter (DWT cycles) of the event.
+     */
+    uint32_t cycles;
+    /**
+     * @brief   The event, see trace_event_t.
+     */
+    uint8_t event;
+    /**
+     * @brief   Event tag, normally the port.
+     */
+    uint8_t tag;
+    /**
+     * @brief   Event argument.
+     */
+    uint16_t argument;
+} trace_record_t;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/**
+ * @brief   Trace hook, usable from any context.
+ */
+#if TRACE_ENABLE == TRUE
+    #define TRACE_EVENT(event, tag, argument)                               \
+        Trace_Event((event), (uint8_t)(tag), (uint16_t)(argument))
+#else
+    #define TRACE_EVENT(event, tag, argument)
+#endif
+
+/*===========================================================================*/
+/* Module inline functions.                                                  */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+void Trace_Init(void);
+void Trace_Event(trace_event_t event, uint8_t tag, uint16_t argument);
+void Trace_Freeze(bool freeze);
+uint32_t Trace_Read(uint32_t *index, trace_record_t *records, uint32_t count);
+
+#endif
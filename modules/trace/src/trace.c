@@ -0,0 +1,126 @@
+/* *
+ *
+ * Binary event trace.
+ * Fixed size records with a cycle timestamp are written to a ring in CCM
+ * from any context, the ring is read out over the serial protocol and
+ * converted to a timeline on the host.
+ *
+ * */
+
+#include "ch.h"
+#include "hal.h"
+#include "trace.h"
+
+/*===========================================================================*/
+/* Module local definitions.                                                 */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module exported variables.                                                */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module local variables and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   The trace ring.
+ */
+CCM_MEMORY static trace_record_t trace_ring[TRACE_RING_SIZE];
+
+/**
+ * @brief   Free running index of the next record to write.
+ */
+static uint32_t trace_head;
+
+/**
+ * @brief   True while the ring is read out, events are discarded.
+ */
+static volatile bool trace_frozen;
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Empties the trace ring.
+ */
+void Trace_Init(void)
+{
+    trace_head = 0;
+    trace_frozen = false;
+}
+
+/**
+ * @brief               Writes a record to the trace ring.
+ * @note                Can be called from any context.
+ *
+ * @param[in] event     The event.
+ * @param[in] tag       Event tag.
+ * @param[in] argument  Event argument.
+ */
+void Trace_Event(trace_event_t event, uint8_t tag, uint16_t argument)
+{
+    trace_record_t *record;
+    syssts_t sts;
+
+    if (trace_frozen == true)
+        return;
+
+    sts = chSysGetStatusAndLockX();
+
+    record = &trace_ring[trace_head & (TRACE_RING_SIZE - 1)];
+    record->cycles = chSysGetRealtimeCounterX();
+    record->event = event;
+    record->tag = tag;
+    record->argument = argument;
+    trace_head++;
+
+    chSysRestoreStatusX(sts);
+}
+
+/**
+ * @brief               Stops or restarts the recording, the ring is frozen
+ *                      while it is read out so that it is consistent.
+ *
+ * @param[in] freeze    True to stop the recording.
+ */
+void Trace_Freeze(bool freeze)
+{
+    trace_frozen = freeze;
+}
+
+/**
+ * @brief               Reads records from the ring. If the requested
+ *                      records are overwritten the read starts at the
+ *                      oldest record.
+ *
+ * @param[in/out] index Free running index of the first record to read,
+ *                      updated to the index of the first record read.
+ * @param[out] records  Pointer to where the records are stored.
+ * @param[in] count     Maximum number of records to read.
+ * @return              The number of records read.
+ */
+uint32_t Trace_Read(uint32_t *index, trace_record_t *records, uint32_t count)
+{
+    uint32_t i, head;
+
+    osalSysLock();
+    head = trace_head;
+    osalSysUnlock();
+
+    if ((head - *index) > TRACE_RING_SIZE)
+        *index = head - TRACE_RING_SIZE;
+
+    if (count > (head - *index))
+        count = head - *index;
+
+    for (i = 0; i < count; i++)
+        records[i] = trace_ring[(*index + i) & (TRACE_RING_SIZE - 1)];
+
+    return count;
+}
@@ -0,0 +1,5 @@
+# List of all the module's related files.
+TRACE_SRCS = $(MODULE_DIR)/trace/src/trace.c
+
+# Required include directories
+TRACE_INC = $(MODULE_DIR)/trace/inc
@@ -5,6 +5,19 @@
 #define USBD1_DATA_REQUEST_EP           1
 #define USBD1_DATA_AVAILABLE_EP         1
 #define USBD1_INTERRUPT_REQUEST_EP      2
+#define USB_RECEIVE_BLOCK_SIZE          64
+
+/* Time the bus stays disconnected so a host holding a session from before
+   a reset notices the disconnect */
+#ifndef USB_RECONNECT_DELAY_MS
+#define USB_RECONNECT_DELAY_MS          500
+#endif
+
+/* EP3 carries the UF2 mass storage interface instead of the vendor bulk
+   interface, the OTG FS core has no endpoint left to have both */
+#ifndef USB_UF2_MSC
+#define USB_UF2_MSC                     FALSE
+#endif
 
 /* Typedefs */
 
@@ -19,8 +32,11 @@ extern const SerialUSBConfig serusbcfg;
 /* Inline functions */
 
 /* Global functions */
+void USBConnect(uint32_t reset_flags);
 bool isUSBActive(void);
 size_t USBSendData(uint8_t *data, size_t size, systime_t timeout);
 size_t USBReadByte(systime_t timeout);
+size_t USBReadBlock(uint8_t **data, systime_t timeout);
+size_t USBReadData(uint8_t *data, size_t size, systime_t timeout);
 
 #endif
@@ -0,0 +1,97 @@
+#ifndef __UF2_FAT_H
+#define __UF2_FAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Defines */
+#define UF2_FAT_SECTOR_SIZE             512
+#define UF2_FAT_NUM_SECTORS             16384
+#define UF2_MAX_BLOCKS                  4096
+#define UF2_READBACK_PAYLOAD            256
+
+#define UF2_MAGIC_START0                0x0A324655
+#define UF2_MAGIC_START1                0x9E5D5157
+#define UF2_MAGIC_END                   0x0AB16F30
+#define UF2_FLAG_NOT_MAIN_FLASH         0x00000001
+#define UF2_FLAG_FAMILY_ID              0x00002000
+#define UF2_FAMILY_STM32F4              0x57755A57
+#define UF2_MAX_PAYLOAD                 476
+
+/* Typedefs */
+
+/**
+ * @brief   UF2 block, one per 512 byte sector of a UF2 file.
+ */
+typedef struct
+{
+  uint32_t magic_start0;
+  uint32_t magic_start1;
+  uint32_t flags;
+  uint32_t target_address;
+  uint32_t payload_size;
+  uint32_t block_number;
+  uint32_t num_blocks;
+  uint32_t family_id;
+  uint8_t data[UF2_MAX_PAYLOAD];
+  uint32_t magic_end;
+} uf2_block_t;
+
+/**
+ * @brief   Result of writing a sector.
+ */
+typedef enum
+{
+  UF2_WRITE_IGNORED = 0,        /* Not a UF2 block for this device.         */
+  UF2_WRITE_DUPLICATE,          /* Block already written.                   */
+  UF2_WRITE_OK,                 /* Block passed to the flash.               */
+  UF2_WRITE_COMPLETE,           /* Last missing block of the file.          */
+  UF2_WRITE_FAILED              /* The flash refused the block.             */
+} uf2_write_status_t;
+
+/**
+ * @brief   Device side of the virtual disk.
+ */
+typedef struct
+{
+  /**
+   * @brief   Contents of INFO_UF2.TXT.
+   */
+  const char *info;
+  /**
+   * @brief   First and end address of the flash the UF2 files cover.
+   */
+  uint32_t flash_base;
+  uint32_t flash_end;
+  /**
+   * @brief   A new UF2 file starts, sectors may be erased again.
+   */
+  void (*begin)(void);
+  /**
+   * @brief   Writes the payload of a block, returns true if accepted.
+   */
+  bool (*write)(uint32_t address, const uint8_t *data, uint32_t size);
+  /**
+   * @brief   All blocks of the file were written.
+   */
+  void (*complete)(void);
+  /**
+   * @brief   Reads the flash.
+   */
+  void (*read)(uint32_t address, uint8_t *data, uint32_t size);
+} uf2_fat_config_t;
+
+/* Global variables */
+
+/* Macros */
+
+/* Inline functions */
+
+/* Global functions */
+void UF2Fat_Init(const uf2_fat_config_t *config);
+void UF2Fat_ReadSector(uint32_t lba, uint8_t *data);
+uf2_write_status_t UF2Fat_WriteSector(uint32_t lba, const uint8_t *data);
+uint32_t UF2Fat_BlocksWritten(void);
+uint32_t UF2Fat_BlocksExpected(void);
+
+#endif
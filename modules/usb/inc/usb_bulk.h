@@ -0,0 +1,31 @@
+#ifndef __USB_BULK_H
+#define __USB_BULK_H
+
+#include "serial_transport.h"
+
+/* Defines */
+#define USBD1_BULK_EP                   3
+#define USB_BULK_INTERFACE              2
+#define USB_BULK_PACKET_SIZE            64
+#define USB_BULK_TRANSFER_SIZE          512
+
+/* Typedefs */
+
+/* Global variables */
+extern const serial_transport_t usb_bulk_transport;
+
+/* Macros */
+
+/* Inline functions */
+
+/* Global functions */
+void USBBulkConfigureHookI(USBDriver *usbp);
+void USBBulkDisconnectI(void);
+bool isUSBBulkActive(void);
+size_t USBBulkSendData(uint8_t *data, size_t size, systime_t timeout);
+size_t USBBulkSendSegments(const serial_segment_t *segments,
+                           size_t count,
+                           systime_t timeout);
+size_t USBBulkReadBlock(uint8_t **data, systime_t timeout);
+
+#endif
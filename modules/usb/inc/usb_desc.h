@@ -5,14 +5,17 @@
  * USB Device Descriptor.
  */
 static const uint8_t vcom_device_descriptor_data[18] = {
-  USB_DESC_DEVICE       (0x0110,        /* bcdUSB (1.1).                    */
-                         0x02,          /* bDeviceClass (CDC).              */
-                         0x00,          /* bDeviceSubClass.                 */
-                         0x00,          /* bDeviceProtocol.                 */
+  USB_DESC_DEVICE       (0x0200,        /* bcdUSB (2.0).                    */
+                         0xEF,          /* bDeviceClass (Miscellaneous).    */
+                         0x02,          /* bDeviceSubClass (Common Class).  */
+                         0x01,          /* bDeviceProtocol (Interface
+                                           Association Descriptor).         */
                          0x40,          /* bMaxPacketSize.                  */
                          0x0483,        /* idVendor (ST).                   */
                          0x5740,        /* idProduct.                       */
-                         0x0200,        /* bcdDevice.                       */
+                         0x0300,        /* bcdDevice (new function set, so
+                                           Windows reads the OS descriptors
+                                           again).                          */
                          1,             /* iManufacturer.                   */
                          2,             /* iProduct.                        */
                          3,             /* iSerialNumber.                   */
@@ -27,15 +30,23 @@ static const USBDescriptor vcom_device_descriptor = {
   vcom_device_descriptor_data
 };
 
-/* Configuration Descriptor tree for a CDC.*/
-static const uint8_t vcom_configuration_descriptor_data[67] = {
+/* Configuration Descriptor tree for a CDC, a vendor bulk and a DFU
+   interface.*/
+static const uint8_t vcom_configuration_descriptor_data[116] = {
   /* Configuration Descriptor.*/
-  USB_DESC_CONFIGURATION(67,            /* wTotalLength.                    */
-                         0x02,          /* bNumInterfaces.                  */
+  USB_DESC_CONFIGURATION(116,           /* wTotalLength.                    */
+                         0x04,          /* bNumInterfaces.                  */
                          0x01,          /* bConfigurationValue.             */
                          0,             /* iConfiguration.                  */
                          0xC0,          /* bmAttributes (self powered).     */
                          150),          /* bMaxPower (300mA).               */
+  /* Interface Association Descriptor, groups the CDC interfaces.*/
+  USB_DESC_INTERFACE_ASSOCIATION(0x00,  /* bFirstInterface.                 */
+                         0x02,          /* bInterfaceCount.                 */
+                         0x02,          /* bFunctionClass (CDC).            */
+                         0x02,          /* bFunctionSubClass (ACM).         */
+                         0x01,          /* bFunctionProtocol (AT commands). */
+                         0),            /* iInterface.                      */
   /* Interface Descriptor.*/
   USB_DESC_INTERFACE    (0x00,          /* bInterfaceNumber.                */
                          0x00,          /* bAlternateSetting.               */
@@ -101,7 +112,55 @@ static const uint8_t vcom_configuration_descriptor_data[67] = {
   USB_DESC_ENDPOINT     (USBD1_DATA_REQUEST_EP | 0x80,  /* bEndpointAddress.*/
                          0x02,          /* bmAttributes (Bulk).             */
                          0x0040,        /* wMaxPacketSize.                  */
-                         0x00)          /* bInterval.                       */
+                         0x00),         /* bInterval.                       */
+  /* Interface Descriptor.*/
+#if USB_UF2_MSC
+  USB_DESC_INTERFACE    (USB_MSC_INTERFACE, /* bInterfaceNumber.            */
+                         0x00,          /* bAlternateSetting.               */
+                         0x02,          /* bNumEndpoints.                   */
+                         0x08,          /* bInterfaceClass (Mass Storage).  */
+                         0x06,          /* bInterfaceSubClass (SCSI
+                                           transparent).                    */
+                         0x50,          /* bInterfaceProtocol (Bulk-Only).  */
+                         0x00),         /* iInterface.                      */
+#else
+  USB_DESC_INTERFACE    (USB_BULK_INTERFACE, /* bInterfaceNumber.           */
+                         0x00,          /* bAlternateSetting.               */
+                         0x02,          /* bNumEndpoints.                   */
+                         0xFF,          /* bInterfaceClass (Vendor).        */
+                         0x00,          /* bInterfaceSubClass.              */
+                         0x00,          /* bInterfaceProtocol.              */
+                         0x00),         /* iInterface.                      */
+#endif
+  /* Endpoint 3 Descriptor.*/
+  USB_DESC_ENDPOINT     (USBD1_BULK_EP,                 /* bEndpointAddress.*/
+                         0x02,          /* bmAttributes (Bulk).             */
+                         USB_BULK_PACKET_SIZE, /* wMaxPacketSize.           */
+                         0x00),         /* bInterval.                       */
+  /* Endpoint 3 Descriptor.*/
+  USB_DESC_ENDPOINT     (USBD1_BULK_EP | 0x80,          /* bEndpointAddress.*/
+                         0x02,          /* bmAttributes (Bulk).             */
+                         USB_BULK_PACKET_SIZE, /* wMaxPacketSize.           */
+                         0x00),         /* bInterval.                       */
+  /* Interface Descriptor.*/
+  USB_DESC_INTERFACE    (USB_DFU_INTERFACE, /* bInterfaceNumber.            */
+                         0x00,          /* bAlternateSetting.               */
+                         0x00,          /* bNumEndpoints.                   */
+                         0xFE,          /* bInterfaceClass (Application
+                                           Specific).                       */
+                         0x01,          /* bInterfaceSubClass (DFU).        */
+                         0x02,          /* bInterfaceProtocol (DFU mode).   */
+                         USB_DFU_STRING_INDEX), /* iInterface (DfuSe memory
+                                           layout).                         */
+  /* DFU Functional Descriptor (DFU 1.1 section 4.1.3).*/
+  USB_DESC_BYTE         (9),            /* bLength.                         */
+  USB_DESC_BYTE         (0x21),         /* bDescriptorType (DFU FUNCTIONAL).*/
+  USB_DESC_BYTE         (0x07),         /* bmAttributes (can download, can
+                                           upload, manifestation
+                                           tolerant).                       */
+  USB_DESC_WORD         (USB_DFU_DETACH_TIMEOUT), /* wDetachTimeOut.        */
+  USB_DESC_WORD         (USB_DFU_TRANSFER_SIZE),  /* wTransferSize.         */
+  USB_DESC_BCD          (0x011A)        /* bcdDFUVersion (DfuSe).           */
 };
 
 /*
@@ -193,6 +252,140 @@ static const uint8_t vcom_string3[] = {
   '0' + CH_KERNEL_PATCH, 0
 };
 
+/*
+ * DfuSe memory layout string of the DFU interface, the bootloader sectors
+ * are read only. Must match FLASH_USER_BASE.
+ */
+static const uint8_t vcom_string4[] = {
+  USB_DESC_BYTE(130),                   /* bLength.                         */
+  USB_DESC_BYTE(USB_DESCRIPTOR_STRING), /* bDescriptorType.                 */
+  '@', 0,
+  'I', 0,
+  'n', 0,
+  't', 0,
+  'e', 0,
+  'r', 0,
+  'n', 0,
+  'a', 0,
+  'l', 0,
+  ' ', 0,
+  'F', 0,
+  'l', 0,
+  'a', 0,
+  's', 0,
+  'h', 0,
+  ' ', 0,
+  ' ', 0,
+  '/', 0,
+  '0', 0,
+  'x', 0,
+  '0', 0,
+  '8', 0,
+  '0', 0,
+  '0', 0,
+  '0', 0,
+  '0', 0,
+  '0', 0,
+  '0', 0,
+  '/', 0,
+  '0', 0,
+  '4', 0,
+  '*', 0,
+  '0', 0,
+  '1', 0,
+  '6', 0,
+  'K', 0,
+  'a', 0,
+  ',', 0,
+  '0', 0,
+  '1', 0,
+  '*', 0,
+  '0', 0,
+  '6', 0,
+  '4', 0,
+  'K', 0,
+  'a', 0,
+  ',', 0,
+  '0', 0,
+  '1', 0,
+  '*', 0,
+  '1', 0,
+  '2', 0,
+  '8', 0,
+  'K', 0,
+  'a', 0,
+  ',', 0,
+  '0', 0,
+  '6', 0,
+  '*', 0,
+  '1', 0,
+  '2', 0,
+  '8', 0,
+  'K', 0,
+  'g', 0
+};
+
+/*
+ * Microsoft OS String Descriptor, tells Windows to ask for the compatible
+ * ID with the vendor code.
+ */
+#define MS_OS_STRING_INDEX              0xEE
+#define MS_OS_VENDOR_CODE               0x20
+#define MS_OS_COMPAT_ID_INDEX           0x04
+
+static const uint8_t ms_os_string_data[] = {
+  USB_DESC_BYTE(18),                    /* bLength.                         */
+  USB_DESC_BYTE(USB_DESCRIPTOR_STRING), /* bDescriptorType.                 */
+  'M', 0,
+  'S', 0,
+  'F', 0,
+  'T', 0,
+  '1', 0,
+  '0', 0,
+  '0', 0,
+  USB_DESC_BYTE(MS_OS_VENDOR_CODE),     /* bMS_VendorCode.                  */
+  USB_DESC_BYTE(0x00)                   /* bPad.                            */
+};
+
+static const USBDescriptor ms_os_string = {
+  sizeof ms_os_string_data,
+  ms_os_string_data
+};
+
+/*
+ * Microsoft Extended Compat ID OS Descriptor, binds WinUSB to the bulk and
+ * the DFU interfaces so libusb and dfu-util work without a driver install.
+ * The mass storage interface keeps the class driver.
+ */
+#if USB_UF2_MSC
+static const uint8_t ms_compat_id_descriptor[40] = {
+  USB_DESC_WORD (40),                   /* dwLength.                        */
+  USB_DESC_WORD (0),
+  USB_DESC_BCD  (0x0100),               /* bcdVersion.                      */
+  USB_DESC_WORD (MS_OS_COMPAT_ID_INDEX),/* wIndex.                          */
+  USB_DESC_BYTE (1),                    /* bCount.                          */
+  0, 0, 0, 0, 0, 0, 0,                  /* Reserved.                        */
+#else
+static const uint8_t ms_compat_id_descriptor[64] = {
+  USB_DESC_WORD (64),                   /* dwLength.                        */
+  USB_DESC_WORD (0),
+  USB_DESC_BCD  (0x0100),               /* bcdVersion.                      */
+  USB_DESC_WORD (MS_OS_COMPAT_ID_INDEX),/* wIndex.                          */
+  USB_DESC_BYTE (2),                    /* bCount.                          */
+  0, 0, 0, 0, 0, 0, 0,                  /* Reserved.                        */
+  USB_DESC_BYTE (USB_BULK_INTERFACE),   /* bFirstInterfaceNumber.           */
+  USB_DESC_BYTE (0x01),                 /* Reserved.                        */
+  'W', 'I', 'N', 'U', 'S', 'B', 0, 0,   /* compatibleID.                    */
+  0, 0, 0, 0, 0, 0, 0, 0,               /* subCompatibleID.                 */
+  0, 0, 0, 0, 0, 0,                     /* Reserved.                        */
+#endif
+  USB_DESC_BYTE (USB_DFU_INTERFACE),    /* bFirstInterfaceNumber.           */
+  USB_DESC_BYTE (0x01),                 /* Reserved.                        */
+  'W', 'I', 'N', 'U', 'S', 'B', 0, 0,   /* compatibleID.                    */
+  0, 0, 0, 0, 0, 0, 0, 0,               /* subCompatibleID.                 */
+  0, 0, 0, 0, 0, 0                      /* Reserved.                        */
+};
+
 /*
  * Strings wrappers array.
  */
@@ -200,7 +393,8 @@ static const USBDescriptor vcom_strings[] = {
   {sizeof vcom_string0, vcom_string0},
   {sizeof vcom_string1, vcom_string1},
   {sizeof vcom_string2, vcom_string2},
-  {sizeof vcom_string3, vcom_string3}
+  {sizeof vcom_string3, vcom_string3},
+  {sizeof vcom_string4, vcom_string4}
 };
 
 #endif
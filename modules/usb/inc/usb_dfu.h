@@ -0,0 +1,81 @@
+#ifndef __USB_DFU_H
+#define __USB_DFU_H
+
+#include "flash_pipeline.h"
+
+/* Defines */
+#define USB_DFU_INTERFACE               3
+#define USB_DFU_STRING_INDEX            4
+#define USB_DFU_TRANSFER_SIZE           FLASH_PIPELINE_BLOCK_SIZE
+#define USB_DFU_DETACH_TIMEOUT          255
+#define USB_DFU_CHECK_POLL_MS           50      /* Poll while checking */
+
+/* DFU class requests (DFU 1.1 section 3) */
+#define DFU_DETACH                      0
+#define DFU_DNLOAD                      1
+#define DFU_UPLOAD                      2
+#define DFU_GETSTATUS                   3
+#define DFU_CLRSTATUS                   4
+#define DFU_GETSTATE                    5
+#define DFU_ABORT                       6
+
+/* DfuSe commands, sent in block 0 */
+#define DFUSE_CMD_GET_COMMANDS          0x00
+#define DFUSE_CMD_SET_ADDRESS           0x21
+#define DFUSE_CMD_ERASE                 0x41
+#define DFUSE_CMD_READ_UNPROTECT        0x92
+
+/* Typedefs */
+
+/**
+ * @brief   DFU states (DFU 1.1 section 6.1.2).
+ */
+typedef enum
+{
+  DFU_STATE_APP_IDLE = 0,
+  DFU_STATE_APP_DETACH = 1,
+  DFU_STATE_IDLE = 2,
+  DFU_STATE_DNLOAD_SYNC = 3,
+  DFU_STATE_DNBUSY = 4,
+  DFU_STATE_DNLOAD_IDLE = 5,
+  DFU_STATE_MANIFEST_SYNC = 6,
+  DFU_STATE_MANIFEST = 7,
+  DFU_STATE_MANIFEST_WAIT_RESET = 8,
+  DFU_STATE_UPLOAD_IDLE = 9,
+  DFU_STATE_ERROR = 10
+} dfu_state_t;
+
+/**
+ * @brief   DFU status codes (DFU 1.1 section 6.1.2).
+ */
+typedef enum
+{
+  DFU_STATUS_OK = 0x00,
+  DFU_STATUS_ERR_TARGET = 0x01,
+  DFU_STATUS_ERR_FILE = 0x02,
+  DFU_STATUS_ERR_WRITE = 0x03,
+  DFU_STATUS_ERR_ERASE = 0x04,
+  DFU_STATUS_ERR_CHECK_ERASED = 0x05,
+  DFU_STATUS_ERR_PROG = 0x06,
+  DFU_STATUS_ERR_VERIFY = 0x07,
+  DFU_STATUS_ERR_ADDRESS = 0x08,
+  DFU_STATUS_ERR_NOTDONE = 0x09,
+  DFU_STATUS_ERR_FIRMWARE = 0x0A,
+  DFU_STATUS_ERR_VENDOR = 0x0B,
+  DFU_STATUS_ERR_USBR = 0x0C,
+  DFU_STATUS_ERR_POR = 0x0D,
+  DFU_STATUS_ERR_UNKNOWN = 0x0E,
+  DFU_STATUS_ERR_STALLEDPKT = 0x0F
+} dfu_status_t;
+
+/* Global variables */
+
+/* Macros */
+
+/* Inline functions */
+
+/* Global functions */
+bool USBDfuRequestsHook(USBDriver *usbp);
+void USBDfuResetI(void);
+
+#endif
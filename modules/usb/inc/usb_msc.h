@@ -0,0 +1,62 @@
+#ifndef __USB_MSC_H
+#define __USB_MSC_H
+
+#include "usb_bulk.h"
+
+/* Defines */
+#define USBD1_MSC_EP                    USBD1_BULK_EP
+#define USB_MSC_INTERFACE               USB_BULK_INTERFACE
+#define USB_MSC_PACKET_SIZE             64
+#define USB_MSC_STACK_SIZE              512
+
+/* Bulk-Only Transport class requests */
+#define MSC_REQ_RESET                   0xFF
+#define MSC_REQ_GET_MAX_LUN             0xFE
+
+/* Bulk-Only Transport wrappers */
+#define MSC_CBW_SIGNATURE               0x43425355
+#define MSC_CBW_SIZE                    31
+#define MSC_CSW_SIGNATURE               0x53425355
+#define MSC_CSW_SIZE                    13
+#define MSC_CSW_PASSED                  0
+#define MSC_CSW_FAILED                  1
+
+/* SCSI commands */
+#define SCSI_TEST_UNIT_READY            0x00
+#define SCSI_REQUEST_SENSE              0x03
+#define SCSI_INQUIRY                    0x12
+#define SCSI_MODE_SENSE_6               0x1A
+#define SCSI_START_STOP_UNIT            0x1B
+#define SCSI_PREVENT_ALLOW_REMOVAL      0x1E
+#define SCSI_READ_FORMAT_CAPACITIES     0x23
+#define SCSI_READ_CAPACITY_10           0x25
+#define SCSI_READ_10                    0x28
+#define SCSI_WRITE_10                   0x2A
+#define SCSI_VERIFY_10                  0x2F
+#define SCSI_SYNCHRONIZE_CACHE_10       0x35
+#define SCSI_MODE_SENSE_10              0x5A
+
+/* SCSI sense keys and additional sense codes */
+#define SCSI_SENSE_NONE                 0x00
+#define SCSI_SENSE_MEDIUM_ERROR         0x03
+#define SCSI_SENSE_ILLEGAL_REQUEST      0x05
+#define SCSI_ASC_NONE                   0x00
+#define SCSI_ASC_WRITE_ERROR            0x0C
+#define SCSI_ASC_INVALID_COMMAND        0x20
+#define SCSI_ASC_LBA_OUT_OF_RANGE       0x21
+
+/* Typedefs */
+
+/* Global variables */
+
+/* Macros */
+
+/* Inline functions */
+
+/* Global functions */
+void USBMscInit(void);
+void USBMscConfigureHookI(USBDriver *usbp);
+void USBMscDisconnectI(void);
+bool USBMscRequestsHook(USBDriver *usbp);
+
+#endif
@@ -7,12 +7,50 @@
 #include "ch.h"
 #include "hal.h"
 #include "myusb.h"
+#include "usb_bulk.h"
+#include "usb_dfu.h"
+#include "usb_msc.h"
 #include "usb_desc.h"
+#include "debug_log.h"
 
 /* Global variable defines */
 
 /* Private variable defines */
 
+/**
+ * @brief   True while the host has the bus suspended.
+ */
+static volatile bool usb_suspended = false;
+
+/**
+ * @brief   Start of the current enumeration, the connect or the first bus
+ *          reset after a configured session.
+ */
+static systime_t enumeration_start;
+
+/**
+ * @brief   Time from the start of the enumeration to the first bus reset
+ *          and to SET_ADDRESS, in ms.
+ */
+static uint32_t enumeration_reset_ms;
+static uint32_t enumeration_address_ms;
+
+/**
+ * @brief   True once the current enumeration reached the configured state.
+ */
+static bool enumeration_done = false;
+
+/**
+ * @brief   Bus resets and suspends since the connect.
+ */
+static uint32_t usb_resets;
+static uint32_t usb_suspends;
+
+/**
+ * @brief   System time the current suspend started.
+ */
+static systime_t suspend_start;
+
 /* Private function defines */
 
 /* Private external functions */
@@ -39,12 +77,43 @@ static const USBDescriptor *get_descriptor(USBDriver *usbp,
   case USB_DESCRIPTOR_CONFIGURATION:
     return &vcom_configuration_descriptor;
   case USB_DESCRIPTOR_STRING:
-    if (dindex < 4)
+    if (dindex < 5)
       return &vcom_strings[dindex];
+    if (dindex == MS_OS_STRING_INDEX)
+      return &ms_os_string;
   }
   return NULL;
 }
 
+/*
+ * Handles the setup requests. The Microsoft OS compatible ID request binds
+ * WinUSB to the bulk and DFU interfaces, the DFU and mass storage class
+ * requests go to their interfaces and the rest goes to the CDC driver.
+ */
+static bool requests_hook(USBDriver *usbp) {
+
+  if (((usbp->setup[0] & USB_RTYPE_TYPE_MASK) == USB_RTYPE_TYPE_VENDOR) &&
+      (usbp->setup[1] == MS_OS_VENDOR_CODE) &&
+      (usbp->setup[4] == MS_OS_COMPAT_ID_INDEX) &&
+      (usbp->setup[5] == 0)) {
+    usbSetupTransfer(usbp,
+                     (uint8_t *)ms_compat_id_descriptor,
+                     sizeof ms_compat_id_descriptor,
+                     NULL);
+    return true;
+  }
+
+  if (USBDfuRequestsHook(usbp) == true)
+    return true;
+
+#if USB_UF2_MSC
+  if (USBMscRequestsHook(usbp) == true)
+    return true;
+#endif
+
+  return sduRequestsHook(usbp);
+}
+
 /**
  * @brief   IN EP1 state.
  */
@@ -99,10 +168,45 @@ static void usb_event(USBDriver *usbp, usbevent_t event) {
 
   switch (event) {
   case USB_EVENT_RESET:
+    /* A reset after a configured session starts a new enumeration.*/
+    usb_resets++;
+    usb_suspended = false;
+    if (enumeration_done == true) {
+      enumeration_start = chVTGetSystemTimeX();
+      enumeration_done = false;
+      enumeration_reset_ms = 0;
+    }
+    else if (enumeration_reset_ms == 0)
+      enumeration_reset_ms = ST2MS(chVTTimeElapsedSinceX(enumeration_start));
+
+    chSysLockFromISR();
+
+    /* Releases the threads waiting on the EP3 interface.*/
+#if USB_UF2_MSC
+    USBMscDisconnectI();
+#else
+    USBBulkDisconnectI();
+#endif
+
+    /* A reset aborts the DFU transfer.*/
+    USBDfuResetI();
+
+    chSysUnlockFromISR();
     return;
   case USB_EVENT_ADDRESS:
+    enumeration_address_ms = ST2MS(chVTTimeElapsedSinceX(enumeration_start));
     return;
   case USB_EVENT_CONFIGURED:
+    if (enumeration_done == false) {
+      enumeration_done = true;
+      DEBUG_LOG("USB: configured in %u ms (reset %u ms, address %u ms), "
+                "%u resets",
+                ST2MS(chVTTimeElapsedSinceX(enumeration_start)),
+                enumeration_reset_ms,
+                enumeration_address_ms,
+                usb_resets);
+    }
+
     chSysLockFromISR();
 
     /* Enables the endpoints specified into the configuration.
@@ -110,6 +214,11 @@ static void usb_event(USBDriver *usbp, usbevent_t event) {
        must be used.*/
     usbInitEndpointI(usbp, USBD1_DATA_REQUEST_EP, &ep1config);
     usbInitEndpointI(usbp, USBD1_INTERRUPT_REQUEST_EP, &ep2config);
+#if USB_UF2_MSC
+    USBMscConfigureHookI(usbp);
+#else
+    USBBulkConfigureHookI(usbp);
+#endif
 
     /* Resetting the state of the CDC subsystem.*/
     sduConfigureHookI(&SDU1);
@@ -117,8 +226,21 @@ static void usb_event(USBDriver *usbp, usbevent_t event) {
     chSysUnlockFromISR();
     return;
   case USB_EVENT_SUSPEND:
+    /* The configuration and the endpoints are kept, transfers in flight
+       continue on resume without a new enumeration.*/
+    if (usb_suspended == false) {
+      usb_suspended = true;
+      usb_suspends++;
+      suspend_start = chVTGetSystemTimeX();
+    }
     return;
   case USB_EVENT_WAKEUP:
+    if (usb_suspended == true) {
+      usb_suspended = false;
+      DEBUG_LOG("USB: resumed after %u ms suspend, %u suspends",
+                ST2MS(chVTTimeElapsedSinceX(suspend_start)),
+                usb_suspends);
+    }
     return;
   case USB_EVENT_STALLED:
     return;
@@ -132,7 +254,7 @@ static void usb_event(USBDriver *usbp, usbevent_t event) {
 const USBConfig usbcfg = {
   usb_event,
   get_descriptor,
-  sduRequestsHook,
+  requests_hook,
   NULL
 };
 
@@ -146,9 +268,60 @@ const SerialUSBConfig serusbcfg = {
   USBD1_INTERRUPT_REQUEST_EP
 };
 
+/**
+ * @brief   Checks if the host may still hold a session with the device
+ *          from before the last reset. Without VBUS there is no host, and
+ *          after a power-on or brown-out reset the host has not seen the
+ *          device yet. Other resets (software, watchdog, pin) can happen
+ *          while enumerated.
+ *
+ * @param[in] reset_flags   RCC_CSR reset flags of the last reset.
+ */
+static bool USBHostMayHaveSession(uint32_t reset_flags)
+{
+  if (palReadPad(GPIOA, GPIOA_VBUS_FS) == PAL_LOW)
+    return false;
+
+  if ((reset_flags & (RCC_CSR_PORRSTF | RCC_CSR_BORRSTF)) != 0)
+    return false;
+
+  return true;
+}
+
+/**
+ * @brief   Starts the USB driver and connects to the bus. The bus is only
+ *          held disconnected when a host may have a session to drop.
+ *
+ * @param[in] reset_flags   RCC_CSR reset flags of the last reset, read
+ *                          once by the system init.
+ */
+void USBConnect(uint32_t reset_flags)
+{
+  uint32_t delay = 0;
+
+  usbDisconnectBus(serusbcfg.usbp);
+
+  if (USBHostMayHaveSession(reset_flags) == true) {
+    delay = USB_RECONNECT_DELAY_MS;
+    chThdSleepMilliseconds(delay);
+  }
+
+  usb_resets = 0;
+  usb_suspends = 0;
+  enumeration_reset_ms = 0;
+  enumeration_address_ms = 0;
+  enumeration_done = false;
+  enumeration_start = chVTGetSystemTime();
+
+  usbStart(serusbcfg.usbp, &usbcfg);
+  usbConnectBus(serusbcfg.usbp);
+
+  DEBUG_LOG("USB: connected, reconnect delay %u ms", delay);
+}
+
 bool isUSBActive(void)
 {
-	if (serusbcfg.usbp->state == USB_ACTIVE)
+	if ((serusbcfg.usbp->state == USB_ACTIVE) && (usb_suspended == false))
 		return true;
 	else
 		return false;
@@ -167,3 +340,41 @@ size_t USBReadByte(systime_t timeout)
 {
   return chnGetTimeout(&SDU1, timeout);
 }
+
+/**
+ * @brief               Waits for at least one byte and then reads everything
+ *                      already available, up to USB_RECEIVE_BLOCK_SIZE bytes.
+ *
+ * @param[out] data     Pointer to the received block.
+ * @param[in] timeout   Time to wait for the first byte.
+ * @return              Number of bytes received, 0 on timeout.
+ */
+size_t USBReadBlock(uint8_t **data, systime_t timeout)
+{
+  static uint8_t block[USB_RECEIVE_BLOCK_SIZE];
+  msg_t first;
+
+  first = chnGetTimeout(&SDU1, timeout);
+
+  if (first < 0)
+    return 0;
+
+  block[0] = (uint8_t)first;
+  *data = block;
+
+  return 1 + chnReadTimeout(&SDU1, &block[1], sizeof(block) - 1,
+                            TIME_IMMEDIATE);
+}
+
+/**
+ * @brief               Reads data straight into the caller's buffer.
+ *
+ * @param[out] data     Pointer to the buffer.
+ * @param[in] size      Number of bytes to read.
+ * @param[in] timeout   Time to wait for the data.
+ * @return              Number of bytes read, less than size on timeout.
+ */
+size_t USBReadData(uint8_t *data, size_t size, systime_t timeout)
+{
+  return chnReadTimeout(&SDU1, data, size, timeout);
+}
@@ -0,0 +1,408 @@
+/* *
+ *
+ * Virtual FAT16 disk for UF2 drag and drop flashing. Nothing is stored,
+ * every sector is generated when it is read: a boot sector, the FATs, a
+ * root directory with INFO_UF2.TXT and CURRENT.UF2 (the flash read back as
+ * UF2) and the file data.
+ *
+ * Written sectors holding a UF2 block are passed to the flash in the order
+ * they arrive, everything else the host writes (directory, FAT) is
+ * dropped. Blocks are tracked in a bitmap so the host may write them in
+ * any order and more than once, the file is complete when every block of
+ * it was written.
+ *
+ * No ChibiOS dependencies, the host test tools build it as is.
+ *
+ * */
+
+#include <string.h>
+#include "uf2_fat.h"
+
+/* Global variable defines */
+
+/* Private variable defines */
+
+/**
+ * @brief   Layout of the volume, one sector per cluster.
+ */
+#define UF2_FAT_RESERVED_SECTORS        1
+#define UF2_FAT_NUM_FATS                2
+#define UF2_FAT_ROOT_ENTRIES            64
+#define UF2_FAT_SECTORS_PER_FAT         ((UF2_FAT_NUM_SECTORS * 2 + 511) / 512)
+#define UF2_FAT_ROOT_SECTORS            (UF2_FAT_ROOT_ENTRIES * 32 / 512)
+#define UF2_FAT_START_FAT0              UF2_FAT_RESERVED_SECTORS
+#define UF2_FAT_START_ROOT              (UF2_FAT_START_FAT0 +               \
+                                         UF2_FAT_NUM_FATS *                 \
+                                         UF2_FAT_SECTORS_PER_FAT)
+#define UF2_FAT_START_CLUSTERS          (UF2_FAT_START_ROOT +               \
+                                         UF2_FAT_ROOT_SECTORS)
+
+/**
+ * @brief   Date and time of the files, 2016-01-01 00:00.
+ */
+#define UF2_FAT_DATE                    (((2016 - 1980) << 9) | (1 << 5) | 1)
+#define UF2_FAT_TIME                    0
+
+/**
+ * @brief   Files on the volume.
+ */
+#define UF2_FILE_INFO                   0
+#define UF2_FILE_CURRENT                1
+#define UF2_NUM_FILES                   2
+
+/**
+ * @brief   A file on the volume, stored in consecutive clusters.
+ */
+typedef struct
+{
+  char name[11];
+  uint32_t size;
+  uint32_t first_cluster;
+  uint32_t clusters;
+} uf2_file_t;
+
+/**
+ * @brief   The device side of the disk.
+ */
+static const uf2_fat_config_t *uf2_config;
+
+/**
+ * @brief   The files.
+ */
+static uf2_file_t uf2_files[UF2_NUM_FILES] = {
+  {"INFO_UF2TXT", 0, 0, 0},
+  {"CURRENT UF2", 0, 0, 0}
+};
+
+/**
+ * @brief   Blocks of the current UF2 file written so far, one bit each.
+ */
+static uint8_t uf2_written[UF2_MAX_BLOCKS / 8];
+
+/**
+ * @brief   Number of blocks of the current file, 0 if no file is written.
+ */
+static uint32_t uf2_num_blocks;
+
+/**
+ * @brief   Number of different blocks of the current file written.
+ */
+static uint32_t uf2_blocks_written;
+
+/* Private function defines */
+
+/* Private external functions */
+
+/**
+ * @brief   Little endian accessors, the sector buffers may be unaligned.
+ */
+static void UF2PutWord(uint8_t *data, uint32_t value)
+{
+  data[0] = (uint8_t)(value);
+  data[1] = (uint8_t)(value >> 8);
+  data[2] = (uint8_t)(value >> 16);
+  data[3] = (uint8_t)(value >> 24);
+}
+
+static void UF2PutHalfWord(uint8_t *data, uint16_t value)
+{
+  data[0] = (uint8_t)(value);
+  data[1] = (uint8_t)(value >> 8);
+}
+
+static uint32_t UF2GetWord(const uint8_t *data)
+{
+  return ((uint32_t)data[0]) | ((uint32_t)data[1] << 8) |
+         ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/**
+ * @brief   Generates the boot sector with the FAT16 BIOS parameter block.
+ */
+static void UF2BootSector(uint8_t *data)
+{
+  data[0] = 0xEB;                               /* Jump.                    */
+  data[1] = 0x3C;
+  data[2] = 0x90;
+  memcpy(&data[3], "UF2 UF2 ", 8);              /* OEM name.                */
+  UF2PutHalfWord(&data[11], UF2_FAT_SECTOR_SIZE);
+  data[13] = 1;                                 /* Sectors per cluster.     */
+  UF2PutHalfWord(&data[14], UF2_FAT_RESERVED_SECTORS);
+  data[16] = UF2_FAT_NUM_FATS;
+  UF2PutHalfWord(&data[17], UF2_FAT_ROOT_ENTRIES);
+  UF2PutHalfWord(&data[19], UF2_FAT_NUM_SECTORS);
+  data[21] = 0xF8;                              /* Media (fixed disk).      */
+  UF2PutHalfWord(&data[22], UF2_FAT_SECTORS_PER_FAT);
+  UF2PutHalfWord(&data[24], 1);                 /* Sectors per track.       */
+  UF2PutHalfWord(&data[26], 1);                 /* Heads.                   */
+  data[36] = 0x80;                              /* Drive number.            */
+  data[38] = 0x29;                              /* Extended boot signature. */
+  UF2PutWord(&data[39], 0x00420042);            /* Volume serial.           */
+  memcpy(&data[43], "KFLYBOOT   ", 11);         /* Volume label.            */
+  memcpy(&data[54], "FAT16   ", 8);             /* File system type.        */
+  data[510] = 0x55;
+  data[511] = 0xAA;
+}
+
+/**
+ * @brief   Generates a FAT sector, each file is one chain of consecutive
+ *          clusters.
+ */
+static void UF2FatSector(uint32_t sector, uint8_t *data)
+{
+  uint32_t i, f, cluster, value;
+
+  for (i = 0; i < UF2_FAT_SECTOR_SIZE / 2; i++) {
+    cluster = sector * (UF2_FAT_SECTOR_SIZE / 2) + i;
+    value = 0;
+
+    if (cluster == 0)
+      value = 0xFFF8;
+    else if (cluster == 1)
+      value = 0xFFFF;
+
+    for (f = 0; f < UF2_NUM_FILES; f++) {
+      if ((cluster >= uf2_files[f].first_cluster) &&
+          (cluster < uf2_files[f].first_cluster + uf2_files[f].clusters)) {
+        if (cluster == uf2_files[f].first_cluster + uf2_files[f].clusters - 1)
+          value = 0xFFFF;
+        else
+          value = cluster + 1;
+      }
+    }
+
+    UF2PutHalfWord(&data[i * 2], (uint16_t)value);
+  }
+}
+
+/**
+ * @brief   Generates the first root directory sector, the volume label and
+ *          the files.
+ */
+static void UF2RootSector(uint8_t *data)
+{
+  uint32_t f;
+  uint8_t *entry;
+
+  memcpy(data, "KFLYBOOT   ", 11);
+  data[11] = 0x08;                              /* Volume label.            */
+
+  for (f = 0; f < UF2_NUM_FILES; f++) {
+    entry = &data[(f + 1) * 32];
+    memcpy(entry, uf2_files[f].name, 11);
+    entry[11] = 0x01;                           /* Read only.               */
+    UF2PutHalfWord(&entry[14], UF2_FAT_TIME);   /* Creation time.           */
+    UF2PutHalfWord(&entry[16], UF2_FAT_DATE);   /* Creation date.           */
+    UF2PutHalfWord(&entry[18], UF2_FAT_DATE);   /* Access date.             */
+    UF2PutHalfWord(&entry[22], UF2_FAT_TIME);   /* Write time.              */
+    UF2PutHalfWord(&entry[24], UF2_FAT_DATE);   /* Write date.              */
+    UF2PutHalfWord(&entry[26], (uint16_t)uf2_files[f].first_cluster);
+    UF2PutWord(&entry[28], uf2_files[f].size);
+  }
+}
+
+/**
+ * @brief   Generates a block of CURRENT.UF2 from the flash.
+ */
+static void UF2ReadbackBlock(uint32_t block, uint8_t *data)
+{
+  uint32_t num_blocks = (uf2_config->flash_end - uf2_config->flash_base) /
+                        UF2_READBACK_PAYLOAD;
+
+  UF2PutWord(&data[0], UF2_MAGIC_START0);
+  UF2PutWord(&data[4], UF2_MAGIC_START1);
+  UF2PutWord(&data[8], UF2_FLAG_FAMILY_ID);
+  UF2PutWord(&data[12], uf2_config->flash_base +
+                        block * UF2_READBACK_PAYLOAD);
+  UF2PutWord(&data[16], UF2_READBACK_PAYLOAD);
+  UF2PutWord(&data[20], block);
+  UF2PutWord(&data[24], num_blocks);
+  UF2PutWord(&data[28], UF2_FAMILY_STM32F4);
+  uf2_config->read(uf2_config->flash_base + block * UF2_READBACK_PAYLOAD,
+                   &data[32],
+                   UF2_READBACK_PAYLOAD);
+  UF2PutWord(&data[508], UF2_MAGIC_END);
+}
+
+/**
+ * @brief   Generates a data sector.
+ */
+static void UF2DataSector(uint32_t cluster, uint8_t *data)
+{
+  uint32_t f, offset, size;
+
+  for (f = 0; f < UF2_NUM_FILES; f++) {
+    if ((cluster < uf2_files[f].first_cluster) ||
+        (cluster >= uf2_files[f].first_cluster + uf2_files[f].clusters))
+      continue;
+
+    offset = (cluster - uf2_files[f].first_cluster) * UF2_FAT_SECTOR_SIZE;
+
+    if (f == UF2_FILE_INFO) {
+      size = uf2_files[f].size - offset;
+      if (size > UF2_FAT_SECTOR_SIZE)
+        size = UF2_FAT_SECTOR_SIZE;
+      memcpy(data, &uf2_config->info[offset], size);
+    }
+    else
+      UF2ReadbackBlock(offset / UF2_FAT_SECTOR_SIZE, data);
+
+    return;
+  }
+}
+
+/**
+ * @brief   Checks if a block holds what the flash already holds.
+ */
+static bool UF2MatchesFlash(uint32_t address, const uint8_t *data,
+                            uint32_t size)
+{
+  uint8_t flash[32];
+  uint32_t n;
+
+  while (size > 0) {
+    n = (size > sizeof(flash)) ? sizeof(flash) : size;
+    uf2_config->read(address, flash, n);
+
+    if (memcmp(flash, data, n) != 0)
+      return false;
+
+    address += n;
+    data += n;
+    size -= n;
+  }
+
+  return true;
+}
+
+/* Global functions */
+
+/**
+ * @brief               Lays out the files of the volume.
+ *
+ * @param[in] config    The device side of the disk, must stay valid.
+ */
+void UF2Fat_Init(const uf2_fat_config_t *config)
+{
+  uint32_t f, cluster = 2;
+
+  uf2_config = config;
+
+  uf2_files[UF2_FILE_INFO].size = strlen(config->info);
+  uf2_files[UF2_FILE_CURRENT].size = (config->flash_end - config->flash_base) /
+                                     UF2_READBACK_PAYLOAD *
+                                     UF2_FAT_SECTOR_SIZE;
+
+  for (f = 0; f < UF2_NUM_FILES; f++) {
+    uf2_files[f].first_cluster = cluster;
+    uf2_files[f].clusters = (uf2_files[f].size + UF2_FAT_SECTOR_SIZE - 1) /
+                            UF2_FAT_SECTOR_SIZE;
+    if (uf2_files[f].clusters == 0)
+      uf2_files[f].clusters = 1;
+
+    cluster += uf2_files[f].clusters;
+  }
+
+  uf2_num_blocks = 0;
+  uf2_blocks_written = 0;
+}
+
+/**
+ * @brief               Generates a sector of the volume.
+ *
+ * @param[in] lba       Sector number.
+ * @param[out] data     Pointer to a 512 byte buffer.
+ */
+void UF2Fat_ReadSector(uint32_t lba, uint8_t *data)
+{
+  memset(data, 0, UF2_FAT_SECTOR_SIZE);
+
+  if (lba == 0)
+    UF2BootSector(data);
+  else if (lba < UF2_FAT_START_ROOT)
+    UF2FatSector((lba - UF2_FAT_START_FAT0) % UF2_FAT_SECTORS_PER_FAT, data);
+  else if (lba == UF2_FAT_START_ROOT)
+    UF2RootSector(data);
+  else if (lba >= UF2_FAT_START_CLUSTERS)
+    UF2DataSector(lba - UF2_FAT_START_CLUSTERS + 2, data);
+}
+
+/**
+ * @brief               Handles a written sector, a UF2 block for this
+ *                      device is passed to the flash.
+ *
+ * @param[in] lba       Sector number, UF2 blocks are accepted anywhere.
+ * @param[in] data      Pointer to the 512 byte sector.
+ * @return              What was done with the sector.
+ */
+uf2_write_status_t UF2Fat_WriteSector(uint32_t lba, const uint8_t *data)
+{
+  uint32_t flags, address, size, block, num_blocks;
+  (void)lba;
+
+  if ((UF2GetWord(&data[0]) != UF2_MAGIC_START0) ||
+      (UF2GetWord(&data[4]) != UF2_MAGIC_START1) ||
+      (UF2GetWord(&data[508]) != UF2_MAGIC_END))
+    return UF2_WRITE_IGNORED;
+
+  flags = UF2GetWord(&data[8]);
+  address = UF2GetWord(&data[12]);
+  size = UF2GetWord(&data[16]);
+  block = UF2GetWord(&data[20]);
+  num_blocks = UF2GetWord(&data[24]);
+
+  if (((flags & UF2_FLAG_NOT_MAIN_FLASH) != 0) ||
+      (((flags & UF2_FLAG_FAMILY_ID) != 0) &&
+       (UF2GetWord(&data[28]) != UF2_FAMILY_STM32F4)) ||
+      (size == 0) || (size > UF2_MAX_PAYLOAD) ||
+      (address < uf2_config->flash_base) ||
+      (address + size > uf2_config->flash_end) ||
+      (num_blocks == 0) || (num_blocks > UF2_MAX_BLOCKS) ||
+      (block >= num_blocks))
+    return UF2_WRITE_IGNORED;
+
+  /* A written file can be written again as it is, anything else is a new
+     file and may erase again */
+  if ((uf2_num_blocks == num_blocks) &&
+      ((uf2_written[block / 8] & (1 << (block % 8))) != 0)) {
+    if ((uf2_blocks_written < uf2_num_blocks) ||
+        (UF2MatchesFlash(address, &data[32], size) == true))
+      return UF2_WRITE_DUPLICATE;
+  }
+
+  if ((uf2_num_blocks != num_blocks) || (uf2_blocks_written == num_blocks)) {
+    memset(uf2_written, 0, sizeof(uf2_written));
+    uf2_num_blocks = num_blocks;
+    uf2_blocks_written = 0;
+    uf2_config->begin();
+  }
+
+  if (uf2_config->write(address, &data[32], size) == false)
+    return UF2_WRITE_FAILED;
+
+  uf2_written[block / 8] |= (1 << (block % 8));
+  uf2_blocks_written++;
+
+  if (uf2_blocks_written == uf2_num_blocks) {
+    uf2_config->complete();
+    return UF2_WRITE_COMPLETE;
+  }
+
+  return UF2_WRITE_OK;
+}
+
+/**
+ * @brief   Number of different blocks of the current UF2 file written.
+ */
+uint32_t UF2Fat_BlocksWritten(void)
+{
+  return uf2_blocks_written;
+}
+
+/**
+ * @brief   Number of blocks of the current UF2 file, 0 if none.
+ */
+uint32_t UF2Fat_BlocksExpected(void)
+{
+  return uf2_num_blocks;
+}
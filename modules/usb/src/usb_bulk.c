@@ -0,0 +1,463 @@
+/* *
+ *
+ * Vendor specific (WinUSB/libusb) bulk interface carrying the serial
+ * protocol next to the CDC ACM port. Transfers span several packets, a
+ * transfer ends with a short packet (or a zero length packet).
+ * Received transfers are double buffered so the host can keep sending
+ * while the previous transfer is parsed.
+ * Scatter-gather transmissions send the whole packets of each segment
+ * straight from the segment (RAM or flash), only packets that straddle two
+ * segments are gathered in a bounce buffer. The pieces are chained from the
+ * transmit interrupt and the host sees one transfer.
+ *
+ * */
+
+#include <string.h>
+#include "ch.h"
+#include "hal.h"
+#include "myusb.h"
+#include "usb_bulk.h"
+
+/* Global variable defines */
+
+/* Private variable defines */
+
+/**
+ * @brief   Number of receive buffers.
+ */
+#define USB_BULK_RX_BUFFERS             2
+
+/**
+ * @brief   No buffer.
+ */
+#define USB_BULK_NO_BUFFER              (-1)
+
+/**
+ * @brief   IN EP3 state.
+ */
+static USBInEndpointState ep3instate;
+
+/**
+ * @brief   OUT EP3 state.
+ */
+static USBOutEndpointState ep3outstate;
+
+/**
+ * @brief   Receive buffers, one is filled by the driver while the other is
+ *          parsed.
+ */
+static uint8_t rx_buffers[USB_BULK_RX_BUFFERS][USB_BULK_TRANSFER_SIZE];
+
+/**
+ * @brief   Size of the transfer in each receive buffer.
+ */
+static size_t rx_sizes[USB_BULK_RX_BUFFERS];
+
+/**
+ * @brief   Buffer being filled by the driver, no buffer if both are taken.
+ */
+static int8_t rx_active = USB_BULK_NO_BUFFER;
+
+/**
+ * @brief   Buffer holding a received transfer, if any.
+ */
+static int8_t rx_ready = USB_BULK_NO_BUFFER;
+
+/**
+ * @brief   Buffer given to the receiver thread, if any.
+ */
+static int8_t rx_owned = USB_BULK_NO_BUFFER;
+
+/**
+ * @brief   Thread waiting for a received transfer, if any.
+ */
+static thread_reference_t rx_waiter = NULL;
+
+/**
+ * @brief   Thread waiting for a transmission to complete, if any.
+ */
+static thread_reference_t tx_waiter = NULL;
+
+/**
+ * @brief   True while the bulk endpoints are configured.
+ */
+static bool bulk_active = false;
+
+/**
+ * @brief   True while a scatter-gather transmission is chained from the
+ *          transmit interrupt.
+ */
+static bool tx_scatter = false;
+
+/**
+ * @brief   Segments left of the scatter-gather transmission, the offset in
+ *          the first of them and if the last packet has been started.
+ */
+static const serial_segment_t *tx_segments;
+static size_t tx_segment_count;
+static uint32_t tx_offset;
+static bool tx_done;
+
+/**
+ * @brief   Packet gathered from the ends of neighbouring segments.
+ */
+static uint8_t tx_bounce[USB_BULK_PACKET_SIZE];
+
+/* Private function defines */
+
+static void USBBulkDataReceived(USBDriver *usbp, usbep_t ep);
+static void USBBulkDataTransmitted(USBDriver *usbp, usbep_t ep);
+
+/**
+ * @brief   EP3 initialization structure (both IN and OUT).
+ */
+static const USBEndpointConfig ep3config = {
+  USB_EP_MODE_TYPE_BULK,
+  NULL,
+  USBBulkDataTransmitted,
+  USBBulkDataReceived,
+  USB_BULK_PACKET_SIZE,
+  USB_BULK_PACKET_SIZE,
+  &ep3instate,
+  &ep3outstate,
+  2,
+  NULL
+};
+
+/* Private external functions */
+
+/**
+ * @brief   Starts a receive transfer into a free buffer, if there is one
+ *          and none is active. Nothing is started while a received
+ *          transfer waits for the receiver thread, the host is NAKed
+ *          until the thread takes it instead of the transfer being
+ *          overwritten.
+ * @note    Must be called from a locked context.
+ */
+static void USBBulkStartReceiveI(void)
+{
+  int8_t i;
+
+  if ((bulk_active == false) || (rx_active != USB_BULK_NO_BUFFER) ||
+      (rx_ready != USB_BULK_NO_BUFFER))
+    return;
+
+  for (i = 0; i < USB_BULK_RX_BUFFERS; i++)
+  {
+    if ((i != rx_ready) && (i != rx_owned))
+    {
+      rx_active = i;
+      usbPrepareReceive(&USBD1, USBD1_BULK_EP, rx_buffers[i],
+                        USB_BULK_TRANSFER_SIZE);
+      usbStartReceiveI(&USBD1, USBD1_BULK_EP);
+      return;
+    }
+  }
+}
+
+/**
+ * @brief   OUT transfer completed, hands the buffer to the receiver thread.
+ *          Receiving continues once the thread takes it.
+ */
+static void USBBulkDataReceived(USBDriver *usbp, usbep_t ep)
+{
+  osalSysLockFromISR();
+
+  if (rx_active != USB_BULK_NO_BUFFER)
+  {
+    rx_sizes[rx_active] = usbGetReceiveTransactionSizeI(usbp, ep);
+    rx_ready = rx_active;
+    rx_active = USB_BULK_NO_BUFFER;
+
+    osalThreadResumeI(&rx_waiter, MSG_OK);
+  }
+
+  osalSysUnlockFromISR();
+}
+
+/**
+ * @brief   Skips the segments that have been sent.
+ */
+static void USBBulkSkipSegmentsI(void)
+{
+  while ((tx_segment_count > 0) && (tx_offset >= tx_segments->size))
+  {
+    tx_segments++;
+    tx_segment_count--;
+    tx_offset = 0;
+  }
+}
+
+/**
+ * @brief   Starts the next piece of a scatter-gather transmission: the
+ *          whole packets left in the current segment, else one packet
+ *          gathered in the bounce buffer. A short packet, or a zero length
+ *          packet when the data ends on a packet boundary, ends the transfer.
+ * @note    Must be called from a locked context.
+ *
+ * @return  True if a piece was started, false if the transmission is done.
+ */
+static bool USBBulkNextSegmentI(void)
+{
+  uint32_t left, n;
+
+  if ((tx_done == true) || (bulk_active == false))
+    return false;
+
+  USBBulkSkipSegmentsI();
+
+  if (tx_segment_count == 0)
+  {
+    tx_done = true;
+    usbPrepareTransmit(&USBD1, USBD1_BULK_EP, NULL, 0);
+  }
+  else if ((tx_segments->size - tx_offset) >= USB_BULK_PACKET_SIZE)
+  {
+    left = tx_segments->size - tx_offset;
+    n = left - (left % USB_BULK_PACKET_SIZE);
+
+    usbPrepareTransmit(&USBD1, USBD1_BULK_EP,
+                       (uint8_t *)&tx_segments->data[tx_offset], n);
+    tx_offset += n;
+  }
+  else
+  {
+    n = 0;
+
+    while ((n < USB_BULK_PACKET_SIZE) && (tx_segment_count > 0))
+    {
+      left = tx_segments->size - tx_offset;
+
+      if (left > (USB_BULK_PACKET_SIZE - n))
+        left = USB_BULK_PACKET_SIZE - n;
+
+      memcpy(&tx_bounce[n], &tx_segments->data[tx_offset], left);
+      n += left;
+      tx_offset += left;
+
+      USBBulkSkipSegmentsI();
+    }
+
+    if (n < USB_BULK_PACKET_SIZE)
+      tx_done = true;
+
+    usbPrepareTransmit(&USBD1, USBD1_BULK_EP, tx_bounce, n);
+  }
+
+  return (usbStartTransmitI(&USBD1, USBD1_BULK_EP) == false);
+}
+
+/**
+ * @brief   IN transfer completed, continues a scatter-gather transmission
+ *          or wakes up the sender.
+ */
+static void USBBulkDataTransmitted(USBDriver *usbp, usbep_t ep)
+{
+  (void)usbp;
+  (void)ep;
+
+  osalSysLockFromISR();
+
+  if ((tx_scatter == false) || (USBBulkNextSegmentI() == false))
+    osalThreadResumeI(&tx_waiter, MSG_OK);
+
+  osalSysUnlockFromISR();
+}
+
+/**
+ * @brief               Transmits one transfer and waits for it to finish.
+ *
+ * @param[in] data      Pointer to the data.
+ * @param[in] size      Size of the data, 0 for a zero length packet.
+ * @param[in] timeout   Time to wait for the host to read the transfer.
+ * @return              True if the transfer was read by the host.
+ */
+static bool USBBulkTransmit(uint8_t *data, size_t size, systime_t timeout)
+{
+  msg_t msg = MSG_RESET;
+
+  usbPrepareTransmit(&USBD1, USBD1_BULK_EP, data, size);
+
+  osalSysLock();
+
+  if ((bulk_active == true) &&
+      (usbStartTransmitI(&USBD1, USBD1_BULK_EP) == false))
+    msg = osalThreadSuspendTimeoutS(&tx_waiter, timeout);
+
+  osalSysUnlock();
+
+  return (msg == MSG_OK);
+}
+
+/**
+ * @brief   Enables the bulk endpoints and starts receiving, called from the
+ *          USB_EVENT_CONFIGURED event.
+ * @note    Must be called from a locked context.
+ *
+ * @param[in] usbp      Pointer to the USB driver.
+ */
+void USBBulkConfigureHookI(USBDriver *usbp)
+{
+  usbInitEndpointI(usbp, USBD1_BULK_EP, &ep3config);
+
+  /* Transfers in flight were lost with the old configuration */
+  rx_active = USB_BULK_NO_BUFFER;
+  rx_ready = USB_BULK_NO_BUFFER;
+  bulk_active = true;
+
+  USBBulkStartReceiveI();
+}
+
+/**
+ * @brief   Disables the bulk interface and releases waiting threads, called
+ *          from the USB_EVENT_RESET event.
+ * @note    Must be called from a locked context.
+ */
+void USBBulkDisconnectI(void)
+{
+  bulk_active = false;
+
+  osalThreadResumeI(&rx_waiter, MSG_RESET);
+  osalThreadResumeI(&tx_waiter, MSG_RESET);
+}
+
+bool isUSBBulkActive(void)
+{
+  if ((bulk_active == true) && (isUSBActive() == true))
+    return true;
+  else
+    return false;
+}
+
+/**
+ * @brief               Sends data as one multi packet transfer, followed by
+ *                      a zero length packet if the transfer ends on a packet
+ *                      boundary.
+ *
+ * @param[in] data      Pointer to the data.
+ * @param[in] size      Size of the data.
+ * @param[in] timeout   Time to wait for the host to read each transfer.
+ * @return              Number of bytes sent.
+ */
+size_t USBBulkSendData(uint8_t *data, size_t size, systime_t timeout)
+{
+  if (USBBulkTransmit(data, size, timeout) == false)
+    return 0;
+
+  /* The host reads until a short packet */
+  if ((size % USB_BULK_PACKET_SIZE) == 0)
+    USBBulkTransmit(NULL, 0, timeout);
+
+  return size;
+}
+
+/**
+ * @brief               Sends a list of segments as one multi packet
+ *                      transfer without copying them.
+ * @note                Segments in flash are read in whole words, a direct
+ *                      piece is always a multiple of the packet size so
+ *                      nothing past the end of a segment is read.
+ *
+ * @param[in] segments  Pointer to the segments, valid until sent.
+ * @param[in] count     Number of segments.
+ * @param[in] timeout   Time to wait for the host to read the transfer.
+ * @return              Number of bytes sent, 0 if the transfer failed.
+ */
+size_t USBBulkSendSegments(const serial_segment_t *segments,
+                           size_t count,
+                           systime_t timeout)
+{
+  msg_t msg = MSG_RESET;
+  size_t i, size = 0;
+
+  for (i = 0; i < count; i++)
+    size += segments[i].size;
+
+  osalSysLock();
+
+  tx_segments = segments;
+  tx_segment_count = count;
+  tx_offset = 0;
+  tx_done = false;
+  tx_scatter = true;
+
+  if (USBBulkNextSegmentI() == true)
+    msg = osalThreadSuspendTimeoutS(&tx_waiter, timeout);
+
+  tx_scatter = false;
+
+  osalSysUnlock();
+
+  if ((msg == MSG_OK) && (tx_done == true))
+    return size;
+  else
+    return 0;
+}
+
+/**
+ * @brief               Waits for a received transfer. The buffer of the
+ *                      previous transfer is given back to the driver.
+ *
+ * @param[out] data     Pointer to the received transfer.
+ * @param[in] timeout   Time to wait for a transfer.
+ * @return              Size of the transfer, 0 on timeout.
+ */
+size_t USBBulkReadBlock(uint8_t **data, systime_t timeout)
+{
+  size_t size = 0;
+
+  osalSysLock();
+
+  /* The previous transfer is parsed, its buffer is free again */
+  rx_owned = USB_BULK_NO_BUFFER;
+  USBBulkStartReceiveI();
+
+  if (rx_ready == USB_BULK_NO_BUFFER)
+    osalThreadSuspendTimeoutS(&rx_waiter, timeout);
+
+  if (rx_ready != USB_BULK_NO_BUFFER)
+  {
+    rx_owned = rx_ready;
+    rx_ready = USB_BULK_NO_BUFFER;
+
+    *data = rx_buffers[rx_owned];
+    size = rx_sizes[rx_owned];
+
+    USBBulkStartReceiveI();
+  }
+
+  osalSysUnlock();
+
+  return size;
+}
+
+/**
+ * @brief               Transport send operation, blocks until sent.
+ */
+static size_t USBBulkTransportSend(uint8_t *data, size_t size)
+{
+  return USBBulkSendData(data, size, TIME_INFINITE);
+}
+
+/**
+ * @brief               Transport scatter-gather send operation, blocks until
+ *                      sent.
+ */
+static size_t USBBulkTransportSendSegments(const serial_segment_t *segments,
+                                           size_t count)
+{
+  return USBBulkSendSegments(segments, count, TIME_INFINITE);
+}
+
+/**
+ * @brief   USB vendor bulk transport descriptor for the serial manager.
+ */
+const serial_transport_t usb_bulk_transport = {
+  "USB Bulk",
+  USB_BULK_TRANSFER_SIZE,
+  NULL,
+  isUSBBulkActive,
+  USBBulkTransportSend,
+  USBBulkReadBlock,
+  USBBulkTransportSendSegments
+};
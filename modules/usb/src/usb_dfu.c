@@ -0,0 +1,502 @@
+/* *
+ *
+ * DFU 1.1 interface with the ST DfuSe extensions, in DFU mode next to the
+ * CDC and bulk interfaces so stock dfu-util can flash the user application.
+ * Download blocks are received straight into a flash pipeline job and
+ * programmed while the host sends the next block, bwPollTimeout reports
+ * the estimated time of the erases and programming in flight.
+ *
+ * DfuSe: block 0 carries commands (set address, erase), block n >= 2 is
+ * data for address + (n - 2) * wTransferSize.
+ *
+ * */
+
+#include "ch.h"
+#include "hal.h"
+#include "usb_dfu.h"
+#include "image_decrypt.h"
+
+/* Global variable defines */
+
+/* Private variable defines */
+
+/**
+ * @brief   Size of a GETSTATUS response.
+ */
+#define USB_DFU_STATUS_SIZE             6
+
+/**
+ * @brief   Current DFU state.
+ */
+static dfu_state_t dfu_state = DFU_STATE_IDLE;
+
+/**
+ * @brief   Current DFU status.
+ */
+static dfu_status_t dfu_status = DFU_STATUS_OK;
+
+/**
+ * @brief   Time the host waits before the next GETSTATUS, in ms.
+ */
+static uint32_t dfu_poll_timeout;
+
+/**
+ * @brief   DfuSe address pointer, base of the data blocks.
+ */
+static uint32_t dfu_address = FLASH_USER_BASE;
+
+/**
+ * @brief   Block number and size of the last download.
+ */
+static uint16_t dfu_block;
+static uint16_t dfu_length;
+
+/**
+ * @brief   Job the next download is received into, reserved before the
+ *          host is told it may download.
+ */
+static flash_job_t *dfu_job = NULL;
+
+/**
+ * @brief   Set while the image of the download is being checked.
+ */
+static bool dfu_checking = false;
+
+/**
+ * @brief   GETSTATUS and GETSTATE response buffer.
+ */
+static uint8_t dfu_response[USB_DFU_STATUS_SIZE];
+
+/**
+ * @brief   DfuSe commands supported, the response to an upload of block 0.
+ */
+static const uint8_t dfuse_commands[] = {
+  DFUSE_CMD_GET_COMMANDS,
+  DFUSE_CMD_SET_ADDRESS,
+  DFUSE_CMD_ERASE
+};
+
+/* Private function defines */
+
+/* Private external functions */
+
+/**
+ * @brief   Reads a little endian 32-bit value.
+ */
+static uint32_t DfuGetWord(const uint8_t *data)
+{
+  return ((uint32_t)data[0]) | ((uint32_t)data[1] << 8) |
+         ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/**
+ * @brief   Gives back the reserved job when no download is running, so the
+ *          other users of the flash pipeline have all jobs.
+ * @note    Must be called from a locked context.
+ */
+static void DfuReleaseJobI(void)
+{
+  if (dfu_job != NULL) {
+    FlashPipeline_ReleaseI(dfu_job);
+    dfu_job = NULL;
+  }
+}
+
+/**
+ * @brief   Ends the download, the console and the UF2 disk may use the
+ *          flash again once the submitted jobs are written.
+ * @note    Must be called from a locked context.
+ */
+static void DfuEndSessionI(void)
+{
+  DfuReleaseJobI();
+  FlashPipeline_EndI(FLASH_OWNER_DFU);
+  dfu_checking = false;
+}
+
+/**
+ * @brief   Enters the error state, a running download is ended.
+ * @note    Must be called from a locked context.
+ */
+static void DfuErrorI(dfu_status_t status)
+{
+  DfuEndSessionI();
+  dfu_state = DFU_STATE_ERROR;
+  dfu_status = status;
+  dfu_poll_timeout = 0;
+}
+
+/**
+ * @brief   Maps a flash error to a DFU status.
+ */
+static dfu_status_t DfuFlashStatus(FLASH_Status status)
+{
+  switch (status) {
+  case FLASH_ERROR_WRP:
+    return DFU_STATUS_ERR_WRITE;
+  case FLASH_ERROR_PGS:
+  case FLASH_ERROR_PGP:
+  case FLASH_ERROR_PGA:
+  case FLASH_ERROR_PROGRAM:
+    return DFU_STATUS_ERR_PROG;
+  default:
+    return DFU_STATUS_ERR_ERASE;
+  }
+}
+
+/**
+ * @brief   Reserves the job for the next download. The host may download
+ *          once a job is reserved, else it is busy until the writer frees
+ *          one.
+ * @note    Must be called from a locked context.
+ */
+static void DfuReserveJobI(void)
+{
+  if (dfu_job == NULL)
+    dfu_job = FlashPipeline_GetJobI();
+
+  if (dfu_job != NULL) {
+    dfu_state = DFU_STATE_DNLOAD_IDLE;
+    dfu_poll_timeout = 0;
+  }
+  else {
+    dfu_state = DFU_STATE_DNBUSY;
+    dfu_poll_timeout = FlashPipeline_NextFreeTimeMsI();
+  }
+}
+
+/**
+ * @brief   Executes a received download block, a DfuSe command or data
+ *          for the writer.
+ * @note    Must be called from a locked context.
+ */
+static void DfuExecuteBlockI(void)
+{
+  flash_job_t *job = dfu_job;
+  const uint8_t *data = (const uint8_t *)job->data;
+
+  if (FlashPipeline_GetStatusI() != FLASH_COMPLETE) {
+    DfuErrorI(DfuFlashStatus(FlashPipeline_GetStatusI()));
+    return;
+  }
+
+  if (dfu_block == 0) {
+    /* Commands report busy once, dfu-util checks for it */
+    if ((dfu_length == 5) && (data[0] == DFUSE_CMD_SET_ADDRESS)) {
+      dfu_address = DfuGetWord(&data[1]);
+      dfu_state = DFU_STATE_DNBUSY;
+      dfu_poll_timeout = 0;
+      return;
+    }
+
+    if ((dfu_length != 1 && dfu_length != 5) ||
+        (data[0] != DFUSE_CMD_ERASE)) {
+      DfuErrorI(DFU_STATUS_ERR_TARGET);
+      return;
+    }
+
+    /* Page erase, or the whole user area for a mass erase */
+    job->type = FLASH_JOB_ERASE;
+
+    if (dfu_length == 5) {
+      job->address = DfuGetWord(&data[1]);
+      job->size = 1;
+    }
+    else {
+      job->address = FLASH_USER_BASE;
+      job->size = FLASH_END_ADDRESS - FLASH_USER_BASE;
+    }
+  }
+  else if (dfu_block >= 2) {
+    job->type = FLASH_JOB_PROGRAM;
+    job->address = dfu_address + (dfu_block - 2) * USB_DFU_TRANSFER_SIZE;
+    job->size = dfu_length;
+  }
+  else {
+    DfuErrorI(DFU_STATUS_ERR_STALLEDPKT);
+    return;
+  }
+
+  dfu_job = NULL;
+
+  if (FlashPipeline_SubmitI(job) != HAL_SUCCESS) {
+    DfuErrorI(DFU_STATUS_ERR_ADDRESS);
+    return;
+  }
+
+  if (dfu_block == 0) {
+    /* The host comes back when the erase should be done */
+    dfu_state = DFU_STATE_DNBUSY;
+    dfu_poll_timeout = job->estimate_ms;
+  }
+  else
+    DfuReserveJobI();
+}
+
+/**
+ * @brief   Waits for the writer to finish everything and for the check of
+ *          the image, then the download is complete. An image that fails
+ *          the check reports errVERIFY.
+ * @note    Must be called from a locked context.
+ */
+static void DfuManifestI(void)
+{
+  image_status_t image;
+
+  if ((dfu_state == DFU_STATE_MANIFEST_SYNC) ||
+      (FlashPipeline_IsIdleI() == false)) {
+    dfu_state = DFU_STATE_MANIFEST;
+    dfu_poll_timeout = FlashPipeline_PendingTimeMsI();
+    return;
+  }
+
+  if (dfu_checking == false) {
+    if (FlashPipeline_GetStatusI() != FLASH_COMPLETE) {
+      DfuErrorI(DfuFlashStatus(FlashPipeline_GetStatusI()));
+      return;
+    }
+
+    /* The check thread ends the session */
+    DfuReleaseJobI();
+
+    if (FlashPipeline_CheckI(FLASH_OWNER_DFU) != HAL_SUCCESS) {
+      DfuErrorI(DFU_STATUS_ERR_VENDOR);
+      return;
+    }
+
+    dfu_checking = true;
+  }
+
+  if (FlashPipeline_CheckDoneI(&image) == false) {
+    dfu_state = DFU_STATE_MANIFEST;
+    dfu_poll_timeout = USB_DFU_CHECK_POLL_MS;
+    return;
+  }
+
+  dfu_checking = false;
+
+  if (image != IMAGE_VALID) {
+    DfuErrorI(DFU_STATUS_ERR_VERIFY);
+    return;
+  }
+
+  /* Manifestation tolerant, ready for the next download */
+  dfu_state = DFU_STATE_IDLE;
+  dfu_poll_timeout = 0;
+}
+
+/**
+ * @brief   DNLOAD data stage finished.
+ */
+static void DfuDownloadComplete(USBDriver *usbp)
+{
+  (void)usbp;
+
+  dfu_state = DFU_STATE_DNLOAD_SYNC;
+}
+
+/**
+ * @brief   Handles a DNLOAD request.
+ */
+static bool DfuDownload(USBDriver *usbp, uint16_t block, uint16_t length)
+{
+  if ((dfu_state != DFU_STATE_IDLE) && (dfu_state != DFU_STATE_DNLOAD_IDLE))
+    return false;
+
+  /* A zero length download ends the transfer */
+  if (length == 0) {
+    if (dfu_state == DFU_STATE_IDLE)
+      return false;
+
+    dfu_state = DFU_STATE_MANIFEST_SYNC;
+    usbSetupTransfer(usbp, NULL, 0, NULL);
+    return true;
+  }
+
+  if (length > USB_DFU_TRANSFER_SIZE)
+    return false;
+
+  osalSysLockFromISR();
+
+  /* The console or the UF2 disk is writing the flash */
+  if ((dfu_state == DFU_STATE_IDLE) &&
+      (FlashPipeline_BeginI(FLASH_OWNER_DFU, FLASH_USER_BASE,
+                            FLASH_END_ADDRESS) != HAL_SUCCESS)) {
+    DfuErrorI(DFU_STATUS_ERR_VENDOR);
+    osalSysUnlockFromISR();
+    return false;
+  }
+
+  if (dfu_job == NULL)
+    dfu_job = FlashPipeline_GetJobI();
+
+  osalSysUnlockFromISR();
+
+  if (dfu_job == NULL)
+    return false;
+
+  dfu_block = block;
+  dfu_length = length;
+
+  /* Received straight into the job */
+  usbSetupTransfer(usbp, (uint8_t *)dfu_job->data, length,
+                   DfuDownloadComplete);
+  return true;
+}
+
+/**
+ * @brief   Handles an UPLOAD request, data is sent straight from the flash.
+ *          The user flash uploads empty while an image key is present.
+ */
+static bool DfuUpload(USBDriver *usbp, uint16_t block, uint16_t length)
+{
+  uint32_t address;
+
+  if ((dfu_state != DFU_STATE_IDLE) && (dfu_state != DFU_STATE_UPLOAD_IDLE))
+    return false;
+
+  if (block == 0) {
+    if (length > sizeof dfuse_commands)
+      length = sizeof dfuse_commands;
+
+    dfu_state = DFU_STATE_IDLE;
+    usbSetupTransfer(usbp, (uint8_t *)dfuse_commands, length, NULL);
+    return true;
+  }
+
+  if (block == 1)
+    return false;
+
+  address = dfu_address + (block - 2) * USB_DFU_TRANSFER_SIZE;
+
+  /* The user flash holds decrypted firmware when images are encrypted */
+  if ((address < FLASH_BASE) || (address >= FLASH_END_ADDRESS))
+    length = 0;
+  else if (((address + length) > FLASH_USER_BASE) &&
+           (ImageDecrypt_KeyPresent(IMAGE_CIPHER_AES128_CTR) == true))
+    length = 0;
+  else if (length > FLASH_END_ADDRESS - address)
+    length = FLASH_END_ADDRESS - address;
+
+  /* A short block ends the upload */
+  if (length < USB_DFU_TRANSFER_SIZE)
+    dfu_state = DFU_STATE_IDLE;
+  else
+    dfu_state = DFU_STATE_UPLOAD_IDLE;
+
+  usbSetupTransfer(usbp, (uint8_t *)address, length, NULL);
+  return true;
+}
+
+/**
+ * @brief   Handles a GETSTATUS request, executes the pending block or
+ *          manifestation and reports the time to the next poll.
+ */
+static bool DfuGetStatus(USBDriver *usbp)
+{
+  osalSysLockFromISR();
+
+  switch (dfu_state) {
+  case DFU_STATE_DNLOAD_SYNC:
+    DfuExecuteBlockI();
+    break;
+  case DFU_STATE_DNBUSY:
+    DfuReserveJobI();
+    break;
+  case DFU_STATE_MANIFEST_SYNC:
+  case DFU_STATE_MANIFEST:
+    DfuManifestI();
+    break;
+  default:
+    break;
+  }
+
+  osalSysUnlockFromISR();
+
+  dfu_response[0] = (uint8_t)dfu_status;
+  dfu_response[1] = (uint8_t)(dfu_poll_timeout);
+  dfu_response[2] = (uint8_t)(dfu_poll_timeout >> 8);
+  dfu_response[3] = (uint8_t)(dfu_poll_timeout >> 16);
+  dfu_response[4] = (uint8_t)dfu_state;
+  dfu_response[5] = 0;
+
+  usbSetupTransfer(usbp, dfu_response, USB_DFU_STATUS_SIZE, NULL);
+  return true;
+}
+
+/**
+ * @brief   Handles the DFU class requests to the DFU interface.
+ *
+ * @param[in] usbp      Pointer to the USB driver.
+ * @return              True if the request was handled.
+ */
+bool USBDfuRequestsHook(USBDriver *usbp)
+{
+  uint16_t value = usbp->setup[2] | (usbp->setup[3] << 8);
+  uint16_t length = usbp->setup[6] | (usbp->setup[7] << 8);
+
+  if (((usbp->setup[0] & USB_RTYPE_TYPE_MASK) != USB_RTYPE_TYPE_CLASS) ||
+      ((usbp->setup[0] & USB_RTYPE_RECIPIENT_MASK) !=
+       USB_RTYPE_RECIPIENT_INTERFACE) ||
+      (usbp->setup[4] != USB_DFU_INTERFACE) ||
+      (usbp->setup[5] != 0))
+    return false;
+
+  switch (usbp->setup[1]) {
+  case DFU_DETACH:
+    /* Already in DFU mode */
+    usbSetupTransfer(usbp, NULL, 0, NULL);
+    return true;
+  case DFU_DNLOAD:
+    if (DfuDownload(usbp, value, length) == true)
+      return true;
+    break;
+  case DFU_UPLOAD:
+    if (DfuUpload(usbp, value, length) == true)
+      return true;
+    break;
+  case DFU_GETSTATUS:
+    return DfuGetStatus(usbp);
+  case DFU_CLRSTATUS:
+    if (dfu_state == DFU_STATE_ERROR) {
+      dfu_state = DFU_STATE_IDLE;
+      dfu_status = DFU_STATUS_OK;
+    }
+    usbSetupTransfer(usbp, NULL, 0, NULL);
+    return true;
+  case DFU_GETSTATE:
+    dfu_response[0] = (uint8_t)dfu_state;
+    usbSetupTransfer(usbp, dfu_response, 1, NULL);
+    return true;
+  case DFU_ABORT:
+    osalSysLockFromISR();
+    DfuEndSessionI();
+    osalSysUnlockFromISR();
+    dfu_state = DFU_STATE_IDLE;
+    usbSetupTransfer(usbp, NULL, 0, NULL);
+    return true;
+  default:
+    break;
+  }
+
+  /* Not valid in this state, the request is stalled */
+  osalSysLockFromISR();
+  if (dfu_state != DFU_STATE_ERROR)
+    DfuErrorI(DFU_STATUS_ERR_STALLEDPKT);
+  osalSysUnlockFromISR();
+
+  return false;
+}
+
+/**
+ * @brief   Returns to the idle state, called from the USB_EVENT_RESET
+ *          event. Jobs already submitted are finished by the writer.
+ * @note    Must be called from a locked context.
+ */
+void USBDfuResetI(void)
+{
+  DfuEndSessionI();
+  dfu_state = DFU_STATE_IDLE;
+  dfu_status = DFU_STATUS_OK;
+  dfu_poll_timeout = 0;
+}
@@ -0,0 +1,720 @@
+/* *
+ *
+ * USB mass storage (Bulk-Only Transport, SCSI) serving the UF2 virtual
+ * disk on EP3, in place of the vendor bulk interface.
+ * Sectors are double buffered: the next sector of a WRITE(10) is received
+ * while the previous one is handed to the flash writer, and the next
+ * sector of a READ(10) is generated while the previous one is sent.
+ * Consecutive UF2 payloads are collected into one flash pipeline job.
+ *
+ * */
+
+#include <string.h>
+#include "ch.h"
+#include "hal.h"
+#include "usb_msc.h"
+#include "uf2_fat.h"
+#include "flash_pipeline.h"
+#include "image_decrypt.h"
+#include "debug_log.h"
+#include "version_information.h"
+
+/* Global variable defines */
+
+/* Private variable defines */
+
+/**
+ * @brief   IN EP3 state.
+ */
+static USBInEndpointState ep3instate;
+
+/**
+ * @brief   OUT EP3 state.
+ */
+static USBOutEndpointState ep3outstate;
+
+/**
+ * @brief   True while the mass storage endpoints are configured.
+ */
+static bool msc_active = false;
+
+/**
+ * @brief   Transfer completion flags and waiting threads.
+ */
+static bool rx_done;
+static bool tx_done;
+static size_t rx_size;
+static thread_reference_t rx_waiter = NULL;
+static thread_reference_t tx_waiter = NULL;
+
+/**
+ * @brief   Command and status wrappers.
+ */
+static uint8_t msc_cbw[USB_MSC_PACKET_SIZE];
+static uint8_t msc_csw[MSC_CSW_SIZE];
+
+/**
+ * @brief   Sector buffers, one is transferred while the other is used.
+ */
+static uint32_t msc_sectors[2][UF2_FAT_SECTOR_SIZE / 4];
+
+/**
+ * @brief   Sense data of the last failed command.
+ */
+static uint8_t msc_sense_key = SCSI_SENSE_NONE;
+static uint8_t msc_asc = SCSI_ASC_NONE;
+
+/**
+ * @brief   Flash job collecting consecutive UF2 payloads.
+ */
+static flash_job_t *msc_job = NULL;
+
+/**
+ * @brief   True while the current UF2 file owns the flash session.
+ */
+static bool msc_session = false;
+
+/**
+ * @brief   System time the current UF2 file started.
+ */
+static systime_t msc_file_start;
+
+/**
+ * @brief   Working area for the mass storage thread.
+ */
+static THD_WORKING_AREA(waUSBMscTask, USB_MSC_STACK_SIZE);
+
+/* Private function defines */
+
+static void USBMscDataReceived(USBDriver *usbp, usbep_t ep);
+static void USBMscDataTransmitted(USBDriver *usbp, usbep_t ep);
+static void MscFlashBegin(void);
+static bool MscFlashWrite(uint32_t address, const uint8_t *data,
+                          uint32_t size);
+static void MscFlashComplete(void);
+static void MscFlashRead(uint32_t address, uint8_t *data, uint32_t size);
+
+/**
+ * @brief   EP3 initialization structure (both IN and OUT).
+ */
+static const USBEndpointConfig ep3config = {
+  USB_EP_MODE_TYPE_BULK,
+  NULL,
+  USBMscDataTransmitted,
+  USBMscDataReceived,
+  USB_MSC_PACKET_SIZE,
+  USB_MSC_PACKET_SIZE,
+  &ep3instate,
+  &ep3outstate,
+  2,
+  NULL
+};
+
+/**
+ * @brief   The device side of the UF2 disk.
+ */
+static const uf2_fat_config_t uf2_config = {
+  "UF2 Bootloader " GIT_VERSION_NAME "\r\n"
+  "Model: KFly\r\n"
+  "Board-ID: STM32F405-KFly\r\n"
+  "Date: " GIT_DATE_NAME "\r\n",
+  FLASH_USER_BASE,
+  FLASH_END_ADDRESS,
+  MscFlashBegin,
+  MscFlashWrite,
+  MscFlashComplete,
+  MscFlashRead
+};
+
+/* Private external functions */
+
+/**
+ * @brief   Big endian accessors for the SCSI fields.
+ */
+static uint32_t MscGetWordBE(const uint8_t *data)
+{
+  return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+         ((uint32_t)data[2] << 8) | ((uint32_t)data[3]);
+}
+
+static void MscPutWordBE(uint8_t *data, uint32_t value)
+{
+  data[0] = (uint8_t)(value >> 24);
+  data[1] = (uint8_t)(value >> 16);
+  data[2] = (uint8_t)(value >> 8);
+  data[3] = (uint8_t)(value);
+}
+
+/**
+ * @brief   Little endian accessors for the wrappers.
+ */
+static uint32_t MscGetWordLE(const uint8_t *data)
+{
+  return ((uint32_t)data[0]) | ((uint32_t)data[1] << 8) |
+         ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static void MscPutWordLE(uint8_t *data, uint32_t value)
+{
+  data[0] = (uint8_t)(value);
+  data[1] = (uint8_t)(value >> 8);
+  data[2] = (uint8_t)(value >> 16);
+  data[3] = (uint8_t)(value >> 24);
+}
+
+/**
+ * @brief   OUT transfer completed.
+ */
+static void USBMscDataReceived(USBDriver *usbp, usbep_t ep)
+{
+  osalSysLockFromISR();
+  rx_size = usbGetReceiveTransactionSizeI(usbp, ep);
+  rx_done = true;
+  osalThreadResumeI(&rx_waiter, MSG_OK);
+  osalSysUnlockFromISR();
+}
+
+/**
+ * @brief   IN transfer completed.
+ */
+static void USBMscDataTransmitted(USBDriver *usbp, usbep_t ep)
+{
+  (void)usbp;
+  (void)ep;
+
+  osalSysLockFromISR();
+  tx_done = true;
+  osalThreadResumeI(&tx_waiter, MSG_OK);
+  osalSysUnlockFromISR();
+}
+
+/**
+ * @brief               Starts receiving a transfer.
+ *
+ * @param[out] data     Pointer to the receive buffer.
+ * @param[in] size      Size of the transfer.
+ */
+static void MscStartReceive(uint8_t *data, size_t size)
+{
+  usbPrepareReceive(&USBD1, USBD1_MSC_EP, data, size);
+
+  osalSysLock();
+  rx_done = false;
+  if (msc_active == true)
+    usbStartReceiveI(&USBD1, USBD1_MSC_EP);
+  osalSysUnlock();
+}
+
+/**
+ * @brief               Waits for the started receive transfer.
+ *
+ * @return              Size of the transfer, -1 if the bus was reset.
+ */
+static int32_t MscWaitReceive(void)
+{
+  int32_t size = -1;
+
+  osalSysLock();
+
+  if ((rx_done == false) && (msc_active == true))
+    osalThreadSuspendS(&rx_waiter);
+
+  if (rx_done == true)
+    size = (int32_t)rx_size;
+
+  osalSysUnlock();
+
+  return size;
+}
+
+/**
+ * @brief               Starts sending a transfer.
+ *
+ * @param[in] data      Pointer to the data.
+ * @param[in] size      Size of the transfer.
+ */
+static void MscStartTransmit(const uint8_t *data, size_t size)
+{
+  usbPrepareTransmit(&USBD1, USBD1_MSC_EP, data, size);
+
+  osalSysLock();
+  tx_done = false;
+  if (msc_active == true)
+    usbStartTransmitI(&USBD1, USBD1_MSC_EP);
+  osalSysUnlock();
+}
+
+/**
+ * @brief               Waits for the started transmit transfer.
+ *
+ * @return              True if the host read the transfer.
+ */
+static bool MscWaitTransmit(void)
+{
+  bool done;
+
+  osalSysLock();
+
+  if ((tx_done == false) && (msc_active == true))
+    osalThreadSuspendS(&tx_waiter);
+
+  done = tx_done;
+
+  osalSysUnlock();
+
+  return done;
+}
+
+/**
+ * @brief   Queues the collected UF2 payloads for the flash writer.
+ */
+static bool MscFlashFlush(void)
+{
+  flash_job_t *job = msc_job;
+
+  if (job == NULL)
+    return HAL_SUCCESS;
+
+  msc_job = NULL;
+
+  return FlashPipeline_Submit(job);
+}
+
+/**
+ * @brief   A new UF2 file starts. The file fails if the console or DFU is
+ *          writing the flash.
+ */
+static void MscFlashBegin(void)
+{
+  MscFlashFlush();
+  msc_session = (FlashPipeline_Begin(FLASH_OWNER_MSC,
+                                     FLASH_USER_BASE,
+                                     FLASH_END_ADDRESS) == HAL_SUCCESS);
+  msc_file_start = chVTGetSystemTime();
+}
+
+/**
+ * @brief   Collects a UF2 payload, a job is queued when it is full or the
+ *          next payload is not consecutive.
+ */
+static bool MscFlashWrite(uint32_t address, const uint8_t *data,
+                          uint32_t size)
+{
+  FLASH_Status status;
+
+  if (msc_session == false)
+    return false;
+
+  if ((msc_job != NULL) &&
+      ((address != msc_job->address + msc_job->size) ||
+       (msc_job->size + size > FLASH_PIPELINE_BLOCK_SIZE)))
+  {
+    if (MscFlashFlush() != HAL_SUCCESS)
+      return false;
+  }
+
+  osalSysLock();
+  status = FlashPipeline_GetStatusI();
+  osalSysUnlock();
+
+  if (status != FLASH_COMPLETE)
+    return false;
+
+  if (msc_job == NULL) {
+    msc_job = FlashPipeline_GetJob(TIME_INFINITE);
+    msc_job->type = FLASH_JOB_PROGRAM;
+    msc_job->address = address;
+    msc_job->size = 0;
+  }
+
+  memcpy((uint8_t *)msc_job->data + msc_job->size, data, size);
+  msc_job->size += size;
+
+  return true;
+}
+
+/**
+ * @brief   All blocks of the UF2 file were written. The image is checked
+ *          once they are programmed, the result goes to the debug log.
+ */
+static void MscFlashComplete(void)
+{
+  MscFlashFlush();
+
+  osalSysLock();
+  if (FlashPipeline_CheckI(FLASH_OWNER_MSC) != HAL_SUCCESS)
+    FlashPipeline_EndI(FLASH_OWNER_MSC);
+  osalSysUnlock();
+
+  msc_session = false;
+
+  DEBUG_LOG("UF2: %u blocks queued in %u ms",
+            UF2Fat_BlocksWritten(),
+            ST2MS(chVTTimeElapsedSinceX(msc_file_start)));
+}
+
+/**
+ * @brief   Reads the flash, it is memory mapped. Reads as zeros when
+ *          images are encrypted, the user flash then holds decrypted
+ *          firmware.
+ */
+static void MscFlashRead(uint32_t address, uint8_t *data, uint32_t size)
+{
+  if (ImageDecrypt_KeyPresent(IMAGE_CIPHER_AES128_CTR) == true)
+    memset(data, 0, size);
+  else
+    memcpy(data, (const void *)address, size);
+}
+
+/**
+ * @brief   Sets the sense data for REQUEST SENSE.
+ */
+static void MscSetSense(uint8_t key, uint8_t asc)
+{
+  msc_sense_key = key;
+  msc_asc = asc;
+}
+
+/**
+ * @brief               Sends a command response, cut to what the host
+ *                      asked for.
+ *
+ * @param[in] data      Pointer to the response.
+ * @param[in] size      Size of the response.
+ * @param[in] length    Data transfer length of the command.
+ * @return              Number of bytes sent.
+ */
+static uint32_t MscSendResponse(const uint8_t *data, uint32_t size,
+                                uint32_t length)
+{
+  if (size > length)
+    size = length;
+
+  if (size == 0)
+    return 0;
+
+  MscStartTransmit(data, size);
+
+  if (MscWaitTransmit() == false)
+    return 0;
+
+  return size;
+}
+
+/**
+ * @brief               READ(10), the next sector is generated while the
+ *                      previous one is sent.
+ *
+ * @return              Number of bytes sent.
+ */
+static uint32_t MscRead(uint32_t lba, uint32_t count)
+{
+  uint32_t i, cur = 0;
+
+  if (count == 0)
+    return 0;
+
+  UF2Fat_ReadSector(lba, (uint8_t *)msc_sectors[cur]);
+  MscStartTransmit((uint8_t *)msc_sectors[cur], UF2_FAT_SECTOR_SIZE);
+
+  for (i = 1; i < count; i++) {
+    UF2Fat_ReadSector(lba + i, (uint8_t *)msc_sectors[cur ^ 1]);
+
+    if (MscWaitTransmit() == false)
+      return (i - 1) * UF2_FAT_SECTOR_SIZE;
+
+    cur ^= 1;
+    MscStartTransmit((uint8_t *)msc_sectors[cur], UF2_FAT_SECTOR_SIZE);
+  }
+
+  if (MscWaitTransmit() == false)
+    return (count - 1) * UF2_FAT_SECTOR_SIZE;
+
+  return count * UF2_FAT_SECTOR_SIZE;
+}
+
+/**
+ * @brief               WRITE(10), the next sector is received while the
+ *                      previous one goes to the flash.
+ *
+ * @return              Number of bytes received.
+ */
+static uint32_t MscWrite(uint32_t lba, uint32_t count)
+{
+  uint32_t i, cur = 0;
+
+  if (count == 0)
+    return 0;
+
+  MscStartReceive((uint8_t *)msc_sectors[cur], UF2_FAT_SECTOR_SIZE);
+
+  for (i = 0; i < count; i++) {
+    if (MscWaitReceive() != UF2_FAT_SECTOR_SIZE)
+      return i * UF2_FAT_SECTOR_SIZE;
+
+    if (i + 1 < count)
+      MscStartReceive((uint8_t *)msc_sectors[cur ^ 1], UF2_FAT_SECTOR_SIZE);
+
+    if (UF2Fat_WriteSector(lba + i, (uint8_t *)msc_sectors[cur]) ==
+        UF2_WRITE_FAILED)
+      MscSetSense(SCSI_SENSE_MEDIUM_ERROR, SCSI_ASC_WRITE_ERROR);
+
+    cur ^= 1;
+  }
+
+  /* Partial jobs are not kept waiting for the next command */
+  if (MscFlashFlush() != HAL_SUCCESS)
+    MscSetSense(SCSI_SENSE_MEDIUM_ERROR, SCSI_ASC_WRITE_ERROR);
+
+  return count * UF2_FAT_SECTOR_SIZE;
+}
+
+/**
+ * @brief               Pads or drains the data phase of a command that
+ *                      did not use all of it, so the host gets the status.
+ *
+ * @param[in] in        True if the data phase is device to host.
+ * @param[in] residue   Bytes left of the data phase.
+ */
+static void MscFinishDataPhase(bool in, uint32_t residue)
+{
+  uint8_t *buffer = (uint8_t *)msc_sectors[0];
+  uint32_t n;
+
+  if (in == true)
+    memset(buffer, 0, UF2_FAT_SECTOR_SIZE);
+
+  while (residue > 0) {
+    n = (residue > UF2_FAT_SECTOR_SIZE) ? UF2_FAT_SECTOR_SIZE : residue;
+
+    if (in == true) {
+      MscStartTransmit(buffer, n);
+      if (MscWaitTransmit() == false)
+        return;
+    }
+    else {
+      MscStartReceive(buffer, n);
+      if (MscWaitReceive() < 0)
+        return;
+    }
+
+    residue -= n;
+  }
+}
+
+/**
+ * @brief               Executes a SCSI command.
+ *
+ * @param[in] cb        Pointer to the command block.
+ * @param[in] length    Data transfer length of the command.
+ * @param[out] done     Number of bytes transferred in the data phase.
+ * @return              True if the command passed.
+ */
+static bool MscExecute(const uint8_t *cb, uint32_t length, uint32_t *done)
+{
+  uint8_t response[36];
+  uint32_t lba, count;
+
+  *done = 0;
+  memset(response, 0, sizeof(response));
+
+  switch (cb[0]) {
+  case SCSI_TEST_UNIT_READY:
+  case SCSI_START_STOP_UNIT:
+  case SCSI_PREVENT_ALLOW_REMOVAL:
+  case SCSI_VERIFY_10:
+    return true;
+
+  case SCSI_SYNCHRONIZE_CACHE_10:
+    return (MscFlashFlush() == HAL_SUCCESS);
+
+  case SCSI_REQUEST_SENSE:
+    response[0] = 0x70;                         /* Current errors.          */
+    response[2] = msc_sense_key;
+    response[7] = 10;                           /* Additional length.       */
+    response[12] = msc_asc;
+    *done = MscSendResponse(response, 18, length);
+    MscSetSense(SCSI_SENSE_NONE, SCSI_ASC_NONE);
+    return true;
+
+  case SCSI_INQUIRY:
+    response[1] = 0x80;                         /* Removable.               */
+    response[2] = 0x04;                         /* SPC-2.                   */
+    response[3] = 0x02;                         /* Response data format.    */
+    response[4] = 31;                           /* Additional length.       */
+    memcpy(&response[8], "KFly    ", 8);
+    memcpy(&response[16], "UF2 Bootloader  ", 16);
+    memcpy(&response[32], "1.0 ", 4);
+    *done = MscSendResponse(response, 36, length);
+    return true;
+
+  case SCSI_MODE_SENSE_6:
+    response[0] = 3;                            /* Mode data length.        */
+    *done = MscSendResponse(response, 4, length);
+    return true;
+
+  case SCSI_MODE_SENSE_10:
+    response[1] = 6;                            /* Mode data length.        */
+    *done = MscSendResponse(response, 8, length);
+    return true;
+
+  case SCSI_READ_FORMAT_CAPACITIES:
+    response[3] = 8;                            /* Capacity list length.    */
+    MscPutWordBE(&response[4], UF2_FAT_NUM_SECTORS);
+    MscPutWordBE(&response[8], UF2_FAT_SECTOR_SIZE);
+    response[8] = 0x02;                         /* Formatted media.         */
+    *done = MscSendResponse(response, 12, length);
+    return true;
+
+  case SCSI_READ_CAPACITY_10:
+    MscPutWordBE(&response[0], UF2_FAT_NUM_SECTORS - 1);
+    MscPutWordBE(&response[4], UF2_FAT_SECTOR_SIZE);
+    *done = MscSendResponse(response, 8, length);
+    return true;
+
+  case SCSI_READ_10:
+  case SCSI_WRITE_10:
+    lba = MscGetWordBE(&cb[2]);
+    count = ((uint32_t)cb[7] << 8) | cb[8];
+
+    if ((lba + count > UF2_FAT_NUM_SECTORS) ||
+        (count * UF2_FAT_SECTOR_SIZE > length)) {
+      MscSetSense(SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_LBA_OUT_OF_RANGE);
+      return false;
+    }
+
+    if (cb[0] == SCSI_READ_10) {
+      *done = MscRead(lba, count);
+      return true;
+    }
+
+    MscSetSense(SCSI_SENSE_NONE, SCSI_ASC_NONE);
+    *done = MscWrite(lba, count);
+    return (msc_sense_key == SCSI_SENSE_NONE);
+
+  default:
+    MscSetSense(SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_COMMAND);
+    return false;
+  }
+}
+
+/**
+ * @brief               Mass storage thread, executes one command wrapper
+ *                      at a time and answers with a status wrapper.
+ *
+ * @param[in] arg       Unused.
+ */
+static THD_FUNCTION(USBMscTask, arg)
+{
+  (void)arg;
+  uint32_t tag, length, done;
+  bool in, passed;
+
+  chRegSetThreadName("USB MSC");
+
+  while (1)
+  {
+    if (msc_active == false) {
+      chThdSleepMilliseconds(10);
+      continue;
+    }
+
+    MscStartReceive(msc_cbw, sizeof(msc_cbw));
+
+    if ((MscWaitReceive() != MSC_CBW_SIZE) ||
+        (MscGetWordLE(&msc_cbw[0]) != MSC_CBW_SIGNATURE))
+      continue;
+
+    tag = MscGetWordLE(&msc_cbw[4]);
+    length = MscGetWordLE(&msc_cbw[8]);
+    in = ((msc_cbw[12] & 0x80) != 0);
+
+    passed = MscExecute(&msc_cbw[15], length, &done);
+
+    /* The host expects the whole data phase before the status */
+    if (done < length)
+      MscFinishDataPhase(in, length - done);
+
+    MscPutWordLE(&msc_csw[0], MSC_CSW_SIGNATURE);
+    MscPutWordLE(&msc_csw[4], tag);
+    MscPutWordLE(&msc_csw[8], length - done);
+    msc_csw[12] = (passed == true) ? MSC_CSW_PASSED : MSC_CSW_FAILED;
+
+    MscStartTransmit(msc_csw, MSC_CSW_SIZE);
+    MscWaitTransmit();
+  }
+}
+
+/* Global functions */
+
+/**
+ * @brief   Lays out the UF2 disk and starts the mass storage thread.
+ */
+void USBMscInit(void)
+{
+  UF2Fat_Init(&uf2_config);
+
+  chThdCreateStatic(waUSBMscTask,
+                    sizeof(waUSBMscTask),
+                    NORMALPRIO,
+                    USBMscTask,
+                    NULL);
+}
+
+/**
+ * @brief   Enables the mass storage endpoints, called from the
+ *          USB_EVENT_CONFIGURED event.
+ * @note    Must be called from a locked context.
+ *
+ * @param[in] usbp      Pointer to the USB driver.
+ */
+void USBMscConfigureHookI(USBDriver *usbp)
+{
+  usbInitEndpointI(usbp, USBD1_MSC_EP, &ep3config);
+
+  msc_active = true;
+}
+
+/**
+ * @brief   Disables the mass storage interface and releases the waiting
+ *          thread, called from the USB_EVENT_RESET event. A UF2 file
+ *          being copied gives up the flash.
+ * @note    Must be called from a locked context.
+ */
+void USBMscDisconnectI(void)
+{
+  msc_active = false;
+  FlashPipeline_EndI(FLASH_OWNER_MSC);
+
+  osalThreadResumeI(&rx_waiter, MSG_RESET);
+  osalThreadResumeI(&tx_waiter, MSG_RESET);
+}
+
+/**
+ * @brief   Handles the Bulk-Only Transport class requests.
+ *
+ * @param[in] usbp      Pointer to the USB driver.
+ * @return              True if the request was handled.
+ */
+bool USBMscRequestsHook(USBDriver *usbp)
+{
+  static uint8_t max_lun = 0;
+
+  if (((usbp->setup[0] & USB_RTYPE_TYPE_MASK) != USB_RTYPE_TYPE_CLASS) ||
+      ((usbp->setup[0] & USB_RTYPE_RECIPIENT_MASK) !=
+       USB_RTYPE_RECIPIENT_INTERFACE) ||
+      (usbp->setup[4] != USB_MSC_INTERFACE) ||
+      (usbp->setup[5] != 0))
+    return false;
+
+  switch (usbp->setup[1]) {
+  case MSC_REQ_GET_MAX_LUN:
+    usbSetupTransfer(usbp, &max_lun, 1, NULL);
+    return true;
+  case MSC_REQ_RESET:
+    usbSetupTransfer(usbp, NULL, 0, NULL);
+    return true;
+  default:
+    return false;
+  }
+}
@@ -1,5 +1,9 @@
 # List of all the module's related files.
-USB_SRCS = $(MODULE_DIR)/usb/src/myusb.c
+USB_SRCS = $(MODULE_DIR)/usb/src/myusb.c \
+           $(MODULE_DIR)/usb/src/usb_bulk.c \
+           $(MODULE_DIR)/usb/src/usb_dfu.c \
+           $(MODULE_DIR)/usb/src/usb_msc.c \
+           $(MODULE_DIR)/usb/src/uf2_fat.c
 
 # Required include directories
 USB_INC = $(MODULE_DIR)/usb/inc
@@ -66,5 +66,7 @@ const uint8_t *ptrGetUniqueID(void);
 const uint8_t *ptrGetBootloaderVersion(void);
 const uint8_t *ptrGetFirmwareVersion(void);
 uint8_t *ptrGetUserIDString(void);
+void vSetUserIDString(const uint8_t *str, uint32_t size);
+uint32_t ulGetUserIDRevision(void);
 
 #endif
@@ -27,6 +27,9 @@ __attribute__ ((used, section(".sw_version")))
 /** @brief  User defined ID string. */
 static uint8_t UserIDString[USER_ID_MAX_SIZE + 1] = "Test ID string!";
 
+/** @brief  Incremented every time the user ID string changes. */
+static uint32_t UserIDRevision = 0;
+
 /*===========================================================================*/
 /* Module local functions.                                                   */
 /*===========================================================================*/
@@ -74,3 +77,38 @@ uint8_t *ptrGetUserIDString(void)
 {
     return UserIDString;
 }
+
+/**
+ * @brief               Sets the user's ID string.
+ *
+ * @param[in] str       Pointer to the new string, need not be terminated.
+ * @param[in] size      Length of the string, truncated to USER_ID_MAX_SIZE.
+ */
+void vSetUserIDString(const uint8_t *str, uint32_t size)
+{
+    uint32_t i;
+
+    if (size > USER_ID_MAX_SIZE)
+        size = USER_ID_MAX_SIZE;
+
+    osalSysLock();
+
+    for (i = 0; i < size; i++)
+        UserIDString[i] = str[i];
+
+    UserIDString[size] = '\0';
+    UserIDRevision++;
+
+    osalSysUnlock();
+}
+
+/**
+ * @brief               Gets the revision of the user's ID string, it changes
+ *                      every time the string is set.
+ *
+ * @return              Returns the revision.
+ */
+uint32_t ulGetUserIDRevision(void)
+{
+    return UserIDRevision;
+}
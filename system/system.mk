@@ -1,5 +1,5 @@
 # List of all the board related files.
-SYSTEMSRC = system/bootloader.c system/system_init.c
+SYSTEMSRC = system/bootloader.c system/system_init.c system/thread_statistics.c
 
 # Required include directories
 SYSTEMINC = system/
@@ -9,6 +9,12 @@
 
 /* All includes from modules */
 #include "myusb.h"
+#include "usb_msc.h"
+#include "mycan.h"
+#include "trace.h"
+#include "debug_log.h"
+#include "flash_pipeline.h"
+#include "serialmanager.h"
 
 
 /*===========================================================================*/
@@ -36,6 +42,11 @@ static system_critical_subscription_t *base_subscription = NULL;
 
 static volatile system_state_t system_state = SYSTEM_UNINITIALIZED;
 
+/**
+ * @brief Reset flags (RCC_CSR) of the last reset, read once at init.
+ */
+static uint32_t reset_flags = 0;
+
 /*===========================================================================*/
 /* Module local functions.                                                   */
 /*===========================================================================*/
@@ -54,6 +65,36 @@ static void vSystemInitList(void)
      *
      */
 
+    /*
+     *
+     * Reads the cause of the last reset and clears the flags, so the next
+     * reset reads its own cause. Modules get the cause from here.
+     *
+     */
+    reset_flags = RCC->CSR;
+    RCC->CSR |= RCC_CSR_RMVF;
+
+    /*
+     *
+     * Empties the event trace, first so all modules can trace.
+     *
+     */
+    Trace_Init();
+
+    /*
+     *
+     * Starts the deferred debug log.
+     *
+     */
+    DebugLog_Init();
+
+    /*
+     *
+     * Starts the flash writer, before USB so DFU can use it.
+     *
+     */
+    FlashPipeline_Init();
+
     /*
      *
      * Initializes the serial-over-USB CDC driver.
@@ -62,11 +103,28 @@ static void vSystemInitList(void)
     sduObjectInit(&SDU1);
     sduStart(&SDU1, &serusbcfg);
 
-    /* Activates the USB driver and then the USB bus pull-up on D+. */
-    usbDisconnectBus(serusbcfg.usbp);
-    chThdSleepMilliseconds(500);
-    usbStart(serusbcfg.usbp, &usbcfg);
-    usbConnectBus(serusbcfg.usbp);
+#if USB_UF2_MSC
+    /* UF2 drag and drop flashing on EP3. */
+    USBMscInit();
+#endif
+
+    /* Activates the USB driver and then the USB bus pull-up on D+,
+       skipping the reconnect delay when the host has no session. */
+    USBConnect(reset_flags);
+
+    /*
+     *
+     * Initializes the CAN (AUX4) transport.
+     *
+     */
+    CANTransportStart();
+
+    /*
+     *
+     * Starts the framed protocol on the CAN and USB bulk transports.
+     *
+     */
+    vSerialManagerInit();
 
 }
 
@@ -88,6 +146,13 @@ static void vSystemDeinitList(void)
      *
      */
 
+    /*
+     *
+     * Disable the CAN (AUX4) transport.
+     *
+     */
+    CANTransportStop();
+
     /*
      *
      * Disable the serial-over-USB CDC driver.
@@ -257,3 +322,13 @@ void vSystemCriticalTaskSubscribe(system_critical_subscription_t *sub)
         sub->next = NULL;
     }
 }
+
+/*
+ * @brief   Returns the reset flags of the last reset.
+ *
+ * @return  The RCC_CSR reset flags read at init.
+ */
+uint32_t ulSystemResetFlags(void)
+{
+    return reset_flags;
+}
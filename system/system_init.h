@@ -73,5 +73,6 @@ void vSystemDeinit(void);
 bool bSystemShutdownRequested(void);
 void vSystemRequestShutdown(uint32_t key);
 void vSystemCriticalTaskSubscribe(system_critical_subscription_t *sub);
+uint32_t ulSystemResetFlags(void);
 
 #endif
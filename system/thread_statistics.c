@@ -0,0 +1,146 @@
+/* *
+ *
+ * Runtime introspection of the threads, walks the registry and reports
+ * the CPU ticks (CH_DBG_THREADS_PROFILING), the unused stack from the fill
+ * pattern (CH_DBG_FILL_THREADS) and the kernel statistics
+ * (CH_DBG_STATISTICS).
+ *
+ * */
+
+#include "ch.h"
+#include "hal.h"
+#include "thread_statistics.h"
+
+/*===========================================================================*/
+/* Module local definitions.                                                 */
+/*===========================================================================*/
+
+#if CH_CFG_USE_REGISTRY != TRUE
+#error "Thread statistics require CH_CFG_USE_REGISTRY"
+#endif
+
+/*===========================================================================*/
+/* Module exported variables.                                                */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module local variables and types.                                         */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+/*
+ * @brief   Counts the bytes above the stack limit of a thread that still
+ *          hold the fill pattern, i.e. the stack never used.
+ *
+ * @param[in] tp    Pointer to the thread.
+ * @return          The number of unused bytes, saturated to 16 bits.
+ */
+static uint16_t usThreadStackFree(thread_t *tp)
+{
+#if (CH_DBG_FILL_THREADS == TRUE) && (CH_DBG_ENABLE_STACK_CHECK == TRUE)
+    const uint8_t *p = (const uint8_t *)tp->p_stklimit;
+    uint32_t n = 0;
+
+    /* The stack is in use at the saved stack pointer, so this ends */
+    while ((*p++ == CH_DBG_STACK_FILL_VALUE) && (n < 0xffff))
+        n++;
+
+    return (uint16_t)n;
+#else
+    (void)tp;
+    return 0;
+#endif
+}
+
+/*
+ * @brief   Fills in the record of a thread.
+ *
+ * @param[in] tp        Pointer to the thread.
+ * @param[out] record   Pointer to the record.
+ */
+static void vThreadStatisticsRecord(thread_t *tp,
+                                    thread_statistics_record_t *record)
+{
+    const char *name = chRegGetThreadNameX(tp);
+    uint32_t i;
+
+    for (i = 0; i < THREAD_STATISTICS_NAME_SIZE; i++)
+    {
+        if ((name != NULL) && (*name != '\0'))
+            record->name[i] = *name++;
+        else
+            record->name[i] = '\0';
+    }
+
+#if CH_DBG_THREADS_PROFILING == TRUE
+    record->cpu_ticks = tp->p_time;
+#else
+    record->cpu_ticks = 0;
+#endif
+    record->stack_free = usThreadStackFree(tp);
+    record->priority = (uint8_t)tp->p_prio;
+    record->state = (uint8_t)tp->p_state;
+}
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+/*
+ * @brief   Fills one page of thread statistics with as many threads as fit,
+ *          starting at registry index first.
+ *
+ * @param[in] first     Registry index of the first thread to report.
+ * @param[out] page     Pointer to the page.
+ * @return              The size of the used part of the page.
+ */
+size_t xSystemGetThreadStatistics(uint8_t first,
+                                  thread_statistics_page_t *page)
+{
+    thread_statistics_header_t *header = &page->header;
+    thread_t *tp;
+    uint32_t index = 0;
+
+    header->first_thread = first;
+    header->record_count = 0;
+    header->record_size = sizeof(thread_statistics_record_t);
+
+    tp = chRegFirstThread();
+
+    while (tp != NULL)
+    {
+        if ((index >= first) &&
+            (header->record_count < THREAD_STATISTICS_PAGE_RECORDS))
+        {
+            vThreadStatisticsRecord(tp, &page->records[header->record_count]);
+            header->record_count++;
+        }
+
+        index++;
+        tp = chRegNextThread(tp);
+    }
+
+    header->thread_count = (uint8_t)index;
+
+    /* Kernel statistics, consistent with each other */
+    chSysLock();
+    header->system_time = chVTGetSystemTimeX();
+#if CH_DBG_STATISTICS == TRUE
+    header->irq_count = ch.kernel_stats.n_irq;
+    header->context_switches = ch.kernel_stats.n_ctxswc;
+    header->critical_thread_worst = ch.kernel_stats.m_crit_thd.worst;
+    header->critical_isr_worst = ch.kernel_stats.m_crit_isr.worst;
+#else
+    header->irq_count = 0;
+    header->context_switches = 0;
+    header->critical_thread_worst = 0;
+    header->critical_isr_worst = 0;
+#endif
+    chSysUnlock();
+
+    return sizeof(thread_statistics_header_t) +
+           header->record_count * sizeof(thread_statistics_record_t);
+}
@@ -0,0 +1,122 @@
+#ifndef __THREAD_STATISTICS_H
+#define __THREAD_STATISTICS_H
+
+/*===========================================================================*/
+/* Module global definitions.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief Number of characters of the thread name in a record.
+ */
+#define THREAD_STATISTICS_NAME_SIZE     12
+
+/**
+ * @brief Number of thread records in a page, a page fits in one frame.
+ */
+#define THREAD_STATISTICS_PAGE_RECORDS  11
+
+/*===========================================================================*/
+/* Module data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief Header of a thread statistics page, followed by the records.
+ */
+typedef struct
+{
+    /**
+     * @brief System time in ticks, the reference for the CPU ticks.
+     */
+    uint32_t system_time;
+    /**
+     * @brief Number of IRQs served.
+     */
+    uint32_t irq_count;
+    /**
+     * @brief Number of context switches.
+     */
+    uint32_t context_switches;
+    /**
+     * @brief Longest critical zone in thread context, in cycles.
+     */
+    uint32_t critical_thread_worst;
+    /**
+     * @brief Longest critical zone in ISR context, in cycles.
+     */
+    uint32_t critical_isr_worst;
+    /**
+     * @brief Number of threads in the registry.
+     */
+    uint8_t thread_count;
+    /**
+     * @brief Registry index of the first record in the page.
+     */
+    uint8_t first_thread;
+    /**
+     * @brief Number of records in the page.
+     */
+    uint8_t record_count;
+    /**
+     * @brief Size of one record, for the host.
+     */
+    uint8_t record_size;
+} thread_statistics_header_t;
+
+/**
+ * @brief Statistics of one thread.
+ */
+typedef struct
+{
+    /**
+     * @brief Name of the thread, not terminated if it fills the field.
+     */
+    char name[THREAD_STATISTICS_NAME_SIZE];
+    /**
+     * @brief System ticks spent executing the thread.
+     */
+    uint32_t cpu_ticks;
+    /**
+     * @brief Stack never used since the thread was created, in bytes.
+     */
+    uint16_t stack_free;
+    /**
+     * @brief Priority of the thread.
+     */
+    uint8_t priority;
+    /**
+     * @brief State of the thread (CH_STATE_*).
+     */
+    uint8_t state;
+} thread_statistics_record_t;
+
+/**
+ * @brief A page of thread statistics, only the used records are sent.
+ */
+typedef struct
+{
+    /**
+     * @brief Kernel statistics and page information.
+     */
+    thread_statistics_header_t header;
+    /**
+     * @brief The thread records.
+     */
+    thread_statistics_record_t records[THREAD_STATISTICS_PAGE_RECORDS];
+} thread_statistics_page_t;
+
+/*===========================================================================*/
+/* Module macros.                                                            */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* Module inline functions.                                                  */
+/*===========================================================================*/
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+size_t xSystemGetThreadStatistics(uint8_t first,
+                                  thread_statistics_page_t *page);
+
+#endif
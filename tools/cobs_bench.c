@@ -0,0 +1,228 @@
+/*
+ * Host harness of the COBS framing (modules/communication/src/cobs.c):
+ * wire size of a frame in SYNC and COBS framing and the cost of the
+ * receive side decoding.
+ *
+ * Build:
+ *   gcc -O2 -Wall -I modules/communication/inc -o cobs_bench \
+ *       tools/cobs_bench.c modules/communication/src/cobs.c
+ *
+ * Use:
+ *   ./cobs_bench
+ *
+ * Frames with a 255 byte payload of random data, zeros and SYNC valued
+ * bytes are built as the generators do, framed both ways and the COBS
+ * frames are decoded by the firmware code and compared. The sizes are the
+ * averages of FRAMES frames. The decode cost (the time stamp counter on
+ * x86, nanoseconds elsewhere) is of the host and only compares the
+ * patterns, the device and the end to end throughput of a link are
+ * measured by tools/usb_bench.py --cobs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cobs.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES_UNIT     "cycles"
+static uint64_t Cycles(void)
+{
+  return __rdtsc();
+}
+#else
+#define CYCLES_UNIT     "ns"
+static uint64_t Cycles(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+#endif
+
+#define SYNC_BYTE       0xa6
+#define CMD_DEBUG       3
+#define PAYLOAD_SIZE    255
+#define FRAME_SIZE      (PAYLOAD_SIZE + 5)
+#define FRAMES          200
+
+static unsigned failures;
+
+static uint8_t Crc8Step(uint8_t data, uint8_t crc)
+{
+  int i;
+
+  crc ^= data;
+  for (i = 0; i < 8; i++)
+    crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+
+  return crc;
+}
+
+static uint16_t Crc16Step(uint8_t data, uint16_t crc)
+{
+  int i;
+
+  crc ^= (uint16_t)data << 8;
+  for (i = 0; i < 8; i++)
+    crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) :
+                           (uint16_t)(crc << 1);
+
+  return crc;
+}
+
+/* CMD | SIZE | CRC8 | DATA | CRC16, the CRCs include the SYNC byte */
+static size_t BuildFrame(const uint8_t *payload, uint8_t *frame)
+{
+  uint8_t crc8 = Crc8Step(SYNC_BYTE, 0);
+  uint16_t crc16 = Crc16Step(SYNC_BYTE, 0xffff);
+  size_t i;
+
+  frame[0] = CMD_DEBUG;
+  frame[1] = PAYLOAD_SIZE;
+  crc8 = Crc8Step(frame[1], Crc8Step(frame[0], crc8));
+  frame[2] = crc8;
+  memcpy(&frame[3], payload, PAYLOAD_SIZE);
+
+  for (i = 0; i < (3 + PAYLOAD_SIZE); i++)
+    crc16 = Crc16Step(frame[i], crc16);
+
+  frame[3 + PAYLOAD_SIZE] = (uint8_t)(crc16 >> 8);
+  frame[4 + PAYLOAD_SIZE] = (uint8_t)crc16;
+
+  return FRAME_SIZE;
+}
+
+/* SYNC, then the frame with every SYNC valued byte doubled */
+static size_t SyncSize(const uint8_t *frame, size_t size)
+{
+  size_t i, n = 1;
+
+  for (i = 0; i < size; i++)
+    n += (frame[i] == SYNC_BYTE) ? 2 : 1;
+
+  return n;
+}
+
+/* Reference encoder, the firmware encodes into the circular buffer */
+static size_t CobsEncode(const uint8_t *src, size_t size, uint8_t *dst)
+{
+  size_t in, out = 1, code_at = 0;
+  uint8_t code = 1;
+
+  for (in = 0; in < size; in++)
+  {
+    if (src[in] == 0)
+    {
+      dst[code_at] = code;
+      code_at = out++;
+      code = 1;
+      continue;
+    }
+
+    dst[out++] = src[in];
+
+    if (++code == COBS_MAX_CODE)
+    {
+      dst[code_at] = code;
+      code_at = out++;
+      code = 1;
+    }
+  }
+
+  dst[code_at] = code;
+  dst[out++] = COBS_DELIMITER;
+
+  return out;
+}
+
+static void Fill(uint8_t *payload, int pattern)
+{
+  int i;
+
+  for (i = 0; i < PAYLOAD_SIZE; i++)
+  {
+    if (pattern == 0)
+      payload[i] = (uint8_t)rand();
+    else if (pattern == 1)
+      payload[i] = 0;
+    else
+      payload[i] = SYNC_BYTE;
+  }
+}
+
+static void Measure(const char *name, int pattern)
+{
+  uint8_t payload[PAYLOAD_SIZE];
+  uint8_t frame[FRAME_SIZE];
+  uint8_t encoded[COBS_ENCODED_SIZE(FRAME_SIZE) + 1];
+  uint8_t decoded[sizeof(encoded)];
+  size_t sync_total = 0, cobs_total = 0, encoded_size, size, end;
+  uint64_t start, decode_time = 0;
+  int i;
+
+  for (i = 0; i < FRAMES; i++)
+  {
+    Fill(payload, pattern);
+    BuildFrame(payload, frame);
+
+    sync_total += SyncSize(frame, FRAME_SIZE);
+    encoded_size = CobsEncode(frame, FRAME_SIZE, encoded);
+    cobs_total += encoded_size;
+
+    /* The receiver finds the delimiter and decodes in place */
+    start = Cycles();
+    end = COBS_FindZero(encoded, encoded_size);
+    memcpy(decoded, encoded, end);
+    size = COBS_Decode(decoded, end, decoded);
+    decode_time += Cycles() - start;
+
+    if ((end != (encoded_size - 1)) || (size != FRAME_SIZE) ||
+        (memcmp(decoded, frame, FRAME_SIZE) != 0))
+    {
+      printf("%s: frame %d does not decode\n", name, i);
+      failures++;
+    }
+  }
+
+  printf("%-10s SYNC %6.1f  COBS %6.1f bytes  decode %5.2f %s/byte\n",
+         name, (double)sync_total / FRAMES, (double)cobs_total / FRAMES,
+         (double)decode_time / (FRAMES * FRAME_SIZE), CYCLES_UNIT);
+}
+
+static void TestMalformed(void)
+{
+  static const uint8_t zero_code[] = {0x02, 0x11, 0x00, 0x22};
+  static const uint8_t past_end[] = {0x05, 0x11, 0x22};
+  uint8_t out[8];
+
+  if ((COBS_Decode(zero_code, sizeof(zero_code), out) != 0) ||
+      (COBS_Decode(past_end, sizeof(past_end), out) != 0))
+  {
+    printf("malformed frames are accepted\n");
+    failures++;
+  }
+}
+
+int main(void)
+{
+  srand(1);
+
+  printf("Frame with a %d byte payload, average of %d frames\n\n",
+         PAYLOAD_SIZE, FRAMES);
+  Measure("random", 0);
+  Measure("zeros", 1);
+  Measure("0xa6", 2);
+  TestMalformed();
+
+  if (failures != 0)
+  {
+    printf("\n%u checks failed\n", failures);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,342 @@
+/*
+ * Host test and cycle count of the image signature check and decryption
+ * (modules/image_verify/src/sha512.c, ed25519.c and aes.c).
+ *
+ * Build:
+ *   gcc -O2 -Wall -I modules/image_verify/inc -o ed25519_bench \
+ *       tools/ed25519_bench.c modules/image_verify/src/sha512.c \
+ *       modules/image_verify/src/ed25519.c modules/image_verify/src/aes.c
+ *
+ * Use:
+ *   ./ed25519_bench
+ *   ./ed25519_bench signed.bin PUBKEY_HEX [AES_KEY_HEX]
+ *
+ * Without arguments the RFC 8032 and FIPS 197 / SP 800-38A test vectors are
+ * checked, with flipped bits of the signatures as well, and the cycles of
+ * a verification and per byte of AES-CTR are printed (the time stamp
+ * counter on x86, nanoseconds elsewhere). With a signed image from
+ * image_sign.py the image is decrypted and hashed in 2 KB blocks as the
+ * flash writer does and checked like the bootloader.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sha512.h"
+#include "ed25519.h"
+#include "aes.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES_UNIT     "cycles"
+static uint64_t Cycles(void)
+{
+  return __rdtsc();
+}
+#else
+#define CYCLES_UNIT     "ns"
+static uint64_t Cycles(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+#endif
+
+#define IMAGE_HEADER_SIZE         512
+#define IMAGE_HEADER_MAGIC        0x594c464b
+#define IMAGE_HEADER_SIGNED_SIZE  80
+#define IMAGE_CIPHER_OFFSET       144
+#define BLOCK_SIZE                2048
+#define RUNS                      100
+
+struct vector
+{
+  const char *public_key;
+  const char *message;
+  const char *signature;
+};
+
+/* RFC 8032 section 7.1, tests 1 to 3 */
+static const struct vector vectors[] = {
+  {"d75a980182b10ab7d54bfed3c964073a0ee172f3daa62325af021a68f707511a",
+   "",
+   "e5564300c360ac729086e2cc806e828a84877f1eb8e5d974d873e06522490155"
+   "5fb8821590a33bacc61e39701cf9b46bd25bf5f0595bbe24655141438e7a100b"},
+  {"3d4017c3e843895a92b70aa74d1b7ebc9c982ccf2ec4968cc0cd55f12af4660c",
+   "72",
+   "92a009a9f0d4cab8720e820b5f642540a2b27b5416503f8fb3762223ebdb69da"
+   "085ac1e43e15996e458f3613d0f11d8c387b2eaeb4302aeeb00d291612bb0c00"},
+  {"fc51cd8e6218a1a38da47ed00230f0580816ed13ba3303ac5deb911548908025",
+   "af82",
+   "6291d657deec24024827e69c3abe01a30ce548a284743a445e3680d7db5ac3ac"
+   "18ff9b538d16f290ae67f760984dc6594a7c15e9716ed28dc027beceea1ec40a"},
+};
+
+struct aes_vector
+{
+  const char *key;
+  const char *counter;
+  const char *plain;
+  const char *cipher;
+};
+
+/* SP 800-38A F.5.1 and F.5.5, first two blocks */
+static const struct aes_vector aes_vectors[] = {
+  {"2b7e151628aed2a6abf7158809cf4f3c",
+   "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff",
+   "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51",
+   "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff"},
+  {"603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4",
+   "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff",
+   "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51",
+   "601ec313775789a5b7a7f504bbf3d228f443e3ca4d62b59aca84e990cacaf5c5"},
+};
+
+static size_t FromHex(const char *hex, uint8_t *out, size_t max)
+{
+  size_t n = 0;
+  unsigned int byte;
+
+  while ((n < max) && (sscanf(&hex[2 * n], "%2x", &byte) == 1))
+    out[n++] = (uint8_t)byte;
+
+  return n;
+}
+
+static uint32_t Load32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int TestAes(void)
+{
+  aes_context_t aes;
+  uint8_t key[32], counter[16], plain[32], cipher[32], data[BLOCK_SIZE];
+  uint64_t start, best = UINT64_MAX;
+  size_t i, size, offset;
+  int failed = 0;
+
+  for (i = 0; i < sizeof(aes_vectors) / sizeof(aes_vectors[0]); i++)
+  {
+    size = FromHex(aes_vectors[i].key, key, sizeof(key));
+    FromHex(aes_vectors[i].counter, counter, sizeof(counter));
+    FromHex(aes_vectors[i].plain, plain, sizeof(plain));
+    FromHex(aes_vectors[i].cipher, cipher, sizeof(cipher));
+    AES_SetKey(&aes, key, size);
+
+    /* In one piece, and split at every offset */
+    for (offset = 0; offset < sizeof(plain); offset++)
+    {
+      memcpy(data, plain, sizeof(plain));
+      AES_CTR_Xor(&aes, counter, 0, data, offset);
+      AES_CTR_Xor(&aes, counter, offset, &data[offset],
+                  sizeof(plain) - offset);
+
+      if (memcmp(data, cipher, sizeof(cipher)) != 0)
+      {
+        printf("aes test %zu: split at %zu failed\n", i + 1, offset);
+        failed++;
+      }
+    }
+
+    for (offset = 0; offset < RUNS; offset++)
+    {
+      start = Cycles();
+      AES_CTR_Xor(&aes, counter, 0, data, sizeof(data));
+      start = Cycles() - start;
+
+      if (start < best)
+        best = start;
+    }
+
+    printf("%s, AES-%zu-CTR: %.1f %s/byte (best of %d)\n",
+           failed ? "FAILED" : "vectors ok", 8 * size,
+           (double)best / sizeof(data), CYCLES_UNIT, RUNS);
+    best = UINT64_MAX;
+  }
+
+  return failed ? 1 : 0;
+}
+
+static int TestVectors(void)
+{
+  uint8_t key[32], sig[64], msg[64];
+  uint64_t start, best = UINT64_MAX;
+  size_t i, bit, size;
+  int failed = 0;
+
+  for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+  {
+    FromHex(vectors[i].public_key, key, sizeof(key));
+    FromHex(vectors[i].signature, sig, sizeof(sig));
+    size = FromHex(vectors[i].message, msg, sizeof(msg));
+
+    if (Ed25519_Verify(sig, key, msg, size) == false)
+    {
+      printf("test %zu: valid signature rejected\n", i + 1);
+      failed++;
+    }
+
+    /* Any flipped bit of the signature or key must be rejected */
+    for (bit = 0; bit < 8 * 96; bit += 7)
+    {
+      uint8_t *p = (bit < 512) ? &sig[bit / 8] : &key[(bit - 512) / 8];
+
+      *p ^= 1 << (bit % 8);
+
+      if (Ed25519_Verify(sig, key, msg, size) == true)
+      {
+        printf("test %zu: bit %zu flipped accepted\n", i + 1, bit);
+        failed++;
+      }
+
+      *p ^= 1 << (bit % 8);
+    }
+  }
+
+  FromHex(vectors[0].public_key, key, sizeof(key));
+  FromHex(vectors[0].signature, sig, sizeof(sig));
+
+  for (i = 0; i < RUNS; i++)
+  {
+    start = Cycles();
+    Ed25519_Verify(sig, key, NULL, 0);
+    start = Cycles() - start;
+
+    if (start < best)
+      best = start;
+  }
+
+  printf("%s, verify: %llu %s (best of %d)\n",
+         failed ? "FAILED" : "vectors ok",
+         (unsigned long long)best, CYCLES_UNIT, RUNS);
+
+  return failed ? 1 : 0;
+}
+
+static int CheckImage(const char *path,
+                      const char *public_key,
+                      const char *aes_key)
+{
+  sha512_context_t sha;
+  aes_context_t aes;
+  uint8_t key[32], digest[SHA512_DIGEST_SIZE];
+  uint8_t *data;
+  uint32_t image_size, offset, n, cipher;
+  uint64_t hash_time, verify_time;
+  long size;
+  bool valid;
+  FILE *f;
+
+  if (FromHex(public_key, key, sizeof(key)) != sizeof(key))
+  {
+    printf("bad public key\n");
+    return 2;
+  }
+
+  f = fopen(path, "rb");
+
+  if (f == NULL)
+  {
+    perror(path);
+    return 2;
+  }
+
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  data = malloc(size);
+
+  if ((data == NULL) || (fread(data, 1, size, f) != (size_t)size))
+  {
+    printf("cannot read %s\n", path);
+    return 2;
+  }
+
+  fclose(f);
+  image_size = (size >= IMAGE_HEADER_SIZE) ? Load32(&data[8]) : 0;
+
+  if ((size < IMAGE_HEADER_SIZE) ||
+      (Load32(&data[0]) != IMAGE_HEADER_MAGIC) ||
+      (Load32(&data[4]) != IMAGE_HEADER_SIZE) ||
+      (image_size > (uint32_t)(size - IMAGE_HEADER_SIZE)))
+  {
+    printf("no image header\n");
+    return 1;
+  }
+
+  cipher = Load32(&data[IMAGE_CIPHER_OFFSET]);
+
+  if ((cipher == 1) || (cipher == 2))
+  {
+    if ((aes_key == NULL) ||
+        (FromHex(aes_key, key, sizeof(key)) != 16 * cipher))
+    {
+      printf("image is encrypted, give the %u byte AES key\n", 16 * cipher);
+      return 2;
+    }
+
+    AES_SetKey(&aes, key, 16 * cipher);
+  }
+  else
+  {
+    cipher = 0;
+  }
+
+  FromHex(public_key, key, sizeof(key));
+
+  /* As the flash writer, one job at a time */
+  hash_time = Cycles();
+  SHA512_Init(&sha);
+
+  for (offset = 0; offset < image_size; offset += n)
+  {
+    n = image_size - offset;
+    n = (n > BLOCK_SIZE) ? BLOCK_SIZE : n;
+
+    if (cipher != 0)
+      AES_CTR_Xor(&aes, &data[IMAGE_CIPHER_OFFSET + 4], offset,
+                  &data[IMAGE_HEADER_SIZE + offset], n);
+
+    SHA512_Update(&sha, &data[IMAGE_HEADER_SIZE + offset], n);
+  }
+
+  SHA512_Final(&sha, digest);
+  hash_time = Cycles() - hash_time;
+
+  if (memcmp(digest, &data[16], SHA512_DIGEST_SIZE) != 0)
+  {
+    printf("bad image digest\n");
+    return 1;
+  }
+
+  verify_time = Cycles();
+  valid = Ed25519_Verify(&data[IMAGE_HEADER_SIGNED_SIZE], key, data,
+                         IMAGE_HEADER_SIGNED_SIZE);
+  verify_time = Cycles() - verify_time;
+
+  printf("%s, %u bytes, %s: %llu %s, verify: %llu %s\n",
+         valid ? "image valid" : "bad signature", image_size,
+         cipher ? "decrypt and hash" : "hash",
+         (unsigned long long)hash_time, CYCLES_UNIT,
+         (unsigned long long)verify_time, CYCLES_UNIT);
+
+  free(data);
+
+  return valid ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc == 1)
+    return TestVectors() | TestAes();
+
+  if ((argc == 3) || (argc == 4))
+    return CheckImage(argv[1], argv[2], (argc == 4) ? argv[3] : NULL);
+
+  printf("usage: %s [signed.bin PUBKEY_HEX [AES_KEY_HEX]]\n", argv[0]);
+  return 2;
+}
@@ -0,0 +1,415 @@
+/*
+ * Host test of the Intel HEX and Motorola S-record decoder
+ * (modules/communication/src/hex_decoder.c).
+ *
+ * Build:
+ *   gcc -Wall -I modules/communication/inc -o hex_decoder_test \
+ *       tools/hex_decoder_test.c modules/communication/src/hex_decoder.c
+ *
+ * Use:
+ *   ./hex_decoder_test
+ *
+ * The records are built with their checksums by the test and fed to the
+ * decoder in blocks of every size from one character up, like the USB
+ * reads of flash_statemachine.c split them. Prints the failed checks and
+ * exits with 1 if there are any.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hex_decoder.h"
+
+#define TEXT_SIZE       4096
+#define MAX_WRITES      32
+
+typedef struct
+{
+  uint32_t address;
+  uint32_t size;
+  uint8_t data[256];
+} write_t;
+
+static hex_decoder_t dec;
+static write_t writes[MAX_WRITES];
+static unsigned write_count;
+static bool write_fails;
+static char text[TEXT_SIZE];
+static unsigned failures;
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);                 \
+      failures++;                                                       \
+    }                                                                   \
+  } while (0)
+
+static bool Write(uint32_t address, const uint8_t *data, uint32_t size)
+{
+  if ((write_fails == true) || (write_count == MAX_WRITES))
+    return false;
+
+  writes[write_count].address = address;
+  writes[write_count].size = size;
+  memcpy(writes[write_count].data, data, size);
+  write_count++;
+  return true;
+}
+
+static void Reset(void)
+{
+  memset(writes, 0, sizeof(writes));
+  write_count = 0;
+  write_fails = false;
+  text[0] = '\0';
+  HexDecoder_Init(&dec, Write);
+}
+
+/* Appends an Intel HEX record, the checksum makes the byte sum zero */
+static void AddIntel(uint8_t type, uint16_t address, const uint8_t *data,
+                     uint8_t count, const char *eol)
+{
+  char *p = text + strlen(text);
+  uint8_t sum = count + (address >> 8) + (address & 0xff) + type;
+  unsigned i;
+
+  p += sprintf(p, ":%02X%04X%02X", count, address, type);
+
+  for (i = 0; i < count; i++)
+  {
+    p += sprintf(p, "%02X", data[i]);
+    sum += data[i];
+  }
+
+  sprintf(p, "%02X%s", (uint8_t)-sum, eol);
+}
+
+/* Appends an S-record, the checksum is the one's complement of the sum */
+static void AddSrec(unsigned type, uint32_t address, const uint8_t *data,
+                    uint8_t count, const char *eol)
+{
+  static const uint8_t address_size[10] = {2, 2, 3, 4, 0, 2, 3, 4, 3, 2};
+  char *p = text + strlen(text);
+  uint8_t length = address_size[type] + count + 1;
+  uint8_t sum = length;
+  unsigned i;
+
+  p += sprintf(p, "S%u%02X", type, length);
+
+  for (i = address_size[type]; i > 0; i--)
+  {
+    p += sprintf(p, "%02X", (uint8_t)(address >> (8 * (i - 1))));
+    sum += (uint8_t)(address >> (8 * (i - 1)));
+  }
+
+  for (i = 0; i < count; i++)
+  {
+    p += sprintf(p, "%02X", data[i]);
+    sum += data[i];
+  }
+
+  sprintf(p, "%02X%s", (uint8_t)~sum, eol);
+}
+
+/* Feeds the text in blocks of the given size until the decoder stops,
+ * returns the last status and the number of characters consumed */
+static hex_status_t Decode(const char *input, size_t block, size_t *consumed)
+{
+  size_t size = strlen(input), offset = 0, used, n;
+  hex_status_t status = HEX_CONTINUE;
+
+  while ((offset < size) && (status == HEX_CONTINUE))
+  {
+    n = (size - offset < block) ? size - offset : block;
+    used = 0;
+    status = HexDecoder_Input(&dec, (const uint8_t *)input + offset, n,
+                              &used);
+    CHECK(used <= n);
+    offset += used;
+  }
+
+  if (consumed != NULL)
+    *consumed = offset;
+
+  return status;
+}
+
+static bool WriteIs(unsigned index, uint32_t address, const uint8_t *data,
+                    uint32_t size)
+{
+  return (index < write_count) &&
+         (writes[index].address == address) &&
+         (writes[index].size == size) &&
+         (memcmp(writes[index].data, data, size) == 0);
+}
+
+static void TestIntel(void)
+{
+  static const uint8_t a[16] = {0x00, 0x10, 0x00, 0x20, 0x49, 0x01, 0x00,
+                                0x08, 0x4d, 0x01, 0x00, 0x08, 0x4f, 0x01,
+                                0x00, 0x08};
+  static const uint8_t b[3] = {0xde, 0xad, 0x01};
+  static const uint8_t c[255] = {1, 2, 3};
+  static const uint8_t linear[2] = {0x08, 0x01};
+  static const uint8_t segment[2] = {0x12, 0x34};
+  static const uint8_t start[4] = {0x08, 0x00, 0x01, 0x49};
+  static char expected[TEXT_SIZE];
+  size_t block, used;
+
+  /* Data, extended linear, start linear, extended segment, end of file */
+  Reset();
+  AddIntel(0x00, 0x1000, a, sizeof(a), "\n");
+  AddIntel(0x04, 0x0000, linear, sizeof(linear), "\n");
+  AddIntel(0x00, 0xfff0, a, sizeof(a), "\n");
+  AddIntel(0x05, 0x0000, start, sizeof(start), "\n");
+  AddIntel(0x02, 0x0000, segment, sizeof(segment), "\n");
+  AddIntel(0x00, 0x0002, b, sizeof(b), "\n");
+  AddIntel(0x03, 0x0000, start, sizeof(start), "\n");
+  AddIntel(0x00, 0x0000, c, sizeof(c), "\n");
+  AddIntel(0x01, 0x0000, NULL, 0, "\n");
+  strcpy(expected, text);
+
+  /* The builder agrees with records written by other tools */
+  CHECK(strstr(text, ":00000001FF\n") != NULL);
+  CHECK(strstr(text, ":020000040801F1\n") != NULL);
+
+  for (block = 1; block <= strlen(expected); block++)
+  {
+    Reset();
+    strcpy(text, expected);
+    CHECK(Decode(text, block, &used) == HEX_END);
+    CHECK(used == strlen(text));
+    CHECK(write_count == 4);
+    CHECK(WriteIs(0, 0x00001000, a, sizeof(a)));
+    CHECK(WriteIs(1, 0x0801fff0, a, sizeof(a)));
+    CHECK(WriteIs(2, 0x00012342, b, sizeof(b)));
+    CHECK(WriteIs(3, 0x00012340, c, sizeof(c)));
+    CHECK(dec.bytes == 2 * sizeof(a) + sizeof(b) + sizeof(c));
+    CHECK(dec.lines == 9);
+  }
+
+  /* Lower case digits */
+  Reset();
+  CHECK(Decode(":0300100001aBcD74\n", 4, NULL) == HEX_CONTINUE);
+  CHECK((write_count == 1) && (writes[0].address == 0x0010) &&
+        (writes[0].data[1] == 0xab) && (writes[0].data[2] == 0xcd));
+}
+
+static void TestSrec(void)
+{
+  static const uint8_t header[4] = {'t', 'e', 's', 't'};
+  static const uint8_t a[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+  static const uint8_t b[5] = {0xff, 0x00, 0x80, 0x7f, 0x55};
+  static const uint8_t c[250] = {9, 8, 7};
+  static char expected[TEXT_SIZE];
+  unsigned end;
+  size_t block, used;
+
+  /* S7, S8 and S9 all end the file after the same data */
+  for (end = 7; end <= 9; end++)
+  {
+    Reset();
+    AddSrec(0, 0x0000, header, sizeof(header), "\n");
+    AddSrec(1, 0x1234, a, sizeof(a), "\n");
+    AddSrec(2, 0x08abcd, b, sizeof(b), "\n");
+    AddSrec(3, 0x0801fe00, c, sizeof(c), "\n");
+    AddSrec(5, 0x0003, NULL, 0, "\n");
+    AddSrec(end, 0x08000000, NULL, 0, "\n");
+    strcpy(expected, text);
+
+    for (block = 1; block <= strlen(expected); block++)
+    {
+      Reset();
+      strcpy(text, expected);
+      CHECK(Decode(text, block, &used) == HEX_END);
+      CHECK(used == strlen(text));
+      CHECK(write_count == 3);
+      CHECK(WriteIs(0, 0x1234, a, sizeof(a)));
+      CHECK(WriteIs(1, 0x08abcd, b, sizeof(b)));
+      CHECK(WriteIs(2, 0x0801fe00, c, sizeof(c)));
+      CHECK(dec.bytes == sizeof(a) + sizeof(b) + sizeof(c));
+      CHECK(dec.lines == 6);
+    }
+  }
+
+  /* The builder agrees with records written by other tools */
+  Reset();
+  AddSrec(9, 0x0000, NULL, 0, "");
+  CHECK(strcmp(text, "S9030000FC") == 0);
+  Reset();
+  AddSrec(1, 0x0038, (const uint8_t *)"\x48\x65\x6c\x6c\x6f", 5, "");
+  CHECK(strcmp(text, "S108003848656C6C6FCB") == 0);
+}
+
+static void TestLineEnds(void)
+{
+  static const uint8_t a[4] = {0x11, 0x22, 0x33, 0x44};
+  static char expected[TEXT_SIZE];
+  size_t block, used, size;
+
+  /* CRLF, blank lines and spaces between records, split at any point,
+   * also between CR and LF */
+  Reset();
+  AddIntel(0x00, 0x0100, a, sizeof(a), "\r\n");
+  strcat(text, "\r\n \r\n");
+  AddSrec(1, 0x0200, a, sizeof(a), "\r\n");
+  AddIntel(0x00, 0x0300, a, sizeof(a), "\r");
+  AddIntel(0x01, 0x0000, NULL, 0, "\r\n");
+  strcpy(expected, text);
+
+  for (block = 1; block <= strlen(expected); block++)
+  {
+    Reset();
+    strcpy(text, expected);
+    CHECK(Decode(text, block, &used) == HEX_END);
+    CHECK(write_count == 3);
+    CHECK(WriteIs(0, 0x0100, a, sizeof(a)));
+    CHECK(WriteIs(1, 0x0200, a, sizeof(a)));
+    CHECK(WriteIs(2, 0x0300, a, sizeof(a)));
+
+    /* Stops after the CR of the end record, the LF is left to the caller */
+    size = strlen(text);
+    CHECK(used == size - 1);
+    CHECK(text[used] == '\n');
+  }
+}
+
+static void TestErrors(void)
+{
+  static const uint8_t a[4] = {0x11, 0x22, 0x33, 0x44};
+  static const uint8_t one[1] = {0x08};
+  char *p;
+  size_t used;
+  unsigned i;
+
+  /* Bad Intel HEX checksum, nothing is written */
+  Reset();
+  AddIntel(0x00, 0x0100, a, sizeof(a), "\n");
+  p = strchr(text, '\n');
+  p[-1] = (p[-1] == '0') ? '1' : '0';
+  CHECK(Decode(text, 7, NULL) == HEX_ERROR_CHECKSUM);
+  CHECK(write_count == 0);
+
+  /* Bad S-record checksum */
+  Reset();
+  AddSrec(3, 0x08000000, a, sizeof(a), "\n");
+  p = strchr(text, '\n');
+  p[-1] = (p[-1] == '0') ? '1' : '0';
+  CHECK(Decode(text, 7, NULL) == HEX_ERROR_CHECKSUM);
+  CHECK(write_count == 0);
+
+  /* Odd number of digits */
+  Reset();
+  CHECK(Decode(":00000001F\n", 3, NULL) == HEX_ERROR_FORMAT);
+
+  /* Empty records */
+  Reset();
+  CHECK(Decode(":\n", 1, NULL) == HEX_ERROR_FORMAT);
+  Reset();
+  CHECK(Decode("S1\n", 1, NULL) == HEX_ERROR_FORMAT);
+
+  /* Byte count does not match the line */
+  Reset();
+  CHECK(Decode(":0400000011223344\n", 5, NULL) == HEX_ERROR_FORMAT);
+  Reset();
+  CHECK(Decode("S1060000112233\n", 5, NULL) == HEX_ERROR_FORMAT);
+
+  /* S-record shorter than its address */
+  Reset();
+  CHECK(Decode("S30300FFFD\n", 5, NULL) == HEX_ERROR_FORMAT);
+
+  /* Unknown Intel HEX type and extended address of the wrong size */
+  Reset();
+  AddIntel(0x06, 0x0000, a, sizeof(a), "\n");
+  CHECK(Decode(text, 64, NULL) == HEX_ERROR_FORMAT);
+  Reset();
+  AddIntel(0x04, 0x0000, one, sizeof(one), "\n");
+  CHECK(Decode(text, 64, NULL) == HEX_ERROR_FORMAT);
+  Reset();
+  AddIntel(0x02, 0x0000, a, sizeof(a), "\n");
+  CHECK(Decode(text, 64, NULL) == HEX_ERROR_FORMAT);
+
+  /* S4 does not exist, the type must be a digit */
+  Reset();
+  CHECK(Decode("S4030000FC\n", 64, NULL) == HEX_ERROR_FORMAT);
+  Reset();
+  CHECK(Decode("SX030000FC\n", 64, NULL) == HEX_ERROR_FORMAT);
+
+  /* Line longer than the largest record */
+  Reset();
+  text[0] = ':';
+
+  for (i = 1; i <= 2 * HEX_MAX_RECORD_SIZE + 2; i++)
+    text[i] = '0';
+
+  text[i] = '\n';
+  text[i + 1] = '\0';
+  CHECK(Decode(text, 100, NULL) == HEX_ERROR_FORMAT);
+
+  /* Bad character, the next call skips the rest of the line */
+  Reset();
+  strcpy(text, ":04010000112G3344\n");
+  AddIntel(0x00, 0x0100, a, sizeof(a), "\n");
+  CHECK(HexDecoder_Input(&dec, (const uint8_t *)text, strlen(text), &used) ==
+        HEX_ERROR_FORMAT);
+  CHECK(text[used - 1] == 'G');
+  CHECK(HexDecoder_Input(&dec, (const uint8_t *)text + used,
+                         strlen(text) - used, &used) == HEX_CONTINUE);
+  CHECK(WriteIs(0, 0x0100, a, sizeof(a)) && (write_count == 1));
+
+  /* Data refused by the write callback */
+  Reset();
+  write_fails = true;
+  AddIntel(0x00, 0x0100, a, sizeof(a), "\n");
+  CHECK(Decode(text, 64, NULL) == HEX_ERROR_WRITE);
+  CHECK(dec.bytes == 0);
+}
+
+static void TestNotRecord(void)
+{
+  static const uint8_t a[4] = {0x11, 0x22, 0x33, 0x44};
+  size_t block, used, start;
+
+  CHECK(HexDecoder_IsRecordStart(':') == true);
+  CHECK(HexDecoder_IsRecordStart('S') == true);
+  CHECK(HexDecoder_IsRecordStart('s') == false);
+  CHECK(HexDecoder_IsRecordStart('{') == false);
+
+  /* Text that is not a record is not consumed */
+  Reset();
+  CHECK(Decode("{\"cmd\":1}\n", 4, &used) == HEX_NOT_RECORD);
+  CHECK(used == 0);
+  CHECK(dec.lines == 0);
+
+  /* The records before it are, and so are the line ends */
+  for (block = 1; block < 64; block++)
+  {
+    Reset();
+    AddIntel(0x00, 0x0100, a, sizeof(a), "\r\n");
+    strcat(text, "\r\n");
+    start = strlen(text);
+    strcat(text, "hello\n");
+    CHECK(Decode(text, block, &used) == HEX_NOT_RECORD);
+    CHECK(used == start);
+    CHECK(write_count == 1);
+  }
+}
+
+int main(void)
+{
+  TestIntel();
+  TestSrec();
+  TestLineEnds();
+  TestErrors();
+  TestNotRecord();
+
+  if (failures != 0)
+  {
+    printf("%u checks failed\n", failures);
+    return 1;
+  }
+
+  printf("All checks passed\n");
+  return 0;
+}
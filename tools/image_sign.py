@@ -0,0 +1,284 @@
+#!/usr/bin/env python3
+#
+# Signs firmware images for the bootloader's image verification
+# (modules/image_verify). Pure Python, no extra packages.
+#
+# Usage: image_sign.py genkey KEY
+#        image_sign.py pubkey KEY
+#        image_sign.py sign KEY app.bin signed.bin [--version N]
+#                          [--encrypt AES_KEY]
+#        image_sign.py verify PUBKEY_HEX signed.bin [AES_KEY]
+#
+# genkey:  Writes a new 32 byte Ed25519 secret seed to KEY and prints the
+#          public key as a C initializer for IMAGE_PUBLIC_KEY.
+# pubkey:  Prints the public key of KEY as a C initializer.
+# sign:    Prepends the signed header to app.bin. The application must be
+#          linked to start IMAGE_HEADER_SIZE bytes into the user flash.
+#          With --encrypt the image is encrypted with AES-CTR, AES_KEY is a
+#          file with the 16 or 32 byte key also programmed into the OTP key
+#          block (IMAGE_KEY_OTP_BLOCK).
+# verify:  Checks a signed image as the bootloader does, decrypting it with
+#          AES_KEY if encrypted.
+#
+# Header, little endian, padded with 0xff to IMAGE_HEADER_SIZE:
+#   magic "KFLY" | header size | image size | version | SHA-512 of the
+#   plain image | Ed25519 signature of the 80 bytes before it | cipher |
+#   CTR counter block
+#
+
+import hashlib
+import os
+import struct
+import sys
+
+IMAGE_HEADER_SIZE = 512
+IMAGE_HEADER_MAGIC = 0x594C464B
+HEADER_SIGNED_SIZE = 80
+CIPHER_OFFSET = 144
+CIPHERS = {16: 1, 32: 2}
+
+# Ed25519, RFC 8032
+P = 2**255 - 19
+L = 2**252 + 27742317777372353535851937790883648493
+D = -121665 * pow(121666, P - 2, P) % P
+SQRT_M1 = pow(2, (P - 1) // 4, P)
+
+
+def point_add(a, b):
+    A = (a[1] - a[0]) * (b[1] - b[0]) % P
+    B = (a[1] + a[0]) * (b[1] + b[0]) % P
+    C = 2 * a[3] * b[3] * D % P
+    Dz = 2 * a[2] * b[2] % P
+    E, F, G, H = B - A, Dz - C, Dz + C, B + A
+    return (E * F % P, G * H % P, F * G % P, E * H % P)
+
+
+def point_mul(s, a):
+    q = (0, 1, 1, 0)
+    while s > 0:
+        if s & 1:
+            q = point_add(q, a)
+        a = point_add(a, a)
+        s >>= 1
+    return q
+
+
+def point_compress(a):
+    zinv = pow(a[2], P - 2, P)
+    x, y = a[0] * zinv % P, a[1] * zinv % P
+    return int.to_bytes(y | ((x & 1) << 255), 32, "little")
+
+
+def point_decompress(s):
+    y = int.from_bytes(s, "little")
+    sign = y >> 255
+    y &= (1 << 255) - 1
+    if y >= P:
+        return None
+    x2 = (y * y - 1) * pow(D * y * y + 1, P - 2, P) % P
+    if x2 == 0:
+        return None if sign else (0, y, 1, 0)
+    x = pow(x2, (P + 3) // 8, P)
+    if (x * x - x2) % P != 0:
+        x = x * SQRT_M1 % P
+    if (x * x - x2) % P != 0:
+        return None
+    if (x & 1) != sign:
+        x = P - x
+    return (x, y, 1, x * y % P)
+
+
+BASE = point_decompress(int.to_bytes(4 * pow(5, P - 2, P) % P, 32, "little"))
+
+
+def sha512_int(data):
+    return int.from_bytes(hashlib.sha512(data).digest(), "little")
+
+
+def secret_expand(seed):
+    h = hashlib.sha512(seed).digest()
+    a = int.from_bytes(h[:32], "little")
+    a &= (1 << 254) - 8
+    a |= 1 << 254
+    return a, h[32:]
+
+
+def public_key(seed):
+    a, _ = secret_expand(seed)
+    return point_compress(point_mul(a, BASE))
+
+
+def sign(seed, msg):
+    a, prefix = secret_expand(seed)
+    A = point_compress(point_mul(a, BASE))
+    r = sha512_int(prefix + msg) % L
+    R = point_compress(point_mul(r, BASE))
+    h = sha512_int(R + A + msg) % L
+    s = (r + h * a) % L
+    return R + int.to_bytes(s, 32, "little")
+
+
+def verify(public, msg, signature):
+    A = point_decompress(public)
+    R = signature[:32]
+    s = int.from_bytes(signature[32:], "little")
+    if A is None or s >= L:
+        return False
+    h = sha512_int(R + public + msg) % L
+    # [s]B - [h]A must encode to R
+    minus_A = ((P - A[0]) % P, A[1], A[2], (P - A[3]) % P)
+    return point_compress(point_add(point_mul(s, BASE),
+                                     point_mul(h, minus_A))) == R
+
+
+# AES encryption, FIPS 197, only what CTR needs
+def aes_sbox():
+    sbox = [0] * 256
+    p = q = 1
+    while True:
+        # p * 3 and q / 3 walk the multiplicative group
+        p ^= ((p << 1) ^ (0x1B if p & 0x80 else 0)) & 0xFF
+        q ^= q << 1
+        q ^= q << 2
+        q ^= q << 4
+        q &= 0xFF
+        if q & 0x80:
+            q ^= 0x09
+        x = q ^ ((q << 1) | (q >> 7)) ^ ((q << 2) | (q >> 6)) ^ \
+            ((q << 3) | (q >> 5)) ^ ((q << 4) | (q >> 4))
+        sbox[p] = (x ^ 0x63) & 0xFF
+        if p == 1:
+            break
+    sbox[0] = 0x63
+    return sbox
+
+
+SBOX = aes_sbox()
+
+
+def xtime(a):
+    return ((a << 1) ^ (0x1B if a & 0x80 else 0)) & 0xFF
+
+
+def aes_expand_key(key):
+    nk = len(key) // 4
+    rounds = nk + 6
+    w = [list(key[4 * i:4 * i + 4]) for i in range(nk)]
+    rcon = 1
+    for i in range(nk, 4 * (rounds + 1)):
+        t = list(w[i - 1])
+        if i % nk == 0:
+            t = [SBOX[b] for b in t[1:] + t[:1]]
+            t[0] ^= rcon
+            rcon = xtime(rcon)
+        elif nk > 6 and i % nk == 4:
+            t = [SBOX[b] for b in t]
+        w.append([a ^ b for a, b in zip(w[i - nk], t)])
+    return [sum(w[4 * r:4 * r + 4], []) for r in range(rounds + 1)]
+
+
+def aes_encrypt(round_keys, block):
+    s = [a ^ b for a, b in zip(block, round_keys[0])]
+    for r in range(1, len(round_keys)):
+        s = [SBOX[b] for b in s]
+        s = [s[(i + 4 * (i % 4)) % 16] for i in range(16)]
+        if r != len(round_keys) - 1:
+            m = []
+            for c in range(4):
+                a = s[4 * c:4 * c + 4]
+                t = a[0] ^ a[1] ^ a[2] ^ a[3]
+                m += [a[i] ^ t ^ xtime(a[i] ^ a[(i + 1) % 4])
+                      for i in range(4)]
+            s = m
+        s = [a ^ b for a, b in zip(s, round_keys[r])]
+    return bytes(s)
+
+
+def aes_ctr(key, counter, data):
+    round_keys = aes_expand_key(key)
+    value = int.from_bytes(counter, "big")
+    out = bytearray()
+    for i in range(0, len(data), 16):
+        block = ((value + i // 16) % 2**128).to_bytes(16, "big")
+        stream = aes_encrypt(round_keys, block)
+        out += bytes(a ^ b for a, b in zip(data[i:i + 16], stream))
+    return bytes(out)
+
+
+def read_aes_key(path):
+    with open(path, "rb") as f:
+        key = f.read()
+    if len(key) not in CIPHERS:
+        raise SystemExit("AES key must be 16 or 32 bytes")
+    return key
+
+
+def c_initializer(key):
+    rows = []
+    for i in range(0, 32, 8):
+        rows.append(", ".join("0x%02x" % b for b in key[i:i + 8]))
+    return "{" + ",\n ".join(rows) + "}"
+
+
+def make_header(image, version):
+    signed = struct.pack("<IIII", IMAGE_HEADER_MAGIC, IMAGE_HEADER_SIZE,
+                         len(image), version)
+    return signed + hashlib.sha512(image).digest()
+
+
+def main(argv):
+    if len(argv) >= 3 and argv[1] == "genkey":
+        seed = os.urandom(32)
+        with open(argv[2], "wb") as f:
+            f.write(seed)
+        print(c_initializer(public_key(seed)))
+    elif len(argv) >= 3 and argv[1] == "pubkey":
+        with open(argv[2], "rb") as f:
+            print(c_initializer(public_key(f.read(32))))
+    elif len(argv) >= 5 and argv[1] == "sign":
+        with open(argv[2], "rb") as f:
+            seed = f.read(32)
+        with open(argv[3], "rb") as f:
+            image = f.read()
+        options = dict(zip(argv[5::2], argv[6::2]))
+        version = int(options.get("--version", "0"), 0)
+        header = make_header(image, version)
+        header += sign(seed, header)
+        if "--encrypt" in options:
+            key = read_aes_key(options["--encrypt"])
+            counter = os.urandom(16)
+            header += struct.pack("<I", CIPHERS[len(key)]) + counter
+            image = aes_ctr(key, counter, image)
+        header += b"\xff" * (IMAGE_HEADER_SIZE - len(header))
+        with open(argv[4], "wb") as f:
+            f.write(header + image)
+    elif len(argv) >= 4 and argv[1] == "verify":
+        public = bytes.fromhex(argv[2])
+        with open(argv[3], "rb") as f:
+            data = f.read()
+        magic, size, image_size, _ = struct.unpack("<IIII", data[:16])
+        image = data[IMAGE_HEADER_SIZE:IMAGE_HEADER_SIZE + image_size]
+        header = data[:HEADER_SIGNED_SIZE]
+        cipher, = struct.unpack("<I", data[CIPHER_OFFSET:CIPHER_OFFSET + 4])
+        if cipher in CIPHERS.values():
+            if len(argv) < 5:
+                sys.stderr.write("image is encrypted, give the AES key\n")
+                return 1
+            key = read_aes_key(argv[4])
+            image = aes_ctr(key, data[CIPHER_OFFSET + 4:CIPHER_OFFSET + 20],
+                            image)
+        ok = (magic == IMAGE_HEADER_MAGIC and size == IMAGE_HEADER_SIZE and
+              len(image) == image_size and
+              header[16:80] == hashlib.sha512(image).digest() and
+              verify(public, header, data[80:144]))
+        print("valid" if ok else "invalid")
+        return 0 if ok else 1
+    else:
+        sys.stderr.write("usage: image_sign.py genkey|pubkey|sign|verify, "
+                         "see the top of the file\n")
+        return 2
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
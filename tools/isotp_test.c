@@ -0,0 +1,301 @@
+/*
+ * Host test of the ISO-TP segmentation and reassembly
+ * (modules/can/src/isotp.c) with two links connected back to back.
+ *
+ * Build:
+ *   gcc -Wall -I modules/can/inc -o isotp_test tools/isotp_test.c \
+ *       modules/can/src/isotp.c
+ *
+ * Use:
+ *   ./isotp_test
+ *
+ * The frames of each direction go through a queue, the test delivers them
+ * like the receive thread of mycan.c does and drives the transmitter like
+ * CANSendData. Prints the failed checks and exits with 1 if there are any.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "isotp.h"
+
+#define QUEUE_SIZE      1024
+#define BUFFER_SIZE     1024
+
+typedef struct
+{
+  uint8_t data[QUEUE_SIZE][ISOTP_CAN_FRAME_SIZE];
+  uint8_t size[QUEUE_SIZE];
+  unsigned head, tail;
+} frame_queue_t;
+
+/* Node to host and host to node */
+static frame_queue_t node_tx, host_tx;
+static isotp_link_t node, host;
+static uint8_t node_buffer[BUFFER_SIZE], host_buffer[BUFFER_SIZE];
+static bool send_fails;
+static unsigned failures;
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);                 \
+      failures++;                                                       \
+    }                                                                   \
+  } while (0)
+
+static bool Put(frame_queue_t *q, const uint8_t *data, uint8_t size)
+{
+  if ((send_fails == true) || ((q->head - q->tail) == QUEUE_SIZE))
+    return false;
+
+  memcpy(q->data[q->head % QUEUE_SIZE], data, size);
+  q->size[q->head % QUEUE_SIZE] = size;
+  q->head++;
+  return true;
+}
+
+static bool NodeSend(const uint8_t *data, uint8_t size)
+{
+  return Put(&node_tx, data, size);
+}
+
+static bool HostSend(const uint8_t *data, uint8_t size)
+{
+  return Put(&host_tx, data, size);
+}
+
+static void Reset(void)
+{
+  memset(&node_tx, 0, sizeof(node_tx));
+  memset(&host_tx, 0, sizeof(host_tx));
+  send_fails = false;
+  ISOTP_Init(&node, NodeSend, node_buffer, BUFFER_SIZE);
+  ISOTP_Init(&host, HostSend, host_buffer, BUFFER_SIZE);
+}
+
+/* Delivers the queued frames of one direction, returns the last status */
+static isotp_rx_status_t Deliver(frame_queue_t *q, isotp_link_t *to,
+                                 bool broadcast)
+{
+  isotp_rx_status_t status = ISOTP_RX_IN_PROGRESS;
+
+  while (q->tail != q->head)
+  {
+    status = ISOTP_ReceiveFrame(to, q->data[q->tail % QUEUE_SIZE],
+                                q->size[q->tail % QUEUE_SIZE], broadcast);
+    q->tail++;
+
+    if ((status == ISOTP_RX_COMPLETE) || (status == ISOTP_RX_ERROR))
+      break;
+  }
+
+  return status;
+}
+
+/* Sends a message from the host to the node, true if it was reassembled */
+static bool HostToNode(const uint8_t *data, uint16_t size, bool broadcast)
+{
+  static const uint8_t continue_to_send[3] = {0x30, 0, 0};
+  isotp_rx_status_t status = ISOTP_RX_IN_PROGRESS;
+
+  if (ISOTP_StartTransmit(&host, data, size) == false)
+    return false;
+
+  while (host.tx_state != ISOTP_TX_IDLE)
+  {
+    status = Deliver(&host_tx, &node, broadcast);
+    if (status == ISOTP_RX_ERROR)
+      return false;
+
+    if (host.tx_state == ISOTP_TX_WAIT_FC)
+    {
+      /* The node never sends flow control for broadcasts, the host paces
+         itself */
+      if (broadcast == true)
+        ISOTP_ReceiveFrame(&host, continue_to_send, 3, false);
+      else if (node_tx.head == node_tx.tail)
+        return false;
+      else
+        Deliver(&node_tx, &host, false);
+    }
+
+    if (host.tx_state == ISOTP_TX_SENDING)
+      ISOTP_ContinueTransmit(&host);
+
+    if (host.tx_state == ISOTP_TX_ERROR)
+      return false;
+  }
+
+  if (status != ISOTP_RX_COMPLETE)
+    status = Deliver(&host_tx, &node, broadcast);
+
+  return (status == ISOTP_RX_COMPLETE) && (node.rx_length == size) &&
+         (memcmp(node.rx_buffer, data, size) == 0);
+}
+
+static void TestSizes(void)
+{
+  static uint8_t message[ISOTP_MAX_MESSAGE_SIZE];
+  static const uint16_t sizes[] = {1, 6, 7, 8, 13, 14, 62, 63, 64, 111, 112,
+                                   113, 500, BUFFER_SIZE};
+  unsigned i, j;
+
+  for (i = 0; i < sizeof(message); i++)
+    message[i] = (uint8_t)(i * 7 + 3);
+
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    for (j = 0; j < 2; j++)
+    {
+      Reset();
+      CHECK(HostToNode(message, sizes[i], j == 1));
+      CHECK(node_tx.head == 0 || j == 0);
+    }
+  }
+
+  /* Single frames up to 7 bytes, first frame from 8 */
+  Reset();
+  CHECK(ISOTP_StartTransmit(&host, message, 7) == true);
+  CHECK(host_tx.size[0] == 8 && host_tx.data[0][0] == 0x07);
+  CHECK(host.tx_state == ISOTP_TX_IDLE);
+
+  Reset();
+  CHECK(ISOTP_StartTransmit(&host, message, 8) == true);
+  CHECK(host_tx.data[0][0] == 0x10 && host_tx.data[0][1] == 0x08);
+  CHECK(host.tx_state == ISOTP_TX_WAIT_FC);
+
+  Reset();
+  CHECK(ISOTP_StartTransmit(&host, message, 0) == false);
+  CHECK(ISOTP_StartTransmit(&host, message, ISOTP_MAX_MESSAGE_SIZE + 1) ==
+        false);
+}
+
+static void TestErrors(void)
+{
+  static uint8_t message[2000];
+  uint8_t frame[ISOTP_CAN_FRAME_SIZE];
+
+  /* Larger than the reassembly buffer, overflow aborts the sender */
+  Reset();
+  CHECK(ISOTP_StartTransmit(&host, message, sizeof(message)) == true);
+  CHECK(Deliver(&host_tx, &node, false) == ISOTP_RX_ERROR);
+  CHECK(node_tx.size[0] == 3 && node_tx.data[0][0] == 0x32);
+  CHECK(Deliver(&node_tx, &host, false) == ISOTP_RX_FLOW_CONTROL);
+  CHECK(host.tx_state == ISOTP_TX_ERROR);
+
+  /* Same on the broadcast ID, no flow control */
+  Reset();
+  ISOTP_StartTransmit(&host, message, sizeof(message));
+  CHECK(Deliver(&host_tx, &node, true) == ISOTP_RX_ERROR);
+  CHECK(node_tx.head == 0);
+
+  /* Wrong sequence number */
+  Reset();
+  ISOTP_StartTransmit(&host, message, 100);
+  Deliver(&host_tx, &node, false);
+  Deliver(&node_tx, &host, false);
+  ISOTP_ContinueTransmit(&host);
+  ISOTP_ContinueTransmit(&host);
+  host_tx.tail++;
+  CHECK(Deliver(&host_tx, &node, false) == ISOTP_RX_ERROR);
+  CHECK(node.rx_active == false);
+
+  /* Consecutive frame without a first frame, or from the other ID */
+  Reset();
+  frame[0] = 0x21;
+  CHECK(ISOTP_ReceiveFrame(&node, frame, 8, false) == ISOTP_RX_ERROR);
+  ISOTP_StartTransmit(&host, message, 100);
+  Deliver(&host_tx, &node, false);
+  CHECK(ISOTP_ReceiveFrame(&node, frame, 8, true) == ISOTP_RX_ERROR);
+
+  /* Invalid single and first frames */
+  Reset();
+  frame[0] = 0x00;
+  CHECK(ISOTP_ReceiveFrame(&node, frame, 8, false) == ISOTP_RX_ERROR);
+  frame[0] = 0x05;
+  CHECK(ISOTP_ReceiveFrame(&node, frame, 4, false) == ISOTP_RX_ERROR);
+  frame[0] = 0x10;
+  frame[1] = 0x07;
+  CHECK(ISOTP_ReceiveFrame(&node, frame, 8, false) == ISOTP_RX_ERROR);
+  CHECK(ISOTP_ReceiveFrame(&node, frame, 0, false) == ISOTP_RX_ERROR);
+
+  /* Flow control that nobody waits for */
+  frame[0] = 0x30;
+  CHECK(ISOTP_ReceiveFrame(&node, frame, 3, false) == ISOTP_RX_ERROR);
+
+  /* Failing frame transmit */
+  Reset();
+  send_fails = true;
+  CHECK(ISOTP_StartTransmit(&host, message, 5) == false);
+  CHECK(ISOTP_StartTransmit(&host, message, 100) == false);
+  CHECK(host.tx_state == ISOTP_TX_ERROR);
+}
+
+static void TestFlowControl(void)
+{
+  static uint8_t message[100];
+  uint8_t fc[3] = {0x30, 2, 0};
+  unsigned frames = 0;
+
+  /* Block size 2 from the receiver, wait after every second frame */
+  Reset();
+  ISOTP_StartTransmit(&host, message, sizeof(message));
+  CHECK(ISOTP_ReceiveFrame(&host, fc, 3, false) == ISOTP_RX_FLOW_CONTROL);
+  CHECK(host.tx_state == ISOTP_TX_SENDING);
+
+  while (host.tx_state != ISOTP_TX_IDLE)
+  {
+    CHECK(ISOTP_ContinueTransmit(&host) == true);
+    frames++;
+
+    if (host.tx_state == ISOTP_TX_WAIT_FC)
+    {
+      CHECK((frames % 2) == 0);
+
+      /* Wait keeps the sender waiting */
+      fc[0] = 0x31;
+      ISOTP_ReceiveFrame(&host, fc, 3, false);
+      CHECK(host.tx_state == ISOTP_TX_WAIT_FC);
+      CHECK(ISOTP_ContinueTransmit(&host) == false);
+
+      fc[0] = 0x30;
+      ISOTP_ReceiveFrame(&host, fc, 3, false);
+    }
+  }
+
+  /* 6 bytes in the first frame, 7 per consecutive frame */
+  CHECK(frames == (sizeof(message) - 6 + 6) / 7);
+  CHECK(host.tx_count == sizeof(message));
+
+  /* Sequence numbers wrap after 15 */
+  Reset();
+  CHECK(HostToNode(node_buffer, BUFFER_SIZE, false));
+}
+
+static void TestSTmin(void)
+{
+  CHECK(ISOTP_STminToMicroseconds(0x00) == 0);
+  CHECK(ISOTP_STminToMicroseconds(0x7f) == 127000);
+  CHECK(ISOTP_STminToMicroseconds(0x80) == 127000);
+  CHECK(ISOTP_STminToMicroseconds(0xf1) == 100);
+  CHECK(ISOTP_STminToMicroseconds(0xf9) == 900);
+  CHECK(ISOTP_STminToMicroseconds(0xfa) == 127000);
+}
+
+int main(void)
+{
+  TestSizes();
+  TestErrors();
+  TestFlowControl();
+  TestSTmin();
+
+  if (failures != 0)
+  {
+    printf("%u checks failed\n", failures);
+    return 1;
+  }
+
+  printf("All checks passed\n");
+  return 0;
+}
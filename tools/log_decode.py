@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+#
+# Formats the binary debug log (Cmd_DebugMessage frames starting with
+# DEBUG_LOG_BINARY_MARKER) from a capture of the serial protocol, using the
+# format strings in the .log_strings section of the firmware ELF file.
+# Text debug messages are printed as they are.
+#
+# Usage: log_decode.py [--cobs] [--tick-hz N] firmware.elf capture.bin
+#
+
+import re
+import struct
+import sys
+
+from trace2chrome import check_frame, cobs_frames, sync_frames
+
+CMD_DEBUG_MESSAGE = 3
+BINARY_MARKER = 0x00
+DROPPED_ID = 0
+
+SPECIFIER = re.compile(r"%([-+ #0]*)(\d*)(?:\.(\d+))?(l{0,2}|h{0,2})([diuxXcsp%])")
+
+
+class Elf(object):
+    """Minimal 32-bit little endian ELF section reader."""
+
+    def __init__(self, data):
+        if data[:4] != b"\x7fELF" or data[4] != 1 or data[5] != 1:
+            raise ValueError("not a 32-bit little endian ELF file")
+        shoff, = struct.unpack_from("<I", data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x2E)
+        headers = [struct.unpack_from("<IIIIIIIIII", data, shoff + i * shentsize)
+                   for i in range(shnum)]
+        names = headers[shstrndx]
+        self.sections = {}
+        for h in headers:
+            end = data.index(b"\x00", names[4] + h[0])
+            name = data[names[4] + h[0]:end].decode()
+            # name -> (type, flags, address, contents)
+            self.sections[name] = (h[1], h[2], h[3], data[h[4]:h[4] + h[5]])
+
+    def string(self, address, section=None):
+        for name, (stype, flags, base, contents) in self.sections.items():
+            if section is not None and name != section:
+                continue
+            # Only loaded PROGBITS sections hold runtime strings
+            if section is None and (stype != 1 or not flags & 2):
+                continue
+            if base <= address < base + len(contents):
+                offset = address - base
+                end = contents.find(b"\x00", offset)
+                return contents[offset:end].decode(errors="replace")
+        return None
+
+
+def format_message(elf, fmt, args):
+    args = list(args)
+
+    def convert(m):
+        flags, width, precision, _, conv = m.groups()
+        if conv == "%":
+            return "%"
+        value = args.pop(0) if args else 0
+        if conv in "di":
+            value = value - (1 << 32) if value & 0x80000000 else value
+            conv = "d"
+        elif conv == "s":
+            value = elf.string(value) or "<0x%08x>" % value
+        elif conv == "p":
+            value, conv = "0x%08x" % value, "s"
+        elif conv == "c":
+            value = chr(value & 0xFF)
+        elif conv == "u":
+            conv = "d"
+        spec = "%" + flags + width + ("." + precision if precision else "") + conv
+        return spec % value
+
+    return SPECIFIER.sub(convert, fmt)
+
+
+def decode(elf, data, tick_hz):
+    pos = 1
+    while pos + 9 <= len(data):
+        fmt_id, time, nargs = struct.unpack_from("<IIB", data, pos)
+        pos += 9
+        args = struct.unpack_from("<%dI" % nargs, data, pos)
+        pos += 4 * nargs
+        if fmt_id == DROPPED_ID:
+            text = "<%d messages dropped>" % args[0]
+        else:
+            fmt = elf.string(fmt_id, ".log_strings")
+            if fmt is None:
+                text = "<unknown format 0x%08x> %s" % (fmt_id, args)
+            else:
+                text = format_message(elf, fmt, args)
+        yield "[%10.3f] %s" % (time / float(tick_hz), text.rstrip("\n"))
+
+
+def main(argv):
+    cobs = "--cobs" in argv
+    tick_hz = 1000
+    paths = []
+    args = iter(argv[1:])
+    for a in args:
+        if a == "--tick-hz":
+            tick_hz = int(next(args))
+        elif a != "--cobs":
+            paths.append(a)
+    if len(paths) != 2:
+        sys.stderr.write("usage: log_decode.py [--cobs] [--tick-hz N] "
+                         "firmware.elf capture.bin\n")
+        return 1
+    with open(paths[0], "rb") as f:
+        elf = Elf(f.read())
+    with open(paths[1], "rb") as f:
+        stream = f.read()
+    for frame in (cobs_frames if cobs else sync_frames)(stream):
+        checked = check_frame(frame)
+        if checked is None or checked[0] != CMD_DEBUG_MESSAGE:
+            continue
+        data = checked[1]
+        if data[:1] == bytes([BINARY_MARKER]):
+            for line in decode(elf, data, tick_hz):
+                print(line)
+        else:
+            print(data.decode(errors="replace").rstrip("\n"))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+#
+# Compares the debug and release build profiles, run by "make report".
+#
+# Usage: profile_report.py [--nm NM] debug.elf release.elf
+#                          [debug_bench.txt release_bench.txt]
+#
+# Sizes:   Flash and RAM per module from the symbol sizes of each ELF,
+#          assigned to the source file of the symbol from the debug
+#          information. LTO drops it for some data, those symbols take the
+#          module of the same name in the debug build. Followed by the
+#          largest functions of the release build.
+# Cycles:  The bench files are a manual input, nothing here or in "make
+#          report" generates them. They are the output of tools/usb_bench.py
+#          and of the VERIFY command saved by hand from a board running each
+#          profile. Lines with the same text are shown side by side with the
+#          ratio of the first number that differs.
+#
+
+import re
+import subprocess
+import sys
+
+TOP_FUNCTIONS = 15
+
+NUMBER = re.compile(r"\d+(?:\.\d+)?")
+
+# Suffixes of clones made by the optimizer
+CLONE_SUFFIX = re.compile(r"\.(?:isra|constprop|part|lto_priv|cold)\b.*$")
+
+
+def module_of(path):
+    """Groups a source path into a module name."""
+    path = path.replace("\\", "/")
+    m = re.search(r"modules/([^/]+)/", path)
+    if m:
+        return m.group(1)
+    m = re.search(r"ChibiOS/os/([^/]+)/", path)
+    if m:
+        return "chibios/" + m.group(1)
+    for name in ("system", "board"):
+        if "/%s/" % name in path or path.startswith(name + "/"):
+            return name
+    if path.endswith("main.c"):
+        return "main"
+    return "other"
+
+
+def read_symbols(nm, elf):
+    """Returns (name, size, type, module) of each sized symbol."""
+    out = subprocess.run([nm, "-S", "-l", "--defined-only", elf],
+                         check=True, stdout=subprocess.PIPE,
+                         universal_newlines=True).stdout
+    symbols = []
+    for line in out.splitlines():
+        fields, _, location = line.partition("\t")
+        fields = fields.split()
+        if len(fields) != 4:
+            continue
+        symbols.append((fields[3], int(fields[1], 16), fields[2].lower(),
+                        module_of(location)))
+    return symbols
+
+
+def assign_modules(symbols, reference):
+    """Takes the module of symbols without debug information from the
+    symbol of the same name in the reference build."""
+    modules = {CLONE_SUFFIX.sub("", s[0]): s[3] for s in reference
+               if s[3] != "other"}
+    return [(name, size, kind,
+             modules.get(CLONE_SUFFIX.sub("", name), module)
+             if module == "other" else module)
+            for name, size, kind, module in symbols]
+
+
+def module_sizes(symbols):
+    """Flash and RAM per module."""
+    sizes = {}
+    for _, size, kind, module in symbols:
+        flash, ram = sizes.get(module, (0, 0))
+        if kind in "tr":
+            flash += size
+        elif kind == "d":
+            flash += size
+            ram += size
+        elif kind == "b":
+            ram += size
+        sizes[module] = (flash, ram)
+    return sizes
+
+
+def change(old, new):
+    if old == 0:
+        return "     -"
+    return "%+5.0f%%" % (100.0 * (new - old) / old)
+
+
+def size_report(debug, release):
+    print("Sizes in bytes, debug -> release\n")
+    print("%-20s %8s %8s %6s   %8s %8s %6s" %
+          ("module", "flash", "", "", "ram", "", ""))
+    d, r = module_sizes(debug), module_sizes(release)
+    total = [0, 0, 0, 0]
+    for module in sorted(set(d) | set(r)):
+        df, dr = d.get(module, (0, 0))
+        rf, rr = r.get(module, (0, 0))
+        total = [total[0] + df, total[1] + rf, total[2] + dr, total[3] + rr]
+        print("%-20s %8d %8d %s   %8d %8d %s" %
+              (module, df, rf, change(df, rf), dr, rr, change(dr, rr)))
+    print("%-20s %8d %8d %s   %8d %8d %s\n" %
+          ("total", total[0], total[1], change(total[0], total[1]),
+           total[2], total[3], change(total[2], total[3])))
+
+    debug_functions = {CLONE_SUFFIX.sub("", s[0]): s[1]
+                       for s in debug if s[2] == "t"}
+    functions = sorted((s for s in release if s[2] == "t"),
+                       key=lambda s: -s[1])[:TOP_FUNCTIONS]
+    print("Largest functions of the release build\n")
+    for name, size, _, module in functions:
+        old = debug_functions.get(CLONE_SUFFIX.sub("", name))
+        print("%-32s %-16s %8s %8d" %
+              (name, module, "-" if old is None else old, size))
+    print()
+
+
+def cycle_report(debug_path, release_path):
+    def load(path):
+        """Lines with numbers by their text, repeated texts in order."""
+        lines = {}
+        with open(path) as f:
+            for line in f:
+                line = line.strip()
+                if NUMBER.search(line):
+                    lines.setdefault(NUMBER.sub("#", line), []).append(line)
+        return lines
+
+    d, r = load(debug_path), load(release_path)
+    print("Cycles and timing, debug -> release\n")
+    for key in d:
+        for old_line, new_line in zip(d[key], r.get(key, [])):
+            ratio = "-"
+            for old, new in zip(NUMBER.findall(old_line),
+                                NUMBER.findall(new_line)):
+                if old != new:
+                    if float(new) != 0:
+                        ratio = "%.2fx" % (float(old) / float(new))
+                    break
+            print("%s\n%s  (%s)\n" % (old_line, new_line, ratio))
+
+
+def main(argv):
+    nm = "nm"
+    if argv[1:2] == ["--nm"]:
+        nm = argv[2]
+        argv = argv[:1] + argv[3:]
+    if len(argv) not in (3, 5):
+        sys.stderr.write("usage: profile_report.py [--nm NM] debug.elf "
+                         "release.elf [debug_bench.txt release_bench.txt]\n")
+        return 2
+    debug = read_symbols(nm, argv[1])
+    release = assign_modules(read_symbols(nm, argv[2]), debug)
+    size_report(debug, release)
+    if len(argv) == 5:
+        cycle_report(argv[3], argv[4])
+    else:
+        print("No cycles, the bench files are a manual input: save the "
+              "output of tools/usb_bench.py and VERIFY for each profile as "
+              "build/<profile>/bench.txt")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
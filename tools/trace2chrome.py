@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+#
+# Converts a capture of the serial protocol containing a trace dump
+# (Cmd_DumpTrace frames) to Chrome trace JSON, viewable in chrome://tracing
+# or Perfetto.
+#
+# Usage: trace2chrome.py [--cobs] capture.bin > trace.json
+#
+
+import json
+import struct
+import sys
+
+SYNC_BYTE = 0xA6
+ACK_BIT = 0x80
+CMD_DUMP_TRACE = 20
+
+# trace_event_t in modules/trace/inc/trace.h: id -> (name, phase)
+EVENTS = {
+    1:  ("RX frame", "B"),
+    2:  ("RX frame", "E"),
+    3:  ("Dispatch", "B"),
+    4:  ("Dispatch", "E"),
+    5:  ("Flash erase", "B"),
+    6:  ("Flash erase", "E"),
+    7:  ("Flash program", "B"),
+    8:  ("Flash program", "E"),
+    9:  ("TX flush", "B"),
+    10: ("TX flush", "E"),
+}
+
+# Events without a port tag are put on their own track
+UNTAGGED = (5, 6, 7, 8)
+
+
+def crc8_step(data, crc):
+    crc ^= data
+    for _ in range(8):
+        crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def crc16_step(data, crc):
+    crc ^= data << 8
+    for _ in range(8):
+        crc = ((crc << 1) ^ 0x1021) & 0xFFFF if crc & 0x8000 else (crc << 1) & 0xFFFF
+    return crc
+
+
+def check_frame(frame):
+    """frame is CMD | SIZE | CRC8 | DATA | CRC16, returns (cmd, data)."""
+    if len(frame) < 3:
+        return None
+    crc8 = crc8_step(frame[1], crc8_step(frame[0], crc8_step(SYNC_BYTE, 0)))
+    if crc8 != frame[2]:
+        return None
+    size = frame[1]
+    if size == 0:
+        return frame[0] & ~ACK_BIT, b""
+    if len(frame) < size + 5:
+        return None
+    crc16 = crc16_step(SYNC_BYTE, 0xFFFF)
+    for b in frame[:size + 3]:
+        crc16 = crc16_step(b, crc16)
+    if frame[size + 3] != (crc16 >> 8) or frame[size + 4] != (crc16 & 0xFF):
+        return None
+    return frame[0] & ~ACK_BIT, bytes(frame[3:size + 3])
+
+
+def sync_frames(stream):
+    """Splits a SYNC framed stream, SYNC bytes in a frame are doubled."""
+    frame = None
+    i = 0
+    while i < len(stream):
+        b = stream[i]
+        i += 1
+        if b == SYNC_BYTE:
+            if i < len(stream) and stream[i] == SYNC_BYTE and frame is not None:
+                frame.append(SYNC_BYTE)
+                i += 1
+                continue
+            if frame:
+                yield frame
+            frame = bytearray()
+        elif frame is not None:
+            frame.append(b)
+    if frame:
+        yield frame
+
+
+def cobs_frames(stream):
+    for chunk in bytes(stream).split(b"\x00"):
+        out = bytearray()
+        i = 0
+        while i < len(chunk):
+            code = chunk[i]
+            out += chunk[i + 1:i + code]
+            i += code
+            if code < 0xFF and i < len(chunk):
+                out.append(0)
+        if out:
+            yield out
+
+
+def decode(stream, cobs):
+    records = {}
+    clock = None
+    for frame in (cobs_frames if cobs else sync_frames)(stream):
+        checked = check_frame(frame)
+        if checked is None or checked[0] != CMD_DUMP_TRACE:
+            continue
+        data = checked[1]
+        if len(data) < 8:
+            continue
+        index, clock = struct.unpack_from("<II", data)
+        for n in range((len(data) - 8) // 8):
+            records[index + n] = struct.unpack_from("<IBBH", data, 8 + 8 * n)
+    return clock, [records[k] for k in sorted(records)]
+
+
+def to_chrome(clock, records):
+    events = []
+    time = 0
+    last = None
+    for cycles, event, tag, argument in records:
+        # Unwrap the 32-bit cycle counter, records are in order
+        if last is not None:
+            time += (cycles - last) & 0xFFFFFFFF
+        last = cycles
+        name, phase = EVENTS.get(event, ("Event %d" % event, "i"))
+        events.append({
+            "name": name,
+            "ph": phase,
+            "ts": time * 1e6 / clock,
+            "pid": 0,
+            "tid": "flash" if event in UNTAGGED else "port %d" % tag,
+            "args": {"argument": argument},
+        })
+    return {"traceEvents": events, "displayTimeUnit": "ns"}
+
+
+def main(argv):
+    cobs = "--cobs" in argv
+    paths = [a for a in argv[1:] if a != "--cobs"]
+    if len(paths) != 1:
+        sys.stderr.write("usage: trace2chrome.py [--cobs] capture.bin\n")
+        return 1
+    with open(paths[0], "rb") as f:
+        clock, records = decode(f.read(), cobs)
+    if clock is None:
+        sys.stderr.write("no trace dump found\n")
+        return 1
+    json.dump(to_chrome(clock, records), sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
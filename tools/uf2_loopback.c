@@ -0,0 +1,146 @@
+/*
+ * Host test of the UF2 virtual disk (modules/usb/src/uf2_fat.c) through a
+ * loopback mounted image, with a RAM flash in place of the device.
+ *
+ * Build:
+ *   gcc -Wall -I modules/usb/inc -o uf2_loopback tools/uf2_loopback.c \
+ *       modules/usb/src/uf2_fat.c
+ *
+ * Use:
+ *   ./uf2_loopback create disk.img
+ *   sudo mount -o loop disk.img /mnt && sudo cp app.uf2 /mnt && sudo umount /mnt
+ *   ./uf2_loopback replay disk.img flash.bin [--reverse]
+ *
+ * create writes every sector the device generates. replay feeds the
+ * sectors of the image that differ from the generated ones to the disk, as
+ * the USB host would write them, in order or reversed to check out of
+ * order writes, and saves the flash.
+ * The UF2 file can be made with uf2conv.py -f 0x57755A57 -b 0x08020000.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uf2_fat.h"
+
+#define FLASH_BASE_ADDRESS      0x08020000
+#define FLASH_END_ADDRESS       0x08100000
+
+static uint8_t flash[FLASH_END_ADDRESS - FLASH_BASE_ADDRESS];
+static unsigned begins, writes, completes;
+
+static void FlashBegin(void)
+{
+  begins++;
+}
+
+static bool FlashWrite(uint32_t address, const uint8_t *data, uint32_t size)
+{
+  uint32_t i;
+
+  /* Programming can only clear bits, same as the real flash */
+  for (i = 0; i < size; i++)
+    flash[address - FLASH_BASE_ADDRESS + i] &= data[i];
+
+  writes++;
+  return true;
+}
+
+static void FlashComplete(void)
+{
+  completes++;
+}
+
+static void FlashRead(uint32_t address, uint8_t *data, uint32_t size)
+{
+  memcpy(data, &flash[address - FLASH_BASE_ADDRESS], size);
+}
+
+static const uf2_fat_config_t config = {
+  "UF2 Bootloader host test\r\nModel: KFly\r\nBoard-ID: STM32F405-KFly\r\n",
+  FLASH_BASE_ADDRESS,
+  FLASH_END_ADDRESS,
+  FlashBegin,
+  FlashWrite,
+  FlashComplete,
+  FlashRead
+};
+
+static int Create(const char *path)
+{
+  uint8_t sector[UF2_FAT_SECTOR_SIZE];
+  uint32_t lba;
+  FILE *f = fopen(path, "wb");
+
+  if (f == NULL)
+    return 1;
+
+  for (lba = 0; lba < UF2_FAT_NUM_SECTORS; lba++) {
+    UF2Fat_ReadSector(lba, sector);
+    fwrite(sector, 1, sizeof(sector), f);
+  }
+
+  fclose(f);
+  return 0;
+}
+
+static int Replay(const char *path, const char *out, int reverse)
+{
+  static uint8_t image[UF2_FAT_NUM_SECTORS][UF2_FAT_SECTOR_SIZE];
+  static bool changed[UF2_FAT_NUM_SECTORS];
+  uint8_t sector[UF2_FAT_SECTOR_SIZE];
+  unsigned counts[UF2_WRITE_FAILED + 1] = {0};
+  uint32_t i, lba;
+  FILE *f = fopen(path, "rb");
+
+  if ((f == NULL) || (fread(image, 1, sizeof(image), f) != sizeof(image)))
+    return 1;
+
+  fclose(f);
+
+  /* The host only writes what it changed */
+  for (lba = 0; lba < UF2_FAT_NUM_SECTORS; lba++) {
+    UF2Fat_ReadSector(lba, sector);
+    changed[lba] = (memcmp(sector, image[lba], sizeof(sector)) != 0);
+  }
+
+  for (i = 0; i < UF2_FAT_NUM_SECTORS; i++) {
+    lba = reverse ? (UF2_FAT_NUM_SECTORS - 1 - i) : i;
+    if (changed[lba] == true)
+      counts[UF2Fat_WriteSector(lba, image[lba])]++;
+  }
+
+  printf("ignored %u, duplicate %u, written %u, complete %u, failed %u\n",
+         counts[UF2_WRITE_IGNORED], counts[UF2_WRITE_DUPLICATE],
+         counts[UF2_WRITE_OK], counts[UF2_WRITE_COMPLETE],
+         counts[UF2_WRITE_FAILED]);
+  printf("blocks %u of %u, begins %u, flash writes %u, completes %u\n",
+         (unsigned)UF2Fat_BlocksWritten(), (unsigned)UF2Fat_BlocksExpected(),
+         begins, writes, completes);
+
+  f = fopen(out, "wb");
+  if (f == NULL)
+    return 1;
+
+  fwrite(flash, 1, sizeof(flash), f);
+  fclose(f);
+
+  return (completes == 1) ? 0 : 2;
+}
+
+int main(int argc, char *argv[])
+{
+  memset(flash, 0xFF, sizeof(flash));
+  UF2Fat_Init(&config);
+
+  if ((argc == 3) && (strcmp(argv[1], "create") == 0))
+    return Create(argv[2]);
+
+  if ((argc >= 4) && (strcmp(argv[1], "replay") == 0))
+    return Replay(argv[2], argv[3],
+                  (argc == 5) && (strcmp(argv[4], "--reverse") == 0));
+
+  fprintf(stderr, "usage: uf2_loopback create IMAGE\n"
+                  "       uf2_loopback replay IMAGE FLASH.BIN [--reverse]\n");
+  return 1;
+}
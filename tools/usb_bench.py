@@ -0,0 +1,252 @@
+#!/usr/bin/env python3
+#
+# Measures round-trip latency and throughput of the serial protocol over
+# the vendor bulk interface. Needs pyusb (libusb). The CDC port carries the
+# ASCII console and does not speak the framed protocol.
+#
+# Usage: usb_bench.py [--cobs] [--count N] [--seconds S]
+#
+# latency:   Ping round trips, one at a time.
+# download:  Pipelined GetDeviceInfo requests, response bytes per second.
+# upload:    Debug message frames (no parser, no ACK) followed by a Ping,
+#            request bytes per second.
+#
+# With --cobs the port is switched to COBS framing first (Cmd_SetFraming),
+# for the end to end comparison with SYNC framing. The framing stays until
+# the device is reset.
+#
+
+import struct
+import sys
+import time
+
+from trace2chrome import (SYNC_BYTE, ACK_BIT, check_frame, cobs_frames,
+                         crc8_step, crc16_step)
+
+USB_VID = 0x0483
+USB_PID = 0x5740
+BULK_INTERFACE = 2
+BULK_EP_OUT = 0x03
+BULK_EP_IN = 0x83
+BULK_TRANSFER = 512
+
+CMD_ACK = 1
+CMD_PING = 2
+CMD_DEBUG_MESSAGE = 3
+CMD_SET_FRAMING = 6
+FRAMING_COBS = 1
+CMD_GET_DEVICE_INFO = 17
+
+
+def cobs_encode(data):
+    out = bytearray()
+    block = bytearray()
+    for b in data:
+        if b == 0:
+            out += bytes([len(block) + 1]) + block
+            block.clear()
+            continue
+        block.append(b)
+        if len(block) == 254:
+            out += b"\xff" + block
+            block.clear()
+    return bytes(out + bytes([len(block) + 1]) + block)
+
+
+def encode_frame(cmd, data=b"", cobs=False):
+    """SYNC framing: SYNC | CMD | SIZE | CRC8 | DATA | CRC16.
+    COBS framing: COBS(CMD | SIZE | CRC8 | DATA | CRC16) | 0x00."""
+    header = bytes([cmd, len(data)])
+    crc8 = crc8_step(SYNC_BYTE, 0)
+    for b in header:
+        crc8 = crc8_step(b, crc8)
+    body = header + bytes([crc8])
+    if data:
+        crc16 = crc16_step(SYNC_BYTE, 0xFFFF)
+        for b in body + data:
+            crc16 = crc16_step(b, crc16)
+        body += data + struct.pack(">H", crc16)
+    if cobs:
+        return cobs_encode(body) + b"\x00"
+    return bytes([SYNC_BYTE]) + body.replace(bytes([SYNC_BYTE]),
+                                             bytes([SYNC_BYTE, SYNC_BYTE]))
+
+
+class FrameReader(object):
+    """Incremental SYNC deframer over a link read function."""
+
+    def __init__(self, read, cobs=False):
+        self.read = read
+        self.cobs = cobs
+        self.pending = bytearray()
+        self.received = 0
+
+    def next_frame(self, timeout):
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            frame = self._split()
+            if frame is not None:
+                checked = check_frame(frame)
+                if checked is not None:
+                    return checked
+                continue
+            chunk = self.read()
+            self.received += len(chunk)
+            self.pending += chunk
+        raise TimeoutError("no response")
+
+    def _split(self):
+        if self.cobs:
+            # A frame is complete at its delimiter
+            end = self.pending.find(b"\x00")
+            if end < 0:
+                return None
+            frame = next(cobs_frames(self.pending[:end]), bytearray())
+            del self.pending[:end + 1]
+            return frame
+        # A frame is complete when the next unescaped SYNC arrives
+        start = self.pending.find(bytes([SYNC_BYTE]))
+        if start < 0:
+            self.pending.clear()
+            return None
+        i = start + 1
+        frame = bytearray()
+        while i < len(self.pending):
+            b = self.pending[i]
+            if b == SYNC_BYTE:
+                if i + 1 < len(self.pending) and self.pending[i + 1] == SYNC_BYTE:
+                    frame.append(SYNC_BYTE)
+                    i += 2
+                    continue
+                if i + 1 == len(self.pending):
+                    return None
+                del self.pending[:i]
+                return frame
+            frame.append(b)
+            i += 1
+        # Header complete and the whole frame received, no need to wait
+        if len(frame) >= 3 and (frame[1] == 0 or len(frame) >= frame[1] + 5):
+            del self.pending[:i]
+            return frame
+        return None
+
+
+class BulkLink(object):
+    name = "Bulk"
+    cobs = False
+
+    def __init__(self):
+        import usb.core
+        import usb.util
+        self.usb = usb
+        self.dev = usb.core.find(idVendor=USB_VID, idProduct=USB_PID)
+        if self.dev is None:
+            raise RuntimeError("device not found")
+        usb.util.claim_interface(self.dev, BULK_INTERFACE)
+
+    def write(self, data):
+        self.dev.write(BULK_EP_OUT, data)
+
+    def read(self):
+        try:
+            return bytes(self.dev.read(BULK_EP_IN, BULK_TRANSFER, timeout=10))
+        except self.usb.core.USBTimeoutError:
+            return b""
+
+
+def wait_for(reader, cmd):
+    while True:
+        got, _ = reader.next_frame(1.0)
+        if got == cmd:
+            return
+
+
+def bench_latency(link, count):
+    reader = FrameReader(link.read, link.cobs)
+    ping = encode_frame(CMD_PING, cobs=link.cobs)
+    samples = []
+    for _ in range(count):
+        start = time.perf_counter()
+        link.write(ping)
+        wait_for(reader, CMD_PING)
+        samples.append((time.perf_counter() - start) * 1e6)
+    samples.sort()
+    return {
+        "min": samples[0],
+        "median": samples[len(samples) // 2],
+        "p99": samples[min(len(samples) - 1, int(len(samples) * 0.99))],
+        "max": samples[-1],
+    }
+
+
+def bench_download(link, seconds, window=3):
+    reader = FrameReader(link.read, link.cobs)
+    request = encode_frame(CMD_GET_DEVICE_INFO, cobs=link.cobs)
+    outstanding = 0
+    start = time.perf_counter()
+    while time.perf_counter() - start < seconds:
+        while outstanding < window:
+            link.write(request)
+            outstanding += 1
+        wait_for(reader, CMD_GET_DEVICE_INFO)
+        outstanding -= 1
+    for _ in range(outstanding):
+        wait_for(reader, CMD_GET_DEVICE_INFO)
+    return reader.received / (time.perf_counter() - start)
+
+
+def bench_upload(link, seconds):
+    reader = FrameReader(link.read, link.cobs)
+    frame = encode_frame(CMD_DEBUG_MESSAGE, bytes(range(255)), link.cobs)
+    batch = frame * 8
+    sent = 0
+    start = time.perf_counter()
+    while time.perf_counter() - start < seconds:
+        link.write(batch)
+        sent += len(batch)
+    # The Ping is answered after everything before it was received
+    link.write(encode_frame(CMD_PING, cobs=link.cobs))
+    wait_for(reader, CMD_PING)
+    return sent / (time.perf_counter() - start)
+
+
+def set_cobs(link):
+    """Switches the port to COBS, the ACK still comes in SYNC framing."""
+    reader = FrameReader(link.read)
+    link.write(encode_frame(CMD_SET_FRAMING | ACK_BIT, bytes([FRAMING_COBS])))
+    wait_for(reader, CMD_ACK)
+    link.cobs = True
+    link.name = "COBS"
+
+
+def main(argv):
+    count = 1000
+    seconds = 5.0
+    cobs = False
+    args = iter(argv[1:])
+    for a in args:
+        if a == "--cobs":
+            cobs = True
+        elif a == "--count":
+            count = int(next(args))
+        elif a == "--seconds":
+            seconds = float(next(args))
+        else:
+            sys.stderr.write("usage: usb_bench.py [--cobs] [--count N] "
+                             "[--seconds S]\n")
+            return 1
+    link = BulkLink()
+    if cobs:
+        set_cobs(link)
+    lat = bench_latency(link, count)
+    down = bench_download(link, seconds)
+    up = bench_upload(link, seconds)
+    print("%-5s ping us: min %.0f median %.0f p99 %.0f max %.0f" %
+          (link.name, lat["min"], lat["median"], lat["p99"], lat["max"]))
+    print("%-5s download %.1f kB/s, upload %.1f kB/s" %
+          (link.name, down / 1e3, up / 1e3))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))